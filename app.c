@@ -6,6 +6,7 @@
 #include <cglm/cglm.h>
 
 #include <stdio.h>
+#include <stddef.h>
 
 #include "utils/vector.h"
 #include "utils/shader_reader.h"
@@ -62,5 +63,34 @@ void emb_setup_buffers(GLuint * vao, GLuint vao_binding_point, GLuint vbo, GLuin
 
 }
 
+//skin stream (emb_skin_vertex) as the second buffer of the vao, see emb_ebvb_handler.skin_data
+void emb_setup_skin_buffer(GLuint vao, GLuint vao_binding_point, GLuint skin_vbo){
+    glVertexArrayVertexBuffer(vao, vao_binding_point, skin_vbo, 0, sizeof(emb_skin_vertex));
 
+    //joints, integer attribute
+    glEnableVertexArrayAttrib(vao, VB_ATTRIB_JOINTS_OFFSET);
+    glVertexArrayAttribIFormat(vao, VB_ATTRIB_JOINTS_OFFSET, 4, GL_UNSIGNED_SHORT, offsetof(emb_skin_vertex,joints));
+    glVertexArrayAttribBinding(vao, VB_ATTRIB_JOINTS_OFFSET, vao_binding_point);
 
+    //weights, unorm8
+    glEnableVertexArrayAttrib(vao, VB_ATTRIB_WEIGHTS_OFFSET);
+    glVertexArrayAttribFormat(vao, VB_ATTRIB_WEIGHTS_OFFSET, 4, GL_UNSIGNED_BYTE, GL_TRUE, offsetof(emb_skin_vertex,weights));
+    glVertexArrayAttribBinding(vao, VB_ATTRIB_WEIGHTS_OFFSET, vao_binding_point);
+}
+
+
+
+
+/*vao of the depth pre-pass: position stream (emb_ebvb_handler.pos_data) at binding 0,
+skin stream at binding 1, same element buffer as the main vao*/
+void emb_setup_depth_buffers(GLuint * vao, GLuint pos_vbo, GLuint skin_vbo, GLuint ebo){
+    glCreateVertexArrays(1,vao);
+    glVertexArrayVertexBuffer(*vao, 0, pos_vbo, 0, VB_ATTRIB_POS_SIZE*sizeof(float));
+    glVertexArrayElementBuffer(*vao,ebo);
+
+    glEnableVertexArrayAttrib(*vao, VB_ATTRIB_POS_OFFSET);
+    glVertexArrayAttribFormat(*vao, VB_ATTRIB_POS_OFFSET, VB_ATTRIB_POS_SIZE, GL_FLOAT, GL_FALSE, 0);
+    glVertexArrayAttribBinding(*vao, VB_ATTRIB_POS_OFFSET, 0);
+
+    emb_setup_skin_buffer(*vao,1,skin_vbo);
+}
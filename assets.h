@@ -0,0 +1,379 @@
+/*______________________________________
+asset registry - loads every file once
+
+Assets are keyed by path + import settings, loading the same key again
+returns the same handle and increases its reference count.
+When the count drops to 0 the asset is not freed right away: it stays
+in the LRU list and is unloaded only when the registry is over its
+memory budget (oldest unused first), so reloading a level is free.
+
+Not thread safe, the registry belongs to the GL thread. Other threads
+go through requests (emb_asset_request in loader.h).
+______________________________________*/
+#pragma once
+
+#include <glad/gl.h>
+#include <stdio.h>
+#include "utils/allocator.h"
+#include "utils/slotmap.h"
+#include "utils/stringmap.h"
+#include "utils/shader_reader.h"
+#include "model/model.h"
+#include "model/material.h"
+
+
+#define EMB_ASSET_KEY_MAX 512
+
+typedef enum{
+    EMB_ASSET_MODEL,
+    EMB_ASSET_SHADER,
+    EMB_ASSET_TEXTURE,
+} emb_asset_type;
+
+//import settings, assets with different settings are loaded separately
+typedef enum{
+    /*vb/eb of a model are freed after emb_asset_uploaded(),
+    the origins can't be instantiated anymore after that*/
+    EMB_ASSET_DISCARD_CPU = 1u<<0,
+} emb_asset_flags;
+
+typedef struct{
+    uint32_t flags;
+} emb_asset_settings;
+
+typedef enum{
+    EMB_ASSET_LOADING, //queued or loading in the background (loader.h)
+    EMB_ASSET_READY,
+    EMB_ASSET_FAILED,
+} emb_asset_state;
+
+
+typedef emb_handle emb_asset_handle;
+
+typedef struct{
+    emb_asset_type type;
+    emb_asset_state state;
+    const char * key; //owned by the registry key map
+    uint32_t flags;
+    uint32_t refcount;
+
+    size_t cpu_bytes;
+    size_t gpu_bytes; //reported by emb_asset_uploaded (models) or the driver (shaders)
+
+    //LRU list of unused assets, slot indices
+    uint32_t lru_prev;
+    uint32_t lru_next;
+
+    union{
+        struct{
+            emb_primitive_origin * primitives; //stable address, instances point here
+            uint32_t primitives_len;
+            emb_arena arena; //vb and eb of all primitives
+        } model;
+        struct{
+            GLuint prog;
+        } shader;
+        struct{
+            emb_texture ref; //layer in the arrays of the material system
+            emb_materials * materials;
+        } texture;
+    };
+} emb_asset;
+
+EMB_SLOTMAP_DEFINE(emb_asset, slotmap_asset)
+
+typedef struct{
+    slotmap_asset assets;
+    strmap keys; //key -> slot index + 1
+
+    size_t budget; //bytes, unused assets are evicted above it
+    size_t used; //cpu + gpu bytes of all loaded assets
+
+    uint32_t lru_head; //least recently used, evicted first
+    uint32_t lru_tail;
+
+    emb_arena scratch; //shader sources, reset after every load
+} emb_asset_registry;
+
+
+
+emb_asset_registry emb_asset_registry_init(size_t budget){
+    emb_asset_registry r;
+    slotmap_asset_init(&r.assets,64,NULL);
+    r.keys = strmap_alloc(64);
+    r.budget = budget;
+    r.used = 0;
+    r.lru_head = EMB_SLOT_NONE;
+    r.lru_tail = EMB_SLOT_NONE;
+    r.scratch = emb_arena_init(64*1024);
+    return r;
+}
+
+
+static inline emb_asset * asset_at_slot(emb_asset_registry * r, uint32_t slot){
+    return &r->assets.values[r->assets.slots[slot].dense_or_next];
+}
+
+static void asset_lru_unlink(emb_asset_registry * r, uint32_t slot){
+    emb_asset * a = asset_at_slot(r,slot);
+    if(a->lru_prev != EMB_SLOT_NONE) asset_at_slot(r,a->lru_prev)->lru_next = a->lru_next;
+    else r->lru_head = a->lru_next;
+    if(a->lru_next != EMB_SLOT_NONE) asset_at_slot(r,a->lru_next)->lru_prev = a->lru_prev;
+    else r->lru_tail = a->lru_prev;
+    a->lru_prev = a->lru_next = EMB_SLOT_NONE;
+}
+
+static void asset_lru_push(emb_asset_registry * r, uint32_t slot){
+    emb_asset * a = asset_at_slot(r,slot);
+    a->lru_prev = r->lru_tail;
+    a->lru_next = EMB_SLOT_NONE;
+    if(r->lru_tail != EMB_SLOT_NONE) asset_at_slot(r,r->lru_tail)->lru_next = slot;
+    else r->lru_head = slot;
+    r->lru_tail = slot;
+}
+
+static size_t asset_model_cpu_bytes(emb_asset * a){
+    size_t bytes = a->model.arena.used_total + a->model.primitives_len*sizeof(emb_primitive_origin);
+    for(uint32_t i=0; i<a->model.primitives_len; ++i) bytes += a->model.primitives[i].meshlets_len*sizeof(emb_meshlet);
+    return bytes;
+}
+
+//frees the data and removes the asset, the handle becomes stale
+static void asset_unload(emb_asset_registry * r, uint32_t slot){
+    emb_asset * a = asset_at_slot(r,slot);
+    if(a->refcount == 0) asset_lru_unlink(r,slot);
+    r->used -= a->cpu_bytes + a->gpu_bytes;
+
+    if(a->type == EMB_ASSET_MODEL){
+        for(uint32_t i=0; i<a->model.primitives_len; ++i) emb_primitive_origin_free(&a->model.primitives[i]);
+        emb_arena_free(&a->model.arena);
+        free(a->model.primitives);
+    }
+    else if(a->type == EMB_ASSET_TEXTURE) {if(a->texture.materials) emb_textures_free(a->texture.materials,a->texture.ref);}
+    else if(a->shader.prog) glDeleteProgram(a->shader.prog);
+
+    strmap_erase(&r->keys,a->key);
+    emb_asset_handle h = {slot, r->assets.slots[slot].generation};
+    slotmap_asset_erase(&r->assets,h);
+}
+
+//unloads unused assets (oldest first) until the registry fits the budget
+void emb_asset_registry_trim(emb_asset_registry * r){
+    while(r->used > r->budget && r->lru_head != EMB_SLOT_NONE) asset_unload(r,r->lru_head);
+}
+
+void emb_asset_registry_set_budget(emb_asset_registry * r, size_t budget){
+    r->budget = budget;
+    emb_asset_registry_trim(r);
+}
+
+
+
+//__________________________________________________
+// references
+//__________________________________________________
+
+static inline emb_asset * emb_asset_get(emb_asset_registry * r, emb_asset_handle h){
+    return slotmap_asset_get(&r->assets,h);
+}
+
+//one more user of the asset
+bool emb_asset_acquire(emb_asset_registry * r, emb_asset_handle h){
+    emb_asset * a = emb_asset_get(r,h);
+    if(!a) return false;
+    if(a->refcount++ == 0) asset_lru_unlink(r,h.index);
+    return true;
+}
+
+//the asset is kept until the registry needs the memory
+void emb_asset_release(emb_asset_registry * r, emb_asset_handle h){
+    emb_asset * a = emb_asset_get(r,h);
+    if(!a || a->refcount == 0) return;
+    if(--a->refcount == 0){
+        asset_lru_push(r,h.index);
+        emb_asset_registry_trim(r);
+    }
+}
+
+//state of the asset, stale handles are reported as failed
+emb_asset_state emb_asset_get_state(emb_asset_registry * r, emb_asset_handle h){
+    emb_asset * a = emb_asset_get(r,h);
+    return a ? a->state : EMB_ASSET_FAILED;
+}
+
+//key of the asset: path and the settings which change the result
+static void asset_make_key(char * key, emb_asset_type type, const char * path, emb_asset_settings settings){
+    snprintf(key,EMB_ASSET_KEY_MAX,"%d:%s#%08x",(int)type,path,settings.flags);
+}
+
+//already loaded asset with this key (acquired), null handle otherwise
+static emb_asset_handle asset_find(emb_asset_registry * r, const char * key){
+    uint32_t slot = (uint32_t)(uintptr_t)strmap_get(&r->keys,key);
+    if(slot == 0) return EMB_HANDLE_NULL;
+    emb_asset_handle h = {slot-1, r->assets.slots[slot-1].generation};
+    //failed loads are retried once nobody holds them
+    emb_asset * a = emb_asset_get(r,h);
+    if(a->state == EMB_ASSET_FAILED && a->refcount == 0) {asset_unload(r,h.index); return EMB_HANDLE_NULL;}
+    emb_asset_acquire(r,h);
+    return h;
+}
+
+static emb_asset_handle asset_add(emb_asset_registry * r, const char * key, emb_asset * a){
+    a->refcount = 1;
+    a->lru_prev = a->lru_next = EMB_SLOT_NONE;
+    emb_asset_handle h;
+    emb_asset * stored = slotmap_asset_insert(&r->assets,*a,&h);
+    if(!stored) return EMB_HANDLE_NULL;
+
+    strmap_set(&r->keys,key,(void*)(uintptr_t)(h.index+1));
+    stored->key = r->keys.slots[strmap_find_hashed(&r->keys,key,emb_strhash(key))].key;
+    r->used += stored->cpu_bytes + stored->gpu_bytes;
+    emb_asset_registry_trim(r);
+    return h;
+}
+
+
+
+//__________________________________________________
+// loaders
+//__________________________________________________
+
+/*all primitives of all meshes in the glTF file.
+Returns acquired handle (release it when done), null handle on failure.
+If the same key is being loaded by emb_loader, that handle is returned (still loading).*/
+emb_asset_handle emb_asset_load_model(emb_asset_registry * r, const char * path, emb_asset_settings settings){
+    char key[EMB_ASSET_KEY_MAX];
+    asset_make_key(key,EMB_ASSET_MODEL,path,settings);
+    emb_asset_handle h = asset_find(r,key);
+    if(!EMB_HANDLE_IS_NULL(h)) return h;
+
+    cgltf_data * data = _model_load_gltf((char*)path);
+    if(!data) {printf("ERROR emb_asset_load_model(): cannot load %s\n",path); return EMB_HANDLE_NULL;}
+
+    emb_asset a;
+    a.type = EMB_ASSET_MODEL;
+    a.state = EMB_ASSET_READY;
+    a.flags = settings.flags;
+    a.gpu_bytes = 0;
+    a.model.primitives_len = 0;
+    for(cgltf_size i=0; i<data->meshes_count; ++i) a.model.primitives_len += data->meshes[i].primitives_count;
+
+    a.model.primitives = (emb_primitive_origin*)calloc(a.model.primitives_len ? a.model.primitives_len : 1,sizeof(emb_primitive_origin));
+    a.model.arena = emb_arena_init(0);
+    uint32_t p = 0;
+    for(cgltf_size i=0; i<data->meshes_count; ++i)
+        for(cgltf_size j=0; j<data->meshes[i].primitives_count; ++j)
+            prim_load_primitive_cgltf(&a.model.primitives[p++],&data->meshes[i].primitives[j],&a.model.arena.base);
+    cgltf_free(data);
+
+    a.cpu_bytes = asset_model_cpu_bytes(&a);
+    return asset_add(r,key,&a);
+}
+
+//primitives of the model asset, NULL for stale handles
+emb_primitive_origin * emb_asset_model(emb_asset_registry * r, emb_asset_handle h, uint32_t * count){
+    emb_asset * a = emb_asset_get(r,h);
+    if(!a || a->type != EMB_ASSET_MODEL || a->state != EMB_ASSET_READY) {if(count) *count = 0; return NULL;}
+    if(count) *count = a->model.primitives_len;
+    return a->model.primitives;
+}
+
+/*tells the registry the model data is on the GPU (gpu_bytes in vbo/ebo).
+With EMB_ASSET_DISCARD_CPU the vertex and element copies are freed.*/
+void emb_asset_uploaded(emb_asset_registry * r, emb_asset_handle h, size_t gpu_bytes){
+    emb_asset * a = emb_asset_get(r,h);
+    if(!a || a->type != EMB_ASSET_MODEL) return;
+
+    r->used -= a->cpu_bytes + a->gpu_bytes;
+    a->gpu_bytes = gpu_bytes;
+    if(a->flags & EMB_ASSET_DISCARD_CPU){
+        for(uint32_t i=0; i<a->model.primitives_len; ++i){
+            a->model.primitives[i].vb = NULL;
+            a->model.primitives[i].eb = NULL;
+            a->model.primitives[i].skin = NULL;
+            a->model.primitives[i].owns_buffers = false;
+        }
+        emb_arena_free(&a->model.arena);
+    }
+    a->cpu_bytes = asset_model_cpu_bytes(a);
+    r->used += a->cpu_bytes + a->gpu_bytes;
+    emb_asset_registry_trim(r);
+}
+
+
+/*linked shader program, the sources are dropped after linking.
+Returns acquired handle, null handle on failure.*/
+emb_asset_handle emb_asset_load_shader(emb_asset_registry * r, const char * vertex_path, const char * fragment_path){
+    char path[EMB_ASSET_KEY_MAX];
+    char key[EMB_ASSET_KEY_MAX];
+    snprintf(path,sizeof(path),"%s|%s",vertex_path,fragment_path);
+    asset_make_key(key,EMB_ASSET_SHADER,path,(emb_asset_settings){0});
+    emb_asset_handle h = asset_find(r,key);
+    if(!EMB_HANDLE_IS_NULL(h)) return h;
+
+    emb_asset a;
+    a.type = EMB_ASSET_SHADER;
+    a.state = EMB_ASSET_READY;
+    a.flags = 0;
+    a.cpu_bytes = 0;
+
+    char * vertex_source = read_shader_file(vertex_path,&r->scratch.base);
+    char * fragment_source = read_shader_file(fragment_path,&r->scratch.base);
+    bool ok = shader_program_from_source(&a.shader.prog,vertex_source,fragment_source);
+    emb_arena_reset(&r->scratch);
+    if(!ok) {printf("ERROR emb_asset_load_shader(): cannot build %s\n",path); return EMB_HANDLE_NULL;}
+
+    //the driver's binary is the closest estimate of program size
+    GLint binary_len = 0;
+    glGetProgramiv(a.shader.prog,GL_PROGRAM_BINARY_LENGTH,&binary_len);
+    a.gpu_bytes = (size_t)binary_len;
+    return asset_add(r,key,&a);
+}
+
+//program of the shader asset, 0 for stale handles
+GLuint emb_asset_shader(emb_asset_registry * r, emb_asset_handle h){
+    emb_asset * a = emb_asset_get(r,h);
+    return a && a->type == EMB_ASSET_SHADER && a->state == EMB_ASSET_READY ? a->shader.prog : 0;
+}
+
+
+
+/*raw RGBA8 file (see emb_texture_load_raw) placed in the texture arrays of m,
+mips are built on the calling thread. Returns acquired handle, null handle on failure.*/
+emb_asset_handle emb_asset_load_texture(emb_asset_registry * r, emb_materials * m, const char * path, uint32_t width, uint32_t height){
+    char key[EMB_ASSET_KEY_MAX];
+    asset_make_key(key,EMB_ASSET_TEXTURE,path,(emb_asset_settings){0});
+    emb_asset_handle h = asset_find(r,key);
+    if(!EMB_HANDLE_IS_NULL(h)) return h;
+
+    emb_texture_data data;
+    if(!emb_texture_load_raw(path,width,height,&r->scratch.base,&data)) {emb_arena_reset(&r->scratch); return EMB_HANDLE_NULL;}
+
+    emb_asset a;
+    a.type = EMB_ASSET_TEXTURE;
+    a.state = EMB_ASSET_READY;
+    a.flags = 0;
+    a.cpu_bytes = 0;
+    a.gpu_bytes = data.bytes;
+    a.texture.materials = m;
+    a.texture.ref = emb_textures_upload(m,&data);
+    emb_arena_reset(&r->scratch);
+    if(a.texture.ref == EMB_TEXTURE_NONE) return EMB_HANDLE_NULL;
+    return asset_add(r,key,&a);
+}
+
+//layer of the texture asset for emb_material.albedo, EMB_TEXTURE_NONE for stale handles
+emb_texture emb_asset_texture(emb_asset_registry * r, emb_asset_handle h){
+    emb_asset * a = emb_asset_get(r,h);
+    return a && a->type == EMB_ASSET_TEXTURE && a->state == EMB_ASSET_READY ? a->texture.ref : EMB_TEXTURE_NONE;
+}
+
+
+
+//unloads everything, including assets still in use
+void emb_asset_registry_free(emb_asset_registry * r){
+    while(r->assets.len) asset_unload(r,r->assets.dense_to_slot[r->assets.len-1]);
+    slotmap_asset_free(&r->assets);
+    strmap_free(&r->keys);
+    emb_arena_free(&r->scratch);
+}
@@ -0,0 +1,821 @@
+/*______________________________________
+ember_bench - headless benchmarks of engine subsystems
+
+usage: ember_bench [--reps N] [--warmup N] [--sizes 1000,10000,...]
+                   [--filter name] [--gltf path] [--json out.json]
+
+GL submission runs on an EGL surfaceless context (llvmpipe works),
+it's skipped if the build has no EGL or no context can be created.
+______________________________________*/
+#include <glad/gl.h>
+#include <cglm/cglm.h>
+
+#include <stdio.h>
+#include <math.h>
+
+#include "utils/vector.h"
+#include "utils/stringmap.h"
+#include "utils/shader_reader.h"
+#include "bhandler.h"
+#include "model/node.h"
+#include "model/light.h"
+#include "model/material.h"
+#include "model/animation.h"
+
+#ifdef EMB_BENCH_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include "app.c"
+#include "render.h"
+#endif
+
+#include "bench.h"
+
+#ifndef EMB_SOURCE_DIR
+#define EMB_SOURCE_DIR "."
+#endif
+
+#ifndef EMB_BENCH_REVISION
+#define EMB_BENCH_REVISION "unknown"
+#endif
+
+#define EMB_BENCH_SIZES_MAX 16
+
+
+volatile float EMB_BENCH_SINK = 0.0f; //keeps results alive
+
+static void bench_scatter(emb_primitive * pr, uint32_t i){
+    pr->pos[0] = (float)(i % 64) - 32.0f;
+    pr->pos[1] = (float)((i / 64) % 64) - 32.0f;
+    pr->pos[2] = -(float)(i / 4096) - 2.0f;
+    pr->rot[1] = (float)i * 0.01f;
+}
+
+
+
+//__________________________________________________
+// node transform update
+//__________________________________________________
+
+typedef struct{
+    emb_node_pool pool;
+    emb_primitive * primitives;
+} bench_nodes;
+
+static void bench_nodes_setup(void * user, uint32_t size){
+    bench_nodes * b = (bench_nodes*)user;
+    uint32_t node_count = size/4 + 4;
+    emb_node_pool_init(&b->pool,node_count,NULL);
+
+    //chains of 4 nodes, primitives are bound to the leaves
+    emb_node * parent = NULL;
+    for(uint32_t i=0; i<node_count; ++i){
+        emb_node * n = emb_node_pool_push(&b->pool);
+        n->pos[0] = 0.1f*(float)i; n->rot[2] = 0.01f*(float)i;
+        if(i % 4) emb_node_set_parent(n,parent);
+        parent = n;
+    }
+
+    b->primitives = (emb_primitive*)malloc(size*sizeof(emb_primitive));
+    for(uint32_t i=0; i<size; ++i){
+        prim_inst_def_trtansform(&b->primitives[i]);
+        bench_scatter(&b->primitives[i],i);
+        prim_inst_set_parent(&b->primitives[i],emb_node_pool_get(&b->pool,(int32_t)((i/4)%(node_count/4)*4 + 3)));
+    }
+}
+
+static void bench_nodes_run(void * user, uint32_t size){
+    bench_nodes * b = (bench_nodes*)user;
+    mat4 m;
+    float acc = 0.0f;
+    for(uint32_t i=0; i<size; ++i){
+        prim_inst_get_transform(&b->primitives[i],m);
+        acc += m[3][0];
+    }
+    EMB_BENCH_SINK += acc;
+}
+
+static void bench_nodes_teardown(void * user, uint32_t size){
+    bench_nodes * b = (bench_nodes*)user;
+    free(b->primitives);
+    emb_node_pool_free(&b->pool);
+}
+
+
+
+//__________________________________________________
+// archetype storage: same scene as node_transform
+//__________________________________________________
+
+typedef struct{
+    emb_node_pool pool;
+    emb_world world;
+} bench_world;
+
+static void bench_world_setup(void * user, uint32_t size){
+    bench_world * b = (bench_world*)user;
+    uint32_t node_count = size/4 + 4;
+    emb_node_pool_init(&b->pool,node_count,NULL);
+    emb_node * parent = NULL;
+    emb_node ** leaves = (emb_node**)malloc((node_count/4)*sizeof(emb_node*));
+    for(uint32_t i=0; i<node_count; ++i){
+        emb_node * n = emb_node_pool_push(&b->pool);
+        n->pos[0] = 0.1f*(float)i; n->rot[2] = 0.01f*(float)i;
+        if(i % 4) emb_node_set_parent(n,parent);
+        if(i % 4 == 3) leaves[i/4] = n;
+        parent = n;
+    }
+
+    emb_world_init(&b->world,size);
+    emb_comp_mask mask = EMB_COMP_BIT(EMB_COMP_TRANSFORM) | EMB_COMP_BIT(EMB_COMP_WORLD) | EMB_COMP_BIT(EMB_COMP_NODE);
+    for(uint32_t i=0; i<size; ++i){
+        emb_entity e = emb_world_spawn(&b->world,mask);
+        emb_primitive tmp;
+        prim_inst_def_trtansform(&tmp);
+        bench_scatter(&tmp,i);
+        emb_transform * t = (emb_transform*)emb_world_get(&b->world,e,EMB_COMP_TRANSFORM);
+        glm_vec3_copy(tmp.pos,t->pos); glm_vec3_copy(tmp.rot,t->rot); glm_vec3_copy(tmp.scale,t->scale);
+        emb_node_ref_set((emb_node_ref*)emb_world_get(&b->world,e,EMB_COMP_NODE),leaves[(i/4)%(node_count/4)]);
+    }
+    free(leaves);
+}
+
+static void bench_world_run(void * user, uint32_t size){
+    bench_world * b = (bench_world*)user;
+    emb_world_update_transforms(&b->world);
+}
+
+static void bench_world_teardown(void * user, uint32_t size){
+    bench_world * b = (bench_world*)user;
+    emb_world_free(&b->world);
+    emb_node_pool_free(&b->pool);
+}
+
+
+
+//__________________________________________________
+// node churn: push, build subtrees, cascade remove
+//__________________________________________________
+
+typedef struct{
+    emb_node_pool pool;
+    emb_node ** roots; //pushed this round, then the ones left alive
+    uint32_t roots_len;
+} bench_churn;
+
+static void bench_node_churn_setup(void * user, uint32_t size){
+    bench_churn * b = (bench_churn*)user;
+    emb_node_pool_init(&b->pool,size,NULL);
+    b->roots = (emb_node**)malloc(((size_t)size/16 + 1)*sizeof(emb_node*));
+    b->roots_len = 0;
+}
+
+static void bench_node_churn_run(void * user, uint32_t size){
+    bench_churn * b = (bench_churn*)user;
+    for(uint32_t round=0; round<4; ++round){
+        //roots left by the previous round go first, the pool stays at the same size
+        for(uint32_t k=0; k<b->roots_len; ++k) emb_node_pool_remove(&b->pool,b->roots[k]);
+        b->roots_len = 0;
+
+        //roots with 7 children each
+        emb_node * root = NULL;
+        for(uint32_t i=0; i<size/2; ++i){
+            emb_node * n = emb_node_pool_push(&b->pool);
+            if(i % 8) emb_node_set_parent(n,root);
+            else root = b->roots[b->roots_len++] = n;
+        }
+        //every second root goes away with its children, the free list gets holes
+        uint32_t kept = 0;
+        for(uint32_t k=0; k<b->roots_len; ++k){
+            if(k % 2) emb_node_pool_remove(&b->pool,b->roots[k]);
+            else b->roots[kept++] = b->roots[k];
+        }
+        b->roots_len = kept;
+    }
+}
+
+static void bench_node_churn_teardown(void * user, uint32_t size){
+    bench_churn * b = (bench_churn*)user;
+    emb_node_pool_free(&b->pool);
+    free(b->roots);
+}
+
+
+
+//__________________________________________________
+// emb_ebvb_handler_instantiate throughput
+//__________________________________________________
+
+typedef struct{
+    emb_ebvb_handler batch;
+    emb_primitive_origin cube;
+    GLuint vbo, ebo;
+} bench_batch;
+
+static void bench_batch_setup(void * user, uint32_t size){
+    bench_batch * b = (bench_batch*)user;
+    b->cube = emb_white_cube();
+    b->batch = emb_ebvb_handler_init(
+        (size+1)*b->cube.vb_len, &b->vbo,
+        (size+1)*b->cube.eb_len*sizeof(uint32_t), &b->ebo
+    );
+}
+
+static void bench_batch_run(void * user, uint32_t size){
+    bench_batch * b = (bench_batch*)user;
+    for(uint32_t i=0; i<size; ++i) emb_ebvb_handler_instantiate(&b->batch,&b->cube);
+}
+
+static void bench_batch_teardown(void * user, uint32_t size){
+    bench_batch * b = (bench_batch*)user;
+    emb_ebvb_handler_free(&b->batch);
+}
+
+
+
+//__________________________________________________
+// handles: spawn, destroy half, spawn again, resolve all
+//__________________________________________________
+
+static void bench_handles_run(void * user, uint32_t size){
+    bench_batch * b = (bench_batch*)user;
+    emb_primitive_handle * handles = (emb_primitive_handle*)malloc(size*sizeof(emb_primitive_handle));
+    for(uint32_t i=0; i<size; ++i) handles[i] = emb_ebvb_handler_instantiate(&b->batch,&b->cube);
+    for(uint32_t i=0; i<size; i+=2) emb_ebvb_handler_destroy(&b->batch,handles[i]);
+
+    float acc = 0.0f;
+    for(uint32_t i=1; i<size; i+=2) acc += emb_ebvb_handler_get(&b->batch,handles[i])->scale[0];
+    EMB_BENCH_SINK += acc;
+    free(handles);
+}
+
+
+
+//__________________________________________________
+// vec_push growth
+//__________________________________________________
+
+static void bench_vec_run(void * user, uint32_t size){
+    vec v = vec_alloc(sizeof(uint32_t),1);
+    for(uint32_t i=0; i<size; ++i) vec_push(&v,&i);
+    EMB_BENCH_SINK += (float)v.len;
+    vec_free(&v);
+}
+
+EMB_VEC_DEFINE(uint32_t, bench_vec_u32)
+
+static void bench_vec_typed_run(void * user, uint32_t size){
+    bench_vec_u32 v;
+    bench_vec_u32_init(&v,NULL);
+    for(uint32_t i=0; i<size; ++i) bench_vec_u32_push(&v,i);
+    EMB_BENCH_SINK += (float)v.len;
+    bench_vec_u32_free(&v);
+}
+
+
+
+//__________________________________________________
+// strmap: lookup of every name, erase/insert churn
+//__________________________________________________
+
+typedef struct{
+    strmap map;
+    char (*names)[24];
+} bench_strmap;
+
+static void bench_strmap_setup(void * user, uint32_t size){
+    bench_strmap * b = (bench_strmap*)user;
+    b->map = strmap_alloc(size);
+    b->names = malloc(size*sizeof(*b->names));
+    for(uint32_t i=0; i<size; ++i){
+        snprintf(b->names[i],sizeof(b->names[i]),"node_%u",i*2654435761u);
+        strmap_set(&b->map,b->names[i],(void*)(uintptr_t)(i+1));
+    }
+}
+
+static void bench_strmap_run(void * user, uint32_t size){
+    bench_strmap * b = (bench_strmap*)user;
+    uintptr_t acc = 0;
+    for(uint32_t i=0; i<size; ++i) acc += (uintptr_t)strmap_get(&b->map,b->names[i]);
+    for(uint32_t i=0; i<size; i+=4) strmap_erase(&b->map,b->names[i]);
+    for(uint32_t i=0; i<size; i+=4) strmap_set(&b->map,b->names[i],(void*)(uintptr_t)(i+1));
+    EMB_BENCH_SINK += (float)acc;
+}
+
+static void bench_strmap_teardown(void * user, uint32_t size){
+    bench_strmap * b = (bench_strmap*)user;
+    strmap_free(&b->map);
+    free(b->names);
+}
+
+
+
+//__________________________________________________
+// clustered lights: binning on 4 threads, no GL
+// sizes above EMB_MAX_LIGHTS run (and are reported) at the cap
+//__________________________________________________
+
+typedef struct{
+    emb_clusters clusters;
+    emb_light * lights;
+    mat4 view;
+} bench_lights;
+
+static void bench_lights_setup(void * user, uint32_t size){
+    bench_lights * b = (bench_lights*)user;
+    b->lights = (emb_light*)calloc(size,sizeof(emb_light));
+    srand(1);
+    for(uint32_t i=0; i<size; ++i){
+        b->lights[i].pos[0] = (float)(rand()%200 - 100);
+        b->lights[i].pos[1] = (float)(rand()%40 - 20);
+        b->lights[i].pos[2] = -(float)(rand()%200);
+        b->lights[i].radius = 2.0f + (float)(rand()%8);
+    }
+    emb_clusters_set_projection(&b->clusters,glm_rad(90.0f),16.0f/9.0f,0.1f,1000.0f);
+    glm_mat4_identity(b->view);
+}
+
+static void bench_lights_run(void * user, uint32_t size){
+    bench_lights * b = (bench_lights*)user;
+    emb_clusters_bin(&b->clusters,b->lights,size,b->view);
+    EMB_BENCH_SINK += (float)b->clusters.indices.len;
+}
+
+static void bench_lights_teardown(void * user, uint32_t size){
+    free(((bench_lights*)user)->lights);
+}
+
+
+
+//__________________________________________________
+// meshlet culling: uv sphere of ~size triangles, camera outside
+//__________________________________________________
+
+typedef struct{
+    emb_meshlet * meshlets;
+    uint32_t meshlets_len;
+    emb_draw_range * ranges;
+    vec4 planes[6];
+} bench_meshlets;
+
+static void bench_meshlets_setup(void * user, uint32_t size){
+    bench_meshlets * b = (bench_meshlets*)user;
+    uint32_t rings = (uint32_t)sqrtf((float)size/4.0f) + 2, segments = rings*2;
+    uint32_t vertices = (rings+1)*(segments+1);
+    float * vb = (float*)malloc(vertices*3*sizeof(float));
+    uint32_t * eb = (uint32_t*)malloc(rings*segments*6*sizeof(uint32_t));
+    for(uint32_t i=0; i<=rings; ++i)
+        for(uint32_t j=0; j<=segments; ++j){
+            float th = GLM_PIf*(float)i/(float)rings, ph = 2.0f*GLM_PIf*(float)j/(float)segments;
+            float * p = &vb[(i*(segments+1)+j)*3];
+            p[0] = sinf(th)*cosf(ph); p[1] = cosf(th); p[2] = sinf(th)*sinf(ph);
+        }
+    uint32_t len = 0;
+    for(uint32_t i=0; i<rings; ++i)
+        for(uint32_t j=0; j<segments; ++j){
+            uint32_t a = i*(segments+1)+j, c = a+segments+1;
+            eb[len++] = a; eb[len++] = a+1; eb[len++] = c;
+            eb[len++] = a+1; eb[len++] = c+1; eb[len++] = c;
+        }
+    b->meshlets = emb_meshlets_build(vb,vertices,3,eb,len,&b->meshlets_len);
+    b->ranges = (emb_draw_range*)malloc((b->meshlets_len ? b->meshlets_len : 1)*sizeof(emb_draw_range));
+    free(vb);
+    free(eb);
+
+    mat4 proj, view, viewproj;
+    glm_perspective(glm_rad(90.0f),1.0f,0.1f,100.0f,proj);
+    glm_lookat((vec3){0.0f,0.0f,3.0f},(vec3){0.0f,0.0f,0.0f},(vec3){0.0f,1.0f,0.0f},view);
+    glm_mat4_mul(proj,view,viewproj);
+    glm_frustum_planes(viewproj,b->planes);
+}
+
+static void bench_meshlets_run(void * user, uint32_t size){
+    bench_meshlets * b = (bench_meshlets*)user;
+    mat4 model;
+    glm_mat4_identity(model);
+    uint32_t n = emb_meshlets_cull(b->meshlets,b->meshlets_len,model,b->planes,(vec3){0.0f,0.0f,3.0f},b->ranges);
+    EMB_BENCH_SINK += (float)n;
+}
+
+static void bench_meshlets_teardown(void * user, uint32_t size){
+    bench_meshlets * b = (bench_meshlets*)user;
+    emb_meshlets_free(b->meshlets,b->meshlets_len);
+    free(b->ranges);
+}
+
+
+
+//__________________________________________________
+// texture mips: ~size pixels RGBA8, resampled to a bucket with the full chain
+//__________________________________________________
+
+typedef struct{
+    uint8_t * rgba;
+    uint32_t side;
+} bench_texture;
+
+static void bench_texture_setup(void * user, uint32_t size){
+    bench_texture * b = (bench_texture*)user;
+    b->side = (uint32_t)sqrtf((float)size);
+    if(b->side == 0) b->side = 1;
+    b->rgba = (uint8_t*)malloc((size_t)b->side*b->side*4);
+    for(size_t i=0; i<(size_t)b->side*b->side*4; ++i) b->rgba[i] = (uint8_t)(rand() & 0xFF);
+}
+
+static void bench_texture_run(void * user, uint32_t size){
+    bench_texture * b = (bench_texture*)user;
+    emb_texture_data t;
+    if(!emb_texture_build(b->rgba,b->side,b->side,NULL,&t)) return;
+    EMB_BENCH_SINK += (float)t.pixels[t.bytes-1];
+    emb_texture_data_free(&t);
+}
+
+static void bench_texture_teardown(void * user, uint32_t size){
+    free(((bench_texture*)user)->rgba);
+}
+
+
+
+//__________________________________________________
+// animation: size props of 4 nodes playing one clip, 60 keys per track
+//__________________________________________________
+
+#define BENCH_ANIM_NODES 4
+#define BENCH_ANIM_KEYS 60
+
+typedef struct{
+    emb_anim_clip clip;
+    emb_node_pool pool;
+    emb_node ** nodes; //BENCH_ANIM_NODES per prop
+    emb_anim_player * players;
+    emb_arena arena; //cursors and poses of the players
+} bench_anim;
+
+static void bench_anim_setup(void * user, uint32_t size){
+    bench_anim * b = (bench_anim*)user;
+    emb_anim_clip * c = &b->clip;
+    memset(c,0,sizeof(*c));
+    c->tracks_len = BENCH_ANIM_NODES*EMB_ANIM_PATH_COUNT;
+    c->keys_len = c->tracks_len*BENCH_ANIM_KEYS;
+    c->tracks = (emb_anim_track*)malloc(c->tracks_len*sizeof(emb_anim_track) + c->keys_len*5*sizeof(float));
+    c->values = (float*)(c->tracks + c->tracks_len);
+    c->times = c->values + (size_t)c->keys_len*4;
+    c->targets = BENCH_ANIM_NODES;
+    c->duration = (float)(BENCH_ANIM_KEYS-1)/30.0f;
+    for(uint32_t t=0; t<c->tracks_len; ++t){
+        emb_anim_track * tr = &c->tracks[t];
+        *tr = (emb_anim_track){t*BENCH_ANIM_KEYS, BENCH_ANIM_KEYS, t/EMB_ANIM_PATH_COUNT, (uint8_t)(t%EMB_ANIM_PATH_COUNT), EMB_ANIM_LINEAR, 0};
+        for(uint32_t k=0; k<BENCH_ANIM_KEYS; ++k){
+            float * v = &c->values[(size_t)(tr->first+k)*4];
+            float a = 0.1f*(float)k;
+            c->times[tr->first+k] = (float)k/30.0f;
+            if(tr->path == EMB_ANIM_ROTATION) {v[0] = 0.0f; v[1] = sinf(a*0.5f); v[2] = 0.0f; v[3] = cosf(a*0.5f);}
+            else {v[0] = v[1] = v[2] = 1.0f + 0.01f*a; v[3] = 0.0f;}
+        }
+    }
+
+    emb_node_pool_init(&b->pool,size*BENCH_ANIM_NODES,NULL);
+    b->nodes = (emb_node**)malloc((size_t)size*BENCH_ANIM_NODES*sizeof(emb_node*));
+    b->players = (emb_anim_player*)malloc(size*sizeof(emb_anim_player));
+    b->arena = emb_arena_init(0);
+    for(uint32_t i=0; i<size; ++i){
+        emb_node ** nodes = &b->nodes[(size_t)i*BENCH_ANIM_NODES];
+        for(uint32_t n=0; n<BENCH_ANIM_NODES; ++n){
+            nodes[n] = emb_node_pool_push(&b->pool);
+            if(n) emb_node_set_parent(nodes[n],nodes[0]);
+        }
+        emb_anim_player_init(&b->players[i],nodes,BENCH_ANIM_NODES,&b->arena.base);
+        emb_anim_player_play(&b->players[i],c,true);
+        b->players[i].layers[0].time = c->duration*(float)(i % 97)/97.0f; //out of phase
+    }
+}
+
+static void bench_anim_run(void * user, uint32_t size){
+    bench_anim * b = (bench_anim*)user;
+    for(uint32_t i=0; i<size; ++i) emb_anim_player_update(&b->players[i],1.0f/60.0f);
+    EMB_BENCH_SINK += b->nodes[0]->rot[1];
+}
+
+static void bench_anim_teardown(void * user, uint32_t size){
+    bench_anim * b = (bench_anim*)user;
+    emb_arena_free(&b->arena); //players allocated only from it
+    free(b->players);
+    free(b->nodes);
+    emb_node_pool_free(&b->pool);
+    emb_anim_clip_free(&b->clip);
+}
+
+
+
+//__________________________________________________
+// glTF load
+//__________________________________________________
+
+typedef struct{
+    const char * path;
+    emb_arena arena; //all primitives of the file, reset after each run
+} bench_gltf;
+
+static void bench_gltf_run(void * user, uint32_t size){
+    bench_gltf * b = (bench_gltf*)user;
+    cgltf_data * data = _model_load_gltf((char*)b->path);
+    if(!data) return;
+
+    for(cgltf_size i=0; i<data->meshes_count; ++i){
+        for(cgltf_size j=0; j<data->meshes[i].primitives_count; ++j){
+            emb_primitive_origin origin;
+            prim_load_primitive_cgltf(&origin,&data->meshes[i].primitives[j],&b->arena.base);
+            EMB_BENCH_SINK += (float)origin.vb_len;
+            emb_primitive_origin_free(&origin);
+        }
+    }
+    cgltf_free(data);
+    emb_arena_reset(&b->arena);
+}
+
+
+
+//__________________________________________________
+// GL submission (EGL surfaceless)
+//__________________________________________________
+
+#ifdef EMB_BENCH_EGL
+
+#define EMB_BENCH_FB_SIZE 256
+
+typedef struct{
+    EGLDisplay display;
+    EGLContext context;
+    GLuint fbo, color_rb, depth_rb;
+    GLuint shader_prog;
+    emb_clusters clusters; //no lights, bound because the fragment shader reads them
+    emb_materials materials; //default material only
+
+    bench_batch scene;
+    GLuint vao;
+
+    //main.c records the frame and the render thread replays it, here both happen on this thread
+    emb_renderer replayer;
+    emb_cmd_list cl;
+    emb_draw_batch draws;
+} bench_gl;
+
+//the shaders are #version 460, llvmpipe may only give 4.5 (gl_BaseInstance through the ARB extension)
+static char * bench_read_shader(const char * name, bool gl45){
+    char path[512];
+    snprintf(path,sizeof(path),"%s/shaders/%s",EMB_SOURCE_DIR,name);
+    char * src = read_shader_file(path,NULL);
+    if(!src || !gl45) return src;
+    char * v = strstr(src,"#version 460");
+    if(!v) return src;
+    const char * ext = "#version 450 core\n#extension GL_ARB_shader_draw_parameters : require\n#define gl_BaseInstance gl_BaseInstanceARB\n";
+    const char * rest = strchr(v,'\n');
+    if(!rest) rest = "";
+    char * patched = (char*)malloc(strlen(src) + strlen(ext) + 1);
+    sprintf(patched,"%.*s%s%s",(int)(v-src),src,ext,rest);
+    free(src);
+    return patched;
+}
+
+static bool bench_gl_init(bench_gl * g){
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    g->display = get_platform_display
+        ? get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,EGL_DEFAULT_DISPLAY,NULL)
+        : eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if(g->display == EGL_NO_DISPLAY || !eglInitialize(g->display,NULL,NULL)) return false;
+    if(!eglBindAPI(EGL_OPENGL_API)) return false;
+
+    EGLint config_attribs[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+    EGLConfig config; EGLint config_count = 0;
+    if(!eglChooseConfig(g->display,config_attribs,&config,1,&config_count) || config_count == 0) return false;
+
+    bool gl45 = false;
+    EGLint ctx_attribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4, EGL_CONTEXT_MINOR_VERSION, 6,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    g->context = eglCreateContext(g->display,config,EGL_NO_CONTEXT,ctx_attribs);
+    if(g->context == EGL_NO_CONTEXT){
+        ctx_attribs[3] = 5; gl45 = true;
+        g->context = eglCreateContext(g->display,config,EGL_NO_CONTEXT,ctx_attribs);
+    }
+    if(g->context == EGL_NO_CONTEXT) return false;
+    if(!eglMakeCurrent(g->display,EGL_NO_SURFACE,EGL_NO_SURFACE,g->context)) return false;
+    if(!gladLoadGL((GLADloadfunc)eglGetProcAddress)) return false;
+    printf("gl submission on: %s\n",glGetString(GL_RENDERER));
+
+    //offscreen target, there is no default framebuffer without surface
+    glCreateRenderbuffers(1,&g->color_rb);
+    glNamedRenderbufferStorage(g->color_rb,GL_RGBA8,EMB_BENCH_FB_SIZE,EMB_BENCH_FB_SIZE);
+    glCreateRenderbuffers(1,&g->depth_rb);
+    glNamedRenderbufferStorage(g->depth_rb,GL_DEPTH_COMPONENT24,EMB_BENCH_FB_SIZE,EMB_BENCH_FB_SIZE);
+    glCreateFramebuffers(1,&g->fbo);
+    glNamedFramebufferRenderbuffer(g->fbo,GL_COLOR_ATTACHMENT0,GL_RENDERBUFFER,g->color_rb);
+    glNamedFramebufferRenderbuffer(g->fbo,GL_DEPTH_ATTACHMENT,GL_RENDERBUFFER,g->depth_rb);
+    glBindFramebuffer(GL_FRAMEBUFFER,g->fbo);
+    glViewport(0,0,EMB_BENCH_FB_SIZE,EMB_BENCH_FB_SIZE);
+
+    char * vertex_source = bench_read_shader("vertex.glsl",gl45);
+    char * fragment_source = bench_read_shader("fragment.glsl",gl45);
+    bool ok = shader_program_from_source(&g->shader_prog,vertex_source,fragment_source);
+    free(vertex_source);
+    free(fragment_source);
+    if(!ok) return false;
+
+    glUseProgram(g->shader_prog);
+
+    emb_clusters_init(&g->clusters,1);
+    emb_clusters_gl_init(&g->clusters);
+    emb_clusters_set_projection(&g->clusters,glm_rad(90.0f),1.0f,0.1f,10000.0f);
+    mat4 view; glm_mat4_identity(view);
+    emb_clusters_bin(&g->clusters,NULL,0,view);
+    emb_clusters_upload(&g->clusters,NULL);
+    emb_clusters_bind(&g->clusters,g->shader_prog,EMB_BENCH_FB_SIZE,EMB_BENCH_FB_SIZE);
+    emb_materials_init(&g->materials);
+    emb_materials_gl_init(&g->materials);
+    emb_materials_upload(&g->materials);
+
+    memset(&g->replayer,0,sizeof(g->replayer));
+    emb_cmd_list_init(&g->cl,0);
+    emb_draw_batch_init(&g->draws);
+    return true;
+}
+
+static void bench_gl_free(bench_gl * g){
+    //the render thread deletes these on exit, the replayer here never ran one
+    if(g->replayer.batch_records){
+        GLuint buffers[2] = {g->replayer.batch_records, g->replayer.batch_draws};
+        EMB_MEM_GPU_RELEASE(EMB_GPU_BUFFER,buffers[0]);
+        EMB_MEM_GPU_RELEASE(EMB_GPU_BUFFER,buffers[1]);
+        glDeleteBuffers(2,buffers);
+    }
+    emb_cmd_list_free(&g->cl);
+    emb_draw_batch_free(&g->draws);
+    emb_clusters_free(&g->clusters);
+    emb_materials_free(&g->materials);
+    glDeleteProgram(g->shader_prog);
+    glDeleteFramebuffers(1,&g->fbo);
+    glDeleteRenderbuffers(1,&g->color_rb);
+    glDeleteRenderbuffers(1,&g->depth_rb);
+    eglMakeCurrent(g->display,EGL_NO_SURFACE,EGL_NO_SURFACE,EGL_NO_CONTEXT);
+    eglDestroyContext(g->display,g->context);
+    eglTerminate(g->display);
+}
+
+
+static void bench_gl_setup(void * user, uint32_t size){
+    bench_gl * g = (bench_gl*)user;
+    bench_batch_setup(&g->scene,size);
+    for(uint32_t i=0; i<size; ++i){
+        emb_primitive_handle h = emb_ebvb_handler_instantiate(&g->scene.batch,&g->scene.cube);
+        bench_scatter(emb_ebvb_handler_get(&g->scene.batch,h),i);
+    }
+
+    emb_ebvb_handler * batch = &g->scene.batch;
+    glCreateBuffers(1,&g->scene.vbo);
+    glCreateBuffers(1,&g->scene.ebo);
+    glNamedBufferStorage(g->scene.vbo,batch->vb_capacity*sizeof(float),batch->vb_data,GL_DYNAMIC_STORAGE_BIT);
+    glNamedBufferStorage(g->scene.ebo,batch->eb_capacity,batch->eb_data,GL_DYNAMIC_STORAGE_BIT);
+    emb_setup_buffers(&g->vao,0,g->scene.vbo,g->scene.ebo);
+    glFinish();
+}
+
+/*opaque pass of the main.c render loop: every instance goes into a draw batch,
+the recorded list is replayed as one multi-draw indirect with models and
+materials from the storage buffers. No culling, lights or render thread.*/
+static void bench_gl_run(void * user, uint32_t size){
+    bench_gl * g = (bench_gl*)user;
+    emb_ebvb_handler * batch = &g->scene.batch;
+    emb_cmd_list * cl = &g->cl;
+    emb_cmd_list_reset(cl);
+    emb_draw_batch_reset(&g->draws);
+
+    mat4 model, view, proj;
+    glm_perspective(glm_rad(90.0f),1.0f,0.1f,10000.0f,proj);
+    glm_mat4_identity(view);
+
+    emb_cmd_target(cl,g->fbo,EMB_BENCH_FB_SIZE,EMB_BENCH_FB_SIZE);
+    emb_cmd_clear(cl,0.0f,0.0f,0.0f,0.0f,EMB_CLEAR_COLOR | EMB_CLEAR_DEPTH);
+    emb_cmd_state(cl,EMB_STATE_DEPTH_TEST | EMB_STATE_CULL_BACK);
+    emb_cmd_program(cl,g->shader_prog);
+    emb_cmd_geometry(cl,g->vao);
+    emb_cmd_uniform(cl,"light_dir",(float[3]){0.0f,-1.0f,0.0f},3);
+    emb_cmd_uniform_mat4(cl,"proj",proj);
+    emb_cmd_uniform_mat4(cl,"view",view);
+    emb_cmd_uniform_int(cl,"transparency",0); //opaque (oit.h)
+    emb_cmd_materials(cl,&g->materials);
+
+    for(uint32_t i = 0; i<batch->primitives.len; ++i){
+        emb_primitive * inst = &batch->primitives.values[i];
+        prim_inst_get_transform(inst,model);
+        emb_draw_batch_add(&g->draws,model,inst->material,&inst->geometry,NULL,0);
+    }
+    emb_cmd_draw_batch(cl,&g->draws);
+
+    emb_renderer_replay(&g->replayer,cl);
+    glFinish();
+}
+
+static void bench_gl_teardown(void * user, uint32_t size){
+    bench_gl * g = (bench_gl*)user;
+    glDeleteVertexArrays(1,&g->vao);
+    glDeleteBuffers(1,&g->scene.vbo);
+    glDeleteBuffers(1,&g->scene.ebo);
+    bench_batch_teardown(&g->scene,size);
+}
+
+#endif //EMB_BENCH_EGL
+
+
+
+//__________________________________________________
+
+static uint32_t bench_parse_sizes(const char * str, uint32_t * sizes){
+    uint32_t n = 0;
+    while(*str && n < EMB_BENCH_SIZES_MAX){
+        char * end;
+        unsigned long v = strtoul(str,&end,10);
+        if(end == str) break;
+        if(v) sizes[n++] = (uint32_t)v;
+        str = (*end == ',') ? end+1 : end;
+    }
+    return n;
+}
+
+
+int main(int argc, char ** argv){
+    uint32_t sizes[EMB_BENCH_SIZES_MAX] = {1000, 10000, 100000};
+    uint32_t sizes_len = 3;
+    uint32_t warmup = 2, reps = 10;
+    const char * filter = NULL;
+    const char * gltf_path = NULL;
+    const char * json_path = NULL;
+
+    for(int i=1; i<argc; ++i){
+        bool has_value = i+1 < argc;
+        if(!strcmp(argv[i],"--reps") && has_value) reps = (uint32_t)atoi(argv[++i]);
+        else if(!strcmp(argv[i],"--warmup") && has_value) warmup = (uint32_t)atoi(argv[++i]);
+        else if(!strcmp(argv[i],"--sizes") && has_value) sizes_len = bench_parse_sizes(argv[++i],sizes);
+        else if(!strcmp(argv[i],"--filter") && has_value) filter = argv[++i];
+        else if(!strcmp(argv[i],"--gltf") && has_value) gltf_path = argv[++i];
+        else if(!strcmp(argv[i],"--json") && has_value) json_path = argv[++i];
+        else {printf("unknown argument: %s\n",argv[i]); return EXIT_FAILURE;}
+    }
+
+    emb_bench b = emb_bench_init(warmup,reps);
+    b.filter = filter;
+    printf("ember_bench %s, warmup %u, reps %u\n",EMB_BENCH_REVISION,b.warmup,b.reps);
+    emb_bench_print_header();
+
+    bench_nodes nodes;
+    bench_world world;
+    bench_churn churn;
+    bench_batch batch;
+    bench_strmap names;
+    bench_meshlets meshlets;
+    bench_texture texture;
+    bench_anim anim;
+    static bench_lights lights; //worker threads keep a pointer to the clusters
+    emb_clusters_init(&lights.clusters,4);
+    uint32_t lights_last = 0;
+    for(uint32_t s=0; s<sizes_len; ++s){
+        emb_bench_run(&b,"node_transform",sizes[s],&nodes,bench_nodes_setup,bench_nodes_run,bench_nodes_teardown);
+        emb_bench_run(&b,"world_transform",sizes[s],&world,bench_world_setup,bench_world_run,bench_world_teardown);
+        emb_bench_run(&b,"node_churn",sizes[s],&churn,bench_node_churn_setup,bench_node_churn_run,bench_node_churn_teardown);
+        emb_bench_run(&b,"ebvb_instantiate",sizes[s],&batch,bench_batch_setup,bench_batch_run,bench_batch_teardown);
+        emb_bench_run(&b,"primitive_handles",sizes[s],&batch,bench_batch_setup,bench_handles_run,bench_batch_teardown);
+        emb_bench_run(&b,"vec_push",sizes[s],NULL,NULL,bench_vec_run,NULL);
+        emb_bench_run(&b,"vec_typed_push",sizes[s],NULL,NULL,bench_vec_typed_run,NULL);
+        emb_bench_run(&b,"strmap_lookup",sizes[s],&names,bench_strmap_setup,bench_strmap_run,bench_strmap_teardown);
+        uint32_t lights_len = sizes[s] < EMB_MAX_LIGHTS ? sizes[s] : EMB_MAX_LIGHTS;
+        if(lights_len != lights_last) emb_bench_run(&b,"light_binning",lights_len,&lights,bench_lights_setup,bench_lights_run,bench_lights_teardown);
+        lights_last = lights_len;
+        emb_bench_run(&b,"meshlet_cull",sizes[s],&meshlets,bench_meshlets_setup,bench_meshlets_run,bench_meshlets_teardown);
+        emb_bench_run(&b,"texture_mips",sizes[s],&texture,bench_texture_setup,bench_texture_run,bench_texture_teardown);
+        emb_bench_run(&b,"anim_players",sizes[s],&anim,bench_anim_setup,bench_anim_run,bench_anim_teardown);
+    }
+    emb_clusters_free(&lights.clusters);
+
+    if(gltf_path){
+        bench_gltf gltf = {gltf_path, emb_arena_init(0)};
+        emb_bench_run(&b,"gltf_load",1,&gltf,NULL,bench_gltf_run,NULL);
+        emb_arena_free(&gltf.arena);
+    }
+
+#ifdef EMB_BENCH_EGL
+    if(!filter || strstr("gl_submit",filter)){
+        bench_gl gl;
+        if(bench_gl_init(&gl)){
+            for(uint32_t s=0; s<sizes_len; ++s)
+                emb_bench_run(&b,"gl_submit",sizes[s],&gl,bench_gl_setup,bench_gl_run,bench_gl_teardown);
+            bench_gl_free(&gl);
+        }
+        else printf("gl_submit skipped: no EGL surfaceless context\n");
+    }
+#endif
+
+    if(json_path && !emb_bench_write_json(&b,json_path,EMB_BENCH_REVISION)) return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
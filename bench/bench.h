@@ -0,0 +1,141 @@
+/*______________________________________
+bench - tiny benchmark harness
+
+Each case is run `warmup` times untimed, then `reps` times timed.
+setup/teardown are not measured. Results are kept for the summary
+and the json report.
+______________________________________*/
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+
+
+#define EMB_BENCH_RESULTS_MAX 256
+#define EMB_BENCH_REPS_MAX 1024
+
+
+typedef void (*emb_bench_fn)(void * user, uint32_t size);
+
+typedef struct{
+    const char * name;
+    uint32_t size; //scene size (parameter of the case)
+    uint32_t reps;
+    double min_ms;
+    double max_ms;
+    double mean_ms;
+    double median_ms;
+    double stddev_ms;
+    double ns_per_item; //median / size
+} emb_bench_result;
+
+typedef struct{
+    uint32_t warmup;
+    uint32_t reps;
+    const char * filter; //run only cases containing this substring (NULL - all)
+
+    emb_bench_result results[EMB_BENCH_RESULTS_MAX];
+    uint32_t results_len;
+} emb_bench;
+
+
+
+static inline double emb_bench_now_ms(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec*1e3 + (double)ts.tv_nsec*1e-6;
+}
+
+static int bench_cmp_double(const void * a, const void * b){
+    double da = *(const double*)a, db = *(const double*)b;
+    return (da > db) - (da < db);
+}
+
+
+emb_bench emb_bench_init(uint32_t warmup, uint32_t reps){
+    emb_bench b;
+    memset(&b,0,sizeof(b));
+    b.warmup = warmup;
+    b.reps = reps > EMB_BENCH_REPS_MAX ? EMB_BENCH_REPS_MAX : (reps ? reps : 1);
+    return b;
+}
+
+
+/*runs a single case. setup and teardown may be NULL.
+user is passed to every callback unchanged.*/
+emb_bench_result * emb_bench_run(
+emb_bench * b, const char * name, uint32_t size, void * user,
+emb_bench_fn setup, emb_bench_fn run, emb_bench_fn teardown
+){
+    if(b->filter && !strstr(name,b->filter)) return NULL;
+    if(b->results_len >= EMB_BENCH_RESULTS_MAX) return NULL;
+
+    for(uint32_t i=0; i<b->warmup; ++i){
+        if(setup) setup(user,size);
+        run(user,size);
+        if(teardown) teardown(user,size);
+    }
+
+    double samples[EMB_BENCH_REPS_MAX];
+    for(uint32_t i=0; i<b->reps; ++i){
+        if(setup) setup(user,size);
+        double t0 = emb_bench_now_ms();
+        run(user,size);
+        samples[i] = emb_bench_now_ms() - t0;
+        if(teardown) teardown(user,size);
+    }
+
+    emb_bench_result * r = &b->results[b->results_len++];
+    r->name = name;
+    r->size = size;
+    r->reps = b->reps;
+
+    double sum = 0.0;
+    for(uint32_t i=0; i<b->reps; ++i) sum += samples[i];
+    r->mean_ms = sum / b->reps;
+
+    double var = 0.0;
+    for(uint32_t i=0; i<b->reps; ++i) var += (samples[i]-r->mean_ms)*(samples[i]-r->mean_ms);
+    r->stddev_ms = b->reps > 1 ? sqrt(var/(b->reps-1)) : 0.0;
+
+    qsort(samples,b->reps,sizeof(double),bench_cmp_double);
+    r->min_ms = samples[0];
+    r->max_ms = samples[b->reps-1];
+    r->median_ms = (b->reps % 2) ? samples[b->reps/2] : 0.5*(samples[b->reps/2-1]+samples[b->reps/2]);
+    r->ns_per_item = size ? r->median_ms*1e6/size : 0.0;
+
+    printf("%-28s %9u %10.4f %10.4f %10.4f %10.4f %10.2f\n",
+        r->name, r->size, r->min_ms, r->median_ms, r->mean_ms, r->stddev_ms, r->ns_per_item);
+    fflush(stdout);
+    return r;
+}
+
+void emb_bench_print_header(){
+    printf("%-28s %9s %10s %10s %10s %10s %10s\n",
+        "case","size","min ms","median ms","mean ms","stddev","ns/item");
+}
+
+
+bool emb_bench_write_json(emb_bench * b, const char * path, const char * revision){
+    FILE * f = fopen(path,"w");
+    if(!f) {printf("ERROR emb_bench_write_json(): cannot open %s\n",path); return false;}
+
+    fprintf(f,"{\n\"revision\":\"%s\",\n\"warmup\":%u,\n\"reps\":%u,\n\"results\":[",
+        revision ? revision : "unknown", b->warmup, b->reps);
+    for(uint32_t i=0; i<b->results_len; ++i){
+        emb_bench_result * r = &b->results[i];
+        fprintf(f,"%s\n{\"name\":\"%s\",\"size\":%u,\"reps\":%u,"
+            "\"min_ms\":%.6f,\"max_ms\":%.6f,\"mean_ms\":%.6f,\"median_ms\":%.6f,"
+            "\"stddev_ms\":%.6f,\"ns_per_item\":%.3f}",
+            i ? "," : "", r->name, r->size, r->reps,
+            r->min_ms, r->max_ms, r->mean_ms, r->median_ms, r->stddev_ms, r->ns_per_item);
+    }
+    fprintf(f,"\n]\n}\n");
+    fclose(f);
+    return true;
+}
@@ -3,11 +3,18 @@
 #include <glad/gl.h>
 #include <stdio.h>
 #include "utils/vector.h"
+#include "utils/slotmap.h"
 #include "model/model.h"
+#include "model/archetype.h"
 
 
 #define EMB_VB_PRIM_CAP 1024
 
+/*instances are stored densely for the render loop,
+outside code keeps emb_primitive_handle, which survives growth*/
+EMB_SLOTMAP_DEFINE(emb_primitive, slotmap_primitive)
+typedef emb_handle emb_primitive_handle;
+
 typedef struct  //eb/vb handler
 {
     float * vb_data; //vertex buffer
@@ -15,32 +22,54 @@ typedef struct  //eb/vb handler
     uint32_t vb_len; //the actual number of ELEMENTS being used
     uint32_t vb_capacity; //all avilable ELEMENTS
 
-    __uint32_t * eb_data; //element array
+    uint8_t * eb_data; //element array, 16 and 32 bit indices mixed
     GLuint * ebo; //ebo reference
-    uint32_t eb_len; //the actual number of ELEMENTS being used
-    uint32_t eb_capacity; //all avilable ELEMENTS
-    vec primitives;
+    uint32_t eb_len; //the actual number of BYTES being used
+    uint32_t eb_capacity; //all avilable BYTES
+    slotmap_primitive primitives; //iterate primitives.values[0..len)
+
+    emb_skin_vertex * skin_data; //skin stream, vertex i of vb_data is skin_data[i]
+    GLuint * skin_vbo; //second vertex buffer, NULL - not uploaded
+
+    float * pos_data; //positions only (3 floats per vertex) for depth-only passes, same vertex order
+    GLuint * pos_vbo; //NULL - not uploaded
+
+    uint32_t id; //emb_geometry_range.owner of the origins placed here
 } emb_ebvb_handler;
 
+uint32_t EMB_EBVB_HANDLER_NEXT_ID = 1;
+
 emb_ebvb_handler emb_ebvb_handler_init(
 uint32_t vb_capacity/*in ELEMENTS*/, 
 GLuint * vbo/*should be initalised by gl*/, 
-uint32_t eb_capacity/*in ELEMENTS*/, 
+uint32_t eb_capacity/*in BYTES*/, 
 GLuint * ebo 
 ){
     emb_ebvb_handler bh; 
+    bh.id = EMB_EBVB_HANDLER_NEXT_ID++;
 
     bh.vbo = vbo;
     bh.vb_capacity = vb_capacity;
     bh.vb_data = (float*)malloc(vb_capacity*sizeof(float));
+    EMB_MEM_ALLOC(EMB_MEM_BATCH,vb_capacity*sizeof(float));
     bh.vb_len = 0;
 
     bh.ebo = ebo;
     bh.eb_capacity = eb_capacity;
-    bh.eb_data = (__uint32_t*)malloc(eb_capacity*sizeof(__uint32_t));
+    bh.eb_data = (uint8_t*)malloc(eb_capacity);
+    EMB_MEM_ALLOC(EMB_MEM_BATCH,eb_capacity);
     bh.eb_len = 0;
 
-    bh.primitives = vec_alloc(sizeof(emb_primitive),EMB_VB_PRIM_CAP);
+    //zero weights for vertices of origins that aren't skinned
+    bh.skin_vbo = NULL;
+    bh.skin_data = (emb_skin_vertex*)calloc(vb_capacity/VB_ATTRIB_SIZE_MAX,sizeof(emb_skin_vertex));
+    EMB_MEM_ALLOC(EMB_MEM_BATCH,vb_capacity/VB_ATTRIB_SIZE_MAX*sizeof(emb_skin_vertex));
+
+    bh.pos_vbo = NULL;
+    bh.pos_data = (float*)malloc(vb_capacity/VB_ATTRIB_SIZE_MAX*VB_ATTRIB_POS_SIZE*sizeof(float));
+    EMB_MEM_ALLOC(EMB_MEM_BATCH,vb_capacity/VB_ATTRIB_SIZE_MAX*VB_ATTRIB_POS_SIZE*sizeof(float));
+
+    slotmap_primitive_init(&bh.primitives,EMB_VB_PRIM_CAP,NULL);
     return bh;
 }
 
@@ -60,7 +89,7 @@ static void ebvb_handler_vb_pop(emb_ebvb_handler * bh, __uint32_t n){
 
 //push back n elements
 static float * ebvb_handler_vb_push(emb_ebvb_handler * bh, float * elem, __uint32_t n){
-    if(bh->vb_len+n >= bh->vb_capacity) {
+    if(bh->vb_len+n > bh->vb_capacity) {
         printf("ERROR vb_push(): vb out of memory.");
         return NULL;
     }
@@ -85,37 +114,25 @@ static float * ebvb_handler_vb_push(emb_ebvb_handler * bh, float * elem, __uint3
 /*`d bhandler_vb_remove(emb_ebvb_handler * bh, __uint_32_t ind, __uint32_t pos){
 }*/
 
-//remove last n elements
+//remove last n bytes
 static void ebvb_handler_eb_pop(emb_ebvb_handler * bh, __uint32_t n){
-    bh->eb_len -= n;
-    if(bh->eb_len<0) bh->eb_len=0;
+    bh->eb_len = n < bh->eb_len ? bh->eb_len - n : 0;
 };
 
-//push back n elements
-static __uint32_t * ebvb_handler_eb_push(emb_ebvb_handler * bh, __uint32_t * elem, __uint32_t n){
-    if(bh->eb_len+n >= bh->eb_capacity) {
+/*reserves n bytes aligned to `align` (index size),
+the padding is left unused*/
+static uint8_t * ebvb_handler_eb_alloc(emb_ebvb_handler * bh, __uint32_t n, __uint32_t align){
+    __uint32_t offset = (bh->eb_len + align-1) & ~(align-1);
+    if(offset+n > bh->eb_capacity) {
         printf("ERROR eb_push(): eb out of memory.");
         return NULL;
     }
-
-    //position of the new element
-    __uint32_t offset = bh->eb_len;
-
-    memcpy(
-        bh->eb_data + offset,
-        elem,
-        n * sizeof(__uint32_t)
-    );
-
-    //upd length
-    bh->eb_len+=n;
-
-    //return element pointer
-    return bh->eb_data + offset; 
+    bh->eb_len = offset+n;
+    return bh->eb_data + offset;
 };
 
 
-//number of elements for rendering
+//bytes of the element buffer in use
 __uint32_t emb_ebvb_handler_ecount_render(emb_ebvb_handler * bh){   
     return bh->eb_len;
 };
@@ -124,59 +141,174 @@ __uint32_t emb_ebvb_handler_ecount_render(emb_ebvb_handler * bh){
 
 
 void emb_ebvb_handler_free(emb_ebvb_handler * bh){
+    EMB_MEM_FREE(EMB_MEM_BATCH,bh->vb_capacity*sizeof(float));
+    EMB_MEM_FREE(EMB_MEM_BATCH,bh->eb_capacity);
+    EMB_MEM_FREE(EMB_MEM_BATCH,bh->vb_capacity/VB_ATTRIB_SIZE_MAX*sizeof(emb_skin_vertex));
+    EMB_MEM_FREE(EMB_MEM_BATCH,bh->vb_capacity/VB_ATTRIB_SIZE_MAX*VB_ATTRIB_POS_SIZE*sizeof(float));
     free(bh->vb_data);
     free(bh->eb_data);
-    vec_free(&bh->primitives);
+    free(bh->skin_data);
+    free(bh->pos_data);
+    slotmap_primitive_free(&bh->primitives);
 }
 
 
+//copies positions of vertices [first, first+count) from vb_data into the position stream
+void emb_ebvb_handler_fill_positions(emb_ebvb_handler * bh, uint32_t first, uint32_t count){
+    for(uint32_t i=first; i<first+count; ++i){
+        const float * v = bh->vb_data + (size_t)i*VB_ATTRIB_SIZE_MAX;
+        float * p = bh->pos_data + (size_t)i*VB_ATTRIB_POS_SIZE;
+        p[0] = v[0]; p[1] = v[1]; p[2] = v[2];
+    }
+}
+
+
+
 //__________________________________________________
 // primitive instancing
 //__________________________________________________
 
-//creating the instance primitive
-emb_primitive* emb_ebvb_handler_instantiate(emb_ebvb_handler * bh, emb_primitive_origin * primitive){
-    emb_primitive instance;
-    instance.primitive = primitive;
+/*uploads the origin once: vertices as they are, indices local to the origin,
+16 bit when the vertex count allows. Already placed origins are only looked up,
+so they don't need cpu data anymore.*/
+static bool ebvb_handler_make_resident(emb_ebvb_handler * bh, emb_primitive_origin * primitive){
+    if(primitive->geometry.owner == bh->id) return true;
+    if(!primitive->vb || !primitive->eb) return false;
 
-    instance.vb_start = ebvb_handler_vb_push(bh,primitive->vb,primitive->vb_len);
-    //printf("instance vb_start: %d\n",instance.vb_start);
-    instance.vb_len = primitive->vb_len;
+    float * vb_start = ebvb_handler_vb_push(bh,primitive->vb,primitive->vb_len);
+    if(!vb_start) return false;
 
-    //get vertex index
-    __uint32_t vertex_offset = (instance.vb_start - bh->vb_data)
-        / (VB_ATTRIB_SIZE_MAX);
-    //printf("VB elem offst: %d\n",vertex_offset);
-    
+    uint32_t vertices = primitive->vb_len / VB_ATTRIB_SIZE_MAX;
+    uint32_t index_size = vertices <= 0x10000 ? 2 : 4;
+    uint8_t * eb_start = ebvb_handler_eb_alloc(bh,primitive->eb_len*index_size,index_size);
+    if(!eb_start) {ebvb_handler_vb_pop(bh,primitive->vb_len); return false;}
 
-
-    instance.eb_start = ebvb_handler_eb_push(bh,primitive->eb,primitive->eb_len);
-    instance.eb_len = primitive->eb_len;
-
-    for(size_t i=0; i<primitive->eb_len; ++i){
-        instance.eb_start[i] += vertex_offset;
-        //printf("\tElem %d\n",instance.eb_start[i]);
+    if(index_size == 2){
+        uint16_t * dst = (uint16_t*)eb_start;
+        for(uint32_t i=0; i<primitive->eb_len; ++i) dst[i] = (uint16_t)primitive->eb[i];
     }
+    else memcpy(eb_start,primitive->eb,primitive->eb_len*sizeof(uint32_t));
+
+    emb_geometry_range * g = &primitive->geometry;
+    g->owner = bh->id;
+    g->base_vertex = (uint32_t)(vb_start - bh->vb_data) / VB_ATTRIB_SIZE_MAX;
+    g->eb_offset = (uint32_t)(eb_start - bh->eb_data);
+    g->eb_len = primitive->eb_len;
+    g->index_size = index_size;
+    if(primitive->skin) memcpy(bh->skin_data + g->base_vertex, primitive->skin, vertices*sizeof(emb_skin_vertex));
+    emb_ebvb_handler_fill_positions(bh,g->base_vertex,vertices);
+    return true;
+}
 
+/*creating the instance primitive.
+Geometry of the origin is placed once, instances reference it.
+Returned handle stays valid until emb_ebvb_handler_destroy(), 
+use emb_ebvb_handler_get() to access the instance.*/
+emb_primitive_handle emb_ebvb_handler_instantiate(emb_ebvb_handler * bh, emb_primitive_origin * primitive){
+    if(!ebvb_handler_make_resident(bh,primitive)) {
+        if(!primitive->vb || !primitive->eb) printf("ERROR emb_ebvb_handler_instantiate(): primitive has no cpu data (discarded after upload?).\n");
+        else printf("ERROR emb_ebvb_handler_instantiate(): cannot place primitive instance in the buffer.\n");
+        return EMB_HANDLE_NULL;
+    }
+    emb_primitive instance;
+    instance.primitive = primitive;
+    instance.geometry = primitive->geometry;
+    instance.material = primitive->material;
 
-
-
-    instance.parent = NULL;
-
+    prim_inst_set_parent(&instance,NULL);
+    prim_inst_set_skin(&instance,NULL,NULL);
 
     //disabled by default
     instance.shader_program_override = false;
 
     //glm_mat6_identity(instance.transform);
     prim_inst_def_trtansform(&instance);
-
-    if(!instance.vb_start || !instance.eb_start) {printf("ERROR emb_ebvb_handler_instantiate(): cannot place primitive instance in the buffer.\n");}
     
-    emb_primitive* ret = (emb_primitive*)vec_push(&(bh->primitives),&instance);
+    emb_primitive_handle ret;
+    slotmap_primitive_insert(&bh->primitives,instance,&ret);
     //printf("created instance in address: %d\n", ret);
     return ret;
 }
 
+//samples fill ratios of the buffers and the instance slots (utils/memstats.h)
+static inline void emb_ebvb_handler_track(emb_ebvb_handler * bh){
+    EMB_MEM_FILL("batch vb floats",bh->vb_len,bh->vb_capacity);
+    EMB_MEM_FILL("batch eb bytes",bh->eb_len,bh->eb_capacity);
+    EMB_MEM_FILL("batch instances",bh->primitives.len,bh->primitives.cap);
+}
+
+/*instance by handle, NULL if it was destroyed.
+The pointer is valid only until the next instantiate/destroy.*/
+static inline emb_primitive * emb_ebvb_handler_get(emb_ebvb_handler * bh, emb_primitive_handle h){
+    return slotmap_primitive_get(&bh->primitives,h);
+}
+
+/*removes the instance from rendering.
+The geometry stays, it is shared with other instances of the origin.*/
+bool emb_ebvb_handler_destroy(emb_ebvb_handler * bh, emb_primitive_handle h){
+    return slotmap_primitive_erase(&bh->primitives,h);
+}
+
+
+//bounding sphere around the aabb of the primitive vertices
+void emb_primitive_origin_bounds(emb_primitive_origin * primitive, emb_bounds * out){
+    vec3 mn = {0.0f,0.0f,0.0f}, mx = {0.0f,0.0f,0.0f};
+    uint32_t vertices = primitive->vb_len / VB_ATTRIB_SIZE_MAX;
+    for(uint32_t i=0; i<vertices; ++i){
+        float * p = &primitive->vb[i*VB_ATTRIB_SIZE_MAX];
+        for(uint32_t k=0; k<3; ++k){
+            if(i == 0 || p[k] < mn[k]) mn[k] = p[k];
+            if(i == 0 || p[k] > mx[k]) mx[k] = p[k];
+        }
+    }
+    float r2 = 0.0f;
+    for(uint32_t k=0; k<3; ++k){
+        out->center[k] = 0.5f*(mn[k]+mx[k]);
+        r2 += 0.25f*(mx[k]-mn[k])*(mx[k]-mn[k]);
+    }
+    out->radius = sqrtf(r2);
+}
+
+/*same as emb_ebvb_handler_instantiate, but the instance lives in the world
+(archetype storage) with transform, world matrix, render range and bounds.
+extra - additional components (EMB_COMP_BIT(EMB_COMP_NODE), ...)*/
+emb_entity emb_ebvb_handler_spawn(emb_ebvb_handler * bh, emb_world * w, emb_primitive_origin * primitive, emb_comp_mask extra){
+    if(!ebvb_handler_make_resident(bh,primitive)) {
+        if(!primitive->vb || !primitive->eb) printf("ERROR emb_ebvb_handler_spawn(): primitive has no cpu data (discarded after upload?).\n");
+        else printf("ERROR emb_ebvb_handler_spawn(): cannot place primitive in the buffer.\n");
+        return EMB_HANDLE_NULL;
+    }
+
+    emb_entity e = emb_world_spawn(w,
+        EMB_COMP_BIT(EMB_COMP_TRANSFORM) | EMB_COMP_BIT(EMB_COMP_WORLD) |
+        EMB_COMP_BIT(EMB_COMP_RENDER_RANGE) | EMB_COMP_BIT(EMB_COMP_BOUNDS) | extra
+    );
+    if(EMB_HANDLE_IS_NULL(e)) return e;
+
+    emb_transform * t = (emb_transform*)emb_world_get(w,e,EMB_COMP_TRANSFORM);
+    glm_vec3_zero(t->pos);
+    glm_vec3_zero(t->rot);
+    t->scale[0] = 1.0f; t->scale[1] = 1.0f; t->scale[2] = 1.0f;
+
+    emb_render_range * range = (emb_render_range*)emb_world_get(w,e,EMB_COMP_RENDER_RANGE);
+    range->eb_offset = primitive->geometry.eb_offset;
+    range->eb_len = primitive->geometry.eb_len;
+    range->base_vertex = primitive->geometry.base_vertex;
+    range->index_size = primitive->geometry.index_size;
+    range->material = primitive->material;
+    range->shader_prog = primitive->shader_prog;
+
+    emb_bounds * bounds = (emb_bounds*)emb_world_get(w,e,EMB_COMP_BOUNDS);
+    if(primitive->vb) emb_primitive_origin_bounds(primitive,bounds);
+    else {glm_vec3_zero(bounds->center); bounds->radius = INFINITY;} //cpu data discarded, never culled
+
+    emb_node_ref * node = (emb_node_ref*)emb_world_get(w,e,EMB_COMP_NODE);
+    if(node) emb_node_ref_set(node,NULL);
+    emb_lod * lod = (emb_lod*)emb_world_get(w,e,EMB_COMP_LOD);
+    if(lod) {lod->level = 0; lod->distance = 0.0f;}
+    return e;
+}
+
 
 
 
@@ -0,0 +1,168 @@
+/*______________________________________
+dynres - dynamic resolution driven by GPU frame time
+
+The scene targets are allocated once at the largest size
+(output size * max_scale). A frame renders into the lower left
+width x height of them, only the viewport changes, so a new size
+costs nothing, then the rendered part is upscaled to the window
+with a linear blit.
+
+The render thread brackets the scene passes with two GL_TIMESTAMP
+queries (pairs cycled through EMB_DYNRES_FRAMES, a pair is read only
+when it comes around again and only if it is available, it never waits
+for the GPU). The recording thread reads the last measurement at the start
+of a frame and scales: GPU time follows the pixel count (scale^2),
+so the next scale is scale * sqrt(target * headroom / time).
+Going down is fast, going up is slow and only with clear room,
+after a change the samples still in flight are skipped.
+______________________________________*/
+#pragma once
+
+#include <glad/gl.h>
+#include <cglm/cglm.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include "render.h"
+
+
+#define EMB_DYNRES_FRAMES 4 //timestamp pairs in flight
+#define EMB_DYNRES_ALIGN 8 //render size step in pixels
+#define EMB_DYNRES_HEADROOM 0.9f //aims below the target
+#define EMB_DYNRES_GROW_BELOW 0.75f //scales up only under this part of the target
+#define EMB_DYNRES_MAX_DOWN 0.75f //largest steps of one change
+#define EMB_DYNRES_MAX_UP 1.05f
+#define EMB_DYNRES_SMOOTHING 0.2f //weight of a new sample
+#define EMB_DYNRES_SETTLE 8 //samples skipped after a change (frames in flight + query lag)
+
+typedef struct{
+    //render thread
+    GLuint queries[EMB_DYNRES_FRAMES][2]; //begin, end
+    uint32_t frame;
+    //render thread writes, recording thread reads
+    _Atomic uint32_t gpu_us; //scene time of the last read pair
+    _Atomic uint32_t measured; //pairs read so far
+    //recording thread
+    uint32_t seen;
+    uint32_t settle;
+    float gpu_ms; //smoothed
+    float target_ms; //0 - fixed at max_scale, no queries
+    float scale;
+    float min_scale;
+    float max_scale;
+    uint32_t out_width; //window
+    uint32_t out_height;
+    uint32_t max_width; //allocated targets
+    uint32_t max_height;
+    uint32_t width; //rendered part of the targets this frame
+    uint32_t height;
+} emb_dynres;
+
+
+static uint32_t dynres_size(uint32_t out, float scale, uint32_t max){
+    uint32_t s = (uint32_t)lroundf((float)out*scale/EMB_DYNRES_ALIGN)*EMB_DYNRES_ALIGN;
+    if(s < EMB_DYNRES_ALIGN) s = EMB_DYNRES_ALIGN;
+    return s > max ? max : s;
+}
+
+
+
+//__________________________________________________
+// GL thread
+//__________________________________________________
+
+/*out_width, out_height - window, scale bounds are relative to it.
+target_ms - GPU time of the scene passes, 0 keeps max_scale.
+Allocate the scene targets with max_width x max_height after this*/
+void emb_dynres_init(emb_dynres * d, uint32_t out_width, uint32_t out_height, float min_scale, float max_scale, float target_ms){
+    memset(d,0,sizeof(*d));
+    if(min_scale > max_scale) min_scale = max_scale;
+    d->out_width = out_width;
+    d->out_height = out_height;
+    d->min_scale = min_scale;
+    d->max_scale = max_scale;
+    d->target_ms = target_ms;
+    d->scale = max_scale;
+    d->max_width = (uint32_t)ceilf((float)out_width*max_scale/EMB_DYNRES_ALIGN)*EMB_DYNRES_ALIGN;
+    d->max_height = (uint32_t)ceilf((float)out_height*max_scale/EMB_DYNRES_ALIGN)*EMB_DYNRES_ALIGN;
+    d->width = dynres_size(out_width,max_scale,d->max_width);
+    d->height = dynres_size(out_height,max_scale,d->max_height);
+    if(target_ms > 0.0f) glGenQueries(2*EMB_DYNRES_FRAMES,d->queries[0]);
+}
+
+void emb_dynres_free(emb_dynres * d){
+    if(d->queries[0][0]) glDeleteQueries(2*EMB_DYNRES_FRAMES,d->queries[0]);
+    memset(d,0,sizeof(*d));
+}
+
+static void dynres_begin(void * user){
+    emb_dynres * d = (emb_dynres*)user;
+    glQueryCounter(d->queries[d->frame % EMB_DYNRES_FRAMES][0],GL_TIMESTAMP);
+}
+
+//render thread: the pair of the next frame was written EMB_DYNRES_FRAMES-1 frames ago
+static void dynres_end(void * user){
+    emb_dynres * d = (emb_dynres*)user;
+    glQueryCounter(d->queries[d->frame % EMB_DYNRES_FRAMES][1],GL_TIMESTAMP);
+    if(++d->frame < EMB_DYNRES_FRAMES) return;
+    GLuint * q = d->queries[d->frame % EMB_DYNRES_FRAMES];
+    GLint available = 0;
+    glGetQueryObjectiv(q[1],GL_QUERY_RESULT_AVAILABLE,&available);
+    if(!available) return; //lost, the pair is written again next frame
+    GLuint64 begin = 0, end = 0;
+    glGetQueryObjectui64v(q[0],GL_QUERY_RESULT,&begin);
+    glGetQueryObjectui64v(q[1],GL_QUERY_RESULT,&end);
+    atomic_store_explicit(&d->gpu_us,end > begin ? (uint32_t)((end-begin)/1000) : 0,memory_order_relaxed);
+    atomic_fetch_add_explicit(&d->measured,1,memory_order_release);
+}
+
+
+
+//__________________________________________________
+// recording
+//__________________________________________________
+
+/*call at the start of a frame, before anything is recorded with width and height.
+Returns true when the render size changed*/
+bool emb_dynres_update(emb_dynres * d){
+    if(d->target_ms <= 0.0f) return false;
+    uint32_t measured = atomic_load_explicit(&d->measured,memory_order_acquire);
+    if(measured == d->seen) return false;
+    d->seen = measured;
+    float ms = (float)atomic_load_explicit(&d->gpu_us,memory_order_relaxed)*0.001f;
+    if(d->settle) {--d->settle; return false;} //measured at the old size
+    d->gpu_ms = d->gpu_ms > 0.0f ? d->gpu_ms + (ms - d->gpu_ms)*EMB_DYNRES_SMOOTHING : ms;
+    if(d->gpu_ms <= 0.0f) return false;
+
+    float step = sqrtf(d->target_ms*EMB_DYNRES_HEADROOM/d->gpu_ms);
+    float scale = d->scale;
+    if(d->gpu_ms > d->target_ms) scale *= fmaxf(step,EMB_DYNRES_MAX_DOWN);
+    else if(d->gpu_ms < d->target_ms*EMB_DYNRES_GROW_BELOW) scale *= fminf(step,EMB_DYNRES_MAX_UP);
+    scale = glm_clamp(scale,d->min_scale,d->max_scale);
+    uint32_t width = dynres_size(d->out_width,scale,d->max_width);
+    uint32_t height = dynres_size(d->out_height,scale,d->max_height);
+    d->scale = scale;
+    if(width == d->width && height == d->height) return false;
+    d->width = width;
+    d->height = height;
+    d->gpu_ms = 0.0f;
+    d->settle = EMB_DYNRES_SETTLE;
+    return true;
+}
+
+//before the first scene pass
+static inline void emb_cmd_dynres_begin(emb_cmd_list * cl, emb_dynres * d){
+    if(d->target_ms > 0.0f) emb_cmd_callback(cl,dynres_begin,d);
+}
+
+//after the last scene pass, before the upscale
+static inline void emb_cmd_dynres_end(emb_cmd_list * cl, emb_dynres * d){
+    if(d->target_ms > 0.0f) emb_cmd_callback(cl,dynres_end,d);
+}
+
+//rendered part of the scene target to dst (0 - window), bilinear
+static inline void emb_cmd_dynres_upscale(emb_cmd_list * cl, const emb_dynres * d, const emb_render_target * scene, uint32_t dst){
+    emb_cmd_blit(cl,scene->fbo,d->width,d->height,dst,d->out_width,d->out_height,d->width != d->out_width || d->height != d->out_height);
+}
@@ -0,0 +1,514 @@
+/*______________________________________
+loader - background asset loading
+
+Worker threads read and parse files into staging memory, finished jobs
+come back through a lock-free ring and the GL thread finishes them in
+emb_loader_update() under a time budget (shader linking, moving data
+into the registry) and a byte budget (buffer uploads).
+Handles are returned right away in EMB_ASSET_LOADING state,
+poll them with emb_asset_get_state().
+
+The loader and the registry have one owner, the GL thread (the render
+thread while emb_renderer runs). Other threads don't call them, they
+fill an emb_asset_request and hand it over with emb_loader_request(),
+requests go through a second ring and are resolved in emb_loader_update().
+______________________________________*/
+#pragma once
+
+#include <SDL3/SDL.h>
+#include <glad/gl.h>
+#include <stdatomic.h>
+#include "assets.h"
+#include "utils/ring.h"
+#include "utils/vector.h"
+
+
+#define EMB_LOADER_MAX_JOBS 1024 //jobs in flight
+#define EMB_LOADER_MAX_WORKERS 8
+#define EMB_LOADER_MAX_REQUESTS 256 //requests from other threads not yet taken by the GL thread
+
+
+typedef struct{
+    emb_asset_type type;
+    emb_asset_handle asset;
+    char path[EMB_ASSET_KEY_MAX]; //model file or vertex shader
+    char path2[EMB_ASSET_KEY_MAX]; //fragment shader
+    uint32_t width; //textures
+    uint32_t height;
+    emb_materials * materials;
+    bool ok;
+
+    //staging memory, filled by the worker
+    emb_arena arena;
+    emb_primitive_origin * primitives;
+    uint32_t primitives_len;
+    char * vertex_source;
+    char * fragment_source;
+    emb_texture_data texture; //with mips
+} emb_load_job;
+
+
+//GPU buffer upload, split between frames
+typedef struct{
+    GLuint buffer;
+    size_t offset;
+    const uint8_t * data; //has to stay valid until the upload is done
+    size_t size;
+    size_t done;
+} emb_upload;
+
+EMB_VEC_DEFINE(emb_upload, vec_upload)
+
+typedef uint64_t emb_upload_ticket;
+
+
+typedef enum{
+    EMB_REQUEST_LOAD,
+    EMB_REQUEST_RELEASE,
+    EMB_REQUEST_UPLOAD,
+} emb_request_op;
+
+/*load, release or upload asked by a thread that doesn't own the registry.
+Filled by emb_asset_request_*(), the GL thread owns it from emb_loader_request()
+until emb_asset_request_done() returns true, then the results can be read.
+Must stay at the same address until then. A load holds a reference to
+the asset even if it failed, give it back with emb_asset_request_release().*/
+typedef struct{
+    emb_request_op op;
+    emb_asset_type type;
+    char path[EMB_ASSET_KEY_MAX]; //model file, texture or vertex shader
+    char path2[EMB_ASSET_KEY_MAX]; //fragment shader
+    emb_asset_settings settings;
+    uint32_t width; //textures
+    uint32_t height;
+    emb_materials * materials;
+    emb_upload upload;
+
+    //results, EMB_REQUEST_LOAD
+    emb_asset_handle asset; //also the input of EMB_REQUEST_RELEASE
+    emb_asset_state state;
+    emb_primitive_origin * primitives; //models, valid until the asset is released
+    uint32_t primitives_len;
+    GLuint prog; //shaders
+    emb_texture texture; //textures
+
+    emb_upload_ticket ticket;
+    _Atomic bool busy;
+} emb_asset_request;
+
+EMB_VEC_DEFINE(emb_asset_request*, vec_request)
+
+
+typedef struct{
+    emb_ring jobs; //GL thread -> workers
+    emb_ring done; //workers -> GL thread
+    emb_ring requests; //other threads -> GL thread
+    vec_request pending; //requests waiting for their job or upload
+    SDL_Semaphore * wake; //one signal per job
+    SDL_Thread * workers[EMB_LOADER_MAX_WORKERS];
+    uint32_t workers_len;
+    _Atomic bool quit;
+    uint32_t in_flight; //jobs not finished by the GL thread
+
+    vec_upload uploads; //FIFO, uploads.data[uploads_head..len)
+    uint32_t uploads_head;
+    emb_upload_ticket uploads_submitted;
+    emb_upload_ticket uploads_finished;
+} emb_loader;
+
+
+
+//__________________________________________________
+// worker side
+//__________________________________________________
+
+static void loader_run_job(emb_load_job * job){
+    job->arena = emb_arena_init(0);
+    job->primitives = NULL;
+    job->primitives_len = 0;
+
+    if(job->type == EMB_ASSET_SHADER){
+        job->vertex_source = read_shader_file(job->path,&job->arena.base);
+        job->fragment_source = read_shader_file(job->path2,&job->arena.base);
+        job->ok = job->vertex_source && job->fragment_source;
+        return;
+    }
+    if(job->type == EMB_ASSET_TEXTURE){
+        job->ok = emb_texture_load_raw(job->path,job->width,job->height,&job->arena.base,&job->texture);
+        return;
+    }
+
+    cgltf_data * data = _model_load_gltf(job->path);
+    if(!data) {job->ok = false; return;}
+
+    for(cgltf_size i=0; i<data->meshes_count; ++i) job->primitives_len += data->meshes[i].primitives_count;
+    job->primitives = (emb_primitive_origin*)calloc(job->primitives_len ? job->primitives_len : 1,sizeof(emb_primitive_origin));
+    uint32_t p = 0;
+    for(cgltf_size i=0; i<data->meshes_count; ++i)
+        for(cgltf_size j=0; j<data->meshes[i].primitives_count; ++j)
+            prim_load_primitive_cgltf(&job->primitives[p++],&data->meshes[i].primitives[j],&job->arena.base);
+    cgltf_free(data);
+    job->ok = true;
+}
+
+static int loader_worker(void * user){
+    emb_loader * l = (emb_loader*)user;
+    for(;;){
+        SDL_WaitSemaphore(l->wake);
+        if(atomic_load_explicit(&l->quit,memory_order_acquire)) return 0;
+
+        void * job;
+        if(!emb_ring_pop(&l->jobs,&job)) continue;
+        loader_run_job((emb_load_job*)job);
+        //can't fail, the ring is as big as the number of jobs in flight
+        emb_ring_push(&l->done,job);
+    }
+}
+
+
+
+//__________________________________________________
+// GL thread side
+//__________________________________________________
+
+emb_loader emb_loader_init(){
+    emb_loader l;
+    emb_ring_init(&l.jobs,EMB_LOADER_MAX_JOBS);
+    emb_ring_init(&l.done,EMB_LOADER_MAX_JOBS);
+    emb_ring_init(&l.requests,EMB_LOADER_MAX_REQUESTS);
+    vec_request_init(&l.pending,NULL);
+    l.wake = SDL_CreateSemaphore(0);
+    atomic_init(&l.quit,false);
+    l.in_flight = 0;
+    l.workers_len = 0;
+
+    vec_upload_init(&l.uploads,NULL);
+    l.uploads_head = 0;
+    l.uploads_submitted = 0;
+    l.uploads_finished = 0;
+    return l;
+}
+
+/*workers = 0 - one less than logical cores.
+Threads keep a pointer to the loader, so it must not move after this call*/
+void emb_loader_start(emb_loader * l, uint32_t workers){
+    if(workers == 0){
+        int cores = SDL_GetNumLogicalCPUCores();
+        workers = cores > 1 ? (uint32_t)cores-1 : 1;
+    }
+    if(workers > EMB_LOADER_MAX_WORKERS) workers = EMB_LOADER_MAX_WORKERS;
+    for(uint32_t i=l->workers_len; i<workers; ++i){
+        SDL_Thread * t = SDL_CreateThread(loader_worker,"emb_loader",l);
+        if(!t) {printf("ERROR emb_loader_start(): cannot create worker thread.\n"); break;}
+        l->workers[l->workers_len++] = t;
+    }
+}
+
+static bool loader_submit(emb_loader * l, emb_load_job * job){
+    if(l->in_flight >= EMB_LOADER_MAX_JOBS || !emb_ring_push(&l->jobs,job)){
+        printf("ERROR emb_loader: too many jobs in flight, %s is not loaded.\n",job->path);
+        free(job);
+        return false;
+    }
+    ++l->in_flight;
+    SDL_SignalSemaphore(l->wake);
+    return true;
+}
+
+//placeholder asset which is filled when the job is finished
+static emb_asset_handle loader_add_pending(emb_asset_registry * r, const char * key, emb_asset_type type, uint32_t flags){
+    emb_asset a;
+    memset(&a,0,sizeof(a));
+    a.type = type;
+    a.state = EMB_ASSET_LOADING;
+    a.flags = flags;
+    return asset_add(r,key,&a);
+}
+
+/*same as emb_asset_load_model, but returns immediately.
+Already loaded (or loading) keys return the existing handle.*/
+emb_asset_handle emb_loader_load_model(emb_loader * l, emb_asset_registry * r, const char * path, emb_asset_settings settings){
+    char key[EMB_ASSET_KEY_MAX];
+    asset_make_key(key,EMB_ASSET_MODEL,path,settings);
+    emb_asset_handle h = asset_find(r,key);
+    if(!EMB_HANDLE_IS_NULL(h)) return h;
+
+    h = loader_add_pending(r,key,EMB_ASSET_MODEL,settings.flags);
+    if(EMB_HANDLE_IS_NULL(h)) return h;
+
+    emb_load_job * job = (emb_load_job*)malloc(sizeof(emb_load_job));
+    job->type = EMB_ASSET_MODEL;
+    job->asset = h;
+    snprintf(job->path,sizeof(job->path),"%s",path);
+    if(!loader_submit(l,job)) emb_asset_get(r,h)->state = EMB_ASSET_FAILED;
+    return h;
+}
+
+//sources are read by a worker, compiled and linked in emb_loader_update
+emb_asset_handle emb_loader_load_shader(emb_loader * l, emb_asset_registry * r, const char * vertex_path, const char * fragment_path){
+    char path[EMB_ASSET_KEY_MAX];
+    char key[EMB_ASSET_KEY_MAX];
+    snprintf(path,sizeof(path),"%s|%s",vertex_path,fragment_path);
+    asset_make_key(key,EMB_ASSET_SHADER,path,(emb_asset_settings){0});
+    emb_asset_handle h = asset_find(r,key);
+    if(!EMB_HANDLE_IS_NULL(h)) return h;
+
+    h = loader_add_pending(r,key,EMB_ASSET_SHADER,0);
+    if(EMB_HANDLE_IS_NULL(h)) return h;
+
+    emb_load_job * job = (emb_load_job*)malloc(sizeof(emb_load_job));
+    job->type = EMB_ASSET_SHADER;
+    job->asset = h;
+    snprintf(job->path,sizeof(job->path),"%s",vertex_path);
+    snprintf(job->path2,sizeof(job->path2),"%s",fragment_path);
+    if(!loader_submit(l,job)) emb_asset_get(r,h)->state = EMB_ASSET_FAILED;
+    return h;
+}
+
+
+/*raw RGBA8 texture, mips are built by a worker, the GL thread only
+uploads them to a layer of the texture arrays of m*/
+emb_asset_handle emb_loader_load_texture(emb_loader * l, emb_asset_registry * r, emb_materials * m, const char * path, uint32_t width, uint32_t height){
+    char key[EMB_ASSET_KEY_MAX];
+    asset_make_key(key,EMB_ASSET_TEXTURE,path,(emb_asset_settings){0});
+    emb_asset_handle h = asset_find(r,key);
+    if(!EMB_HANDLE_IS_NULL(h)) return h;
+
+    h = loader_add_pending(r,key,EMB_ASSET_TEXTURE,0);
+    if(EMB_HANDLE_IS_NULL(h)) return h;
+    emb_asset_get(r,h)->texture.ref = EMB_TEXTURE_NONE;
+
+    emb_load_job * job = (emb_load_job*)malloc(sizeof(emb_load_job));
+    job->type = EMB_ASSET_TEXTURE;
+    job->asset = h;
+    job->width = width;
+    job->height = height;
+    job->materials = m;
+    snprintf(job->path,sizeof(job->path),"%s",path);
+    if(!loader_submit(l,job)) emb_asset_get(r,h)->state = EMB_ASSET_FAILED;
+    return h;
+}
+
+
+/*copies data into the buffer (glNamedBufferSubData) a part per frame.
+The data must stay valid until emb_loader_upload_done() says so.*/
+emb_upload_ticket emb_loader_upload(emb_loader * l, GLuint buffer, size_t offset, const void * data, size_t size){
+    emb_upload u = {buffer, offset, (const uint8_t*)data, size, 0};
+    //drop finished uploads before the queue grows
+    if(l->uploads_head == l->uploads.len) {vec_upload_clear(&l->uploads); l->uploads_head = 0;}
+    vec_upload_push(&l->uploads,u);
+    return ++l->uploads_submitted;
+}
+
+static inline bool emb_loader_upload_done(const emb_loader * l, emb_upload_ticket t){
+    return t <= l->uploads_finished;
+}
+
+
+
+//__________________________________________________
+// requests from other threads
+//__________________________________________________
+
+static void loader_request_init(emb_asset_request * q, emb_request_op op, emb_asset_type type){
+    memset(q,0,sizeof(*q));
+    q->op = op;
+    q->type = type;
+    q->asset = EMB_HANDLE_NULL;
+    q->state = EMB_ASSET_LOADING;
+    q->texture = EMB_TEXTURE_NONE;
+    atomic_init(&q->busy,false);
+}
+
+void emb_asset_request_model(emb_asset_request * q, const char * path, emb_asset_settings settings){
+    loader_request_init(q,EMB_REQUEST_LOAD,EMB_ASSET_MODEL);
+    snprintf(q->path,sizeof(q->path),"%s",path);
+    q->settings = settings;
+}
+
+void emb_asset_request_shader(emb_asset_request * q, const char * vertex_path, const char * fragment_path){
+    loader_request_init(q,EMB_REQUEST_LOAD,EMB_ASSET_SHADER);
+    snprintf(q->path,sizeof(q->path),"%s",vertex_path);
+    snprintf(q->path2,sizeof(q->path2),"%s",fragment_path);
+}
+
+void emb_asset_request_texture(emb_asset_request * q, emb_materials * m, const char * path, uint32_t width, uint32_t height){
+    loader_request_init(q,EMB_REQUEST_LOAD,EMB_ASSET_TEXTURE);
+    snprintf(q->path,sizeof(q->path),"%s",path);
+    q->materials = m;
+    q->width = width;
+    q->height = height;
+}
+
+//drops the reference a finished load request got
+void emb_asset_request_release(emb_asset_request * q, emb_asset_handle h){
+    loader_request_init(q,EMB_REQUEST_RELEASE,EMB_ASSET_MODEL);
+    q->asset = h;
+}
+
+//data must stay valid until the request is done
+void emb_asset_request_upload(emb_asset_request * q, GLuint buffer, size_t offset, const void * data, size_t size){
+    loader_request_init(q,EMB_REQUEST_UPLOAD,EMB_ASSET_MODEL);
+    q->upload = (emb_upload){buffer, offset, (const uint8_t*)data, size, 0};
+}
+
+//any thread, false if the ring is full (the request is not taken, try again next frame)
+bool emb_loader_request(emb_loader * l, emb_asset_request * q){
+    atomic_store_explicit(&q->busy,true,memory_order_relaxed);
+    if(!emb_ring_push(&l->requests,q)){
+        atomic_store_explicit(&q->busy,false,memory_order_relaxed);
+        printf("ERROR emb_loader_request(): too many requests, %s is not queued.\n",q->path);
+        return false;
+    }
+    return true;
+}
+
+//results of the request are visible to the caller once this returns true
+static inline bool emb_asset_request_done(emb_asset_request * q){
+    return !atomic_load_explicit(&q->busy,memory_order_acquire);
+}
+
+static void loader_request_finish(emb_asset_request * q, emb_asset_state state){
+    q->state = state;
+    atomic_store_explicit(&q->busy,false,memory_order_release);
+}
+
+//starts the loads and uploads asked since the last update
+static void loader_take_requests(emb_loader * l, emb_asset_registry * r){
+    void * p;
+    while(emb_ring_pop(&l->requests,&p)){
+        emb_asset_request * q = (emb_asset_request*)p;
+        if(q->op == EMB_REQUEST_RELEASE){
+            emb_asset_release(r,q->asset);
+            loader_request_finish(q,EMB_ASSET_READY);
+            continue;
+        }
+        if(q->op == EMB_REQUEST_UPLOAD) q->ticket = emb_loader_upload(l,q->upload.buffer,q->upload.offset,q->upload.data,q->upload.size);
+        else if(q->type == EMB_ASSET_MODEL) q->asset = emb_loader_load_model(l,r,q->path,q->settings);
+        else if(q->type == EMB_ASSET_SHADER) q->asset = emb_loader_load_shader(l,r,q->path,q->path2);
+        else q->asset = emb_loader_load_texture(l,r,q->materials,q->path,q->width,q->height);
+        if(!vec_request_push(&l->pending,q)) loader_request_finish(q,EMB_ASSET_FAILED);
+    }
+}
+
+//copies results of finished assets and uploads into their requests
+static void loader_resolve_requests(emb_loader * l, emb_asset_registry * r){
+    for(size_t i=0; i<l->pending.len;){
+        emb_asset_request * q = l->pending.data[i];
+        emb_asset_state state = EMB_ASSET_READY;
+        if(q->op == EMB_REQUEST_UPLOAD){
+            if(!emb_loader_upload_done(l,q->ticket)) {++i; continue;}
+        }
+        else{
+            state = emb_asset_get_state(r,q->asset);
+            if(state == EMB_ASSET_LOADING) {++i; continue;}
+            if(q->type == EMB_ASSET_MODEL) q->primitives = emb_asset_model(r,q->asset,&q->primitives_len);
+            else if(q->type == EMB_ASSET_SHADER) q->prog = emb_asset_shader(r,q->asset);
+            else q->texture = emb_asset_texture(r,q->asset);
+        }
+        loader_request_finish(q,state);
+        vec_request_swap_remove(&l->pending,i);
+    }
+}
+
+
+//moves finished job into its asset, the result is dropped if the asset was unloaded meanwhile
+static void loader_finish_job(emb_asset_registry * r, emb_load_job * job){
+    emb_asset * a = emb_asset_get(r,job->asset);
+    if(!a){
+        for(uint32_t i=0; i<job->primitives_len; ++i) emb_primitive_origin_free(&job->primitives[i]);
+        emb_arena_free(&job->arena);
+        free(job->primitives);
+        return;
+    }
+    r->used -= a->cpu_bytes + a->gpu_bytes;
+
+    if(job->type == EMB_ASSET_MODEL){
+        a->model.primitives = job->primitives;
+        a->model.primitives_len = job->primitives_len;
+        a->model.arena = job->arena;
+        a->cpu_bytes = asset_model_cpu_bytes(a);
+        a->state = job->ok ? EMB_ASSET_READY : EMB_ASSET_FAILED;
+    }
+    else if(job->type == EMB_ASSET_TEXTURE){
+        a->state = EMB_ASSET_FAILED;
+        if(job->ok){
+            a->texture.materials = job->materials;
+            a->texture.ref = emb_textures_upload(job->materials,&job->texture);
+            a->gpu_bytes = job->texture.bytes;
+            if(a->texture.ref != EMB_TEXTURE_NONE) a->state = EMB_ASSET_READY;
+        }
+        emb_arena_free(&job->arena);
+    }
+    else{
+        a->state = EMB_ASSET_FAILED;
+        if(job->ok && shader_program_from_source(&a->shader.prog,job->vertex_source,job->fragment_source)){
+            GLint binary_len = 0;
+            glGetProgramiv(a->shader.prog,GL_PROGRAM_BINARY_LENGTH,&binary_len);
+            a->gpu_bytes = (size_t)binary_len;
+            a->state = EMB_ASSET_READY;
+        }
+        emb_arena_free(&job->arena);
+    }
+    if(a->state == EMB_ASSET_FAILED) printf("ERROR emb_loader: cannot load %s\n",job->path);
+
+    r->used += a->cpu_bytes + a->gpu_bytes;
+    emb_asset_registry_trim(r);
+}
+
+/*once per frame on the GL thread, also takes and resolves requests.
+time_budget_ns - for finishing jobs, at least one job is finished per call
+byte_budget - for buffer uploads*/
+void emb_loader_update(emb_loader * l, emb_asset_registry * r, uint64_t time_budget_ns, size_t byte_budget){
+    uint64_t start = SDL_GetTicksNS();
+    loader_take_requests(l,r);
+
+    void * job;
+    while(emb_ring_pop(&l->done,&job)){
+        loader_finish_job(r,(emb_load_job*)job);
+        free(job);
+        --l->in_flight;
+        if(SDL_GetTicksNS() - start >= time_budget_ns) break;
+    }
+
+    while(byte_budget && l->uploads_head < l->uploads.len){
+        emb_upload * u = &l->uploads.data[l->uploads_head];
+        size_t n = u->size - u->done;
+        if(n > byte_budget) n = byte_budget;
+        glNamedBufferSubData(u->buffer,u->offset+u->done,n,u->data+u->done);
+        u->done += n;
+        byte_budget -= n;
+        if(u->done == u->size) {++l->uploads_head; ++l->uploads_finished;}
+    }
+    loader_resolve_requests(l,r);
+}
+
+//stops the workers, unfinished jobs are dropped
+void emb_loader_free(emb_loader * l){
+    atomic_store_explicit(&l->quit,true,memory_order_release);
+    for(uint32_t i=0; i<l->workers_len; ++i) SDL_SignalSemaphore(l->wake);
+    for(uint32_t i=0; i<l->workers_len; ++i) SDL_WaitThread(l->workers[i],NULL);
+    l->workers_len = 0;
+
+    void * job;
+    while(emb_ring_pop(&l->jobs,&job)) free(job);
+    while(emb_ring_pop(&l->done,&job)){
+        emb_load_job * j = (emb_load_job*)job;
+        for(uint32_t i=0; i<j->primitives_len; ++i) emb_primitive_origin_free(&j->primitives[i]);
+        emb_arena_free(&j->arena);
+        free(j->primitives);
+        free(j);
+    }
+    l->in_flight = 0;
+
+    //nobody resolves them anymore
+    while(emb_ring_pop(&l->requests,&job)) loader_request_finish((emb_asset_request*)job,EMB_ASSET_FAILED);
+    for(size_t i=0; i<l->pending.len; ++i) loader_request_finish(l->pending.data[i],EMB_ASSET_FAILED);
+
+    emb_ring_free(&l->jobs);
+    emb_ring_free(&l->done);
+    emb_ring_free(&l->requests);
+    vec_request_free(&l->pending);
+    SDL_DestroySemaphore(l->wake);
+    vec_upload_free(&l->uploads);
+}
@@ -8,21 +8,68 @@
 
 
 #include "utils/vector.h"
+#include "utils/allocator.h"
 #include "utils/shader_reader.h"
 #include "bhandler.h"
+#include "assets.h"
+#include "loader.h"
 
 #include "model/camera.h"
 #include "model/node.h"
+#include "model/light.h"
+#include "model/material.h"
+#include "model/animation.h"
+#include "utils/profiler.h"
+#include "utils/frameloop.h"
+#include "render.h"
+#include "oit.h"
+#include "overdraw.h"
+#include "dynres.h"
+#include "snapshot.h"
+#include "replay.h"
 
 #include "input.c"
 #include "app.c"
 
 
+#define SCENE_SNAPSHOT "scene.snap"
+#define CAMERA_KEY_SPACING 0.25f //seconds between recorded flythrough keys
+#define MEMORY_PRINT_FRAMES 600 //EMB_MEMORY dump interval
 #define WIDTH 1024
 #define HEIGHT 1024
+#define DYNRES_MIN_SCALE 0.5f //default bounds of --dynres, relative to the window
+#define DYNRES_MAX_SCALE 1.0f
+#define SCENE_VB_FLOATS 2000024 //capacity of the scene vertex buffer
 
 float MOUSE_DEBUG_SENS = 0.01f;
 
+//loader work needs the GL context, so it runs on the render thread (which then owns the registry)
+typedef struct{
+    emb_loader * loader;
+    emb_asset_registry * assets;
+} loader_frame;
+
+static void loader_frame_update(void * user){
+    loader_frame * lf = (loader_frame*)user;
+    emb_loader_update(lf->loader,lf->assets,2000000,4u*1024*1024); //2ms, 4MB per frame
+}
+
+
+//whole instance, palette - first matrix of its skin this frame, EMB_SKIN_NONE - bind pose
+static void batch_add_whole(emb_draw_batch * b, emb_primitive * inst, mat4 model, uint32_t palette){
+    if(palette != EMB_SKIN_NONE) emb_draw_batch_add_skinned(b,model,inst->material,&inst->geometry,palette);
+    else emb_draw_batch_add(b,model,inst->material,&inst->geometry,NULL,0);
+}
+
+//meshlets outside the frustum or facing away are not submitted
+static void batch_add_visible(emb_draw_batch * b, emb_primitive * inst, mat4 model, uint32_t palette, vec4 * planes, vec3 cam_pos, emb_frame_allocator * scratch){
+    emb_primitive_origin * origin = inst->primitive;
+    //meshlet bounds are in bind pose, skinned vertices move out of them
+    if(!origin->meshlets_len || origin->skinned) {batch_add_whole(b,inst,model,palette); return;}
+    emb_draw_range * ranges = (emb_draw_range*)emb_frame_alloc(scratch,origin->meshlets_len*sizeof(emb_draw_range));
+    uint32_t n = emb_meshlets_cull(origin->meshlets,origin->meshlets_len,model,planes,cam_pos,ranges);
+    emb_draw_batch_add(b,model,inst->material,&inst->geometry,ranges,n);
+}
 
 
 float ISOF_SCALE = 0.4f;
@@ -42,13 +89,54 @@ bool isof(float x, float y, float z){
 
 
 
-int main() {
+/*usage: ember [--record file] [--replay file] [--fixed-dt]
+                [--path-record file] [--flythrough file] [--frames N] [--headless]
+                [--prepass] [--overdraw] [--dynres ms] [--dynres-min s] [--dynres-max s] [--fps N]
+--fixed-dt - every frame is one simulation step long, with --replay or
+--flythrough the run is the same on every machine and every commit.
+--headless - no visible window (SDL offscreen driver), for perf runs.
+--prepass - depth-only pass before the opaque colour pass (F2 toggles it).
+--overdraw - prints shaded fragments per pixel of the opaque pass (F3 toggles it).
+--dynres - scales the render resolution to keep the GPU time of the scene
+under ms, between --dynres-min and --dynres-max times the window size.
+--fps - caps the frame rate, the game thread sleeps before sampling input.*/
+int main(int argc, char ** argv) {
+    const char * record_path = NULL;
+    const char * replay_path = NULL;
+    const char * path_record_path = NULL;
+    const char * flythrough_path = NULL;
+    bool fixed_dt = false, headless = false, prepass = false, overdraw_on = false;
+    uint64_t max_frames = 0; //0 - until the window is closed
+    uint32_t target_fps = 0; //0 - no cap
+    float dynres_ms = 0.0f, dynres_min = DYNRES_MIN_SCALE, dynres_max = DYNRES_MAX_SCALE;
+    for(int i=1; i<argc; ++i){
+        bool has_value = i+1 < argc;
+        if(!strcmp(argv[i],"--record") && has_value) record_path = argv[++i];
+        else if(!strcmp(argv[i],"--replay") && has_value) replay_path = argv[++i];
+        else if(!strcmp(argv[i],"--path-record") && has_value) path_record_path = argv[++i];
+        else if(!strcmp(argv[i],"--flythrough") && has_value) flythrough_path = argv[++i];
+        else if(!strcmp(argv[i],"--frames") && has_value) max_frames = (uint64_t)atoll(argv[++i]);
+        else if(!strcmp(argv[i],"--fps") && has_value) target_fps = (uint32_t)atoi(argv[++i]);
+        else if(!strcmp(argv[i],"--dynres") && has_value) dynres_ms = (float)atof(argv[++i]);
+        else if(!strcmp(argv[i],"--dynres-min") && has_value) dynres_min = (float)atof(argv[++i]);
+        else if(!strcmp(argv[i],"--dynres-max") && has_value) dynres_max = (float)atof(argv[++i]);
+        else if(!strcmp(argv[i],"--fixed-dt")) fixed_dt = true;
+        else if(!strcmp(argv[i],"--headless")) headless = true;
+        else if(!strcmp(argv[i],"--prepass")) prepass = true;
+        else if(!strcmp(argv[i],"--overdraw")) overdraw_on = true;
+        else {printf("unknown argument: %s\n",argv[i]); return EXIT_FAILURE;}
+    }
+
+    if(record_path && replay_path) {printf("--record and --replay can't be used together\n"); return EXIT_FAILURE;}
+    if(dynres_min <= 0.0f || dynres_max <= 0.0f) {printf("--dynres-min and --dynres-max have to be positive\n"); return EXIT_FAILURE;}
+
+    if(headless) SDL_SetHint(SDL_HINT_VIDEO_DRIVER,"offscreen");
     SDL_Init(SDL_INIT_VIDEO);
     //__________________________________________________
     // CREATE WINDOW
     //__________________________________________________
     SDL_Window* window = SDL_CreateWindow("ember", WIDTH, HEIGHT,
-        SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE
+        SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | (headless ? SDL_WINDOW_HIDDEN : 0)
     );
     if(window==NULL) return EXIT_FAILURE;
 
@@ -62,10 +150,15 @@ int main() {
     //__________________________________________________
     // vertex buffer and element buffer
     //__________________________________________________
-    GLuint vbo, ebo, vao;
-    emb_ebvb_handler batch = emb_ebvb_handler_init(2000024, &vbo, 2000024, &ebo);
+    GLuint vbo, ebo, vao, skin_vbo, pos_vbo, depth_vao;
+    //origins over 65536 vertices keep 4-byte indices, the element buffer is sized for the worst case
+    emb_ebvb_handler batch = emb_ebvb_handler_init(SCENE_VB_FLOATS, &vbo, SCENE_VB_FLOATS*sizeof(uint32_t), &ebo);
     glCreateBuffers(1,&vbo);
     glCreateBuffers(1,&ebo);
+    glCreateBuffers(1,&skin_vbo);
+    glCreateBuffers(1,&pos_vbo);
+    batch.skin_vbo = &skin_vbo;
+    batch.pos_vbo = &pos_vbo;
 
     //__________________________________________________
     // add the debug figures
@@ -73,15 +166,33 @@ int main() {
 
     emb_primitive_origin color_rect = emb_debug_rainbow_cube();
     emb_primitive_origin white_cube = emb_white_cube();
-
-
-    emb_primitive* pr0 = emb_ebvb_handler_instantiate(&batch,&white_cube);
-    emb_primitive* pr1 = emb_ebvb_handler_instantiate(&batch,&color_rect);
+    //imported primitives get meshlets on load, hand-made ones need it explicitly
+    emb_primitive_origin_build_meshlets(&color_rect);
+    emb_primitive_origin_build_meshlets(&white_cube);
+    //skinned instances are drawn whole, no meshlets
+    emb_primitive_origin twist_cube = emb_debug_skinned_cube();
+
+    //materials are indexed per draw, different materials still share one multi-draw
+    emb_materials materials;
+    emb_materials_init(&materials);
+    emb_material warm = emb_material_color(1.0f,0.8f,0.6f,1.0f);
+    warm.flags = EMB_MATERIAL_VERTEX_COLOR;
+    white_cube.material = emb_material_add(&materials,&warm);
+    //transparent instances go through the weighted blended pass, no sorting
+    emb_material glass = emb_material_color(0.6f,0.8f,1.0f,0.35f);
+    glass.flags = EMB_MATERIAL_VERTEX_COLOR | EMB_MATERIAL_TRANSPARENT;
+    uint32_t glass_material = emb_material_add(&materials,&glass);
+
+
+    emb_primitive_handle pr0_handle = emb_ebvb_handler_instantiate(&batch,&white_cube);
+    emb_primitive_handle pr1_handle = emb_ebvb_handler_instantiate(&batch,&color_rect);
+    emb_primitive_handle pr2_handle = emb_ebvb_handler_instantiate(&batch,&color_rect);
+    emb_primitive_handle twist_handle = emb_ebvb_handler_instantiate(&batch,&twist_cube);
 
     
     /*create new node pool - can be 1 or more*/
     emb_node_pool nodepool;
-    emb_node_pool_init(&nodepool,1024);
+    emb_node_pool_init(&nodepool,1024,NULL);
     emb_node* n = emb_node_pool_push(&nodepool);
 
     /*apply some transformations to the node*/
@@ -91,16 +202,48 @@ int main() {
     n->scale[2] = 0.75f;
     
    
+    emb_primitive * pr0 = emb_ebvb_handler_get(&batch,pr0_handle);
     pr0->scale[0]=0.25f;
     pr0->scale[1]=0.25f;
     pr0->scale[2]=0.25f;
     pr0->rot[0]=0.25f;
     pr0->pos[0]=1.75f;
-    pr0->parent = n;
+    prim_inst_set_parent(pr0,n);
     
+    emb_primitive * pr1 = emb_ebvb_handler_get(&batch,pr1_handle);
     pr1->rot[1]=-0.25f;
     pr1->scale[1]=0.1f;
-    pr1->parent = n;
+    prim_inst_set_parent(pr1,n);
+
+    emb_primitive * pr2 = emb_ebvb_handler_get(&batch,pr2_handle);
+    pr2->material = glass_material;
+    pr2->pos[2] = 0.6f;
+    pr2->scale[0] = 0.5f;
+    pr2->scale[1] = 0.5f;
+    pr2->scale[2] = 0.5f;
+    prim_inst_set_parent(pr2,n);
+
+    emb_primitive * twist = emb_ebvb_handler_get(&batch,twist_handle);
+    twist->pos[0] = -1.75f;
+    twist->scale[0] = 0.25f;
+    twist->scale[1] = 0.25f;
+    twist->scale[2] = 0.25f;
+
+    /*skeleton of the skinned cube: two joints in glTF form go through the same
+    loaders as a file, the top joint twists in the simulation*/
+    cgltf_node twist_gltf_nodes[2] = {
+        {.rotation = {0.0f,0.0f,0.0f,1.0f}, .scale = {1.0f,1.0f,1.0f}},
+        {.rotation = {0.0f,0.0f,0.0f,1.0f}, .scale = {1.0f,1.0f,1.0f}, .parent = &twist_gltf_nodes[0]},
+    };
+    cgltf_node * twist_gltf_joints[2] = {&twist_gltf_nodes[0],&twist_gltf_nodes[1]};
+    cgltf_skin twist_gltf_skin = {.joints = twist_gltf_joints, .joints_count = 2};
+    cgltf_data twist_gltf = {.nodes = twist_gltf_nodes, .nodes_count = 2, .skins = &twist_gltf_skin, .skins_count = 1};
+    emb_node * twist_joints[2]; //per glTF node, as emb_skin_palettes_add takes them
+    emb_skin twist_skin;
+    if(!emb_nodes_load_cgltf(&nodepool,&twist_gltf,twist_joints)
+        || !emb_skin_load_cgltf(&twist_skin,&twist_gltf,&twist_gltf_skin,&twist_cube,1,NULL)) return EXIT_FAILURE;
+    prim_inst_set_skin(twist,&twist_skin,twist_joints);
+    float twist_time = 0.0f;
 
 
     emb_node* multinode = emb_node_pool_push(&nodepool);
@@ -110,14 +253,15 @@ int main() {
 
     //adding objects in a loop (testing)
     /*for(uint16_t i = 0; i < 1000; ++i){
-        emb_primitive* pri;
-        if(rand() % 100 > 50) pri = emb_ebvb_handler_instantiate(&batch,&color_rect);
-        else pri = emb_ebvb_handler_instantiate(&batch,&white_cube);
+        emb_primitive_handle h;
+        if(rand() % 100 > 50) h = emb_ebvb_handler_instantiate(&batch,&color_rect);
+        else h = emb_ebvb_handler_instantiate(&batch,&white_cube);
+        emb_primitive* pri = emb_ebvb_handler_get(&batch,h);
 
         pri->pos[0] = rand()%256 - 128;
         pri->pos[1] = rand()%256 - 128;
         pri->pos[2] = rand()%256 - 128;
-        pri->parent=multinode;
+        prim_inst_set_parent(pri,multinode);
     }*/
     
     
@@ -128,18 +272,30 @@ int main() {
                 if(!isof(i,j,k)) continue;
 
 
-                emb_primitive* pri = emb_ebvb_handler_instantiate(&batch,&white_cube);
+                emb_primitive* pri = emb_ebvb_handler_get(&batch,emb_ebvb_handler_instantiate(&batch,&white_cube));
                 pri->pos[0] = i;
                 pri->pos[1] = j;
                 pri->pos[2] = k;
-                pri->parent=multinode;
+                prim_inst_set_parent(pri,multinode);
             }
         }
     }*/
     
 
+    //origins of every instance, a snapshot stores indices into this table
+    emb_primitive_origin * scene_origins[] = {&color_rect,&white_cube,&twist_cube};
+    uint32_t scene_origins_len = sizeof(scene_origins)/sizeof(scene_origins[0]);
+
     glNamedBufferStorage(vbo,batch.vb_capacity*sizeof(float),batch.vb_data,GL_DYNAMIC_STORAGE_BIT);
-    glNamedBufferStorage(ebo,batch.eb_capacity*sizeof(__uint32_t),batch.eb_data,GL_DYNAMIC_STORAGE_BIT);
+    glNamedBufferStorage(ebo,batch.eb_capacity,batch.eb_data,GL_DYNAMIC_STORAGE_BIT);
+    EMB_MEM_GPU_SET(EMB_GPU_BUFFER,vbo,"batch vbo",batch.vb_capacity*sizeof(float));
+    EMB_MEM_GPU_SET(EMB_GPU_BUFFER,ebo,"batch ebo",batch.eb_capacity);
+    size_t skin_bytes = batch.vb_capacity/VB_ATTRIB_SIZE_MAX*sizeof(emb_skin_vertex);
+    glNamedBufferStorage(skin_vbo,skin_bytes,batch.skin_data,GL_DYNAMIC_STORAGE_BIT);
+    EMB_MEM_GPU_SET(EMB_GPU_BUFFER,skin_vbo,"batch skin vbo",skin_bytes);
+    size_t pos_bytes = batch.vb_capacity/VB_ATTRIB_SIZE_MAX*VB_ATTRIB_POS_SIZE*sizeof(float);
+    glNamedBufferStorage(pos_vbo,pos_bytes,batch.pos_data,GL_DYNAMIC_STORAGE_BIT);
+    EMB_MEM_GPU_SET(EMB_GPU_BUFFER,pos_vbo,"batch position vbo",pos_bytes);
 
 
 
@@ -162,6 +318,8 @@ int main() {
     // VAO
     //__________________________________________________
     emb_setup_buffers(&vao,0,vbo,ebo);
+    emb_setup_skin_buffer(vao,1,skin_vbo);
+    emb_setup_depth_buffers(&depth_vao,pos_vbo,skin_vbo,ebo); //depth pre-pass reads 12 bytes per vertex
     GLuint attrib_pos = 0;
     GLuint attrib_clr = 1;
     glBindVertexArray(vao);
@@ -169,32 +327,73 @@ int main() {
     //__________________________________________________
     // shaders
     //__________________________________________________
-    GLuint shader_prog;
-
-    //reading source
-    char * vertex_source = read_shader_file("shaders/vertex.glsl");
-    char * fragment_source = read_shader_file("shaders/fragment.glsl");
-    
-       
-
-    if(!shader_program_from_source(&shader_prog, vertex_source, fragment_source)){
+    //every file is loaded once, unused assets are unloaded above the budget
+    emb_asset_registry assets = emb_asset_registry_init(512u*1024*1024);
+    emb_asset_handle shader_asset = emb_asset_load_shader(&assets,"shaders/vertex.glsl","shaders/fragment.glsl");
+    GLuint shader_prog = emb_asset_shader(&assets,shader_asset);
+    if(!shader_prog){
         printf("ERROR: no shader program.\n");
         return EXIT_FAILURE;
     }
+    emb_asset_handle composite_asset = emb_asset_load_shader(&assets,"shaders/fullscreen.glsl","shaders/oit_composite.glsl");
+    GLuint composite_prog = emb_asset_shader(&assets,composite_asset);
+    if(!composite_prog){
+        printf("ERROR: no transparency composite program.\n");
+        return EXIT_FAILURE;
+    }
+    emb_asset_handle depth_asset = emb_asset_load_shader(&assets,"shaders/depth_vertex.glsl","shaders/depth_fragment.glsl");
+    GLuint depth_prog = emb_asset_shader(&assets,depth_asset);
+    if(!depth_prog){
+        printf("ERROR: no depth pre-pass program.\n");
+        return EXIT_FAILURE;
+    }
+    //runtime loads go through the loader, so they don't stall the frame.
+    //once the render thread runs, it owns the loader and the registry, this thread only sends emb_asset_request
+    emb_loader loader = emb_loader_init();
+    emb_loader_start(&loader,0);
     SDL_SetHint(SDL_HINT_RENDER_VSYNC, "1");
     glUseProgram(shader_prog);
 
-    mat4 model;
-    GLuint model_uniform_loc = glGetUniformLocation(shader_prog,"model");
-    
+    //uniforms are set by name from the command list
     mat4 view;
-    GLuint view_uniform_loc = glGetUniformLocation(shader_prog,"view");
-
     mat4 proj;
-    GLuint proj_uniform_loc = glGetUniformLocation(shader_prog,"proj");
-    
     vec3 light_dir; light_dir[0]=0.0f; light_dir[1]=-1.0f; light_dir[2] = 0.0f;
-    GLuint light_dir_uniform_loc = glGetUniformLocation(shader_prog,"light_dir");
+
+    //__________________________________________________
+    // clustered point lights
+    //__________________________________________________
+    emb_clusters clusters;
+    emb_clusters_init(&clusters,4);
+    emb_clusters_gl_init(&clusters);
+    emb_materials_gl_init(&materials);
+
+    //joint matrices of skinned instances, refilled every frame
+    emb_skin_palettes palettes;
+    if(!emb_skin_palettes_init(&palettes)) return EXIT_FAILURE;
+    emb_skin_palettes_gl_init(&palettes);
+
+    //the scene is drawn offscreen, transparency shares its depth.
+    //targets have the largest render size, dynres only moves the viewport
+    emb_dynres dynres;
+    emb_dynres_init(&dynres,WIDTH,HEIGHT,dynres_min,dynres_max,dynres_ms);
+    emb_render_target scene;
+    emb_oit oit;
+    if(!emb_render_target_init(&scene,dynres.max_width,dynres.max_height) || !emb_oit_init(&oit,&scene)) return EXIT_FAILURE;
+    emb_overdraw overdraw;
+    emb_overdraw_init(&overdraw);
+
+    #define DEMO_LIGHTS 64
+    emb_light lights[DEMO_LIGHTS];
+    for(uint32_t i=0; i<DEMO_LIGHTS; ++i){
+        emb_light * l = &lights[i];
+        memset(l,0,sizeof(*l));
+        l->type = EMB_LIGHT_POINT;
+        l->radius = 2.0f;
+        l->intensity = 1.5f;
+        l->color[0] = (float)(rand()%100)*0.01f;
+        l->color[1] = (float)(rand()%100)*0.01f;
+        l->color[2] = (float)(rand()%100)*0.01f;
+    }
 
     //__________________________________________________
     // creating the camera
@@ -206,85 +405,246 @@ int main() {
     //__________________________________________________
     // main loop
     //__________________________________________________
-    uint32_t prev_tick = SDL_GetTicks();
+    //simulation runs at fixed 60 steps per second, rendering interpolates between steps
+    emb_frame_loop loop = emb_frame_loop_init(60);
+    vec3 prev_cam_pos;
+    glm_vec3_copy(cam.pos,prev_cam_pos);
+    camera render_cam = cam;
+
+    //input comes from SDL, a recording, or a camera path
+    emb_input input = emb_input_init();
+    if(fixed_dt) input.fixed_ns = loop.step_ns;
+    if(replay_path && !emb_input_replay(&input,replay_path)) return EXIT_FAILURE;
+    if(record_path && !emb_input_record(&input,record_path)) return EXIT_FAILURE;
+    emb_camera_path camera_path;
+    emb_camera_path_init(&camera_path);
+    if(flythrough_path && !emb_camera_path_load(&camera_path,flythrough_path)) return EXIT_FAILURE;
+    emb_run_stats run_stats;
+    emb_run_stats_init(&run_stats);
     
     glEnable(GL_CULL_FACE); glCullFace(GL_BACK);
     glEnable(GL_DEPTH_TEST); 
 
     //SDL_SetWindowRelativeMouseMode(window,true);
 
+    //GL context moves to the render thread, this thread only records commands
+    loader_frame loader_ctx = {&loader,&assets};
+    emb_renderer renderer;
+    if(!emb_renderer_start(&renderer,window,gl_context,2,target_fps)) return EXIT_FAILURE; //2 frames in flight
+
+    uint64_t frame_count = 0;
+    emb_frame_allocator frame_scratch = emb_frame_allocator_init(256*1024);
+    emb_draw_batch draw_batch;
+    emb_draw_batch transparent_batch;
+    emb_draw_batch sorted_batch;
+    emb_draw_batch_init(&draw_batch);
+    emb_draw_batch_init(&transparent_batch);
+    emb_draw_batch_init(&sorted_batch);
+
     while(true){
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        EMB_PROFILE_BEGIN("frame");
+        //blocks on the GPU (frames in flight) and sleeps to --fps here, before input is sampled
+        emb_renderer_begin(&renderer);
+        emb_frame_allocator_reset(&frame_scratch);
+        emb_skin_palettes_reset(&palettes);
+        emb_cmd_list * cl = emb_renderer_list(&renderer);
         //__________________________________________________
-        // delta time
+        // frame time
         //__________________________________________________
-        uint32_t current_tick = SDL_GetTicks();
-        float delta_time = ((float)current_tick-(float)prev_tick)*0.001f;
-        prev_tick = current_tick;
-        //printf("fps: %f\n",1.0f/delta_time);
+        uint64_t real_ns = emb_frame_loop_elapsed(&loop);
+        if(frame_count) emb_run_stats_add(&run_stats,real_ns);
+        if(max_frames && frame_count >= max_frames) {EMB_PROFILE_END(); goto break_main_loop;}
+
+        EMB_PROFILE_BEGIN("input");
+        SDL_Event event;
+        while (SDL_PollEvent(&event))
+        {
+            if(event.type == SDL_EVENT_QUIT) {EMB_PROFILE_END(); EMB_PROFILE_END(); goto break_main_loop;}
+        }
+        //the frame reads input only from here, so a replay follows the same path
+        if(!emb_input_next(&input,real_ns)) {EMB_PROFILE_END(); EMB_PROFILE_END(); goto break_main_loop;}
+        uint32_t sim_steps = emb_frame_loop_advance(&loop,input.frame.frame_ns);
+        //printf("fps: %f\n",1.0f/loop.frame_dt);
 
         //__________________________________________________
         // mouse control
         //__________________________________________________
-        mousedx = 0.0f; mousedy = 0.0f;
-        uint32_t mouse_state = emb_mouse_delta(&mousedx,&mousedy);
-        mousedx*=EMB_INPUT_TICKLEN; mousedy*=EMB_INPUT_TICKLEN;
-        //printf("mouse: dx=%f, dy=%f\n",mousedx, mousedy);
-        if(mouse_state){
+        mousedx = input.frame.mouse_dx*EMB_INPUT_TICKLEN;
+        mousedy = input.frame.mouse_dy*EMB_INPUT_TICKLEN;
+        if(input.frame.mouse_buttons){
             cam.rot[0] = glm_clamp(cam.rot[0]+mousedy*0.4f,-1.4f,1.4f);
             cam.rot[1] += mousedx*0.4f;
         }
-        
 
-
-
-        SDL_Event event;
-        while (SDL_PollEvent(&event))
-        {
-            if(event.type == SDL_EVENT_QUIT) goto break_main_loop;
+        //restore point: F5 saves the scene, F9 brings it back (nodes and handles stay valid)
+        if(emb_input_pressed(&input,SDL_SCANCODE_F5))
+            emb_snapshot_save(SCENE_SNAPSHOT,&nodepool,&batch,scene_origins,scene_origins_len);
+        if(emb_input_pressed(&input,SDL_SCANCODE_F9)
+            && emb_snapshot_load(SCENE_SNAPSHOT,&nodepool,&batch,scene_origins,scene_origins_len,materials.materials_len)){
+            emb_cmd_ebvb_handler_upload(cl,&batch);
+            emb_primitive * t = emb_ebvb_handler_get(&batch,twist_handle); //skins aren't saved
+            if(t && t->primitive == &twist_cube) prim_inst_set_skin(t,&twist_skin,twist_joints);
         }
-        
-       
+        if(emb_input_pressed(&input,SDL_SCANCODE_F2)) {prepass = !prepass; printf("depth pre-pass %s\n",prepass ? "on" : "off");}
+        if(emb_input_pressed(&input,SDL_SCANCODE_F3)) overdraw_on = !overdraw_on;
+        EMB_PROFILE_END();
+
+        emb_cmd_callback(cl,loader_frame_update,&loader_ctx);
 
         glm_perspective(cam.fov,(float)WIDTH/(float)HEIGHT,0.1f,10000.0f,proj);
 
-        emb_get_keyboard_movement(movement_dir);
+        emb_input_movement(&input,movement_dir);
 
         movement_dir[0]*=10.0f;
         movement_dir[1]*=10.0f;
         movement_dir[2]*=10.0f;
 
         glm_vec3_rotate(movement_dir,cam.rot[1],(vec3){0,1,0});
-        glm_vec3_scale(movement_dir,delta_time,movement_dir);
+        glm_vec3_scale(movement_dir,loop.step_dt,movement_dir);
 
-        glm_vec3_add(cam.pos,movement_dir,cam.pos);
+        //__________________________________________________
+        // simulation, fixed steps
+        //__________________________________________________
+        EMB_PROFILE_BEGIN("simulation");
+        for(uint32_t step = 0; step<sim_steps; ++step){
+            emb_node_pool_save_state(&nodepool);
+            glm_vec3_copy(cam.pos,prev_cam_pos);
+
+            glm_vec3_add(cam.pos,movement_dir,cam.pos);
+            multinode->rot[1]+=loop.step_dt*0.1f;
+            twist_time += loop.step_dt;
+            twist_joints[1]->rot[1] = sinf(twist_time)*0.8f;
+        }
+        EMB_PROFILE_END();
+
+        //camera rotation follows the mouse every frame, position is interpolated
+        render_cam = cam;
+        glm_vec3_lerp(prev_cam_pos,cam.pos,loop.alpha,render_cam.pos);
+        float path_time = (float)emb_frame_loop_render_time(&loop);
+        if(path_record_path && (!camera_path.keys.len || path_time >= emb_camera_path_duration(&camera_path) + CAMERA_KEY_SPACING))
+            emb_camera_path_add(&camera_path,path_time,&render_cam);
+        if(flythrough_path){
+            if(path_time > emb_camera_path_duration(&camera_path)) {EMB_PROFILE_END(); goto break_main_loop;}
+            emb_camera_path_sample(&camera_path,path_time,&render_cam);
+            cam.rot[0] = render_cam.rot[0]; cam.rot[1] = render_cam.rot[1]; cam.rot[2] = render_cam.rot[2];
+        }
 
-        glClearColor(0.0f,0.0f,0.0f,0.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
-        multinode->rot[1]+=delta_time*0.1f;
+        //render size of this frame, from the GPU time of earlier ones
+        emb_dynres_update(&dynres);
+        emb_cmd_dynres_begin(cl,&dynres);
+        emb_cmd_target(cl,scene.fbo,dynres.width,dynres.height);
+        emb_cmd_clear(cl,0.0f,0.0f,0.0f,0.0f,EMB_CLEAR_COLOR | EMB_CLEAR_DEPTH);
+        emb_cmd_state(cl,EMB_STATE_DEPTH_TEST | EMB_STATE_CULL_BACK);
+        emb_cmd_program(cl,shader_prog);
+        emb_cmd_geometry(cl,vao);
         //__________________________________________________
         // rendering each emb_primitive
         //__________________________________________________
+        EMB_PROFILE_BEGIN("transforms");
+        //model matrices live only for this frame
+        mat4 * models = (mat4*)emb_frame_alloc(&frame_scratch,batch.primitives.len*sizeof(mat4));
+        bool * visible = (bool*)emb_frame_alloc(&frame_scratch,batch.primitives.len*sizeof(bool));
         for(uint32_t i = 0; i<batch.primitives.len; ++i){
-            emb_primitive * inst = VEC_GETPTR(&batch.primitives,emb_primitive,i);
-                                    
-            prim_inst_get_transform(inst,model);
-            camera_get_view(&cam,view);
-
-            glUniform3f(light_dir_uniform_loc,light_dir[0],light_dir[1],light_dir[2]);
-            glUniformMatrix4fv(proj_uniform_loc,1,GL_FALSE,(float*)proj);
-            glUniformMatrix4fv(model_uniform_loc,1,GL_FALSE,(float*)model);
-            glUniformMatrix4fv(view_uniform_loc,1,GL_FALSE,(float*)view);
-            void * eoffset = (void*)( (inst->eb_start - batch.eb_data) *sizeof(__uint32_t) );
-            
-
-            glDrawElements(
-                GL_TRIANGLES,
-                inst->eb_len, //in elements
-                GL_UNSIGNED_INT,
-                eoffset //in bytes??? what a hell is this actually.
-            );
+            emb_primitive * inst = &batch.primitives.values[i];
+            //ignored node hides its whole branch
+            emb_node * parent = prim_inst_parent(inst);
+            visible[i] = !parent || emb_node_active(parent);
+            if(visible[i]) prim_inst_get_transform_lerp(inst,loop.alpha,models[i]);
+        }
+        camera_get_view(&render_cam,view);
+        EMB_PROFILE_END();
+
+        EMB_PROFILE_BEGIN("lights");
+        //lights circle around the scene
+        float time = (float)emb_frame_loop_render_time(&loop);
+        for(uint32_t i=0; i<DEMO_LIGHTS; ++i){
+            float a = time*0.3f + (float)i*(6.2832f/DEMO_LIGHTS);
+            lights[i].pos[0] = cosf(a)*(2.0f + (float)(i%4));
+            lights[i].pos[1] = sinf(a*2.0f)*0.5f;
+            lights[i].pos[2] = sinf(a)*(2.0f + (float)(i%4));
+        }
+        emb_clusters_set_projection(&clusters,cam.fov,(float)WIDTH/(float)HEIGHT,0.1f,10000.0f);
+        emb_clusters_bin(&clusters,lights,DEMO_LIGHTS,view);
+        emb_cmd_clusters(cl,&clusters,lights,(float)dynres.width,(float)dynres.height);
+        EMB_PROFILE_END();
+
+        EMB_PROFILE_BEGIN("record");
+        emb_cmd_uniform(cl,"light_dir",light_dir,3);
+        emb_cmd_uniform_mat4(cl,"proj",proj);
+        emb_cmd_uniform_mat4(cl,"view",view);
+        emb_cmd_uniform_int(cl,"transparency",EMB_TRANSPARENCY_OPAQUE);
+        emb_cmd_materials(cl,&materials);
+        //palettes are added before the table is recorded, draw records point into it
+        uint32_t * palette = (uint32_t*)emb_frame_alloc(&frame_scratch,batch.primitives.len*sizeof(uint32_t));
+        for(uint32_t i = 0; i<batch.primitives.len; ++i){
+            emb_primitive * inst = &batch.primitives.values[i];
+            palette[i] = visible[i] && inst->skin ? emb_skin_palettes_add(&palettes,inst->skin,inst->joints,loop.alpha) : EMB_SKIN_NONE;
         }
+        emb_cmd_skin_palettes(cl,&palettes);
+
+        //meshlets outside the frustum or facing away are not submitted,
+        //the rest of every instance goes into one multi-draw (opaque and transparent)
+        mat4 viewproj;
+        vec4 planes[6];
+        glm_mat4_mul(proj,view,viewproj);
+        glm_frustum_planes(viewproj,planes);
+        emb_draw_batch_reset(&draw_batch);
+        emb_draw_batch_reset(&transparent_batch);
+        emb_draw_batch_reset(&sorted_batch);
+        emb_sort_key * sorted = (emb_sort_key*)emb_frame_alloc(&frame_scratch,batch.primitives.len*sizeof(emb_sort_key));
+        emb_sort_key * opaque = (emb_sort_key*)emb_frame_alloc(&frame_scratch,2*batch.primitives.len*sizeof(emb_sort_key));
+        emb_sort_key * opaque_order = opaque + batch.primitives.len;
+        uint32_t sorted_len = 0, opaque_len = 0;
+        for(uint32_t i = 0; i<batch.primitives.len; ++i){
+            if(!visible[i]) continue;
+            emb_primitive * inst = &batch.primitives.values[i];
+            uint32_t flags = materials.materials[inst->material].flags;
+            //distance along the view direction
+            float * t = models[i][3];
+            float depth = -(view[0][2]*t[0] + view[1][2]*t[1] + view[2][2]*t[2] + view[3][2]);
+            if(flags & EMB_MATERIAL_SORTED) {sorted[sorted_len++] = (emb_sort_key){depth, i}; continue;}
+            if(!(flags & EMB_MATERIAL_TRANSPARENT)) {opaque[opaque_len++] = (emb_sort_key){depth, i}; continue;}
+            batch_add_visible(&transparent_batch,inst,models[i],palette[i],planes,render_cam.pos,&frame_scratch);
+        }
+        //opaque front to back (coarse buckets), nearer surfaces fill the depth first
+        emb_sort_front_to_back(opaque,opaque_len,0.1f,opaque_order);
+        for(uint32_t k=0; k<opaque_len; ++k){
+            uint32_t i = opaque_order[k].index;
+            batch_add_visible(&draw_batch,&batch.primitives.values[i],models[i],palette[i],planes,render_cam.pos,&frame_scratch);
+        }
+
+        if(draw_batch.records.len){
+            //depth first from positions only, then every pixel is shaded once
+            if(prepass){
+                emb_cmd_prepass_begin(cl,depth_prog,depth_vao,proj,view);
+                emb_cmd_draw_batch(cl,&draw_batch);
+                emb_cmd_prepass_end(cl,shader_prog,vao);
+            }
+            if(overdraw_on) emb_cmd_overdraw_begin(cl,&overdraw,dynres.width,dynres.height);
+            if(prepass) emb_cmd_redraw_batch(cl);
+            else emb_cmd_draw_batch(cl,&draw_batch);
+            if(overdraw_on) emb_cmd_overdraw_end(cl);
+        }
+
+        if(transparent_batch.records.len){
+            emb_cmd_oit_begin(cl,&oit,dynres.width,dynres.height);
+            emb_cmd_draw_batch(cl,&transparent_batch);
+            emb_cmd_oit_composite(cl,&oit,&scene,dynres.width,dynres.height,composite_prog);
+        }
+        if(sorted_len){
+            emb_sort_back_to_front(sorted,sorted_len);
+            for(uint32_t k=0; k<sorted_len; ++k){
+                uint32_t i = sorted[k].index;
+                batch_add_whole(&sorted_batch,&batch.primitives.values[i],models[i],palette[i]);
+            }
+            emb_cmd_program(cl,shader_prog);
+            emb_cmd_geometry(cl,vao);
+            emb_cmd_sorted_begin(cl);
+            emb_cmd_draw_batch(cl,&sorted_batch); //draws of a multi-draw keep their order
+        }
+        emb_cmd_dynres_end(cl,&dynres);
+        emb_cmd_dynres_upscale(cl,&dynres,&scene,0);
+        EMB_PROFILE_END();
         //void * eoffset = (void*)( (batch.ebo + ) );
         /*glDrawElements(
                 GL_TRIANGLES,
@@ -293,13 +653,31 @@ int main() {
                 0*sizeof(__uint32_t)
         );*/
 
-        SDL_GL_SwapWindow(window);
+        //the render thread replays this list while the next frame is simulated
+        emb_renderer_submit(&renderer);
+
+        EMB_PROFILE_END(); //frame
+        ++frame_count;
 
+        //fill ratios and the memory dump, compiled out without EMB_MEMORY
+        emb_ebvb_handler_track(&batch);
+        emb_node_pool_track(&nodepool,"node pool");
+        emb_frame_allocator_track(&frame_scratch,"frame scratch");
+        if(frame_count % MEMORY_PRINT_FRAMES == 0) EMB_MEM_PRINT();
     }
     
 
 
     break_main_loop:
+    emb_renderer_stop(&renderer); //GL is usable on this thread again
+    emb_run_stats_print(&run_stats);
+    emb_run_stats_free(&run_stats);
+    EMB_MEM_PRINT();
+    emb_input_close(&input);
+    if(path_record_path) emb_camera_path_save(&camera_path,path_record_path);
+    emb_camera_path_free(&camera_path);
+    EMB_PROFILE_EXPORT("ember_trace.json");
+    EMB_PROFILE_SHUTDOWN();
     
     /*printf("\nEBO:\n");
     for(uint i=0; i<batch.eb_len; ++i){
@@ -309,14 +687,40 @@ int main() {
     
 
     glDeleteVertexArrays(1, &vao);
+    glDeleteVertexArrays(1, &depth_vao);
+    EMB_MEM_GPU_RELEASE(EMB_GPU_BUFFER,vbo);
+    EMB_MEM_GPU_RELEASE(EMB_GPU_BUFFER,ebo);
+    EMB_MEM_GPU_RELEASE(EMB_GPU_BUFFER,skin_vbo);
+    EMB_MEM_GPU_RELEASE(EMB_GPU_BUFFER,pos_vbo);
     glDeleteBuffers(1, &vbo);
-    glDeleteProgram(shader_prog);
+    glDeleteBuffers(1, &ebo);
+    glDeleteBuffers(1, &skin_vbo);
+    glDeleteBuffers(1, &pos_vbo);
+    emb_loader_free(&loader);
+    emb_clusters_free(&clusters);
+    emb_oit_free(&oit);
+    emb_overdraw_free(&overdraw);
+    emb_dynres_free(&dynres);
+    emb_render_target_free(&scene);
+    emb_asset_release(&assets,shader_asset);
+    emb_asset_release(&assets,composite_asset);
+    emb_asset_release(&assets,depth_asset);
+    emb_asset_registry_free(&assets); //deletes the shader program, frees texture layers
+    emb_materials_free(&materials);
+    emb_skin_palettes_free(&palettes);
+    emb_skin_free(&twist_skin);
 
     SDL_DestroyWindow(window);
     SDL_Quit();
 
     emb_ebvb_handler_free(&batch);
+    emb_primitive_origin_free(&color_rect);
+    emb_primitive_origin_free(&white_cube);
     emb_node_pool_free(&nodepool);
+    emb_frame_allocator_free(&frame_scratch);
+    emb_draw_batch_free(&draw_batch);
+    emb_draw_batch_free(&transparent_batch);
+    emb_draw_batch_free(&sorted_batch);
 
     return EXIT_SUCCESS;
 }
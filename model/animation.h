@@ -0,0 +1,445 @@
+/*______________________________________
+animation - glTF animation playback
+
+Clips are imported from glTF animation channels into flat tracks:
+- key times of all tracks in one array, key values in another
+  (4 floats per key: translation/scale padded, rotation as quaternion xyzw)
+- a track is a range of keys and the channel it drives (target, path)
+
+Time only moves forward between frames, so every track keeps a cursor
+to its current key and steps over one or two keys per sample instead
+of a binary search. The cursor is rewound when the clip loops.
+Keys are interpolated with one SSE lerp per track, rotations with
+normalized lerp (keys are dense, the difference to slerp is invisible).
+
+Samples go into a pose (T/R/S per target), two poses can be blended
+before they are written into the nodes. Targets are glTF node indices,
+a player binds them to emb_node pointers, so one clip drives any number
+of instances and only the cursors and poses are per instance.
+______________________________________*/
+#pragma once
+
+#include <cglm/cglm.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "node.h"
+#include "model.h"
+#include "../utils/allocator.h"
+
+
+typedef enum{
+    EMB_ANIM_TRANSLATION,
+    EMB_ANIM_ROTATION,
+    EMB_ANIM_SCALE,
+    EMB_ANIM_PATH_COUNT
+} emb_anim_path;
+
+typedef enum{
+    EMB_ANIM_LINEAR,
+    EMB_ANIM_STEP,
+} emb_anim_interp;
+
+typedef struct{
+    uint32_t first; //first key in times/values of the clip
+    uint32_t count;
+    uint32_t target; //glTF node index
+    uint8_t path; //emb_anim_path
+    uint8_t interp; //emb_anim_interp
+    uint16_t pad;
+} emb_anim_track;
+
+typedef struct{
+    emb_anim_track * tracks;
+    float * values; //4 floats per key
+    float * times; //seconds, increasing inside a track
+    uint32_t tracks_len;
+    uint32_t keys_len;
+    uint32_t targets; //highest target + 1
+    float duration; //last key of the longest track
+    emb_allocator * allocator;
+} emb_anim_clip;
+
+//state of one clip on one instance
+typedef struct{
+    const emb_anim_clip * clip; //NULL - nothing is playing
+    uint32_t * cursors; //key per track, kept between samples
+    uint32_t cursors_cap;
+    float time; //seconds
+    float speed; //1 - normal, negative plays backwards
+    bool loop; //false - stops at the ends
+} emb_anim_state;
+
+//sampled channels, values[target*3 + path]
+typedef struct{
+    float (*values)[4];
+    uint8_t * mask; //bit per emb_anim_path, channels written by the last sample
+    uint32_t targets;
+} emb_anim_pose;
+
+/*animation of one instance: a clip playing, optionally a second one
+fading in (emb_anim_player_crossfade), results go into nodes*/
+typedef struct{
+    emb_anim_state layers[2]; //0 - playing, 1 - fading in
+    float fade; //weight of layer 1
+    float fade_speed; //weight per second
+    emb_anim_pose poses[2];
+    emb_node ** nodes; //by target, NULL entries are skipped, not owned
+    uint32_t nodes_len;
+    emb_allocator * allocator;
+} emb_anim_player;
+
+
+
+//__________________________________________________
+// math
+//__________________________________________________
+
+/*euler angles of emb_node (glm_euler_xyz, R = Rx*Ry*Rz) from a unit quaternion xyzw,
+only the 7 needed matrix elements are computed*/
+static inline void emb_euler_from_quat(const float * q, vec3 out){
+    float x = q[0], y = q[1], z = q[2], w = q[3];
+    float r00 = 1.0f - 2.0f*(y*y + z*z), r01 = 2.0f*(x*y - w*z), r02 = 2.0f*(x*z + w*y);
+    float cy = sqrtf(r00*r00 + r01*r01); //atan2 keeps precision near +-90 degrees, asin doesn't
+    out[1] = atan2f(r02,cy);
+    if(cy > 1e-6f){
+        out[0] = atan2f(-2.0f*(y*z - w*x),1.0f - 2.0f*(x*x + y*y));
+        out[2] = atan2f(-r01,r00);
+    }
+    else{ //gimbal lock, x and z rotate around the same axis
+        out[0] = atan2f(2.0f*(y*z + w*x),1.0f - 2.0f*(x*x + z*z));
+        out[2] = 0.0f;
+    }
+}
+
+#ifdef __SSE2__
+static inline __m128 anim_dot4(__m128 a, __m128 b){
+    __m128 m = _mm_mul_ps(a,b);
+    m = _mm_add_ps(m,_mm_shuffle_ps(m,m,_MM_SHUFFLE(2,3,0,1)));
+    return _mm_add_ps(m,_mm_shuffle_ps(m,m,_MM_SHUFFLE(1,0,3,2)));
+}
+
+static inline void anim_lerp(const float * a, const float * b, float f, float * out){
+    __m128 va = _mm_loadu_ps(a);
+    _mm_storeu_ps(out,_mm_add_ps(va,_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b),va),_mm_set1_ps(f))));
+}
+
+//shortest arc: b is negated when the quaternions are in opposite hemispheres
+static inline void anim_nlerp(const float * a, const float * b, float f, float * out){
+    __m128 va = _mm_loadu_ps(a), vb = _mm_loadu_ps(b);
+    vb = _mm_xor_ps(vb,_mm_and_ps(anim_dot4(va,vb),_mm_set1_ps(-0.0f)));
+    __m128 r = _mm_add_ps(va,_mm_mul_ps(_mm_sub_ps(vb,va),_mm_set1_ps(f)));
+    _mm_storeu_ps(out,_mm_div_ps(r,_mm_sqrt_ps(anim_dot4(r,r))));
+}
+#else
+static inline void anim_lerp(const float * a, const float * b, float f, float * out){
+    for(int i=0; i<4; ++i) out[i] = a[i] + (b[i]-a[i])*f;
+}
+
+static inline void anim_nlerp(const float * a, const float * b, float f, float * out){
+    float sign = a[0]*b[0] + a[1]*b[1] + a[2]*b[2] + a[3]*b[3] < 0.0f ? -1.0f : 1.0f;
+    float len = 0.0f;
+    for(int i=0; i<4; ++i) {out[i] = a[i] + (sign*b[i]-a[i])*f; len += out[i]*out[i];}
+    len = 1.0f/sqrtf(len);
+    for(int i=0; i<4; ++i) out[i] *= len;
+}
+#endif
+
+
+
+//__________________________________________________
+// clips
+//__________________________________________________
+
+static bool anim_channel_supported(const cgltf_animation_channel * ch){
+    if(!ch->target_node || !ch->sampler || !ch->sampler->input || !ch->sampler->output) return false;
+    return ch->target_path == cgltf_animation_path_type_translation
+        || ch->target_path == cgltf_animation_path_type_rotation
+        || ch->target_path == cgltf_animation_path_type_scale;
+}
+
+/*imports translation/rotation/scale channels of the animation, morph weights are skipped.
+Cubic spline keys are imported without tangents and played linearly.
+Free with emb_anim_clip_free.*/
+bool emb_anim_clip_load_cgltf(emb_anim_clip * out, const cgltf_data * data, const cgltf_animation * anim, emb_allocator * allocator){
+    memset(out,0,sizeof(*out));
+    if(!allocator) allocator = EMB_MEM_HEAP(EMB_MEM_ANIM);
+    out->allocator = allocator;
+    uint32_t tracks = 0, keys = 0;
+    for(cgltf_size i=0; i<anim->channels_count; ++i){
+        if(!anim_channel_supported(&anim->channels[i])) continue;
+        ++tracks;
+        keys += (uint32_t)anim->channels[i].sampler->input->count;
+    }
+    if(!tracks || !keys) {printf("ERROR emb_anim_clip_load_cgltf(): %s has no node channels.\n",anim->name ? anim->name : "animation"); return false;}
+
+    //one block: tracks, values, times (tracks and values keep 16 byte alignment)
+    out->tracks = (emb_anim_track*)emb_alloc(allocator,tracks*sizeof(emb_anim_track) + keys*5*sizeof(float));
+    if(!out->tracks) {printf("ERROR emb_anim_clip_load_cgltf(): out of memory.\n"); return false;}
+    out->values = (float*)(out->tracks + tracks);
+    out->times = out->values + (size_t)keys*4;
+    out->tracks_len = tracks;
+    out->keys_len = keys;
+
+    uint32_t t = 0, k = 0;
+    for(cgltf_size i=0; i<anim->channels_count; ++i){
+        const cgltf_animation_channel * ch = &anim->channels[i];
+        if(!anim_channel_supported(ch)) continue;
+        const cgltf_animation_sampler * s = ch->sampler;
+        emb_anim_track * tr = &out->tracks[t++];
+        tr->first = k;
+        tr->count = (uint32_t)s->input->count;
+        tr->target = (uint32_t)cgltf_node_index(data,ch->target_node);
+        tr->path = ch->target_path == cgltf_animation_path_type_translation ? EMB_ANIM_TRANSLATION
+            : ch->target_path == cgltf_animation_path_type_rotation ? EMB_ANIM_ROTATION : EMB_ANIM_SCALE;
+        tr->interp = s->interpolation == cgltf_interpolation_type_step ? EMB_ANIM_STEP : EMB_ANIM_LINEAR;
+        tr->pad = 0;
+
+        bool cubic = s->interpolation == cgltf_interpolation_type_cubic_spline; //in-tangent, value, out-tangent
+        cgltf_size components = tr->path == EMB_ANIM_ROTATION ? 4 : 3;
+        for(uint32_t j=0; j<tr->count; ++j){
+            float * v = &out->values[(size_t)(k+j)*4];
+            v[0] = v[1] = v[2] = v[3] = 0.0f;
+            cgltf_accessor_read_float(s->input,j,&out->times[k+j],1);
+            cgltf_accessor_read_float(s->output,cubic ? 3*j+1 : j,v,components);
+        }
+        k += tr->count;
+
+        if(out->times[k-1] > out->duration) out->duration = out->times[k-1];
+        if(tr->target+1 > out->targets) out->targets = tr->target+1;
+    }
+    return true;
+}
+
+void emb_anim_clip_free(emb_anim_clip * c){
+    if(c->tracks) emb_free(c->allocator,c->tracks,c->tracks_len*sizeof(emb_anim_track) + c->keys_len*5*sizeof(float));
+    memset(c,0,sizeof(*c));
+}
+
+
+
+//__________________________________________________
+// sampling
+//__________________________________________________
+
+/*value of the track at t. The cursor is moved forward from the last
+sample, it goes back to the first key only when t is before it.*/
+static inline void anim_sample_track(const emb_anim_clip * c, const emb_anim_track * tr, uint32_t * cursor, float t, float * out){
+    const float * times = c->times + tr->first;
+    uint32_t k = *cursor;
+    if(k >= tr->count || times[k] > t) k = 0;
+    while(k+1 < tr->count && times[k+1] <= t) ++k;
+    *cursor = k;
+
+    const float * v = c->values + (size_t)(tr->first + k)*4;
+    if(k+1 >= tr->count || t <= times[k] || tr->interp == EMB_ANIM_STEP) {memcpy(out,v,4*sizeof(float)); return;}
+    float f = (t - times[k])/(times[k+1] - times[k]);
+    if(tr->path == EMB_ANIM_ROTATION) anim_nlerp(v,v+4,f,out);
+    else anim_lerp(v,v+4,f,out);
+}
+
+bool emb_anim_pose_init(emb_anim_pose * p, uint32_t targets, emb_allocator * allocator){
+    p->targets = targets;
+    p->values = (float(*)[4])emb_alloc(allocator,targets*(EMB_ANIM_PATH_COUNT*4*sizeof(float) + 1));
+    if(!p->values) {printf("ERROR emb_anim_pose_init(): out of memory.\n"); p->targets = 0; return false;}
+    p->mask = (uint8_t*)(p->values + (size_t)targets*EMB_ANIM_PATH_COUNT);
+    memset(p->mask,0,targets);
+    return true;
+}
+
+void emb_anim_pose_free(emb_anim_pose * p, emb_allocator * allocator){
+    if(p->values) emb_free(allocator,p->values,p->targets*(EMB_ANIM_PATH_COUNT*4*sizeof(float) + 1));
+    p->values = NULL;
+    p->mask = NULL;
+    p->targets = 0;
+}
+
+//cursors for the clip, time goes to the start
+bool emb_anim_state_set(emb_anim_state * s, const emb_anim_clip * clip, bool loop, emb_allocator * allocator){
+    if(clip && clip->tracks_len > s->cursors_cap){
+        uint32_t * cursors = (uint32_t*)emb_realloc(allocator,s->cursors,s->cursors_cap*sizeof(uint32_t),clip->tracks_len*sizeof(uint32_t));
+        if(!cursors) {printf("ERROR emb_anim_state_set(): out of memory.\n"); return false;}
+        s->cursors = cursors;
+        s->cursors_cap = clip->tracks_len;
+    }
+    if(clip) memset(s->cursors,0,clip->tracks_len*sizeof(uint32_t));
+    s->clip = clip;
+    s->time = 0.0f;
+    s->speed = 1.0f;
+    s->loop = loop;
+    return true;
+}
+
+void emb_anim_state_free(emb_anim_state * s, emb_allocator * allocator){
+    emb_free(allocator,s->cursors,s->cursors_cap*sizeof(uint32_t));
+    memset(s,0,sizeof(*s));
+}
+
+//moves the time by dt*speed, wraps when looping, clamps otherwise
+void emb_anim_state_advance(emb_anim_state * s, float dt){
+    float d = s->clip->duration;
+    s->time += dt*s->speed;
+    if(s->time >= 0.0f && s->time <= d) return;
+    if(s->loop && d > 0.0f){
+        s->time = fmodf(s->time,d);
+        if(s->time < 0.0f) s->time += d;
+    }
+    else s->time = s->time < 0.0f ? 0.0f : d;
+}
+
+//samples every track of the clip at the state's time, tracks of targets outside the pose are skipped
+void emb_anim_sample(emb_anim_state * s, emb_anim_pose * pose){
+    const emb_anim_clip * c = s->clip;
+    memset(pose->mask,0,pose->targets);
+    for(uint32_t i=0; i<c->tracks_len; ++i){
+        const emb_anim_track * tr = &c->tracks[i];
+        if(tr->target >= pose->targets) continue;
+        anim_sample_track(c,tr,&s->cursors[i],s->time,pose->values[tr->target*EMB_ANIM_PATH_COUNT + tr->path]);
+        pose->mask[tr->target] |= (uint8_t)(1u << tr->path);
+    }
+}
+
+/*out = a*(1-w) + b*w per channel, out can be a.
+Channels sampled in only one of the poses are taken from it as they are.*/
+void emb_anim_pose_blend(const emb_anim_pose * a, const emb_anim_pose * b, float w, emb_anim_pose * out){
+    uint32_t targets = a->targets < b->targets ? a->targets : b->targets;
+    if(out->targets < targets) targets = out->targets;
+    for(uint32_t t=0; t<targets; ++t){
+        uint8_t ma = a->mask[t], mb = b->mask[t];
+        for(uint32_t p=0; p<EMB_ANIM_PATH_COUNT; ++p){
+            const float * va = a->values[t*EMB_ANIM_PATH_COUNT + p];
+            const float * vb = b->values[t*EMB_ANIM_PATH_COUNT + p];
+            float * o = out->values[t*EMB_ANIM_PATH_COUNT + p];
+            uint8_t bit = (uint8_t)(1u << p);
+            if((ma & bit) && (mb & bit)){
+                if(p == EMB_ANIM_ROTATION) anim_nlerp(va,vb,w,o);
+                else anim_lerp(va,vb,w,o);
+            }
+            else if(mb & bit) memcpy(o,vb,4*sizeof(float));
+            else if((ma & bit) && o != va) memcpy(o,va,4*sizeof(float));
+        }
+        out->mask[t] = ma | mb;
+    }
+}
+
+//writes sampled channels into the nodes, channels which weren't sampled keep their values
+void emb_anim_pose_apply(const emb_anim_pose * pose, emb_node ** nodes, uint32_t nodes_len){
+    uint32_t targets = pose->targets < nodes_len ? pose->targets : nodes_len;
+    for(uint32_t t=0; t<targets; ++t){
+        uint8_t mask = pose->mask[t];
+        emb_node * n = nodes[t];
+        if(!mask || !n) continue;
+        float (*v)[4] = &pose->values[t*EMB_ANIM_PATH_COUNT];
+        if(mask & (1u << EMB_ANIM_TRANSLATION)) {n->pos[0] = v[0][0]; n->pos[1] = v[0][1]; n->pos[2] = v[0][2];}
+        if(mask & (1u << EMB_ANIM_ROTATION)) emb_euler_from_quat(v[1],n->rot);
+        if(mask & (1u << EMB_ANIM_SCALE)) {n->scale[0] = v[2][0]; n->scale[1] = v[2][1]; n->scale[2] = v[2][2];}
+    }
+}
+
+
+
+//__________________________________________________
+// player
+//__________________________________________________
+
+/*nodes - emb_node per target (glTF node index), see emb_nodes_load_cgltf.
+The array isn't copied, it has to outlive the player.*/
+bool emb_anim_player_init(emb_anim_player * p, emb_node ** nodes, uint32_t nodes_len, emb_allocator * allocator){
+    memset(p,0,sizeof(*p));
+    if(!allocator) allocator = EMB_MEM_HEAP(EMB_MEM_ANIM);
+    p->nodes = nodes;
+    p->nodes_len = nodes_len;
+    p->allocator = allocator;
+    if(!emb_anim_pose_init(&p->poses[0],nodes_len,allocator)) return false;
+    if(!emb_anim_pose_init(&p->poses[1],nodes_len,allocator)) {emb_anim_pose_free(&p->poses[0],allocator); return false;}
+    return true;
+}
+
+void emb_anim_player_free(emb_anim_player * p){
+    emb_anim_state_free(&p->layers[0],p->allocator);
+    emb_anim_state_free(&p->layers[1],p->allocator);
+    emb_anim_pose_free(&p->poses[0],p->allocator);
+    emb_anim_pose_free(&p->poses[1],p->allocator);
+}
+
+//switches to the clip immediately, a running crossfade is dropped
+bool emb_anim_player_play(emb_anim_player * p, const emb_anim_clip * clip, bool loop){
+    p->layers[1].clip = NULL;
+    p->fade = 0.0f;
+    return emb_anim_state_set(&p->layers[0],clip,loop,p->allocator);
+}
+
+/*fades the clip in over `seconds`, when the fade ends it becomes the playing clip.
+With nothing playing it starts immediately.*/
+bool emb_anim_player_crossfade(emb_anim_player * p, const emb_anim_clip * clip, float seconds, bool loop){
+    if(!p->layers[0].clip || seconds <= 0.0f) return emb_anim_player_play(p,clip,loop);
+    if(!emb_anim_state_set(&p->layers[1],clip,loop,p->allocator)) return false;
+    p->fade = 0.0f;
+    p->fade_speed = 1.0f/seconds;
+    return true;
+}
+
+//advances the clips by dt and writes the result into the nodes, call once per simulation step
+void emb_anim_player_update(emb_anim_player * p, float dt){
+    emb_anim_state * a = &p->layers[0], * b = &p->layers[1];
+    if(!a->clip) return;
+    emb_anim_state_advance(a,dt);
+    if(b->clip){
+        emb_anim_state_advance(b,dt);
+        p->fade += dt*p->fade_speed;
+        if(p->fade >= 1.0f){ //fade finished, layer 1 takes over with its cursors
+            emb_anim_state tmp = *a;
+            *a = *b;
+            *b = tmp;
+            b->clip = NULL;
+            p->fade = 0.0f;
+        }
+    }
+
+    emb_anim_sample(a,&p->poses[0]);
+    if(b->clip){
+        emb_anim_sample(b,&p->poses[1]);
+        emb_anim_pose_blend(&p->poses[0],&p->poses[1],p->fade,&p->poses[0]);
+    }
+    emb_anim_pose_apply(&p->poses[0],p->nodes,p->nodes_len);
+}
+
+
+
+//__________________________________________________
+// nodes
+//__________________________________________________
+
+/*emb_node for every glTF node with its rest transform and hierarchy,
+out[i] - node of data->nodes[i], out needs data->nodes_count entries.
+The result can be passed to emb_anim_player_init as it is.*/
+bool emb_nodes_load_cgltf(emb_node_pool * np, const cgltf_data * data, emb_node ** out){
+    for(cgltf_size i=0; i<data->nodes_count; ++i){
+        const cgltf_node * src = &data->nodes[i];
+        emb_node * n = emb_node_pool_push(np);
+        if(!n) {printf("ERROR emb_nodes_load_cgltf(): node pool is full.\n"); return false;}
+        out[i] = n;
+        if(src->has_matrix){
+            mat4 m, r;
+            vec4 t;
+            memcpy(m,src->matrix,sizeof(m));
+            glm_decompose(m,t,r,n->scale);
+            glm_vec3_copy(t,n->pos);
+            glm_euler_angles(r,n->rot);
+        }
+        else{
+            glm_vec3_copy((float*)src->translation,n->pos);
+            glm_vec3_copy((float*)src->scale,n->scale);
+            emb_euler_from_quat(src->rotation,n->rot);
+        }
+        emb_node_save_state(n);
+    }
+    for(cgltf_size i=0; i<data->nodes_count; ++i)
+        if(data->nodes[i].parent) emb_node_set_parent(out[i],out[cgltf_node_index(data,data->nodes[i].parent)]);
+    return true;
+}
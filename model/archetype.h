@@ -0,0 +1,470 @@
+#pragma once
+
+#include <glad/gl.h>
+#include <cglm/cglm.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "node.h"
+#include "../utils/allocator.h"
+#include "../utils/slotmap.h"
+#include "../utils/vector.h"
+
+//__________________________________________________
+// emb_world - archetype storage of renderable instances
+//__________________________________________________
+
+/*
+Instances with the same set of components (archetype) are stored together
+in chunks of EMB_CHUNK_BYTES. Inside the chunk every component has its own
+cache-line aligned array (column), so a system reads only what it needs
+instead of whole emb_primitive structs.
+
+Rows are packed: removing an instance moves the last row of the archetype
+into the hole. Instances are referenced by emb_entity handles.
+*/
+
+#define EMB_CHUNK_BYTES (16*1024)
+#ifndef EMB_CACHE_LINE
+#define EMB_CACHE_LINE 64
+#endif
+#define EMB_ARCHETYPES_MAX 64
+
+//components
+#define EMB_COMP_TRANSFORM 0 //local pos/rot/scale
+#define EMB_COMP_WORLD 1 //world matrix, written by emb_world_update_transforms
+#define EMB_COMP_RENDER_RANGE 2 //place of the geometry in the batch
+#define EMB_COMP_BOUNDS 3 //local bounding sphere
+#define EMB_COMP_LOD 4
+#define EMB_COMP_NODE 5 //parent emb_node
+#define EMB_COMP_STATIC 6 //tag, world matrix is computed once
+#define EMB_COMP_COUNT 7
+
+#define EMB_COMP_BIT(c) (1u<<(c))
+
+typedef uint32_t emb_comp_mask;
+typedef emb_handle emb_entity;
+
+
+typedef struct{
+    vec3 pos;
+    vec3 rot;
+    vec3 scale;
+} emb_transform;
+
+typedef struct{
+    uint32_t eb_offset; //in bytes
+    uint32_t eb_len; //in indices
+    uint32_t base_vertex; //indices are local to the primitive
+    uint32_t index_size; //2 or 4 bytes
+    uint32_t material; //index in the material table
+    GLuint shader_prog;
+} emb_render_range;
+
+typedef struct{
+    vec3 center;
+    float radius;
+} emb_bounds;
+
+typedef struct{
+    uint32_t level; //current level
+    float distance; //distance of the next switch
+} emb_lod;
+
+//set with emb_node_ref_set, a removed parent stops matching the generation
+typedef struct{
+    emb_node * parent;
+    uint32_t generation;
+} emb_node_ref;
+
+static inline void emb_node_ref_set(emb_node_ref * r, emb_node * n){
+    r->parent = n;
+    r->generation = n ? n->generation : 0;
+}
+
+
+//size of each component, tags take no space
+static const uint32_t EMB_COMP_SIZE[EMB_COMP_COUNT] = {
+    sizeof(emb_transform),
+    sizeof(mat4),
+    sizeof(emb_render_range),
+    sizeof(emb_bounds),
+    sizeof(emb_lod),
+    sizeof(emb_node_ref),
+    0,
+};
+
+
+
+typedef struct{
+    uint8_t * data; //EMB_CHUNK_BYTES, aligned to the cache line
+    uint32_t len; //rows in use
+} emb_chunk;
+
+EMB_VEC_DEFINE(emb_chunk, vec_chunk)
+
+typedef struct{
+    emb_comp_mask mask;
+    uint32_t chunk_cap; //rows per chunk
+    uint32_t offsets[EMB_COMP_COUNT]; //column offsets inside the chunk
+    uint32_t entity_offset; //column of emb_entity (back reference)
+    vec_chunk chunks; //all full except the last one
+    uint32_t len; //rows in all chunks
+} emb_archetype;
+
+
+typedef struct{
+    uint16_t archetype;
+    uint32_t chunk;
+    uint32_t row;
+} emb_entity_location;
+
+EMB_SLOTMAP_DEFINE(emb_entity_location, slotmap_entity)
+
+
+typedef struct{
+    emb_archetype archetypes[EMB_ARCHETYPES_MAX];
+    uint32_t archetypes_len;
+    slotmap_entity entities;
+} emb_world;
+
+
+
+#define ARCHETYPE_COLUMN(a, chunk, comp) ((chunk)->data + (a)->offsets[comp])
+#define ARCHETYPE_ENTITIES(a, chunk) ((emb_entity*)((chunk)->data + (a)->entity_offset))
+
+static uint32_t archetype_align(uint32_t v){
+    return (v + EMB_CACHE_LINE-1) & ~(uint32_t)(EMB_CACHE_LINE-1);
+}
+
+static void archetype_init(emb_archetype * a, emb_comp_mask mask){
+    a->mask = mask;
+    a->len = 0;
+    vec_chunk_init(&a->chunks,NULL);
+
+    uint32_t row_bytes = sizeof(emb_entity), columns = 1;
+    for(uint32_t c=0; c<EMB_COMP_COUNT; ++c){
+        if(!(mask & EMB_COMP_BIT(c))) continue;
+        row_bytes += EMB_COMP_SIZE[c];
+        ++columns;
+    }
+    //every column can lose up to a cache line on alignment
+    a->chunk_cap = (EMB_CHUNK_BYTES - columns*EMB_CACHE_LINE) / row_bytes;
+
+    uint32_t offset = 0;
+    for(uint32_t c=0; c<EMB_COMP_COUNT; ++c){
+        a->offsets[c] = 0;
+        if(!(mask & EMB_COMP_BIT(c)) || EMB_COMP_SIZE[c] == 0) continue;
+        a->offsets[c] = offset;
+        offset = archetype_align(offset + EMB_COMP_SIZE[c]*a->chunk_cap);
+    }
+    a->entity_offset = offset;
+}
+
+static void archetype_free(emb_archetype * a){
+    for(uint32_t i=0; i<a->chunks.len; ++i) {EMB_MEM_FREE(EMB_MEM_WORLD,EMB_CHUNK_BYTES); free(a->chunks.data[i].data);}
+    vec_chunk_free(&a->chunks);
+    a->len = 0;
+}
+
+
+
+void emb_world_init(emb_world * w, uint32_t entity_cap){
+    w->archetypes_len = 0;
+    slotmap_entity_init(&w->entities,entity_cap,NULL);
+}
+
+void emb_world_free(emb_world * w){
+    for(uint32_t i=0; i<w->archetypes_len; ++i) archetype_free(&w->archetypes[i]);
+    w->archetypes_len = 0;
+    slotmap_entity_free(&w->entities);
+}
+
+
+static int32_t world_archetype_get(emb_world * w, emb_comp_mask mask){
+    for(uint32_t i=0; i<w->archetypes_len; ++i) if(w->archetypes[i].mask == mask) return i;
+    if(w->archetypes_len >= EMB_ARCHETYPES_MAX) {printf("ERROR emb_world: too many archetypes.\n"); return -1;}
+    archetype_init(&w->archetypes[w->archetypes_len],mask);
+    return w->archetypes_len++;
+}
+
+//reserves a row at the end of the archetype
+static bool archetype_push_row(emb_archetype * a, emb_entity e, emb_entity_location * loc){
+    emb_chunk * ch = a->chunks.len ? &a->chunks.data[a->chunks.len-1] : NULL;
+    if(!ch || ch->len >= a->chunk_cap){
+        emb_chunk nc;
+        nc.data = (uint8_t*)aligned_alloc(EMB_CACHE_LINE,EMB_CHUNK_BYTES);
+        nc.len = 0;
+        if(!nc.data) {printf("ERROR emb_world: out of memory.\n"); return false;}
+        if(!vec_chunk_push(&a->chunks,nc)) {free(nc.data); printf("ERROR emb_world: out of memory.\n"); return false;}
+        EMB_MEM_ALLOC(EMB_MEM_WORLD,EMB_CHUNK_BYTES);
+        ch = &a->chunks.data[a->chunks.len-1];
+    }
+    loc->chunk = a->chunks.len-1;
+    loc->row = ch->len++;
+    ARCHETYPE_ENTITIES(a,ch)[loc->row] = e;
+    ++a->len;
+    return true;
+}
+
+//fills the hole with the last row, fixes location of the moved entity
+static void world_remove_row(emb_world * w, emb_archetype * a, uint32_t chunk, uint32_t row){
+    emb_chunk * last = &a->chunks.data[a->chunks.len-1];
+    emb_chunk * ch = &a->chunks.data[chunk];
+    uint32_t last_row = last->len-1;
+
+    if(ch != last || row != last_row){
+        for(uint32_t c=0; c<EMB_COMP_COUNT; ++c){
+            uint32_t size = EMB_COMP_SIZE[c];
+            if(!(a->mask & EMB_COMP_BIT(c)) || size == 0) continue;
+            memcpy(ARCHETYPE_COLUMN(a,ch,c) + row*size, ARCHETYPE_COLUMN(a,last,c) + last_row*size, size);
+        }
+        emb_entity moved = ARCHETYPE_ENTITIES(a,last)[last_row];
+        ARCHETYPE_ENTITIES(a,ch)[row] = moved;
+        emb_entity_location * loc = slotmap_entity_at(&w->entities,moved);
+        loc->chunk = chunk;
+        loc->row = row;
+    }
+
+    --last->len;
+    --a->len;
+    if(last->len == 0){
+        EMB_MEM_FREE(EMB_MEM_WORLD,EMB_CHUNK_BYTES);
+        free(last->data);
+        vec_chunk_pop(&a->chunks);
+    }
+}
+
+
+
+//__________________________________________________
+// entities
+//__________________________________________________
+
+//new entity with components of the mask, component data is not initialised
+emb_entity emb_world_spawn(emb_world * w, emb_comp_mask mask){
+    emb_entity e = EMB_HANDLE_NULL;
+    int32_t ai = world_archetype_get(w,mask);
+    if(ai < 0) return e;
+
+    emb_entity_location loc = {(uint16_t)ai, 0, 0};
+    emb_entity_location * stored = slotmap_entity_insert(&w->entities,loc,&e);
+    if(!stored) return EMB_HANDLE_NULL;
+    if(!archetype_push_row(&w->archetypes[ai],e,stored)){
+        slotmap_entity_erase(&w->entities,e);
+        return EMB_HANDLE_NULL;
+    }
+    return e;
+}
+
+bool emb_world_despawn(emb_world * w, emb_entity e){
+    emb_entity_location * loc = slotmap_entity_get(&w->entities,e);
+    if(!loc) return false;
+    world_remove_row(w,&w->archetypes[loc->archetype],loc->chunk,loc->row);
+    return slotmap_entity_erase(&w->entities,e);
+}
+
+/*pointer to the component of the entity, NULL if it doesn't have one.
+Valid until the next structural change (spawn, despawn, mask change).*/
+void * emb_world_get(emb_world * w, emb_entity e, uint32_t comp){
+    emb_entity_location * loc = slotmap_entity_get(&w->entities,e);
+    if(!loc) return NULL;
+    emb_archetype * a = &w->archetypes[loc->archetype];
+    if(!(a->mask & EMB_COMP_BIT(comp)) || EMB_COMP_SIZE[comp] == 0) return NULL;
+    return ARCHETYPE_COLUMN(a,&a->chunks.data[loc->chunk],comp) + loc->row*EMB_COMP_SIZE[comp];
+}
+
+emb_comp_mask emb_world_mask(emb_world * w, emb_entity e){
+    emb_entity_location * loc = slotmap_entity_get(&w->entities,e);
+    return loc ? w->archetypes[loc->archetype].mask : 0;
+}
+
+/*moves the entity into the archetype of the new mask.
+Components present in both are copied, the new ones are uninitialised.*/
+bool emb_world_set_mask(emb_world * w, emb_entity e, emb_comp_mask mask){
+    emb_entity_location * loc = slotmap_entity_get(&w->entities,e);
+    if(!loc) return false;
+    if(w->archetypes[loc->archetype].mask == mask) return true;
+
+    int32_t ai = world_archetype_get(w,mask);
+    if(ai < 0) return false;
+    emb_archetype * from = &w->archetypes[loc->archetype];
+    emb_archetype * to = &w->archetypes[ai];
+
+    emb_entity_location old = *loc;
+    emb_entity_location nloc = {(uint16_t)ai, 0, 0};
+    if(!archetype_push_row(to,e,&nloc)) return false;
+
+    emb_chunk * src = &from->chunks.data[old.chunk];
+    emb_chunk * dst = &to->chunks.data[nloc.chunk];
+    for(uint32_t c=0; c<EMB_COMP_COUNT; ++c){
+        uint32_t size = EMB_COMP_SIZE[c];
+        if(!(from->mask & to->mask & EMB_COMP_BIT(c)) || size == 0) continue;
+        memcpy(ARCHETYPE_COLUMN(to,dst,c) + nloc.row*size, ARCHETYPE_COLUMN(from,src,c) + old.row*size, size);
+    }
+
+    world_remove_row(w,from,old.chunk,old.row);
+    *slotmap_entity_at(&w->entities,e) = nloc;
+    return true;
+}
+
+static inline bool emb_world_add(emb_world * w, emb_entity e, uint32_t comp){
+    return emb_world_set_mask(w,e,emb_world_mask(w,e) | EMB_COMP_BIT(comp));
+}
+
+static inline bool emb_world_remove(emb_world * w, emb_entity e, uint32_t comp){
+    return emb_world_set_mask(w,e,emb_world_mask(w,e) & ~EMB_COMP_BIT(comp));
+}
+
+
+
+//__________________________________________________
+// queries
+//__________________________________________________
+
+/*iterates chunks of every archetype which has all `include`
+and none of `exclude` components:
+
+emb_query q = emb_world_query(&world, EMB_COMP_BIT(EMB_COMP_TRANSFORM), 0);
+while(emb_query_next(&q)){
+    emb_transform * t = EMB_QUERY_COLUMN(&q, EMB_COMP_TRANSFORM, emb_transform);
+    for(uint32_t i=0; i<q.len; ++i) ...
+}
+*/
+typedef struct{
+    emb_world * world;
+    emb_comp_mask include;
+    emb_comp_mask exclude;
+    uint32_t archetype;
+    int32_t chunk; //current chunk, -1 before the first call
+
+    emb_archetype * a;
+    emb_chunk * ch;
+    uint32_t len; //rows in the current chunk
+} emb_query;
+
+emb_query emb_world_query(emb_world * w, emb_comp_mask include, emb_comp_mask exclude){
+    emb_query q;
+    q.world = w;
+    q.include = include;
+    q.exclude = exclude;
+    q.archetype = 0;
+    q.chunk = -1;
+    q.a = NULL; q.ch = NULL; q.len = 0;
+    return q;
+}
+
+bool emb_query_next(emb_query * q){
+    emb_world * w = q->world;
+    while(q->archetype < w->archetypes_len){
+        emb_archetype * a = &w->archetypes[q->archetype];
+        if((a->mask & q->include) == q->include && !(a->mask & q->exclude)
+        && (uint32_t)(q->chunk+1) < a->chunks.len){
+            ++q->chunk;
+            q->a = a;
+            q->ch = &a->chunks.data[q->chunk];
+            q->len = q->ch->len;
+            return true;
+        }
+        ++q->archetype;
+        q->chunk = -1;
+    }
+    return false;
+}
+
+#define EMB_QUERY_COLUMN(q, comp, type) ((type*)ARCHETYPE_COLUMN((q)->a,(q)->ch,comp))
+#define EMB_QUERY_ENTITIES(q) ARCHETYPE_ENTITIES((q)->a,(q)->ch)
+
+
+
+//__________________________________________________
+// systems
+//__________________________________________________
+
+static inline void world_local_matrix(emb_transform * t, mat4 m){
+    glm_mat4_identity(m);
+    glm_euler_xyz(t->rot,m);
+    glm_scale(m,t->scale);
+    glm_translated(m,t->pos);
+}
+
+/*writes world matrices of all dynamic instances (static ones are skipped).
+Reads only transform, node and world columns.*/
+void emb_world_update_transforms(emb_world * w){
+    const emb_comp_mask need = EMB_COMP_BIT(EMB_COMP_TRANSFORM) | EMB_COMP_BIT(EMB_COMP_WORLD);
+    emb_query q = emb_world_query(w,need,EMB_COMP_BIT(EMB_COMP_STATIC));
+    while(emb_query_next(&q)){
+        emb_transform * t = EMB_QUERY_COLUMN(&q,EMB_COMP_TRANSFORM,emb_transform);
+        mat4 * world = EMB_QUERY_COLUMN(&q,EMB_COMP_WORLD,mat4);
+        for(uint32_t i=0; i<q.len; ++i) world_local_matrix(&t[i],world[i]);
+
+        if(!(q.a->mask & EMB_COMP_BIT(EMB_COMP_NODE))) continue;
+        emb_node_ref * node = EMB_QUERY_COLUMN(&q,EMB_COMP_NODE,emb_node_ref);
+        for(uint32_t i=0; i<q.len; ++i){
+            emb_node * parent = emb_node_live(node[i].parent,node[i].generation);
+            if(!parent) continue;
+            mat4 parent_tr;
+            emb_node_get_transform(parent,parent_tr);
+            glm_mat4_mul(parent_tr,world[i],world[i]);
+        }
+    }
+}
+
+/*computes the world matrix once and marks the entity static,
+emb_world_update_transforms won't touch it anymore*/
+bool emb_world_make_static(emb_world * w, emb_entity e){
+    emb_transform * t = (emb_transform*)emb_world_get(w,e,EMB_COMP_TRANSFORM);
+    mat4 * world = (mat4*)emb_world_get(w,e,EMB_COMP_WORLD);
+    if(!t || !world) return false;
+    world_local_matrix(t,*world);
+
+    emb_node_ref * node = (emb_node_ref*)emb_world_get(w,e,EMB_COMP_NODE);
+    emb_node * parent = node ? emb_node_live(node->parent,node->generation) : NULL;
+    if(parent){
+        mat4 parent_tr;
+        emb_node_get_transform(parent,parent_tr);
+        glm_mat4_mul(parent_tr,*world,*world);
+    }
+    return emb_world_add(w,e,EMB_COMP_STATIC);
+}
+
+
+//single draw produced by emb_world_build_draw_list
+typedef struct{
+    mat4 * world; //points into the chunk, valid until the next structural change
+    emb_render_range range;
+} emb_draw_item;
+
+EMB_VEC_DEFINE(emb_draw_item, vec_draw_item)
+
+/*collects instances which have render range and world matrix.
+planes - 6 frustum planes (xyz normal, w distance, pointing inside),
+NULL disables culling. Instances without bounds are never culled.*/
+void emb_world_build_draw_list(emb_world * w, vec4 * planes, vec_draw_item * out){
+    const emb_comp_mask need = EMB_COMP_BIT(EMB_COMP_WORLD) | EMB_COMP_BIT(EMB_COMP_RENDER_RANGE);
+    emb_query q = emb_world_query(w,need,0);
+    while(emb_query_next(&q)){
+        mat4 * world = EMB_QUERY_COLUMN(&q,EMB_COMP_WORLD,mat4);
+        emb_render_range * range = EMB_QUERY_COLUMN(&q,EMB_COMP_RENDER_RANGE,emb_render_range);
+        bool cull = planes && (q.a->mask & EMB_COMP_BIT(EMB_COMP_BOUNDS));
+        emb_bounds * bounds = cull ? EMB_QUERY_COLUMN(&q,EMB_COMP_BOUNDS,emb_bounds) : NULL;
+
+        for(uint32_t i=0; i<q.len; ++i){
+            if(cull){
+                //sphere to world space, scale taken from the largest axis
+                vec3 c;
+                glm_mat4_mulv3(world[i],bounds[i].center,1.0f,c);
+                float sx = glm_vec3_norm2(world[i][0]), sy = glm_vec3_norm2(world[i][1]), sz = glm_vec3_norm2(world[i][2]);
+                float s2 = sx > sy ? (sx > sz ? sx : sz) : (sy > sz ? sy : sz);
+                float r = bounds[i].radius * sqrtf(s2);
+
+                bool inside = true;
+                for(uint32_t p=0; p<6 && inside; ++p)
+                    inside = planes[p][0]*c[0] + planes[p][1]*c[1] + planes[p][2]*c[2] + planes[p][3] >= -r;
+                if(!inside) continue;
+            }
+            emb_draw_item item = {&world[i], range[i]};
+            vec_draw_item_push(out,item);
+        }
+    }
+}
@@ -4,6 +4,7 @@
 #include <glad/gl.h>
 #include <cglm/cglm.h>
 #include <stdio.h>
+#include "../utils/vector.h"
 
 
 
@@ -30,4 +31,110 @@ void camera_get_view(camera *cam, mat4 m) {
     glm_euler_xyz((vec3){-cam->rot[0], -cam->rot[1], -cam->rot[2]}, rotation);
 
     glm_mat4_mul(rotation, m, m);
-}
\ No newline at end of file
+}
+
+
+
+
+//__________________________________________________
+// camera path - flythrough along recorded keys
+//__________________________________________________
+
+#define EMB_CAMERA_PATH_MAGIC 0x43424D45u //"EMBC"
+#define EMB_CAMERA_PATH_VERSION 1
+
+typedef struct{
+    float t; //seconds from the start of the path
+    vec3 pos;
+    vec3 rot;
+} emb_camera_key;
+
+EMB_VEC_DEFINE(emb_camera_key, vec_camera_key)
+
+//keys sorted by time, positions and angles are Catmull-Rom interpolated
+typedef struct{
+    vec_camera_key keys;
+} emb_camera_path;
+
+void emb_camera_path_init(emb_camera_path * p){
+    vec_camera_key_init(&p->keys,NULL);
+}
+
+void emb_camera_path_free(emb_camera_path * p){
+    vec_camera_key_free(&p->keys);
+}
+
+//appends the camera at time t, keys not later than the last one are skipped
+void emb_camera_path_add(emb_camera_path * p, float t, const camera * cam){
+    if(p->keys.len && t <= p->keys.data[p->keys.len-1].t) return;
+    emb_camera_key k;
+    k.t = t;
+    glm_vec3_copy((float*)cam->pos,k.pos);
+    glm_vec3_copy((float*)cam->rot,k.rot);
+    vec_camera_key_push(&p->keys,k);
+}
+
+static inline float emb_camera_path_duration(const emb_camera_path * p){
+    return p->keys.len ? p->keys.data[p->keys.len-1].t : 0.0f;
+}
+
+static inline float camera_catmull_rom(float p0, float p1, float p2, float p3, float u){
+    float u2 = u*u, u3 = u2*u;
+    return 0.5f*(2.0f*p1 + (p2-p0)*u + (2.0f*p0 - 5.0f*p1 + 4.0f*p2 - p3)*u2 + (3.0f*p1 - p0 - 3.0f*p2 + p3)*u3);
+}
+
+//moves the camera to time t of the path (clamped to the ends), fov is kept
+void emb_camera_path_sample(const emb_camera_path * p, float t, camera * cam){
+    size_t n = p->keys.len;
+    if(!n) return;
+    const emb_camera_key * k = p->keys.data;
+    if(t <= k[0].t || n == 1) {glm_vec3_copy((float*)k[0].pos,cam->pos); glm_vec3_copy((float*)k[0].rot,cam->rot); return;}
+    if(t >= k[n-1].t) {glm_vec3_copy((float*)k[n-1].pos,cam->pos); glm_vec3_copy((float*)k[n-1].rot,cam->rot); return;}
+
+    //last key not after t
+    size_t lo = 0, hi = n-1;
+    while(hi - lo > 1){
+        size_t mid = (lo+hi)/2;
+        if(k[mid].t <= t) lo = mid; else hi = mid;
+    }
+    const emb_camera_key * k0 = &k[lo ? lo-1 : 0], * k1 = &k[lo], * k2 = &k[lo+1], * k3 = &k[lo+2 < n ? lo+2 : n-1];
+    float u = (t - k1->t)/(k2->t - k1->t);
+    for(uint32_t i=0; i<3; ++i){
+        cam->pos[i] = camera_catmull_rom(k0->pos[i],k1->pos[i],k2->pos[i],k3->pos[i],u);
+        cam->rot[i] = camera_catmull_rom(k0->rot[i],k1->rot[i],k2->rot[i],k3->rot[i],u);
+    }
+}
+
+bool emb_camera_path_save(const emb_camera_path * p, const char * path){
+    FILE * f = fopen(path,"wb");
+    if(!f) {printf("ERROR emb_camera_path_save(): cannot open %s.\n",path); return false;}
+    uint32_t h[4] = {EMB_CAMERA_PATH_MAGIC, EMB_CAMERA_PATH_VERSION, (uint32_t)sizeof(emb_camera_key), (uint32_t)p->keys.len};
+    bool ok = fwrite(h,sizeof(h),1,f) == 1 && fwrite(p->keys.data,sizeof(emb_camera_key),p->keys.len,f) == p->keys.len;
+    if(fclose(f) != 0) ok = false;
+    if(!ok) printf("ERROR emb_camera_path_save(): cannot write %s.\n",path);
+    return ok;
+}
+
+//replaces the keys of p
+bool emb_camera_path_load(emb_camera_path * p, const char * path){
+    FILE * f = fopen(path,"rb");
+    if(!f) {printf("ERROR emb_camera_path_load(): cannot open %s.\n",path); return false;}
+    uint32_t h[4];
+    bool ok = fread(h,sizeof(h),1,f) == 1 && h[0] == EMB_CAMERA_PATH_MAGIC && h[1] == EMB_CAMERA_PATH_VERSION
+        && h[2] == sizeof(emb_camera_key) && vec_camera_key_reserve(&p->keys,h[3]);
+    if(ok){
+        ok = fread(p->keys.data,sizeof(emb_camera_key),h[3],f) == h[3];
+        p->keys.len = ok ? h[3] : 0;
+    }
+    fclose(f);
+    if(!ok) {printf("ERROR emb_camera_path_load(): %s is not a camera path.\n",path); return false;}
+    //sampling divides by the time between keys, they have to increase (NaN fails too)
+    for(size_t i=1; i<p->keys.len; ++i){
+        if(!(p->keys.data[i].t > p->keys.data[i-1].t)){
+            printf("ERROR emb_camera_path_load(): key %zu of %s is not after the previous one.\n",i,path);
+            p->keys.len = 0;
+            return false;
+        }
+    }
+    return true;
+}
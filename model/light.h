@@ -0,0 +1,399 @@
+#pragma once
+
+#include <SDL3/SDL.h>
+#include <glad/gl.h>
+#include <cglm/cglm.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <stdatomic.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "../utils/vector.h"
+
+/*
+Clustered forward lighting.
+
+The view frustum is split into froxels: EMB_CLUSTER_X x EMB_CLUSTER_Y screen tiles
+and EMB_CLUSTER_Z depth slices growing exponentially from near to far.
+Every frame the lights are binned on the CPU:
+1. screen/depth range of every light (4 lights at once with SSE2)
+2. clusters are split by depth slices between threads, each thread counts
+   lights per cluster, then writes light indices (counting sort)
+3. per-thread lists are merged into a single compact index list
+
+The fragment shader finds its cluster from gl_FragCoord and loops
+only over the lights in it. Binning doesn't need GL, only upload/bind do.
+*/
+
+#define EMB_CLUSTER_X 16
+#define EMB_CLUSTER_Y 9
+#define EMB_CLUSTER_Z 24
+#define EMB_CLUSTER_XY (EMB_CLUSTER_X*EMB_CLUSTER_Y)
+#define EMB_CLUSTER_COUNT (EMB_CLUSTER_XY*EMB_CLUSTER_Z)
+
+#define EMB_MAX_LIGHTS 1024
+#define EMB_CLUSTER_MAX_INDICES (EMB_CLUSTER_COUNT*32) //size of the index SSBO
+#define EMB_CLUSTER_MAX_THREADS 8
+
+//SSBO bindings, same as in shaders/fragment.glsl
+#define EMB_LIGHT_BINDING 0
+#define EMB_CLUSTER_BINDING 1
+#define EMB_LIGHT_INDEX_BINDING 2
+
+
+typedef enum{
+    EMB_LIGHT_POINT,
+    EMB_LIGHT_SPOT,
+} emb_light_type;
+
+//std430 layout, uploaded as is
+typedef struct{
+    vec3 pos;
+    float radius; //no light past it
+    vec3 color;
+    float intensity;
+    vec3 dir; //spot only
+    float cos_outer; //spot only, cosine of the outer cone angle
+    float cos_inner; //spot only, full intensity inside
+    uint32_t type; //emb_light_type
+    float pad[2];
+} emb_light;
+
+//lights of the cluster: indices[offset..offset+count)
+typedef struct{
+    uint32_t offset;
+    uint32_t count;
+} emb_cluster;
+
+//clusters touched by the light, empty if x1 < x0
+typedef struct{
+    int16_t x0, x1;
+    int16_t y0, y1;
+    int16_t z0, z1;
+} emb_light_range;
+
+
+typedef struct emb_clusters emb_clusters;
+
+typedef struct{
+    emb_clusters * c;
+    uint32_t z_begin, z_end; //depth slices of this thread
+    vec_u32 indices; //offsets in the grid are relative to this list while binning
+    SDL_Semaphore * go;
+    SDL_Thread * thread; //NULL for the calling thread
+} emb_cluster_worker;
+
+struct emb_clusters{
+    //projection
+    float near, far;
+    float tan_x, tan_y; //half fov tangents
+    float log_scale; //slice = log(depth/near)*log_scale
+
+    //binning result
+    emb_cluster * grid; //EMB_CLUSTER_COUNT, slice-major: z*XY + y*X + x
+    vec_u32 indices;
+
+    //per frame input
+    emb_light_range * ranges;
+    uint32_t lights_len;
+
+    emb_cluster_worker workers[EMB_CLUSTER_MAX_THREADS];
+    uint32_t workers_len;
+    SDL_Semaphore * done;
+    _Atomic bool quit;
+
+    GLuint ssbo_lights, ssbo_grid, ssbo_indices; //0 until emb_clusters_gl_init
+};
+
+
+
+//__________________________________________________
+// light ranges
+//__________________________________________________
+
+static inline int16_t cluster_slice(const emb_clusters * c, float depth){
+    int s = (int)floorf(logf(depth/c->near)*c->log_scale);
+    return (int16_t)(s < 0 ? 0 : s >= EMB_CLUSTER_Z ? EMB_CLUSTER_Z-1 : s);
+}
+
+static inline int16_t cluster_tile(float ndc, int tiles){
+    float t = (ndc*0.5f+0.5f)*(float)tiles;
+    if(t < 0.0f) t = 0.0f;
+    if(t > (float)tiles-0.5f) t = (float)tiles-0.5f;
+    return (int16_t)t;
+}
+
+/*conservative range of the light: the view space box around its sphere
+is projected through the corners with the smallest and largest depth*/
+static void cluster_light_range(const emb_clusters * c, mat4 view, const emb_light * l, emb_light_range * out){
+    vec3 v;
+    glm_mat4_mulv3(view,(float*)l->pos,1.0f,v);
+    float d = -v[2], r = l->radius;
+    float dmin = d-r, dmax = d+r;
+    out->x0 = 0; out->x1 = -1;
+    if(dmax < c->near || dmin > c->far) return;
+    if(dmin < c->near) dmin = c->near;
+    if(dmax > c->far) dmax = c->far;
+
+    float x0 = fminf((v[0]-r)/dmin,(v[0]-r)/dmax)/c->tan_x;
+    float x1 = fmaxf((v[0]+r)/dmin,(v[0]+r)/dmax)/c->tan_x;
+    float y0 = fminf((v[1]-r)/dmin,(v[1]-r)/dmax)/c->tan_y;
+    float y1 = fmaxf((v[1]+r)/dmin,(v[1]+r)/dmax)/c->tan_y;
+    if(x1 < -1.0f || x0 > 1.0f || y1 < -1.0f || y0 > 1.0f) return;
+
+    out->x0 = cluster_tile(x0,EMB_CLUSTER_X); out->x1 = cluster_tile(x1,EMB_CLUSTER_X);
+    out->y0 = cluster_tile(y0,EMB_CLUSTER_Y); out->y1 = cluster_tile(y1,EMB_CLUSTER_Y);
+    out->z0 = cluster_slice(c,dmin); out->z1 = cluster_slice(c,dmax);
+}
+
+#ifdef __SSE2__
+static inline __m128i cluster_tile4(__m128 ndc, int tiles){
+    __m128 t = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(ndc,_mm_set1_ps(0.5f)),_mm_set1_ps(0.5f)),_mm_set1_ps((float)tiles));
+    t = _mm_min_ps(_mm_max_ps(t,_mm_setzero_ps()),_mm_set1_ps((float)tiles-0.5f));
+    return _mm_cvttps_epi32(t);
+}
+
+//same as cluster_light_range for 4 lights at once, depth slices stay scalar (log)
+static void cluster_light_range4(const emb_clusters * c, mat4 view, const emb_light * l, emb_light_range * out){
+    //transposed positions
+    __m128 px = _mm_setr_ps(l[0].pos[0],l[1].pos[0],l[2].pos[0],l[3].pos[0]);
+    __m128 py = _mm_setr_ps(l[0].pos[1],l[1].pos[1],l[2].pos[1],l[3].pos[1]);
+    __m128 pz = _mm_setr_ps(l[0].pos[2],l[1].pos[2],l[2].pos[2],l[3].pos[2]);
+    __m128 r = _mm_setr_ps(l[0].radius,l[1].radius,l[2].radius,l[3].radius);
+
+    //column-major view matrix
+    #define CLUSTER_ROW(i) _mm_add_ps(_mm_add_ps(_mm_mul_ps(px,_mm_set1_ps(view[0][i])),_mm_mul_ps(py,_mm_set1_ps(view[1][i]))), \
+        _mm_add_ps(_mm_mul_ps(pz,_mm_set1_ps(view[2][i])),_mm_set1_ps(view[3][i])))
+    __m128 vx = CLUSTER_ROW(0), vy = CLUSTER_ROW(1), vz = CLUSTER_ROW(2);
+    #undef CLUSTER_ROW
+
+    __m128 d = _mm_sub_ps(_mm_setzero_ps(),vz);
+    __m128 dmin = _mm_sub_ps(d,r), dmax = _mm_add_ps(d,r);
+    __m128 near = _mm_set1_ps(c->near), far = _mm_set1_ps(c->far);
+    __m128 hidden = _mm_or_ps(_mm_cmplt_ps(dmax,near),_mm_cmpgt_ps(dmin,far));
+    dmin = _mm_max_ps(dmin,near);
+    dmax = _mm_min_ps(dmax,far);
+
+    __m128 inv_tx = _mm_set1_ps(1.0f/c->tan_x), inv_ty = _mm_set1_ps(1.0f/c->tan_y);
+    __m128 xl = _mm_sub_ps(vx,r), xh = _mm_add_ps(vx,r);
+    __m128 yl = _mm_sub_ps(vy,r), yh = _mm_add_ps(vy,r);
+    __m128 x0 = _mm_mul_ps(_mm_min_ps(_mm_div_ps(xl,dmin),_mm_div_ps(xl,dmax)),inv_tx);
+    __m128 x1 = _mm_mul_ps(_mm_max_ps(_mm_div_ps(xh,dmin),_mm_div_ps(xh,dmax)),inv_tx);
+    __m128 y0 = _mm_mul_ps(_mm_min_ps(_mm_div_ps(yl,dmin),_mm_div_ps(yl,dmax)),inv_ty);
+    __m128 y1 = _mm_mul_ps(_mm_max_ps(_mm_div_ps(yh,dmin),_mm_div_ps(yh,dmax)),inv_ty);
+    __m128 one = _mm_set1_ps(1.0f), minus_one = _mm_set1_ps(-1.0f);
+    hidden = _mm_or_ps(hidden,_mm_or_ps(_mm_cmplt_ps(x1,minus_one),_mm_cmpgt_ps(x0,one)));
+    hidden = _mm_or_ps(hidden,_mm_or_ps(_mm_cmplt_ps(y1,minus_one),_mm_cmpgt_ps(y0,one)));
+
+    int32_t tx0[4], tx1[4], ty0[4], ty1[4];
+    float zmin[4], zmax[4];
+    _mm_storeu_si128((__m128i*)tx0,cluster_tile4(x0,EMB_CLUSTER_X));
+    _mm_storeu_si128((__m128i*)tx1,cluster_tile4(x1,EMB_CLUSTER_X));
+    _mm_storeu_si128((__m128i*)ty0,cluster_tile4(y0,EMB_CLUSTER_Y));
+    _mm_storeu_si128((__m128i*)ty1,cluster_tile4(y1,EMB_CLUSTER_Y));
+    _mm_storeu_ps(zmin,dmin);
+    _mm_storeu_ps(zmax,dmax);
+    int hidden_bits = _mm_movemask_ps(hidden);
+
+    for(int i=0; i<4; ++i){
+        if(hidden_bits & (1<<i)) {out[i].x0 = 0; out[i].x1 = -1; continue;}
+        out[i].x0 = (int16_t)tx0[i]; out[i].x1 = (int16_t)tx1[i];
+        out[i].y0 = (int16_t)ty0[i]; out[i].y1 = (int16_t)ty1[i];
+        out[i].z0 = cluster_slice(c,zmin[i]); out[i].z1 = cluster_slice(c,zmax[i]);
+    }
+}
+#endif
+
+
+
+//__________________________________________________
+// binning
+//__________________________________________________
+
+//counting sort of the lights into the clusters of worker's slices
+static void cluster_bin_slices(emb_cluster_worker * w){
+    emb_clusters * c = w->c;
+    emb_cluster * grid = c->grid;
+    uint32_t first = w->z_begin*EMB_CLUSTER_XY, last = w->z_end*EMB_CLUSTER_XY;
+    for(uint32_t i=first; i<last; ++i) grid[i].count = 0;
+
+    #define CLUSTER_FOREACH_CELL(rg, body)                                               \
+        for(int z = rg->z0 > (int)w->z_begin ? rg->z0 : (int)w->z_begin;                 \
+            z <= rg->z1 && z < (int)w->z_end; ++z)                                      \
+            for(int y = rg->y0; y <= rg->y1; ++y){                                       \
+                emb_cluster * row = &grid[z*EMB_CLUSTER_XY + y*EMB_CLUSTER_X];            \
+                for(int x = rg->x0; x <= rg->x1; ++x) {body}                             \
+            }
+
+    for(uint32_t l=0; l<c->lights_len; ++l){
+        const emb_light_range * rg = &c->ranges[l];
+        if(rg->x1 < rg->x0) continue;
+        CLUSTER_FOREACH_CELL(rg, ++row[x].count;)
+    }
+
+    uint32_t total = 0;
+    for(uint32_t i=first; i<last; ++i){
+        grid[i].offset = total;
+        total += grid[i].count;
+        grid[i].count = 0; //becomes write cursor
+    }
+
+    vec_u32_clear(&w->indices);
+    vec_u32_reserve(&w->indices,total);
+    w->indices.len = total;
+    uint32_t * out = w->indices.data;
+    for(uint32_t l=0; l<c->lights_len; ++l){
+        const emb_light_range * rg = &c->ranges[l];
+        if(rg->x1 < rg->x0) continue;
+        CLUSTER_FOREACH_CELL(rg, out[row[x].offset + row[x].count++] = l;)
+    }
+    #undef CLUSTER_FOREACH_CELL
+}
+
+static int cluster_worker_thread(void * user){
+    emb_cluster_worker * w = (emb_cluster_worker*)user;
+    for(;;){
+        SDL_WaitSemaphore(w->go);
+        if(atomic_load_explicit(&w->c->quit,memory_order_acquire)) return 0;
+        cluster_bin_slices(w);
+        SDL_SignalSemaphore(w->c->done);
+    }
+}
+
+static void clusters_split_slices(emb_clusters * c){
+    for(uint32_t i=0; i<c->workers_len; ++i){
+        c->workers[i].z_begin = i*EMB_CLUSTER_Z/c->workers_len;
+        c->workers[i].z_end = (i+1)*EMB_CLUSTER_Z/c->workers_len;
+    }
+}
+
+/*threads - number of threads binning (including the calling one), 0 or 1 - no extra threads.
+The structure must not move after init if threads > 1.*/
+void emb_clusters_init(emb_clusters * c, uint32_t threads){
+    memset(c,0,sizeof(*c));
+    c->grid = (emb_cluster*)calloc(EMB_CLUSTER_COUNT,sizeof(emb_cluster));
+    c->ranges = (emb_light_range*)malloc(EMB_MAX_LIGHTS*sizeof(emb_light_range));
+    EMB_MEM_ALLOC(EMB_MEM_RENDER,EMB_CLUSTER_COUNT*sizeof(emb_cluster));
+    EMB_MEM_ALLOC(EMB_MEM_RENDER,EMB_MAX_LIGHTS*sizeof(emb_light_range));
+    vec_u32_init(&c->indices,NULL);
+    atomic_init(&c->quit,false);
+
+    if(threads == 0) threads = 1;
+    if(threads > EMB_CLUSTER_MAX_THREADS) threads = EMB_CLUSTER_MAX_THREADS;
+    c->done = threads > 1 ? SDL_CreateSemaphore(0) : NULL;
+    c->workers_len = 1;
+    for(uint32_t i=0; i<threads; ++i){
+        emb_cluster_worker * w = &c->workers[i];
+        w->c = c;
+        vec_u32_init(&w->indices,NULL);
+        w->go = NULL;
+        w->thread = NULL;
+        if(i == 0) continue;
+        w->go = SDL_CreateSemaphore(0);
+        w->thread = SDL_CreateThread(cluster_worker_thread,"emb_clusters",w);
+        if(!w->thread) {printf("ERROR emb_clusters_init(): cannot create thread.\n"); SDL_DestroySemaphore(w->go); break;}
+        c->workers_len = i+1;
+    }
+    clusters_split_slices(c);
+}
+
+//projection parameters, same as in glm_perspective
+void emb_clusters_set_projection(emb_clusters * c, float fovy, float aspect, float near, float far){
+    c->near = near;
+    c->far = far;
+    c->tan_y = tanf(fovy*0.5f);
+    c->tan_x = c->tan_y*aspect;
+    c->log_scale = (float)EMB_CLUSTER_Z/logf(far/near);
+}
+
+/*bins lights into the clusters (c->grid, c->indices).
+Only the first EMB_MAX_LIGHTS lights are used.*/
+void emb_clusters_bin(emb_clusters * c, const emb_light * lights, uint32_t count, mat4 view){
+    if(count > EMB_MAX_LIGHTS) count = EMB_MAX_LIGHTS;
+    c->lights_len = count;
+
+    uint32_t i = 0;
+#ifdef __SSE2__
+    for(; i+4 <= count; i += 4) cluster_light_range4(c,view,&lights[i],&c->ranges[i]);
+#endif
+    for(; i<count; ++i) cluster_light_range(c,view,&lights[i],&c->ranges[i]);
+
+    for(uint32_t t=1; t<c->workers_len; ++t) SDL_SignalSemaphore(c->workers[t].go);
+    cluster_bin_slices(&c->workers[0]);
+    for(uint32_t t=1; t<c->workers_len; ++t) SDL_WaitSemaphore(c->done);
+
+    //merge, offsets of every worker start after the previous ones
+    vec_u32_clear(&c->indices);
+    for(uint32_t t=0; t<c->workers_len; ++t){
+        emb_cluster_worker * w = &c->workers[t];
+        uint32_t base = (uint32_t)c->indices.len;
+        for(uint32_t k=w->z_begin*EMB_CLUSTER_XY; k<w->z_end*EMB_CLUSTER_XY; ++k){
+            emb_cluster * cl = &c->grid[k];
+            cl->offset += base;
+            //the GPU list is limited, the farthest clusters lose lights first
+            if(cl->offset + cl->count > EMB_CLUSTER_MAX_INDICES)
+                cl->count = cl->offset < EMB_CLUSTER_MAX_INDICES ? EMB_CLUSTER_MAX_INDICES - cl->offset : 0;
+        }
+        vec_u32_append(&c->indices,w->indices.data,w->indices.len);
+    }
+}
+
+void emb_clusters_free(emb_clusters * c){
+    atomic_store_explicit(&c->quit,true,memory_order_release);
+    for(uint32_t t=1; t<c->workers_len; ++t){
+        SDL_SignalSemaphore(c->workers[t].go);
+        SDL_WaitThread(c->workers[t].thread,NULL);
+        SDL_DestroySemaphore(c->workers[t].go);
+    }
+    for(uint32_t t=0; t<c->workers_len; ++t) vec_u32_free(&c->workers[t].indices);
+    if(c->done) SDL_DestroySemaphore(c->done);
+    c->workers_len = 0;
+
+    if(c->ssbo_lights){
+        GLuint buffers[3] = {c->ssbo_lights, c->ssbo_grid, c->ssbo_indices};
+        for(uint32_t i=0; i<3; ++i) EMB_MEM_GPU_RELEASE(EMB_GPU_BUFFER,buffers[i]);
+        glDeleteBuffers(3,buffers);
+    }
+    if(c->grid) EMB_MEM_FREE(EMB_MEM_RENDER,EMB_CLUSTER_COUNT*sizeof(emb_cluster));
+    if(c->ranges) EMB_MEM_FREE(EMB_MEM_RENDER,EMB_MAX_LIGHTS*sizeof(emb_light_range));
+    free(c->grid);
+    free(c->ranges);
+    vec_u32_free(&c->indices);
+}
+
+
+
+//__________________________________________________
+// GL
+//__________________________________________________
+
+void emb_clusters_gl_init(emb_clusters * c){
+    glCreateBuffers(1,&c->ssbo_lights);
+    glCreateBuffers(1,&c->ssbo_grid);
+    glCreateBuffers(1,&c->ssbo_indices);
+    glNamedBufferStorage(c->ssbo_lights,EMB_MAX_LIGHTS*sizeof(emb_light),NULL,GL_DYNAMIC_STORAGE_BIT);
+    glNamedBufferStorage(c->ssbo_grid,EMB_CLUSTER_COUNT*sizeof(emb_cluster),c->grid,GL_DYNAMIC_STORAGE_BIT);
+    glNamedBufferStorage(c->ssbo_indices,EMB_CLUSTER_MAX_INDICES*sizeof(uint32_t),NULL,GL_DYNAMIC_STORAGE_BIT);
+    EMB_MEM_GPU_SET(EMB_GPU_BUFFER,c->ssbo_lights,"cluster lights",EMB_MAX_LIGHTS*sizeof(emb_light));
+    EMB_MEM_GPU_SET(EMB_GPU_BUFFER,c->ssbo_grid,"cluster grid",EMB_CLUSTER_COUNT*sizeof(emb_cluster));
+    EMB_MEM_GPU_SET(EMB_GPU_BUFFER,c->ssbo_indices,"cluster indices",EMB_CLUSTER_MAX_INDICES*sizeof(uint32_t));
+}
+
+//uploads the result of the last emb_clusters_bin
+void emb_clusters_upload(emb_clusters * c, const emb_light * lights){
+    size_t indices = c->indices.len < EMB_CLUSTER_MAX_INDICES ? c->indices.len : EMB_CLUSTER_MAX_INDICES;
+    if(c->lights_len) glNamedBufferSubData(c->ssbo_lights,0,c->lights_len*sizeof(emb_light),lights);
+    glNamedBufferSubData(c->ssbo_grid,0,EMB_CLUSTER_COUNT*sizeof(emb_cluster),c->grid);
+    if(indices) glNamedBufferSubData(c->ssbo_indices,0,indices*sizeof(uint32_t),c->indices.data);
+}
+
+//binds SSBOs and sets cluster uniforms of the program (it has to be in use)
+void emb_clusters_bind(emb_clusters * c, GLuint prog, float width, float height){
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER,EMB_LIGHT_BINDING,c->ssbo_lights);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER,EMB_CLUSTER_BINDING,c->ssbo_grid);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER,EMB_LIGHT_INDEX_BINDING,c->ssbo_indices);
+    glUniform4f(glGetUniformLocation(prog,"cluster_depth"),c->near,c->far,c->log_scale,0.0f);
+    glUniform2f(glGetUniformLocation(prog,"cluster_screen"),width,height);
+}
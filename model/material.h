@@ -0,0 +1,307 @@
+/*______________________________________
+material - texture arrays and the material table
+
+Textures are never bound per draw. Every texture is resampled to a square
+power of two and stored as a layer of the GL_TEXTURE_2D_ARRAY of that
+size (one array per size bucket, 128..2048) with a full mip chain,
+all arrays stay bound to texture units 0..EMB_TEXTURE_BUCKETS-1.
+
+Materials are 32 byte records in one SSBO. A draw only carries the index
+of its material (base instance, see render.h), so primitives with
+different materials still go into the same multi-draw.
+
+Mips are built on the CPU (emb_texture_build), the loader runs it on
+worker threads and only the upload is left for the GL thread.
+______________________________________*/
+#pragma once
+
+#include <glad/gl.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include "../utils/allocator.h"
+
+
+#define EMB_TEXTURE_BUCKETS 5
+#define EMB_TEXTURE_MIN_SIZE 128 //size of bucket 0, every next bucket doubles it
+#define EMB_TEXTURE_UNIT 0 //bucket i is bound to unit EMB_TEXTURE_UNIT+i
+#define EMB_TEXTURE_NONE 0xFFFFFFFFu
+
+#define EMB_MAX_MATERIALS 1024
+#define EMB_MATERIAL_BINDING 3
+#define EMB_MATERIAL_DEFAULT 0 //white, vertex colors
+
+//layers of every array, allocated at once with the first texture of the size
+static const uint32_t EMB_TEXTURE_BUCKET_LAYERS[EMB_TEXTURE_BUCKETS] = {64,64,32,16,8};
+
+//bucket << 16 | layer
+typedef uint32_t emb_texture;
+
+static inline emb_texture emb_texture_make(uint32_t bucket, uint32_t layer){ return bucket << 16 | layer; }
+static inline uint32_t emb_texture_bucket(emb_texture t){ return t >> 16; }
+static inline uint32_t emb_texture_layer(emb_texture t){ return t & 0xFFFFu; }
+
+typedef enum{
+    EMB_MATERIAL_VERTEX_COLOR = 1u<<0, //base color is multiplied by the vertex color
+    EMB_MATERIAL_TRANSPARENT = 1u<<1, //alpha of base color * albedo, drawn in the weighted blended pass (oit.h)
+    EMB_MATERIAL_SORTED = 1u<<2, //transparent, but drawn back to front after the composite, for exact ordering
+} emb_material_flags;
+
+//std430 record, same layout as `material` in shaders/fragment.glsl
+typedef struct{
+    float base_color[4];
+    emb_texture albedo; //EMB_TEXTURE_NONE - base color only
+    uint32_t flags;
+    float pad[2];
+} emb_material;
+_Static_assert(sizeof(emb_material) == 32, "emb_material has to match the shader");
+
+//RGBA8 (sRGB) texture with all its mips, level after level
+typedef struct{
+    uint8_t * pixels;
+    emb_allocator * allocator;
+    uint32_t bucket;
+    uint32_t size; //of level 0
+    uint32_t levels;
+    size_t bytes; //all levels
+} emb_texture_data;
+
+/*materials are edited by the recording thread and uploaded in ranges,
+textures belong to the GL thread*/
+typedef struct{
+    emb_material * materials; //EMB_MAX_MATERIALS
+    uint32_t materials_len;
+    uint32_t dirty_first; //materials[dirty_first..dirty_end) are not uploaded yet
+    uint32_t dirty_end;
+    GLuint ssbo;
+
+    GLuint arrays[EMB_TEXTURE_BUCKETS]; //0 until the first texture of the size
+    uint32_t levels[EMB_TEXTURE_BUCKETS];
+    uint64_t used[EMB_TEXTURE_BUCKETS]; //bit per layer
+} emb_materials;
+
+
+
+//__________________________________________________
+// mips (any thread)
+//__________________________________________________
+
+static inline float texture_to_linear(float v){
+    return v <= 0.04045f ? v/12.92f : powf((v+0.055f)/1.055f,2.4f);
+}
+
+static inline uint8_t texture_to_srgb(float v){
+    v = v <= 0.0031308f ? v*12.92f : 1.055f*powf(v,1.0f/2.4f) - 0.055f;
+    v = v < 0.0f ? 0.0f : v > 1.0f ? 1.0f : v;
+    return (uint8_t)(v*255.0f + 0.5f);
+}
+
+//level 0: bilinear resample of the source to size x size, exact sizes are copied
+static void texture_resample(const uint8_t * src, uint32_t width, uint32_t height, uint8_t * dst, uint32_t size){
+    if(width == size && height == size) {memcpy(dst,src,(size_t)size*size*4); return;}
+    float sx = (float)width/(float)size, sy = (float)height/(float)size;
+    for(uint32_t y=0; y<size; ++y){
+        float fy = ((float)y + 0.5f)*sy - 0.5f;
+        if(fy < 0.0f) fy = 0.0f;
+        uint32_t y0 = (uint32_t)fy, y1 = y0+1 < height ? y0+1 : y0;
+        float ty = fy - (float)y0;
+        for(uint32_t x=0; x<size; ++x){
+            float fx = ((float)x + 0.5f)*sx - 0.5f;
+            if(fx < 0.0f) fx = 0.0f;
+            uint32_t x0 = (uint32_t)fx, x1 = x0+1 < width ? x0+1 : x0;
+            float tx = fx - (float)x0;
+            const uint8_t * a = &src[((size_t)y0*width + x0)*4], * b = &src[((size_t)y0*width + x1)*4];
+            const uint8_t * c = &src[((size_t)y1*width + x0)*4], * d = &src[((size_t)y1*width + x1)*4];
+            uint8_t * o = &dst[((size_t)y*size + x)*4];
+            for(uint32_t k=0; k<4; ++k){
+                float top = a[k] + (b[k]-a[k])*tx, bottom = c[k] + (d[k]-c[k])*tx;
+                o[k] = (uint8_t)(top + (bottom-top)*ty + 0.5f);
+            }
+        }
+    }
+}
+
+/*resamples RGBA8 pixels (sRGB color, linear alpha) to the smallest bucket
+holding max(width,height) and builds the mip chain, 2x2 box filter in linear space.
+Textures over the largest bucket are scaled down to it.
+Free the result with emb_texture_data_free.*/
+bool emb_texture_build(const uint8_t * rgba, uint32_t width, uint32_t height, emb_allocator * allocator, emb_texture_data * out){
+    memset(out,0,sizeof(*out));
+    if(!rgba || width == 0 || height == 0) {printf("ERROR emb_texture_build(): empty texture.\n"); return false;}
+
+    uint32_t largest = width > height ? width : height;
+    uint32_t bucket = 0;
+    while(bucket+1 < EMB_TEXTURE_BUCKETS && (EMB_TEXTURE_MIN_SIZE << bucket) < largest) ++bucket;
+    uint32_t size = EMB_TEXTURE_MIN_SIZE << bucket;
+
+    out->bucket = bucket;
+    out->size = size;
+    out->allocator = allocator ? allocator : EMB_MEM_HEAP(EMB_MEM_TEXTURES);
+    for(uint32_t s=size; s; s>>=1) {out->bytes += (size_t)s*s*4; ++out->levels;}
+    out->pixels = (uint8_t*)emb_alloc(out->allocator,out->bytes);
+    if(!out->pixels) {printf("ERROR emb_texture_build(): out of memory.\n"); return false;}
+
+    texture_resample(rgba,width,height,out->pixels,size);
+
+    float linear[256];
+    for(uint32_t i=0; i<256; ++i) linear[i] = texture_to_linear((float)i/255.0f);
+
+    uint8_t * src = out->pixels;
+    for(uint32_t s=size; s > 1; s>>=1){
+        uint8_t * dst = src + (size_t)s*s*4;
+        uint32_t half = s/2;
+        for(uint32_t y=0; y<half; ++y){
+            for(uint32_t x=0; x<half; ++x){
+                const uint8_t * a = &src[((size_t)(2*y)*s + 2*x)*4];
+                const uint8_t * b = a + (size_t)s*4;
+                uint8_t * o = &dst[((size_t)y*half + x)*4];
+                for(uint32_t k=0; k<3; ++k)
+                    o[k] = texture_to_srgb((linear[a[k]] + linear[a[k+4]] + linear[b[k]] + linear[b[k+4]])*0.25f);
+                o[3] = (uint8_t)((a[3] + a[7] + b[3] + b[7] + 2)/4);
+            }
+        }
+        src = dst;
+    }
+    return true;
+}
+
+void emb_texture_data_free(emb_texture_data * t){
+    if(t->pixels) emb_free(t->allocator,t->pixels,t->bytes);
+    t->pixels = NULL;
+}
+
+/*raw RGBA8 file (width*height*4 bytes, rows top to bottom) with mips.
+There is no image decoder, textures are converted offline.*/
+bool emb_texture_load_raw(const char * path, uint32_t width, uint32_t height, emb_allocator * allocator, emb_texture_data * out){
+    memset(out,0,sizeof(*out));
+    size_t bytes = (size_t)width*height*4;
+    FILE * f = fopen(path,"rb");
+    if(!f) {printf("ERROR emb_texture_load_raw(): cannot open %s\n",path); return false;}
+    uint8_t * rgba = (uint8_t*)malloc(bytes ? bytes : 1);
+    size_t read = rgba ? fread(rgba,1,bytes,f) : 0;
+    fclose(f);
+    if(read != bytes || bytes == 0){
+        printf("ERROR emb_texture_load_raw(): %s is not %ux%u RGBA8.\n",path,width,height);
+        free(rgba);
+        return false;
+    }
+    bool ok = emb_texture_build(rgba,width,height,allocator,out);
+    free(rgba);
+    return ok;
+}
+
+
+
+//__________________________________________________
+// materials
+//__________________________________________________
+
+static inline emb_material emb_material_color(float r, float g, float b, float a){
+    emb_material m = {{r,g,b,a}, EMB_TEXTURE_NONE, 0, {0.0f,0.0f}};
+    return m;
+}
+
+//table with the default material, no GL needed
+bool emb_materials_init(emb_materials * m){
+    memset(m,0,sizeof(*m));
+    m->materials = (emb_material*)calloc(EMB_MAX_MATERIALS,sizeof(emb_material));
+    if(!m->materials) {printf("ERROR emb_materials_init(): out of memory.\n"); return false;}
+    EMB_MEM_ALLOC(EMB_MEM_RENDER,EMB_MAX_MATERIALS*sizeof(emb_material));
+    m->materials[EMB_MATERIAL_DEFAULT] = emb_material_color(1.0f,1.0f,1.0f,1.0f);
+    m->materials[EMB_MATERIAL_DEFAULT].flags = EMB_MATERIAL_VERTEX_COLOR;
+    m->materials_len = 1;
+    m->dirty_first = 0;
+    m->dirty_end = 1;
+    return true;
+}
+
+static inline void material_mark_dirty(emb_materials * m, uint32_t i){
+    if(m->dirty_first >= m->dirty_end) {m->dirty_first = i; m->dirty_end = i+1; return;}
+    if(i < m->dirty_first) m->dirty_first = i;
+    if(i+1 > m->dirty_end) m->dirty_end = i+1;
+}
+
+//index of the new material, EMB_MATERIAL_DEFAULT if the table is full
+uint32_t emb_material_add(emb_materials * m, const emb_material * material){
+    if(m->materials_len >= EMB_MAX_MATERIALS) {printf("ERROR emb_material_add(): too many materials.\n"); return EMB_MATERIAL_DEFAULT;}
+    uint32_t i = m->materials_len++;
+    m->materials[i] = *material;
+    material_mark_dirty(m,i);
+    return i;
+}
+
+//the material can be changed through the pointer until the next upload
+emb_material * emb_material_edit(emb_materials * m, uint32_t i){
+    if(i >= m->materials_len) return NULL;
+    material_mark_dirty(m,i);
+    return &m->materials[i];
+}
+
+
+
+//__________________________________________________
+// GL
+//__________________________________________________
+
+void emb_materials_gl_init(emb_materials * m){
+    glCreateBuffers(1,&m->ssbo);
+    glNamedBufferStorage(m->ssbo,EMB_MAX_MATERIALS*sizeof(emb_material),NULL,GL_DYNAMIC_STORAGE_BIT);
+    EMB_MEM_GPU_SET(EMB_GPU_BUFFER,m->ssbo,"materials",EMB_MAX_MATERIALS*sizeof(emb_material));
+}
+
+//uploads changed materials and binds the table
+void emb_materials_upload(emb_materials * m){
+    if(m->dirty_first < m->dirty_end)
+        glNamedBufferSubData(m->ssbo,m->dirty_first*sizeof(emb_material),(m->dirty_end-m->dirty_first)*sizeof(emb_material),&m->materials[m->dirty_first]);
+    m->dirty_first = m->dirty_end = 0;
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER,EMB_MATERIAL_BINDING,m->ssbo);
+}
+
+/*places the texture in a free layer of its bucket, GL thread only.
+The array is created and bound with the first texture of the size.
+Returns EMB_TEXTURE_NONE when the bucket is full.*/
+emb_texture emb_textures_upload(emb_materials * m, const emb_texture_data * t){
+    uint32_t b = t->bucket;
+    uint32_t layers = EMB_TEXTURE_BUCKET_LAYERS[b];
+    uint64_t free_layers = ~m->used[b] & (layers < 64 ? (1ull << layers) - 1 : ~0ull);
+    if(!free_layers) {printf("ERROR emb_textures_upload(): no free layer for %ux%u textures.\n",t->size,t->size); return EMB_TEXTURE_NONE;}
+
+    if(!m->arrays[b]){
+        glCreateTextures(GL_TEXTURE_2D_ARRAY,1,&m->arrays[b]);
+        glTextureStorage3D(m->arrays[b],(GLsizei)t->levels,GL_SRGB8_ALPHA8,(GLsizei)t->size,(GLsizei)t->size,(GLsizei)layers);
+        glTextureParameteri(m->arrays[b],GL_TEXTURE_MIN_FILTER,GL_LINEAR_MIPMAP_LINEAR);
+        glTextureParameteri(m->arrays[b],GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+        glTextureParameteri(m->arrays[b],GL_TEXTURE_WRAP_S,GL_REPEAT);
+        glTextureParameteri(m->arrays[b],GL_TEXTURE_WRAP_T,GL_REPEAT);
+        glTextureParameterf(m->arrays[b],GL_TEXTURE_MAX_ANISOTROPY,8.0f);
+        glBindTextureUnit(EMB_TEXTURE_UNIT+b,m->arrays[b]);
+        m->levels[b] = t->levels;
+        EMB_MEM_GPU_SET(EMB_GPU_TEXTURE,m->arrays[b],"texture array",(uint64_t)t->bytes*layers);
+    }
+
+    uint32_t layer = (uint32_t)__builtin_ctzll(free_layers);
+    m->used[b] |= 1ull << layer;
+    const uint8_t * p = t->pixels;
+    for(uint32_t level=0, s=t->size; level<t->levels; ++level, s>>=1){
+        glTextureSubImage3D(m->arrays[b],(GLint)level,0,0,(GLint)layer,(GLsizei)s,(GLsizei)s,1,GL_RGBA,GL_UNSIGNED_BYTE,p);
+        p += (size_t)s*s*4;
+    }
+    return emb_texture_make(b,layer);
+}
+
+//the layer can be reused, materials still pointing at it show the next texture
+void emb_textures_free(emb_materials * m, emb_texture t){
+    if(t == EMB_TEXTURE_NONE) return;
+    m->used[emb_texture_bucket(t)] &= ~(1ull << emb_texture_layer(t));
+}
+
+void emb_materials_free(emb_materials * m){
+    for(uint32_t b=0; b<EMB_TEXTURE_BUCKETS; ++b) if(m->arrays[b]) {EMB_MEM_GPU_RELEASE(EMB_GPU_TEXTURE,m->arrays[b]); glDeleteTextures(1,&m->arrays[b]);}
+    if(m->ssbo) {EMB_MEM_GPU_RELEASE(EMB_GPU_BUFFER,m->ssbo); glDeleteBuffers(1,&m->ssbo);}
+    if(m->materials) EMB_MEM_FREE(EMB_MEM_RENDER,EMB_MAX_MATERIALS*sizeof(emb_material));
+    free(m->materials);
+    memset(m,0,sizeof(*m));
+}
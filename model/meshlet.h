@@ -0,0 +1,203 @@
+/*______________________________________
+meshlet - small clusters of triangles for culling
+
+Primitives are split at import into meshlets of at most
+EMB_MESHLET_MAX_VERTICES unique vertices and EMB_MESHLET_MAX_TRIANGLES
+triangles. Every meshlet keeps a bounding sphere and a cone containing
+the normals of its triangles, so per frame whole meshlets outside
+the frustum or facing away from the camera are skipped.
+
+Triangles are taken in index order, so meshlets are consecutive ranges
+of the original element buffer and surviving neighbours merge
+into one draw range.
+______________________________________*/
+#pragma once
+
+#include <cglm/cglm.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include "../utils/memstats.h"
+
+
+#define EMB_MESHLET_MAX_VERTICES 64
+#define EMB_MESHLET_MAX_TRIANGLES 124
+
+typedef struct{
+    vec3 center; //bounding sphere, model space
+    float radius;
+    vec3 cone_axis; //average normal
+    float cone_cutoff; //sine of the cone angle, 1 - triangles face all around (no cone culling)
+    uint32_t first; //first index in the primitive element buffer
+    uint32_t count; //indices
+} emb_meshlet;
+
+//range of indices to draw, relative to the primitive
+typedef struct{
+    uint32_t first;
+    uint32_t count;
+} emb_draw_range;
+
+
+
+//__________________________________________________
+// build
+//__________________________________________________
+
+//sphere and normal cone of triangles eb[first..first+count)
+static void meshlet_bounds(emb_meshlet * m, const float * vb, uint32_t stride, const uint32_t * eb){
+    vec3 mn, mx;
+    for(uint32_t i=0; i<m->count; ++i){
+        const float * p = &vb[eb[m->first+i]*stride];
+        for(uint32_t k=0; k<3; ++k){
+            if(i == 0 || p[k] < mn[k]) mn[k] = p[k];
+            if(i == 0 || p[k] > mx[k]) mx[k] = p[k];
+        }
+    }
+    float r2 = 0.0f;
+    for(uint32_t k=0; k<3; ++k) m->center[k] = 0.5f*(mn[k]+mx[k]);
+    for(uint32_t i=0; i<m->count; ++i){
+        const float * p = &vb[eb[m->first+i]*stride];
+        float dx = p[0]-m->center[0], dy = p[1]-m->center[1], dz = p[2]-m->center[2];
+        float d2 = dx*dx + dy*dy + dz*dz;
+        if(d2 > r2) r2 = d2;
+    }
+    m->radius = sqrtf(r2);
+
+    //normals of counter-clockwise triangles
+    vec3 normals[EMB_MESHLET_MAX_TRIANGLES];
+    uint32_t normals_len = 0;
+    vec3 axis = {0.0f,0.0f,0.0f};
+    for(uint32_t t=0; t<m->count; t+=3){
+        const float * a = &vb[eb[m->first+t]*stride];
+        const float * b = &vb[eb[m->first+t+1]*stride];
+        const float * c = &vb[eb[m->first+t+2]*stride];
+        vec3 ab = {b[0]-a[0],b[1]-a[1],b[2]-a[2]};
+        vec3 ac = {c[0]-a[0],c[1]-a[1],c[2]-a[2]};
+        vec3 n;
+        glm_vec3_cross(ab,ac,n);
+        float len = glm_vec3_norm(n);
+        if(len <= 1e-12f) continue; //degenerate, never visible
+        glm_vec3_scale(n,1.0f/len,normals[normals_len]);
+        glm_vec3_add(axis,normals[normals_len],axis);
+        ++normals_len;
+    }
+
+    float axis_len = glm_vec3_norm(axis);
+    m->cone_cutoff = 1.0f;
+    glm_vec3_zero(m->cone_axis);
+    if(normals_len == 0 || axis_len <= 1e-6f) return;
+    glm_vec3_scale(axis,1.0f/axis_len,m->cone_axis);
+
+    float mindp = 1.0f;
+    for(uint32_t i=0; i<normals_len; ++i){
+        float dp = glm_vec3_dot(normals[i],m->cone_axis);
+        if(dp < mindp) mindp = dp;
+    }
+    //cones wider than ~84 degrees are almost never culled, skip the test
+    if(mindp > 0.1f) m->cone_cutoff = sqrtf(1.0f - mindp*mindp);
+}
+
+/*splits triangles eb[0..eb_len) into meshlets.
+vb - positions at the start of every vertex, stride in floats.
+Returns heap array (emb_meshlets_free), NULL if there are no triangles or no memory.*/
+emb_meshlet * emb_meshlets_build(const float * vb, uint32_t vertices, uint32_t stride, const uint32_t * eb, uint32_t eb_len, uint32_t * out_len){
+    *out_len = 0;
+    uint32_t triangles = eb_len/3;
+    if(triangles == 0 || vertices == 0) return NULL;
+    for(uint32_t i=0; i<triangles*3; ++i)
+        if(eb[i] >= vertices) {printf("ERROR emb_meshlets_build(): index out of range.\n"); return NULL;}
+
+    uint32_t cap = triangles/EMB_MESHLET_MAX_TRIANGLES + 16;
+    emb_meshlet * meshlets = (emb_meshlet*)malloc(cap*sizeof(emb_meshlet));
+    uint32_t * seen = (uint32_t*)calloc(vertices,sizeof(uint32_t)); //meshlet number+1 which used the vertex last
+    if(!meshlets || !seen) {free(meshlets); free(seen); return NULL;}
+
+    uint32_t len = 0, unique = 0;
+    meshlets[0].first = 0;
+    meshlets[0].count = 0;
+    for(uint32_t t=0; t<triangles; ++t){
+        const uint32_t * tri = &eb[t*3];
+        uint32_t mark = len+1;
+        uint32_t fresh = (seen[tri[0]] != mark) + (seen[tri[1]] != mark && tri[1] != tri[0]) +
+            (seen[tri[2]] != mark && tri[2] != tri[0] && tri[2] != tri[1]);
+
+        if(unique + fresh > EMB_MESHLET_MAX_VERTICES || meshlets[len].count/3 >= EMB_MESHLET_MAX_TRIANGLES){
+            meshlet_bounds(&meshlets[len],vb,stride,eb);
+            if(++len == cap){
+                cap *= 2;
+                emb_meshlet * grown = (emb_meshlet*)realloc(meshlets,cap*sizeof(emb_meshlet));
+                if(!grown) {free(meshlets); free(seen); return NULL;}
+                meshlets = grown;
+            }
+            meshlets[len].first = t*3;
+            meshlets[len].count = 0;
+            unique = 0;
+            mark = len+1;
+            fresh = 1 + (tri[1] != tri[0]) + (tri[2] != tri[0] && tri[2] != tri[1]);
+        }
+        seen[tri[0]] = seen[tri[1]] = seen[tri[2]] = mark;
+        unique += fresh;
+        meshlets[len].count += 3;
+    }
+    meshlet_bounds(&meshlets[len],vb,stride,eb);
+    free(seen);
+    *out_len = len+1;
+    emb_meshlet * fit = (emb_meshlet*)realloc(meshlets,(len+1)*sizeof(emb_meshlet));
+    if(fit) meshlets = fit;
+    EMB_MEM_ALLOC(EMB_MEM_MESHLETS,(len+1)*sizeof(emb_meshlet));
+    return meshlets;
+}
+
+//frees the array returned by emb_meshlets_build
+void emb_meshlets_free(emb_meshlet * meshlets, uint32_t len){
+    if(!meshlets) return;
+    EMB_MEM_FREE(EMB_MEM_MESHLETS,len*sizeof(emb_meshlet));
+    free(meshlets);
+}
+
+
+
+//__________________________________________________
+// culling
+//__________________________________________________
+
+/*writes index ranges of meshlets which can be visible, neighbours are merged.
+planes - 6 frustum planes in world space (xyz normal, w distance, pointing inside),
+camera - world position. out needs room for len ranges.
+Returns the number of ranges.*/
+uint32_t emb_meshlets_cull(const emb_meshlet * meshlets, uint32_t len, mat4 model, vec4 * planes, vec3 camera, emb_draw_range * out){
+    //sphere radius grows with the largest axis, cones survive only uniform scale without mirroring
+    float sx = glm_vec3_norm(model[0]), sy = glm_vec3_norm(model[1]), sz = glm_vec3_norm(model[2]);
+    float smax = fmaxf(sx,fmaxf(sy,sz));
+    bool cones = smax > 0.0f && fabsf(sx-sy) <= 1e-3f*smax && fabsf(sx-sz) <= 1e-3f*smax && glm_mat4_det(model) > 0.0f;
+    float inv_s = smax > 0.0f ? 1.0f/smax : 0.0f;
+
+    uint32_t ranges = 0;
+    for(uint32_t i=0; i<len; ++i){
+        const emb_meshlet * m = &meshlets[i];
+        vec3 c;
+        glm_mat4_mulv3(model,(float*)m->center,1.0f,c);
+        float r = m->radius*smax;
+
+        bool visible = true;
+        for(uint32_t p=0; p<6 && visible; ++p)
+            visible = planes[p][0]*c[0] + planes[p][1]*c[1] + planes[p][2]*c[2] + planes[p][3] >= -r;
+
+        if(visible && cones && m->cone_cutoff < 1.0f){
+            vec3 axis, view;
+            glm_mat4_mulv3(model,(float*)m->cone_axis,0.0f,axis);
+            glm_vec3_scale(axis,inv_s,axis);
+            glm_vec3_sub(c,camera,view);
+            //every triangle faces away if the whole sphere is behind the cone
+            visible = glm_vec3_dot(view,axis) < m->cone_cutoff*glm_vec3_norm(view) + r;
+        }
+        if(!visible) continue;
+
+        if(ranges && out[ranges-1].first + out[ranges-1].count == m->first) out[ranges-1].count += m->count;
+        else out[ranges++] = (emb_draw_range){m->first,m->count};
+    }
+    return ranges;
+}
@@ -5,6 +5,8 @@
 #include <cglm/cglm.h>
 #include <stdio.h>
 #include "node.h"
+#include "meshlet.h"
+#include "../utils/allocator.h"
 
 #define CGLTF_IMPLEMENTATION
 #include "cgltf.h"
@@ -21,10 +23,36 @@
 #define VB_ATTRIB_NORMAL_SIZE 3
 #define VB_ATTRIB_SIZE_MAX 11
 
+//skin stream (emb_skin_vertex), second vertex buffer binding
+#define VB_ATTRIB_JOINTS_OFFSET 4
+#define VB_ATTRIB_WEIGHTS_OFFSET 5
+
+/*joints and weights of one vertex (glTF JOINTS_0/WEIGHTS_0).
+Kept in a stream parallel to the vertex buffer with the same vertex index,
+so base_vertex of a draw addresses both. Joints index the skin's joint list.*/
+typedef struct{
+    uint16_t joints[4];
+    uint8_t weights[4]; //unorm8, sum is 255
+} emb_skin_vertex;
+
 //__________________________________________________
 // emb_primitive_origin - unique sample of the primitive
 //__________________________________________________
 
+/*place of the primitive in the shared vertex/element buffer (bhandler.h).
+Indices are local to the primitive, the draw adds base_vertex.*/
+typedef struct{
+    uint32_t owner; //id of the buffer handler holding it, 0 - not uploaded
+    uint32_t base_vertex;
+    uint32_t eb_offset; //in bytes
+    uint32_t eb_len; //in indices
+    uint32_t index_size; //2 or 4 bytes
+} emb_geometry_range;
+
+static inline GLenum emb_index_type(uint32_t index_size){
+    return index_size == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
 /*
 The simplest primitive consisting of triangles. 
 Can contain only one material (shader). 
@@ -39,7 +67,19 @@ typedef struct //primitive template
 
     uint32_t * eb; //local triangles buffer 
     uint32_t eb_len; //length of the original triangles buffer (in elements)
-    
+
+    emb_skin_vertex * skin; //vb_len/VB_ATTRIB_SIZE_MAX entries, NULL - not skinned
+    bool skinned; //the uploaded geometry has a skin stream, stays set when skin is discarded
+
+    bool owns_buffers; //vb and eb were allocated by the loader
+    emb_allocator * allocator; //where vb and eb live (NULL - heap)
+
+    emb_geometry_range geometry; //uploaded once, shared by all instances
+
+    emb_meshlet * meshlets; //heap, kept when vb and eb are discarded
+    uint32_t meshlets_len;
+
+    uint32_t material; //index in the material table (model/material.h), 0 - default
     
     GLuint shader_prog; //the single primitive support only one shader program
 } emb_primitive_origin; 
@@ -51,21 +91,15 @@ typedef struct //primitive template
 //__________________________________________________
 // emb_primitive - instance of the primitive
 //__________________________________________________
+struct emb_skin; //model/skin.h
+
 typedef struct //vertex primitive (instance)
 {    
     emb_primitive_origin * primitive; //reference to the original primitive
 
-    /*
-    If the primitive is created successfully, 
-    it gets its own vertex buffer, independent of the unique primitive. 
-    Several instances can share one place in buffer (same vb_start), for optimisation.
-    */
-
-    float * vb_start; //reference to the vertex buffer
-    size_t vb_len; //length in the vertex buffer (in elements)
-
-    uint32_t * eb_start; //reference to the element buffer
-    size_t eb_len; //length in the element buffer (in elements)
+    //shared place of the origin in the buffer, every instance of it draws the same range
+    emb_geometry_range geometry;
+    uint32_t material; //taken from the origin, can be changed per instance
 
     // mat4 transform; //primitive matrix
     vec3 pos;
@@ -77,24 +111,63 @@ typedef struct //vertex primitive (instance)
     bool shader_program_override;
 
     // reference to the parent node. child node will inherit all the transformations.
+    // set with prim_inst_set_parent, read with prim_inst_parent
     emb_node * parent;
+    uint32_t parent_generation;
+
+    //joints deforming a skinned origin, set with prim_inst_set_skin. NULL - drawn in bind pose
+    const struct emb_skin * skin;
+    emb_node ** joints; //emb_node per glTF node index (emb_nodes_load_cgltf)
 
 } emb_primitive; 
 
 
+static inline void prim_inst_set_parent(emb_primitive * pr, emb_node * n){
+    pr->parent = n;
+    pr->parent_generation = n ? n->generation : 0;
+}
+
+//skin - shared by the instances of the mesh, joints - nodes of this instance's skeleton
+static inline void prim_inst_set_skin(emb_primitive * pr, const struct emb_skin * skin, emb_node ** joints){
+    pr->skin = skin;
+    pr->joints = joints;
+}
+
+//NULL if there is none or it was removed from the pool
+static inline emb_node * prim_inst_parent(const emb_primitive * pr){
+    return emb_node_live(pr->parent,pr->parent_generation);
+}
+
 void prim_inst_get_transform(emb_primitive * pr, mat4 m){
     glm_mat4_identity(m);
     glm_euler_xyz(pr->rot,m);
     glm_scale(m,pr->scale); //not affected by rotation
     glm_translated(m,pr->pos); //not affected by scale rotation
 
-    if(pr->parent != NULL && pr->parent->node_state!=NODE_STATE_NONE){
+    emb_node * parent = prim_inst_parent(pr);
+    if(parent){
         mat4 parent_tr;
-        emb_node_get_transform(pr->parent,parent_tr);
+        emb_node_get_transform(parent,parent_tr);
         glm_mat4_mul(parent_tr,m,m);
     }
 };
 
+/*interpolated transform (utils/frameloop.h), only the parent nodes are interpolated,
+local transform of the primitive is taken as is*/
+void prim_inst_get_transform_lerp(emb_primitive * pr, float alpha, mat4 m){
+    glm_mat4_identity(m);
+    glm_euler_xyz(pr->rot,m);
+    glm_scale(m,pr->scale);
+    glm_translated(m,pr->pos);
+
+    emb_node * parent = prim_inst_parent(pr);
+    if(parent){
+        mat4 parent_tr;
+        emb_node_get_transform_lerp(parent,alpha,parent_tr);
+        glm_mat4_mul(parent_tr,m,m);
+    }
+}
+
 void prim_inst_def_trtansform(emb_primitive * pr){
     pr->pos[0] = 0.0f; pr->pos[1] = 0.0f; pr->pos[2] = 0.0f;
     pr->rot[0] = 0.0f; pr->rot[1] = 0.0f; pr->rot[2] = 0.0f;
@@ -145,7 +218,31 @@ typedef struct
 
 
 
-void prim_load_primitive_cgltf(emb_primitive_origin *out, const cgltf_primitive *primitive) {
+//splits the triangles into meshlets (model/meshlet.h) for per-cluster culling
+void emb_primitive_origin_build_meshlets(emb_primitive_origin * o){
+    emb_meshlets_free(o->meshlets,o->meshlets_len);
+    o->meshlets = emb_meshlets_build(o->vb,o->vb_len/VB_ATTRIB_SIZE_MAX,VB_ATTRIB_SIZE_MAX,o->eb,o->eb_len,&o->meshlets_len);
+}
+
+
+//weights scaled to sum 255, the rounding error goes to the largest one
+static void prim_quantize_weights(const float * w, uint8_t * out){
+    float sum = w[0] + w[1] + w[2] + w[3];
+    if(sum <= 0.0f) {out[0] = 255; out[1] = out[2] = out[3] = 0; return;}
+    int total = 0, largest = 0;
+    for(int k=0; k<4; ++k){
+        out[k] = (uint8_t)(w[k]/sum*255.0f + 0.5f);
+        total += out[k];
+        if(w[k] > w[largest]) largest = k;
+    }
+    out[largest] = (uint8_t)(out[largest] + 255 - total);
+}
+
+/*loads the primitive data into out->vb and out->eb.
+JOINTS_0/WEIGHTS_0 go to out->skin, other joint sets are dropped (4 influences).
+allocator - where buffers are placed (NULL - heap), 
+with an arena the whole level can be freed by a single reset.*/
+void prim_load_primitive_cgltf(emb_primitive_origin *out, const cgltf_primitive *primitive, emb_allocator * allocator) {
     size_t num_vertices = 0;
     size_t num_indices = 0;
     size_t vertex_stride = VB_ATTRIB_SIZE_MAX;
@@ -154,17 +251,39 @@ void prim_load_primitive_cgltf(emb_primitive_origin *out, const cgltf_primitive
     if (primitive->attributes_count > 0) num_vertices = primitive->attributes[0].data->count;
     if (primitive->indices) num_indices = primitive->indices->count;
 
+    if(!allocator) allocator = EMB_MEM_HEAP(EMB_MEM_GLTF);
+    out->allocator = allocator;
+    out->owns_buffers = true;
+    out->use_vertex_colors = false;
+    out->use_uv = false;
+    memset(&out->geometry, 0, sizeof(out->geometry)); //not uploaded
+    out->meshlets = NULL;
+    out->meshlets_len = 0;
+    out->material = 0;
+    out->skin = NULL;
+
+    bool joints = false, weights = false;
+    for(size_t j = 0; j < primitive->attributes_count; j++){
+        if(primitive->attributes[j].index != 0) continue;
+        if(primitive->attributes[j].type == cgltf_attribute_type_joints) joints = true;
+        if(primitive->attributes[j].type == cgltf_attribute_type_weights) weights = true;
+    }
+    if(joints && weights){
+        out->skin = (emb_skin_vertex*)emb_alloc(allocator, num_vertices * sizeof(emb_skin_vertex));
+        if(out->skin) memset(out->skin, 0, num_vertices * sizeof(emb_skin_vertex));
+    }
+    out->skinned = out->skin != NULL;
     
-    out->vb_len = num_vertices * vertex_stride * sizeof(float);
-    out->vb = (float*)malloc(out->vb_len);
+    out->vb_len = num_vertices * vertex_stride; //in elements
+    out->vb = (float*)emb_alloc(allocator, out->vb_len * sizeof(float));
 
-    out->eb_len = num_indices * sizeof(uint32_t);
-    out->eb = (uint32_t*)malloc(out->eb_len);
+    out->eb_len = num_indices; //in elements
+    out->eb = (uint32_t*)emb_alloc(allocator, out->eb_len * sizeof(uint32_t));
 
 
 
     //fill vbo with zeros
-    memset(out->vb, 0, out->vb_len);
+    memset(out->vb, 0, out->vb_len * sizeof(float));
 
     // fill vbo with values from cgltf primitive
     for (size_t i = 0; i < num_vertices; i++) {
@@ -190,11 +309,13 @@ void prim_load_primitive_cgltf(emb_primitive_origin *out, const cgltf_primitive
                     vbo_ver[2] = temp[2];
                     break;
                 case cgltf_attribute_type_color:
+                    out->use_vertex_colors = true;
                     vbo_ver[3] = temp[0];
                     vbo_ver[4] = temp[1];
                     vbo_ver[5] = temp[2];
                     break;
                 case cgltf_attribute_type_texcoord:
+                    out->use_uv = true;
                     vbo_ver[6] = temp[0];
                     vbo_ver[7] = temp[1];
                     break;
@@ -203,6 +324,16 @@ void prim_load_primitive_cgltf(emb_primitive_origin *out, const cgltf_primitive
                     vbo_ver[9] = temp[1];
                     vbo_ver[10] = temp[2];
                     break;
+                case cgltf_attribute_type_joints:
+                    if (out->skin && attr->index == 0) {
+                        unsigned int ids[4] = {0};
+                        cgltf_accessor_read_uint(accessor, i, ids, 4);
+                        for (int k = 0; k < 4; k++) out->skin[i].joints[k] = (uint16_t)ids[k];
+                    }
+                    break;
+                case cgltf_attribute_type_weights:
+                    if (out->skin && attr->index == 0) prim_quantize_weights(temp, out->skin[i].weights);
+                    break;
                 default:
                     break;
             }
@@ -215,6 +346,23 @@ void prim_load_primitive_cgltf(emb_primitive_origin *out, const cgltf_primitive
             out->eb[i] = (uint32_t)cgltf_accessor_read_index(primitive->indices, i);
         }
     }
+
+    emb_primitive_origin_build_meshlets(out);
+}
+
+//frees buffers allocated by the loader (with an arena it does nothing) and meshlets
+void emb_primitive_origin_free(emb_primitive_origin * o){
+    emb_meshlets_free(o->meshlets,o->meshlets_len);
+    o->meshlets = NULL;
+    o->meshlets_len = 0;
+    if(!o->owns_buffers) return;
+    if(o->skin) emb_free(o->allocator, o->skin, o->vb_len / VB_ATTRIB_SIZE_MAX * sizeof(emb_skin_vertex));
+    o->skin = NULL;
+    emb_free(o->allocator, o->vb, o->vb_len * sizeof(float));
+    emb_free(o->allocator, o->eb, o->eb_len * sizeof(uint32_t));
+    o->vb = NULL; o->vb_len = 0;
+    o->eb = NULL; o->eb_len = 0;
+    o->owns_buffers = false;
 }
 
 
@@ -243,10 +391,10 @@ cgltf_data * _model_load_gltf(char * path){
     if(res != cgltf_result_success) return NULL;
 
     res = cgltf_load_buffers(&options,data,path);
-    if(res != cgltf_result_success) return NULL;
+    if(res != cgltf_result_success) {cgltf_free(data); return NULL;}
 
     res = cgltf_validate(data);
-    if(res != cgltf_result_success) return NULL;
+    if(res != cgltf_result_success) {cgltf_free(data); return NULL;}
 
     return data;
 }
@@ -339,9 +487,17 @@ static __uint32_t cube_elements[] = {
 //primitive used for debugging
 emb_primitive_origin emb_debug_rainbow_cube(){
     emb_primitive_origin m;
+    memset(&m.geometry,0,sizeof(m.geometry));
+    m.meshlets = NULL;
+    m.meshlets_len = 0;
+    m.material = 0;
     
     m.vb = rainbow_cube_vertices;
     m.eb = cube_elements;
+    m.skin = NULL;
+    m.skinned = false;
+    m.owns_buffers = false; //static arrays
+    m.allocator = NULL;
     //m.transform   
     m.use_vertex_colors = true;
     m.vb_len = sizeof(rainbow_cube_vertices) / sizeof(float);
@@ -351,12 +507,35 @@ emb_primitive_origin emb_debug_rainbow_cube(){
 
 emb_primitive_origin emb_white_cube(){
     emb_primitive_origin m;
+    memset(&m.geometry,0,sizeof(m.geometry));
+    m.meshlets = NULL;
+    m.meshlets_len = 0;
+    m.material = 0;
     
     m.vb = white_cube_vertices;
     m.eb = cube_elements;
+    m.skin = NULL;
+    m.skinned = false;
+    m.owns_buffers = false; //static arrays
+    m.allocator = NULL;
     //m.transform   
     m.use_vertex_colors = true;
     m.vb_len = sizeof(white_cube_vertices) / sizeof(float);
     m.eb_len = sizeof(cube_elements) / sizeof(__uint32_t);
     return m;
 }
+
+static emb_skin_vertex rainbow_cube_skin[sizeof(rainbow_cube_vertices) / sizeof(float) / VB_ATTRIB_SIZE_MAX];
+
+/*rainbow cube with two joints: the bottom vertices follow joint 0, the top ones joint 1.
+Both joints rest at the origin, so the inverse bind matrices are identity.*/
+emb_primitive_origin emb_debug_skinned_cube(){
+    emb_primitive_origin m = emb_debug_rainbow_cube();
+    for(uint32_t v=0; v<m.vb_len/VB_ATTRIB_SIZE_MAX; ++v){
+        uint16_t joint = rainbow_cube_vertices[v*VB_ATTRIB_SIZE_MAX + 1] > 0.0f;
+        rainbow_cube_skin[v] = (emb_skin_vertex){{joint,0,0,0},{255,0,0,0}};
+    }
+    m.skin = rainbow_cube_skin;
+    m.skinned = true;
+    return m;
+}
@@ -1,23 +1,38 @@
 #pragma once
 
 #include <cglm/cglm.h>
+#include "../utils/allocator.h"
 
 
 
 #define NODE_STATE_NONE 0
 #define NODE_STATE_ACTIVE 1
-#define NODE_STATE_IGNORE 2 
+#define NODE_STATE_IGNORE 2 //the node and its whole subtree are skipped
+
+#define EMB_NODE_CHUNK 256 //nodes per pool chunk
 
 typedef struct emb_node emb_node;
 
 /*node allows to apply recursive transformations 
-to the models on the scene or to each other.*/
+to the models on the scene or to each other.
+Children are linked as a list: first_child -> next_sibling -> ...*/
 typedef struct emb_node {
     uint8_t node_state;
     vec3 pos;
     vec3 rot;
     vec3 scale;
-    emb_node* parent; //reference to the parent in emb_node_pool
+    //state before the last simulation step, rendering interpolates towards pos/rot/scale
+    vec3 prev_pos;
+    vec3 prev_rot;
+    vec3 prev_scale;
+    emb_node* parent; //reference to the parent in emb_node_pool, change via emb_node_set_parent()
+
+    emb_node* first_child;
+    emb_node* next_sibling; //next free node while NODE_STATE_NONE
+    emb_node* prev_sibling;
+
+    uint32_t index; //position in the pool
+    uint32_t generation; //bumped on remove, references taken before stop matching (emb_node_live)
 }emb_node;
 
 
@@ -25,7 +40,13 @@ void emb_node_init(emb_node * n){
     n->pos[0]=0.0f; n->pos[1]=0.0f; n->pos[2]=0.0f;
     n->rot[0]=0.0f; n->rot[1]=0.0f; n->rot[2]=0.0f;
     n->scale[0]=1.0f; n->scale[1]=1.0f; n->scale[2]=1.0f;
+    glm_vec3_copy(n->pos,n->prev_pos);
+    glm_vec3_copy(n->rot,n->prev_rot);
+    glm_vec3_copy(n->scale,n->prev_scale);
     n->parent = NULL;
+    n->first_child = NULL;
+    n->next_sibling = NULL;
+    n->prev_sibling = NULL;
     n->node_state = NODE_STATE_ACTIVE;
 }
 
@@ -46,6 +67,111 @@ void emb_node_get_transform(emb_node * n, mat4 m){
 
 
 
+//call before every simulation step (utils/frameloop.h)
+static inline void emb_node_save_state(emb_node * n){
+    glm_vec3_copy(n->pos,n->prev_pos);
+    glm_vec3_copy(n->rot,n->prev_rot);
+    glm_vec3_copy(n->scale,n->prev_scale);
+}
+
+//transform of the node alone (without parents) between the previous and the current state
+void emb_node_get_local_lerp(emb_node * n, float alpha, mat4 m){
+    vec3 pos, rot, scale;
+    glm_vec3_lerp(n->prev_pos,n->pos,alpha,pos);
+    glm_vec3_lerp(n->prev_rot,n->rot,alpha,rot);
+    glm_vec3_lerp(n->prev_scale,n->scale,alpha,scale);
+
+    glm_mat4_identity(m);
+    glm_euler_xyz(rot,m);
+    glm_scale(m,scale);
+    glm_translated(m,pos);
+}
+
+/*same as emb_node_get_transform, but between the previous
+and the current state, alpha - emb_frame_loop.alpha*/
+void emb_node_get_transform_lerp(emb_node * n, float alpha, mat4 m){
+    emb_node_get_local_lerp(n,alpha,m);
+    if(n->parent != NULL && n->parent->node_state!=NODE_STATE_NONE){
+        mat4 parent_tr;
+        emb_node_get_transform_lerp(n->parent,alpha,parent_tr);
+        glm_mat4_mul(parent_tr,m,m);
+    }
+}
+
+
+
+//__________________________________________________
+// hierarchy
+//__________________________________________________
+
+static void node_unlink(emb_node * n){
+    if(n->prev_sibling) n->prev_sibling->next_sibling = n->next_sibling;
+    else if(n->parent) n->parent->first_child = n->next_sibling;
+    if(n->next_sibling) n->next_sibling->prev_sibling = n->prev_sibling;
+    n->parent = NULL;
+    n->next_sibling = NULL;
+    n->prev_sibling = NULL;
+}
+
+//true if n is inside the subtree of root (or is the root)
+bool emb_node_in_subtree(emb_node * root, emb_node * n){
+    for(; n; n = n->parent) if(n == root) return true;
+    return false;
+}
+
+/*reparents the node with all its children. parent can be NULL.
+Fails if the new parent is inside the node's own subtree.*/
+bool emb_node_set_parent(emb_node * n, emb_node * parent){
+    if(parent && emb_node_in_subtree(n,parent)) return false;
+    node_unlink(n);
+    if(!parent) return true;
+
+    n->parent = parent;
+    n->next_sibling = parent->first_child;
+    if(parent->first_child) parent->first_child->prev_sibling = n;
+    parent->first_child = n;
+    return true;
+}
+
+/*next node of the subtree in depth-first order (pre-order), NULL at the end.
+skip_children - don't go into the children of cur.
+Uses only links, so it needs no stack.*/
+emb_node * emb_node_dfs_next(emb_node * root, emb_node * cur, bool skip_children){
+    if(!skip_children && cur->first_child) return cur->first_child;
+    while(cur != root){
+        if(cur->next_sibling) return cur->next_sibling;
+        cur = cur->parent;
+    }
+    return NULL;
+}
+
+//depth-first iteration which skips NODE_STATE_IGNORE branches
+#define EMB_NODE_FOREACH(root, it) \
+    for(emb_node * it = ((root)->node_state==NODE_STATE_IGNORE) ? NULL : (root); it; \
+        it = emb_node_dfs_next((root),it,false), \
+        it = emb_node_foreach_skip_ignored((root),it))
+
+//helper of EMB_NODE_FOREACH, moves past ignored nodes and their subtrees
+emb_node * emb_node_foreach_skip_ignored(emb_node * root, emb_node * it){
+    while(it && it->node_state == NODE_STATE_IGNORE) it = emb_node_dfs_next(root,it,true);
+    return it;
+}
+
+/*node referenced from outside the pool (primitives, emb_node_ref), NULL once it was removed.
+The free list reuses nodes right away, the pointer alone may already be a different node.*/
+static inline emb_node * emb_node_live(emb_node * n, uint32_t generation){
+    return n && n->generation == generation && n->node_state != NODE_STATE_NONE ? n : NULL;
+}
+
+/*false if the node or any of its parents is ignored or removed.
+Primitives bound to such nodes shouldn't be drawn.*/
+bool emb_node_active(emb_node * n){
+    for(; n; n = n->parent) if(n->node_state != NODE_STATE_ACTIVE) return false;
+    return true;
+}
+
+
+
 
 
 //__________________________________________________
@@ -54,64 +180,142 @@ void emb_node_get_transform(emb_node * n, mat4 m){
 referencing to another nodes in the pool.*/
 typedef struct
 {
-    /*Array will be allocated only once. 
-    Even if realloc will be introduced, 
-    it's gonna be pretty slow.*/
-    emb_node * nodes; 
-    
-    /*optimisation stuff. When new node added, value increases by 1.
-    it will increase, until array is full. If so, it will become 0
-    and start to search for a free place from start*/
-    size_t last_index; 
+    /*Nodes are allocated in chunks of EMB_NODE_CHUNK
+    which are never moved, so emb_node* stays valid
+    when the pool grows.*/
+    emb_node ** chunks; 
+    uint32_t chunks_len;
+    uint32_t chunks_cap;
 
+    emb_node * free_list; //free nodes linked by next_sibling, O(1) push/remove
+
+    size_t len; //nodes in use
     size_t capacity; //measured in number of elements
 
+    emb_allocator * allocator; //NULL - heap
+
 }emb_node_pool;
 
 
-void emb_node_pool_init(emb_node_pool * np, size_t capacity){
-    np->nodes = malloc(capacity*sizeof(emb_node));
-    for(uint32_t i=0; i<capacity; ++i) np->nodes[i].node_state = NODE_STATE_NONE;
-    np->capacity = capacity;
-    np->last_index = 0;
+static bool node_pool_grow(emb_node_pool * np){
+    if(np->chunks_len >= np->chunks_cap){
+        uint32_t cap = np->chunks_cap ? np->chunks_cap*2 : 4;
+        emb_node ** chunks = emb_realloc(np->allocator,np->chunks,
+            np->chunks_cap*sizeof(emb_node*),cap*sizeof(emb_node*));
+        if(!chunks) return false;
+        np->chunks = chunks;
+        np->chunks_cap = cap;
+    }
+    emb_node * chunk = emb_alloc(np->allocator,EMB_NODE_CHUNK*sizeof(emb_node));
+    if(!chunk) return false;
+
+    //linked backwards, so nodes are taken in index order
+    uint32_t base = np->chunks_len*EMB_NODE_CHUNK;
+    for(uint32_t i=EMB_NODE_CHUNK; i>0; --i){
+        emb_node * n = &chunk[i-1];
+        n->node_state = NODE_STATE_NONE;
+        n->index = base + i-1;
+        n->generation = 0;
+        n->next_sibling = np->free_list;
+        np->free_list = n;
+    }
+    np->chunks[np->chunks_len++] = chunk;
+    np->capacity += EMB_NODE_CHUNK;
+    return true;
+}
+
+/*capacity - initial number of nodes, the pool grows by chunks when it's full*/
+void emb_node_pool_init(emb_node_pool * np, size_t capacity, emb_allocator * allocator){
+    np->allocator = allocator ? allocator : EMB_MEM_HEAP(EMB_MEM_NODES);
+    np->chunks = NULL;
+    np->chunks_len = 0;
+    np->chunks_cap = 0;
+    np->free_list = NULL;
+    np->len = 0;
+    np->capacity = 0;
+    while(np->capacity < capacity && node_pool_grow(np));
+}
+
+
+emb_node * emb_node_pool_get(emb_node_pool * np, int32_t index){
+    if(index<0 || index>=np->capacity) return NULL;
+    emb_node * n = &np->chunks[index/EMB_NODE_CHUNK][index%EMB_NODE_CHUNK];
+    return n->node_state==NODE_STATE_NONE ? NULL : n;
+}
+
+
+static emb_node * node_leftmost_leaf(emb_node * n){
+    while(n->first_child) n = n->first_child;
+    return n;
 }
 
+/*removes the node together with its whole subtree (cascade).
+Removed nodes get a new generation, primitives bound to them
+(prim_inst_set_parent) lose the parent transform, even after
+the node is reused by emb_node_pool_push.*/
+void emb_node_pool_remove(emb_node_pool * np, emb_node * n){
+    if(!n || n->node_state == NODE_STATE_NONE) return;
+    node_unlink(n);
+
+    /*post-order: children are released before their parent,
+    so links of a node are read before it goes to the free list*/
+    emb_node * it = node_leftmost_leaf(n);
+    while(it){
+        emb_node * next;
+        if(it == n) next = NULL;
+        else if(it->next_sibling) next = node_leftmost_leaf(it->next_sibling);
+        else next = it->parent;
+
+        it->node_state = NODE_STATE_NONE;
+        ++it->generation;
+        it->parent = NULL; it->first_child = NULL; it->prev_sibling = NULL;
+        it->next_sibling = np->free_list;
+        np->free_list = it;
+        --np->len;
+        it = next;
+    }
+}
 
 void emb_node_pool_remove_node(emb_node_pool * np, size_t index){
-    if(index>=np->capacity) return;
-    np->nodes[index].node_state = NODE_STATE_NONE;
+    emb_node_pool_remove(np,emb_node_pool_get(np,(int32_t)index));
 }
 
 
 emb_node * emb_node_pool_push(emb_node_pool * np){
-    if(np->last_index < np->capacity && np->nodes[np->last_index].node_state == NODE_STATE_NONE){ //if has free space at back
-        emb_node_init(&np->nodes[np->last_index]); 
-        ++np->last_index; //increase last index
-        return &np->nodes[np->last_index-1];
-    }
-    else{ //if array is full, try to find saome free space from start
-        np->last_index = 0;
-        while (np->last_index < np->capacity)
-        {
-            if(np->nodes[np->last_index].node_state == NODE_STATE_NONE){
-                emb_node_init(&np->nodes[np->last_index]); 
-                ++np->last_index;
-                return &np->nodes[np->last_index-1];
-            }
-            ++np->last_index;
-        }
-        return NULL; //no free space, failed to add new node
-    }
+    if(!np->free_list && !node_pool_grow(np)) return NULL; //failed to add new node
+    emb_node * n = np->free_list;
+    np->free_list = n->next_sibling;
+    emb_node_init(n);
+    ++np->len;
+    return n;
 }
 
-emb_node * emb_node_pool_get(emb_node_pool * np, int32_t index){
-    if(index<0 || index>=np->capacity || np->nodes[index].node_state==NODE_STATE_NONE) return NULL;
-    return &np->nodes[index];
+
+//saves the state of every node in use, call before every simulation step
+void emb_node_pool_save_state(emb_node_pool * np){
+    for(uint32_t c=0; c<np->chunks_len; ++c){
+        emb_node * chunk = np->chunks[c];
+        for(uint32_t i=0; i<EMB_NODE_CHUNK; ++i)
+            if(chunk[i].node_state != NODE_STATE_NONE) emb_node_save_state(&chunk[i]);
+    }
 }
 
 
+//samples the fill ratio of the pool (utils/memstats.h)
+static inline void emb_node_pool_track(emb_node_pool * np, const char * name){
+    EMB_MEM_FILL(name,np->len,np->capacity);
+}
+
 void emb_node_pool_free(emb_node_pool * np){
-    free(np->nodes);
+    for(uint32_t i=0; i<np->chunks_len; ++i)
+        emb_free(np->allocator,np->chunks[i],EMB_NODE_CHUNK*sizeof(emb_node));
+    emb_free(np->allocator,np->chunks,np->chunks_cap*sizeof(emb_node*));
+    np->chunks = NULL;
+    np->chunks_len = 0;
+    np->chunks_cap = 0;
+    np->free_list = NULL;
+    np->len = 0;
+    np->capacity = 0;
 }
 
 
@@ -0,0 +1,197 @@
+/*______________________________________
+skin - joint palettes for GPU skinning
+
+A glTF skin is a list of joints (nodes) with their inverse bind matrices.
+Joint nodes live in the node pool like any other node (emb_nodes_load_cgltf)
+and are animated by emb_anim_player, the skin only references them.
+
+Every frame each skinned instance appends its palette
+(world(joint) * inverse_bind for every joint) to one shared table,
+the table is uploaded into a single SSBO. A draw record carries the first
+matrix of its palette, the vertex shader blends 4 matrices per vertex,
+so any number of skinned instances still go into the same multi-draw.
+
+Joints are walked parent-first: the world matrix of a joint is the one
+of its parent (already in the table) times its local transform,
+a skeleton costs one matrix product per joint.
+______________________________________*/
+#pragma once
+
+#include <glad/gl.h>
+#include <cglm/cglm.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include "node.h"
+#include "model.h"
+#include "../utils/allocator.h"
+
+
+#define EMB_SKIN_MAX_MATRICES 8192 //palette table (SSBO) size, shared by all instances
+#define EMB_SKIN_BINDING 5 //same as in shaders/vertex.glsl
+#define EMB_SKIN_NONE 0xFFFFFFFFu
+
+
+//joints of a glTF skin, shared by all instances of the skinned mesh
+typedef struct emb_skin{
+    mat4 * inverse_bind; //per joint
+    uint32_t * nodes; //glTF node index of the joint
+    int32_t * parents; //joint index of the parent, -1 - parent isn't a joint
+    uint32_t * order; //joint indices, parents before children
+    uint32_t joints_len;
+    emb_allocator * allocator;
+} emb_skin;
+
+//palettes of the frame, reset before the instances are added
+typedef struct{
+    mat4 * matrices; //EMB_SKIN_MAX_MATRICES
+    uint32_t len;
+    GLuint ssbo; //0 until emb_skin_palettes_gl_init
+} emb_skin_palettes;
+
+
+static size_t skin_block_size(uint32_t joints){
+    return joints*(sizeof(mat4) + 3*sizeof(uint32_t));
+}
+
+void emb_skin_free(emb_skin * s){
+    if(s->inverse_bind) emb_free(s->allocator,s->inverse_bind,skin_block_size(s->joints_len));
+    memset(s,0,sizeof(*s));
+}
+
+//vertex joints index the joint list, a bad index would read another instance's palette
+static bool skin_joints_valid(const emb_primitive_origin * o, uint32_t primitive, uint32_t joints){
+    if(!o->skin) return true;
+    uint32_t vertices = o->vb_len/VB_ATTRIB_SIZE_MAX;
+    for(uint32_t v=0; v<vertices; ++v)
+        for(uint32_t k=0; k<4; ++k)
+            if(o->skin[v].joints[k] >= joints){
+                printf("ERROR emb_skin_load_cgltf(): vertex %u of primitive %u uses joint %u, the skin has %u.\n",v,primitive,o->skin[v].joints[k],joints);
+                return false;
+            }
+    return true;
+}
+
+/*joint indices sorted parent-first in one pass: joints are bucketed by parent
+(counting sort), then the buckets are appended breadth first starting with the roots.
+Joints not reached from a root are in a cycle.*/
+static bool skin_sort_joints(emb_skin * s){
+    uint32_t n = s->joints_len;
+    uint32_t * start = (uint32_t*)calloc(n+2,sizeof(uint32_t)); //bucket of parent p at start[p+1], roots at start[0]
+    uint32_t * by_parent = (uint32_t*)malloc(n*sizeof(uint32_t));
+    if(!start || !by_parent) {free(start); free(by_parent); return false;}
+    for(uint32_t j=0; j<n; ++j) ++start[s->parents[j]+2];
+    for(uint32_t b=0; b<=n; ++b) start[b+1] += start[b];
+    for(uint32_t j=0; j<n; ++j) by_parent[start[s->parents[j]+1]++] = j;
+    //start[b] is the end of bucket b now, its begin is start[b-1] (0 for the roots)
+
+    uint32_t placed = 0;
+    for(uint32_t i=0; i<start[0]; ++i) s->order[placed++] = by_parent[i];
+    for(uint32_t i=0; i<placed; ++i){
+        uint32_t j = s->order[i];
+        for(uint32_t k=start[j]; k<start[j+1]; ++k) s->order[placed++] = by_parent[k];
+    }
+    free(start);
+    free(by_parent);
+    return placed == n;
+}
+
+/*primitives - origins of the mesh the skin deforms, their vertex joints are checked.
+allocator - NULL uses the heap*/
+bool emb_skin_load_cgltf(emb_skin * out, const cgltf_data * data, const cgltf_skin * skin, const emb_primitive_origin * primitives, uint32_t primitives_len, emb_allocator * allocator){
+    memset(out,0,sizeof(*out));
+    if(!allocator) allocator = EMB_MEM_HEAP(EMB_MEM_ANIM);
+    uint32_t n = (uint32_t)skin->joints_count;
+    if(!n || n > 0x10000) {printf("ERROR emb_skin_load_cgltf(): %s has %u joints.\n",skin->name ? skin->name : "skin",n); return false;}
+    for(uint32_t i=0; i<primitives_len; ++i) if(!skin_joints_valid(&primitives[i],i,n)) return false;
+
+    //one block: matrices first, they keep the alignment
+    out->inverse_bind = (mat4*)emb_alloc(allocator,skin_block_size(n));
+    if(!out->inverse_bind) {printf("ERROR emb_skin_load_cgltf(): out of memory.\n"); return false;}
+    out->nodes = (uint32_t*)(out->inverse_bind + n);
+    out->parents = (int32_t*)(out->nodes + n);
+    out->order = (uint32_t*)(out->parents + n);
+    out->joints_len = n;
+    out->allocator = allocator;
+
+    //glTF node -> joint, so parents are found without searching the joint list
+    int32_t * joint_of = (int32_t*)malloc(data->nodes_count*sizeof(int32_t));
+    if(!joint_of) {printf("ERROR emb_skin_load_cgltf(): out of memory.\n"); emb_skin_free(out); return false;}
+    for(cgltf_size i=0; i<data->nodes_count; ++i) joint_of[i] = -1;
+    for(uint32_t j=0; j<n; ++j){
+        out->nodes[j] = (uint32_t)cgltf_node_index(data,skin->joints[j]);
+        joint_of[out->nodes[j]] = (int32_t)j;
+    }
+    for(uint32_t j=0; j<n; ++j){
+        if(skin->inverse_bind_matrices) cgltf_accessor_read_float(skin->inverse_bind_matrices,j,(float*)out->inverse_bind[j],16);
+        else glm_mat4_identity(out->inverse_bind[j]);
+        const cgltf_node * parent = skin->joints[j]->parent;
+        out->parents[j] = parent ? joint_of[cgltf_node_index(data,parent)] : -1;
+    }
+    free(joint_of);
+
+    if(!skin_sort_joints(out)) {printf("ERROR emb_skin_load_cgltf(): joint hierarchy has a cycle.\n"); emb_skin_free(out); return false;}
+    return true;
+}
+
+
+
+//__________________________________________________
+// palettes
+//__________________________________________________
+
+bool emb_skin_palettes_init(emb_skin_palettes * p){
+    p->len = 0;
+    p->ssbo = 0;
+    p->matrices = (mat4*)malloc(EMB_SKIN_MAX_MATRICES*sizeof(mat4));
+    if(!p->matrices) {printf("ERROR emb_skin_palettes_init(): out of memory.\n"); return false;}
+    EMB_MEM_ALLOC(EMB_MEM_RENDER,EMB_SKIN_MAX_MATRICES*sizeof(mat4));
+    return true;
+}
+
+void emb_skin_palettes_gl_init(emb_skin_palettes * p){
+    glCreateBuffers(1,&p->ssbo);
+    glNamedBufferStorage(p->ssbo,EMB_SKIN_MAX_MATRICES*sizeof(mat4),NULL,GL_DYNAMIC_STORAGE_BIT);
+    EMB_MEM_GPU_SET(EMB_GPU_BUFFER,p->ssbo,"skin palettes",EMB_SKIN_MAX_MATRICES*sizeof(mat4));
+}
+
+//call once per frame before the instances are added
+static inline void emb_skin_palettes_reset(emb_skin_palettes * p){
+    p->len = 0;
+}
+
+/*appends the palette of one skinned instance.
+nodes - emb_node per glTF node index (emb_nodes_load_cgltf), alpha - emb_frame_loop.alpha.
+Returns the first matrix for emb_draw_batch_add_skinned, EMB_SKIN_NONE when the table is full.*/
+uint32_t emb_skin_palettes_add(emb_skin_palettes * p, const emb_skin * s, emb_node ** nodes, float alpha){
+    if(p->len + s->joints_len > EMB_SKIN_MAX_MATRICES) {printf("ERROR emb_skin_palettes_add(): palette table is full.\n"); return EMB_SKIN_NONE;}
+    uint32_t first = p->len;
+    mat4 * out = p->matrices + first;
+
+    //world matrices of the joints
+    for(uint32_t i=0; i<s->joints_len; ++i){
+        uint32_t j = s->order[i];
+        emb_node * n = nodes[s->nodes[j]];
+        if(s->parents[j] < 0) emb_node_get_transform_lerp(n,alpha,out[j]);
+        else{
+            mat4 local;
+            emb_node_get_local_lerp(n,alpha,local);
+            glm_mat4_mul(out[s->parents[j]],local,out[j]);
+        }
+    }
+    //only now, children needed the world matrices of their parents
+    for(uint32_t j=0; j<s->joints_len; ++j) glm_mat4_mul(out[j],s->inverse_bind[j],out[j]);
+
+    p->len += s->joints_len;
+    return first;
+}
+
+void emb_skin_palettes_free(emb_skin_palettes * p){
+    if(p->ssbo) {EMB_MEM_GPU_RELEASE(EMB_GPU_BUFFER,p->ssbo); glDeleteBuffers(1,&p->ssbo);}
+    if(p->matrices) EMB_MEM_FREE(EMB_MEM_RENDER,EMB_SKIN_MAX_MATRICES*sizeof(mat4));
+    free(p->matrices);
+    p->matrices = NULL;
+    p->ssbo = 0;
+    p->len = 0;
+}
@@ -0,0 +1,126 @@
+/*______________________________________
+oit - weighted blended order-independent transparency
+
+Transparent geometry is drawn in one unsorted batch after the opaque pass
+(McGuire and Bavoil, "Weighted Blended Order-Independent Transparency"):
+- accumulation (RGBA16F) sums premultiplied color * weight and alpha * weight
+- revealage (R8) multiplies (1 - alpha), the part of the background left visible
+The weight falls off with depth, so nearer surfaces dominate without sorting.
+A full screen composite divides the sums and blends them over the scene.
+
+The pass tests against the scene depth, but doesn't write it.
+Materials with EMB_MATERIAL_SORTED are the exception for the few cases
+where the approximation is visible (nested glass, text): they are sorted
+back to front on the CPU and alpha blended after the composite.
+______________________________________*/
+#pragma once
+
+#include <glad/gl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "render.h"
+
+
+#define EMB_OIT_ACCUM_UNIT (EMB_TEXTURE_UNIT + EMB_TEXTURE_BUCKETS) //after the material arrays
+#define EMB_OIT_REVEALAGE_UNIT (EMB_OIT_ACCUM_UNIT + 1)
+
+//shaders/fragment.glsl "transparency" uniform
+typedef enum{
+    EMB_TRANSPARENCY_OPAQUE = 0,
+    EMB_TRANSPARENCY_WEIGHTED = 1,
+    EMB_TRANSPARENCY_SORTED = 2,
+} emb_transparency_mode;
+
+typedef struct{
+    GLuint fbo;
+    GLuint accum;
+    GLuint revealage;
+    uint32_t width;
+    uint32_t height;
+} emb_oit;
+
+
+
+//__________________________________________________
+// GL thread
+//__________________________________________________
+
+//targets of the scene size, the depth of the scene is attached for testing
+bool emb_oit_init(emb_oit * o, const emb_render_target * scene){
+    memset(o,0,sizeof(*o));
+    o->width = scene->width;
+    o->height = scene->height;
+    glCreateTextures(GL_TEXTURE_2D,1,&o->accum);
+    glTextureStorage2D(o->accum,1,GL_RGBA16F,(GLsizei)o->width,(GLsizei)o->height);
+    glCreateTextures(GL_TEXTURE_2D,1,&o->revealage);
+    glTextureStorage2D(o->revealage,1,GL_R8,(GLsizei)o->width,(GLsizei)o->height);
+    EMB_MEM_GPU_SET(EMB_GPU_TEXTURE,o->accum,"oit accum",(uint64_t)o->width*o->height*8);
+    EMB_MEM_GPU_SET(EMB_GPU_TEXTURE,o->revealage,"oit revealage",(uint64_t)o->width*o->height);
+
+    glCreateFramebuffers(1,&o->fbo);
+    glNamedFramebufferTexture(o->fbo,GL_COLOR_ATTACHMENT0,o->accum,0);
+    glNamedFramebufferTexture(o->fbo,GL_COLOR_ATTACHMENT1,o->revealage,0);
+    glNamedFramebufferTexture(o->fbo,GL_DEPTH_ATTACHMENT,scene->depth,0);
+    GLenum buffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glNamedFramebufferDrawBuffers(o->fbo,2,buffers);
+    if(glCheckNamedFramebufferStatus(o->fbo,GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE){
+        printf("ERROR emb_oit_init(): incomplete framebuffer %ux%u.\n",o->width,o->height);
+        return false;
+    }
+    return true;
+}
+
+void emb_oit_free(emb_oit * o){
+    if(o->fbo) glDeleteFramebuffers(1,&o->fbo);
+    if(o->accum) {EMB_MEM_GPU_RELEASE(EMB_GPU_TEXTURE,o->accum); glDeleteTextures(1,&o->accum);}
+    if(o->revealage) {EMB_MEM_GPU_RELEASE(EMB_GPU_TEXTURE,o->revealage); glDeleteTextures(1,&o->revealage);}
+    memset(o,0,sizeof(*o));
+}
+
+
+
+//__________________________________________________
+// recording
+//__________________________________________________
+
+/*clears the targets and switches to the accumulation pass. Program and
+geometry of the scene stay, draw the transparent batch after this.
+width, height - rendered part of the scene (dynres.h), at most its size*/
+void emb_cmd_oit_begin(emb_cmd_list * cl, const emb_oit * o, uint32_t width, uint32_t height){
+    emb_cmd_target(cl,o->fbo,width,height);
+    emb_cmd_clear_buffer(cl,o->fbo,0,0.0f,0.0f,0.0f,0.0f);
+    emb_cmd_clear_buffer(cl,o->fbo,1,1.0f,0.0f,0.0f,0.0f);
+    //foliage and particles are seen from both sides
+    emb_cmd_state(cl,EMB_STATE_DEPTH_TEST | EMB_STATE_NO_DEPTH_WRITE | EMB_STATE_BLEND_OIT);
+    emb_cmd_uniform_int(cl,"transparency",EMB_TRANSPARENCY_WEIGHTED);
+}
+
+/*blends the accumulated color over the scene with the composite program
+(shaders/fullscreen.glsl + shaders/oit_composite.glsl).
+The scene program and geometry have to be set again after this*/
+void emb_cmd_oit_composite(emb_cmd_list * cl, const emb_oit * o, const emb_render_target * scene, uint32_t width, uint32_t height, uint32_t composite_program){
+    emb_cmd_target(cl,scene->fbo,width,height);
+    emb_cmd_state(cl,EMB_STATE_NO_DEPTH_WRITE | EMB_STATE_BLEND_ALPHA);
+    emb_cmd_program(cl,composite_program);
+    emb_cmd_texture(cl,EMB_OIT_ACCUM_UNIT,o->accum);
+    emb_cmd_texture(cl,EMB_OIT_REVEALAGE_UNIT,o->revealage);
+    emb_cmd_fullscreen(cl);
+}
+
+//alpha blending in submission order, draw the batch of sorted instances after this
+void emb_cmd_sorted_begin(emb_cmd_list * cl){
+    emb_cmd_state(cl,EMB_STATE_DEPTH_TEST | EMB_STATE_NO_DEPTH_WRITE | EMB_STATE_BLEND_ALPHA);
+    emb_cmd_uniform_int(cl,"transparency",EMB_TRANSPARENCY_SORTED);
+}
+
+static int oit_sort_compare(const void * a, const void * b){
+    float da = ((const emb_sort_key*)a)->depth, db = ((const emb_sort_key*)b)->depth;
+    return (da < db) - (da > db);
+}
+
+//farthest first, depth - distance along the view direction
+static inline void emb_sort_back_to_front(emb_sort_key * keys, uint32_t n){
+    if(n > 1) qsort(keys,n,sizeof(emb_sort_key),oit_sort_compare);
+}
@@ -0,0 +1,103 @@
+/*______________________________________
+overdraw - shaded fragment counter (debug)
+
+While the counter is on, every fragment the scene program shades
+increments one atomic in an SSBO (shaders/fragment.glsl "overdraw").
+Depth is tested before shading (early_fragment_tests), so the count is
+the real fragment work of the pass: with the depth pre-pass it falls
+to about one fragment per covered pixel.
+
+Counters are cycled through EMB_OVERDRAW_FRAMES buffers, a counter is
+read back only when it comes around again, so the GPU has finished it
+and the read doesn't stall. The render thread prints the average
+fragments per pixel every EMB_OVERDRAW_PRINT_FRAMES counted frames.
+The pixel count of a frame is stored when it is recorded, the render size
+can change every frame (dynres.h).
+______________________________________*/
+#pragma once
+
+#include <glad/gl.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include "render.h"
+
+
+#define EMB_OVERDRAW_BINDING 6 //same as in shaders/fragment.glsl
+#define EMB_OVERDRAW_FRAMES 4 //counters in flight
+#define EMB_OVERDRAW_PRINT_FRAMES 240
+#define EMB_OVERDRAW_PIXEL_FRAMES (2*EMB_OVERDRAW_FRAMES) //read back frames + recorded ahead of the replay
+
+/*owned by the render thread after emb_overdraw_init, except pixels and recorded:
+recording stays less than EMB_OVERDRAW_FRAMES frames ahead of the replay (frames in flight)*/
+typedef struct{
+    GLuint counters[EMB_OVERDRAW_FRAMES];
+    uint64_t pixels[EMB_OVERDRAW_PIXEL_FRAMES]; //rendered pixels of the frame, by counted frame
+    uint32_t recorded; //recorded counted frames
+    uint32_t frame; //counted frames
+    uint64_t fragments; //read back since the last print
+    uint64_t counted_pixels;
+    uint32_t samples;
+} emb_overdraw;
+
+
+
+//__________________________________________________
+// GL thread
+//__________________________________________________
+
+void emb_overdraw_init(emb_overdraw * o){
+    memset(o,0,sizeof(*o));
+    glCreateBuffers(EMB_OVERDRAW_FRAMES,o->counters);
+    for(uint32_t i=0; i<EMB_OVERDRAW_FRAMES; ++i){
+        glNamedBufferStorage(o->counters[i],sizeof(uint32_t),NULL,GL_DYNAMIC_STORAGE_BIT);
+        EMB_MEM_GPU_SET(EMB_GPU_BUFFER,o->counters[i],"overdraw counter",sizeof(uint32_t));
+    }
+}
+
+void emb_overdraw_free(emb_overdraw * o){
+    for(uint32_t i=0; i<EMB_OVERDRAW_FRAMES; ++i) if(o->counters[i]) EMB_MEM_GPU_RELEASE(EMB_GPU_BUFFER,o->counters[i]);
+    if(o->counters[0]) glDeleteBuffers(EMB_OVERDRAW_FRAMES,o->counters);
+    memset(o,0,sizeof(*o));
+}
+
+//render thread: reads the counter written EMB_OVERDRAW_FRAMES frames ago, clears and binds it
+static void overdraw_next(void * user){
+    emb_overdraw * o = (emb_overdraw*)user;
+    uint32_t slot = o->frame % EMB_OVERDRAW_FRAMES;
+    GLuint counter = o->counters[slot];
+    if(o->frame >= EMB_OVERDRAW_FRAMES){
+        uint32_t fragments = 0;
+        glGetNamedBufferSubData(counter,0,sizeof(fragments),&fragments);
+        o->fragments += fragments;
+        o->counted_pixels += o->pixels[(o->frame - EMB_OVERDRAW_FRAMES) % EMB_OVERDRAW_PIXEL_FRAMES];
+        if(++o->samples == EMB_OVERDRAW_PRINT_FRAMES){
+            printf("overdraw: %.2f shaded fragments per pixel\n",(double)o->fragments/(double)o->counted_pixels);
+            o->fragments = 0;
+            o->counted_pixels = 0;
+            o->samples = 0;
+        }
+    }
+    uint32_t zero = 0;
+    glNamedBufferSubData(counter,0,sizeof(zero),&zero);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER,EMB_OVERDRAW_BINDING,counter);
+    ++o->frame;
+}
+
+
+
+//__________________________________________________
+// recording
+//__________________________________________________
+
+/*fragments of the scene program drawn until emb_cmd_overdraw_end are counted,
+the scene program has to be bound. width, height - rendered part of the target*/
+void emb_cmd_overdraw_begin(emb_cmd_list * cl, emb_overdraw * o, uint32_t width, uint32_t height){
+    o->pixels[o->recorded++ % EMB_OVERDRAW_PIXEL_FRAMES] = (uint64_t)width*height;
+    emb_cmd_callback(cl,overdraw_next,o);
+    emb_cmd_uniform_int(cl,"overdraw",1);
+}
+
+static inline void emb_cmd_overdraw_end(emb_cmd_list * cl){
+    emb_cmd_uniform_int(cl,"overdraw",0);
+}
@@ -0,0 +1,839 @@
+/*______________________________________
+render - command lists replayed by a render thread
+
+The game thread records compact commands (draw ranges, matrices, state,
+buffer data) into a command list, the render thread owns the GL context
+and replays the previous frame's list while the next one is recorded:
+
+    emb_renderer_begin(&renderer); //paces the frame, then sample input
+    emb_cmd_list * cl = emb_renderer_list(&renderer);
+    emb_cmd_uniform_mat4(cl,"view",view);
+    emb_cmd_draw(cl,model,&inst->geometry,inst->material);
+    emb_renderer_submit(&renderer); //waits only if the render thread is a frame behind
+
+Commands don't hold GL state, uniforms are set by name and every piece
+of data is copied into the list, so nothing recorded has to outlive
+emb_renderer_submit. Callbacks run on the render thread for work that
+needs the GL context (asset uploads), data they touch belongs to the
+render thread while it runs.
+______________________________________*/
+#pragma once
+
+#include <SDL3/SDL.h>
+#include <glad/gl.h>
+#include <cglm/cglm.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include "utils/framepacing.h"
+#include "utils/profiler.h"
+#include "utils/vector.h"
+#include "model/light.h"
+#include "model/model.h"
+#include "model/material.h"
+#include "model/skin.h"
+
+
+#define EMB_CMD_ALIGN 8
+#define EMB_RENDER_UNIFORM_CACHE 64 //resolved uniform locations per renderer
+#define EMB_DRAW_RECORD_BINDING 4
+
+typedef enum{
+    EMB_CMD_CLEAR,
+    EMB_CMD_STATE,
+    EMB_CMD_PROGRAM,
+    EMB_CMD_GEOMETRY,
+    EMB_CMD_UNIFORM,
+    EMB_CMD_UNIFORM_INT,
+    EMB_CMD_BUFFER_DATA,
+    EMB_CMD_BIND_STORAGE,
+    EMB_CMD_DRAW,
+    EMB_CMD_DRAW_BATCH,
+    EMB_CMD_CALLBACK,
+    EMB_CMD_TARGET,
+    EMB_CMD_CLEAR_BUFFER,
+    EMB_CMD_TEXTURE,
+    EMB_CMD_FULLSCREEN,
+    EMB_CMD_BLIT,
+    EMB_CMD_REDRAW_BATCH,
+} emb_cmd_type;
+
+typedef enum{
+    EMB_CLEAR_COLOR = 1,
+    EMB_CLEAR_DEPTH = 2,
+} emb_clear_bits;
+
+typedef enum{
+    EMB_STATE_DEPTH_TEST = 1,
+    EMB_STATE_CULL_BACK = 2,
+    EMB_STATE_NO_DEPTH_WRITE = 4,
+    EMB_STATE_BLEND_ALPHA = 8, //src alpha, 1 - src alpha
+    EMB_STATE_BLEND_OIT = 16, //buffer 0 additive, buffer 1 multiplied by 1 - src (oit.h)
+    EMB_STATE_DEPTH_EQUAL = 32, //only fragments at the stored depth pass (after a depth pre-pass)
+    EMB_STATE_NO_COLOR_WRITE = 64,
+} emb_state_bits;
+
+typedef void (*emb_cmd_fn)(void * user);
+
+//every command starts with a header, size includes the header and padding
+typedef struct{
+    uint32_t type;
+    uint32_t size;
+} emb_cmd_header;
+
+typedef struct{ emb_cmd_header h; float color[4]; uint32_t bits; } emb_cmd_clear_t;
+typedef struct{ emb_cmd_header h; uint32_t bits; } emb_cmd_state_t;
+typedef struct{ emb_cmd_header h; uint32_t program; } emb_cmd_program_t;
+typedef struct{ emb_cmd_header h; uint32_t vertex_array; } emb_cmd_geometry_t;
+typedef struct{ emb_cmd_header h; const char * name; uint32_t floats; float v[16]; } emb_cmd_uniform_t; //1-4 floats or a mat4
+typedef struct{ emb_cmd_header h; uint32_t buffer; uint32_t size; size_t offset; } emb_cmd_buffer_data_t; //data follows
+typedef struct{ emb_cmd_header h; uint32_t binding; uint32_t buffer; } emb_cmd_bind_storage_t;
+typedef struct{ emb_cmd_header h; float model[16]; emb_geometry_range geometry; uint32_t material; } emb_cmd_draw_t; //model unaligned
+typedef struct{ emb_cmd_header h; uint32_t records; uint32_t draws[2]; uint32_t pad; } emb_cmd_draw_batch_t; //records, then 16 and 32 bit draws follow
+typedef struct{ emb_cmd_header h; const char * name; int32_t v; } emb_cmd_uniform_int_t;
+typedef struct{ emb_cmd_header h; emb_cmd_fn fn; void * user; } emb_cmd_callback_t;
+typedef struct{ emb_cmd_header h; uint32_t fbo; uint32_t width; uint32_t height; } emb_cmd_target_t;
+typedef struct{ emb_cmd_header h; uint32_t fbo; uint32_t draw_buffer; float v[4]; } emb_cmd_clear_buffer_t;
+typedef struct{ emb_cmd_header h; uint32_t unit; uint32_t texture; } emb_cmd_texture_t;
+typedef struct{ emb_cmd_header h; uint32_t src; uint32_t dst; uint32_t src_size[2]; uint32_t dst_size[2]; uint32_t linear; } emb_cmd_blit_t;
+
+
+//model and material of one instance in a batch, std430 (shaders/vertex.glsl)
+typedef struct{
+    float model[16];
+    uint32_t material;
+    uint32_t skin; //first palette matrix + 1 (model/skin.h), 0 - not skinned
+    uint32_t pad[2];
+} emb_draw_record;
+
+//as glMultiDrawElementsIndirect reads it, base_instance is the record
+typedef struct{
+    uint32_t count;
+    uint32_t instance_count;
+    uint32_t first_index;
+    int32_t base_vertex;
+    uint32_t base_instance;
+} emb_draw_indirect;
+
+_Static_assert(sizeof(emb_cmd_draw_batch_t) % 8 == 0 && sizeof(emb_draw_record) % 8 == 0, "batch data has to stay aligned");
+
+EMB_VEC_DEFINE(emb_draw_record, vec_draw_record)
+EMB_VEC_DEFINE(emb_draw_indirect, vec_draw_indirect)
+
+/*instances of any origin and material drawn by one multi-draw
+per index size, memory is kept between frames*/
+typedef struct{
+    vec_draw_record records;
+    vec_draw_indirect draws[2]; //16 and 32 bit indices
+} emb_draw_batch;
+
+#define EMB_DEPTH_BUCKETS 32 //front to back order of opaque instances
+
+//instance with its distance along the view direction, sorted for drawing
+typedef struct{
+    float depth;
+    uint32_t index;
+} emb_sort_key;
+
+
+//offscreen color + depth, the scene is drawn here and blitted to the window
+typedef struct{
+    GLuint fbo;
+    GLuint color; //RGBA8 texture
+    GLuint depth; //DEPTH_COMPONENT32F texture, shared with passes drawn on top (oit.h)
+    uint32_t width;
+    uint32_t height;
+} emb_render_target;
+
+
+//growing byte buffer, memory is kept between frames
+typedef struct{
+    uint8_t * data;
+    size_t len;
+    size_t cap;
+    uint32_t count;
+} emb_cmd_list;
+
+
+typedef struct{
+    uint32_t program;
+    const char * name;
+    GLint location;
+} render_uniform_slot;
+
+typedef struct{
+    SDL_Window * window;
+    SDL_GLContext context;
+    SDL_Thread * thread;
+    SDL_Semaphore * filled; //game -> render, a list is ready
+    SDL_Semaphore * consumed; //render -> game, the previous list is replayed
+    SDL_Semaphore * paced; //render -> game, the replayed frame is done waiting for the GPU
+    _Atomic bool quit;
+
+    emb_cmd_list lists[2];
+    uint32_t recording; //list of the game thread
+    uint32_t replaying; //list of the render thread
+
+    uint32_t frames_in_flight;
+    uint32_t target_fps;
+    emb_frame_pacer pacer; //render thread only, fences and GPU timing
+    emb_frame_limiter limiter; //game thread, sleeps to target_fps before input
+    bool begun; //game thread, emb_renderer_begin was called this frame
+    uint64_t submitted; //game thread
+    uint64_t frames;
+
+    //render thread state
+    uint32_t program;
+    GLint model_location;
+    GLint batch_location; //"draw_batch", 1 while a batch is drawn
+    GLuint batch_records; //streamed per batch
+    GLuint batch_draws;
+    uint32_t batch_draws_len[2]; //draws of the last batch, for EMB_CMD_REDRAW_BATCH
+    GLuint empty_vao; //full screen triangles take vertices from gl_VertexID
+    uint32_t state; //last emb_state_bits
+    render_uniform_slot uniforms[EMB_RENDER_UNIFORM_CACHE];
+    uint32_t uniforms_len;
+} emb_renderer;
+
+
+
+//__________________________________________________
+// render targets (GL thread)
+//__________________________________________________
+
+bool emb_render_target_init(emb_render_target * t, uint32_t width, uint32_t height){
+    memset(t,0,sizeof(*t));
+    t->width = width;
+    t->height = height;
+    glCreateTextures(GL_TEXTURE_2D,1,&t->color);
+    glTextureStorage2D(t->color,1,GL_RGBA8,(GLsizei)width,(GLsizei)height);
+    glCreateTextures(GL_TEXTURE_2D,1,&t->depth);
+    glTextureStorage2D(t->depth,1,GL_DEPTH_COMPONENT32F,(GLsizei)width,(GLsizei)height);
+    EMB_MEM_GPU_SET(EMB_GPU_TEXTURE,t->color,"target color",(uint64_t)width*height*4);
+    EMB_MEM_GPU_SET(EMB_GPU_TEXTURE,t->depth,"target depth",(uint64_t)width*height*4);
+    glCreateFramebuffers(1,&t->fbo);
+    glNamedFramebufferTexture(t->fbo,GL_COLOR_ATTACHMENT0,t->color,0);
+    glNamedFramebufferTexture(t->fbo,GL_DEPTH_ATTACHMENT,t->depth,0);
+    if(glCheckNamedFramebufferStatus(t->fbo,GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE){
+        printf("ERROR emb_render_target_init(): incomplete framebuffer %ux%u.\n",width,height);
+        return false;
+    }
+    return true;
+}
+
+void emb_render_target_free(emb_render_target * t){
+    if(t->fbo) glDeleteFramebuffers(1,&t->fbo);
+    if(t->color) {EMB_MEM_GPU_RELEASE(EMB_GPU_TEXTURE,t->color); glDeleteTextures(1,&t->color);}
+    if(t->depth) {EMB_MEM_GPU_RELEASE(EMB_GPU_TEXTURE,t->depth); glDeleteTextures(1,&t->depth);}
+    memset(t,0,sizeof(*t));
+}
+
+
+
+//__________________________________________________
+// recording
+//__________________________________________________
+
+void emb_cmd_list_init(emb_cmd_list * cl, size_t capacity){
+    cl->cap = capacity ? capacity : 4096;
+    cl->data = (uint8_t*)malloc(cl->cap);
+    EMB_MEM_ALLOC(EMB_MEM_RENDER,cl->cap);
+    cl->len = 0;
+    cl->count = 0;
+}
+
+static inline void emb_cmd_list_reset(emb_cmd_list * cl){
+    cl->len = 0;
+    cl->count = 0;
+}
+
+void emb_cmd_list_free(emb_cmd_list * cl){
+    if(cl->data) EMB_MEM_FREE(EMB_MEM_RENDER,cl->cap);
+    free(cl->data);
+    cl->data = NULL;
+    cl->len = cl->cap = 0;
+    cl->count = 0;
+}
+
+//reserves a command of `size` bytes (header included), extra bytes follow it
+static void * cmd_push(emb_cmd_list * cl, emb_cmd_type type, size_t size, size_t extra){
+    size_t total = (size + extra + EMB_CMD_ALIGN-1) & ~(size_t)(EMB_CMD_ALIGN-1);
+    if(cl->len + total > cl->cap){
+        size_t cap = cl->cap*2;
+        while(cap < cl->len + total) cap *= 2;
+        cl->data = (uint8_t*)realloc(cl->data,cap);
+        EMB_MEM_REALLOC(EMB_MEM_RENDER,cl->cap,cap);
+        cl->cap = cap;
+    }
+    emb_cmd_header * h = (emb_cmd_header*)(cl->data + cl->len);
+    h->type = type;
+    h->size = (uint32_t)total;
+    cl->len += total;
+    ++cl->count;
+    return h;
+}
+
+void emb_cmd_clear(emb_cmd_list * cl, float r, float g, float b, float a, uint32_t bits){
+    emb_cmd_clear_t * c = (emb_cmd_clear_t*)cmd_push(cl,EMB_CMD_CLEAR,sizeof(*c),0);
+    c->color[0] = r; c->color[1] = g; c->color[2] = b; c->color[3] = a;
+    c->bits = bits;
+}
+
+void emb_cmd_state(emb_cmd_list * cl, uint32_t bits){
+    emb_cmd_state_t * c = (emb_cmd_state_t*)cmd_push(cl,EMB_CMD_STATE,sizeof(*c),0);
+    c->bits = bits;
+}
+
+void emb_cmd_program(emb_cmd_list * cl, uint32_t program){
+    emb_cmd_program_t * c = (emb_cmd_program_t*)cmd_push(cl,EMB_CMD_PROGRAM,sizeof(*c),0);
+    c->program = program;
+}
+
+void emb_cmd_geometry(emb_cmd_list * cl, uint32_t vertex_array){
+    emb_cmd_geometry_t * c = (emb_cmd_geometry_t*)cmd_push(cl,EMB_CMD_GEOMETRY,sizeof(*c),0);
+    c->vertex_array = vertex_array;
+}
+
+//name has to be a string literal (or live as long as the renderer), floats - 1..4 or 16
+void emb_cmd_uniform(emb_cmd_list * cl, const char * name, const float * v, uint32_t floats){
+    if(floats > 16) floats = 16;
+    emb_cmd_uniform_t * c = (emb_cmd_uniform_t*)cmd_push(cl,EMB_CMD_UNIFORM,sizeof(*c) - (16-floats)*sizeof(float),0);
+    c->name = name;
+    c->floats = floats;
+    memcpy(c->v,v,floats*sizeof(float));
+}
+
+static inline void emb_cmd_uniform_mat4(emb_cmd_list * cl, const char * name, mat4 m){
+    emb_cmd_uniform(cl,name,(const float*)m,16);
+}
+
+//name has to be a string literal
+void emb_cmd_uniform_int(emb_cmd_list * cl, const char * name, int32_t v){
+    emb_cmd_uniform_int_t * c = (emb_cmd_uniform_int_t*)cmd_push(cl,EMB_CMD_UNIFORM_INT,sizeof(*c),0);
+    c->name = name;
+    c->v = v;
+}
+
+//data is copied into the list
+void emb_cmd_buffer_data(emb_cmd_list * cl, uint32_t buffer, size_t offset, const void * data, uint32_t size){
+    emb_cmd_buffer_data_t * c = (emb_cmd_buffer_data_t*)cmd_push(cl,EMB_CMD_BUFFER_DATA,sizeof(*c),size);
+    c->buffer = buffer;
+    c->size = size;
+    c->offset = offset;
+    memcpy(c+1,data,size);
+}
+
+void emb_cmd_bind_storage(emb_cmd_list * cl, uint32_t binding, uint32_t buffer){
+    emb_cmd_bind_storage_t * c = (emb_cmd_bind_storage_t*)cmd_push(cl,EMB_CMD_BIND_STORAGE,sizeof(*c),0);
+    c->binding = binding;
+    c->buffer = buffer;
+}
+
+/*triangles of the range in the bound geometry, model goes to the "model" uniform,
+material index to the base instance*/
+void emb_cmd_draw(emb_cmd_list * cl, mat4 model, const emb_geometry_range * geometry, uint32_t material){
+    emb_cmd_draw_t * c = (emb_cmd_draw_t*)cmd_push(cl,EMB_CMD_DRAW,sizeof(*c),0);
+    memcpy(c->model,model,sizeof(c->model));
+    c->geometry = *geometry;
+    c->material = material;
+}
+
+void emb_draw_batch_init(emb_draw_batch * b){
+    vec_draw_record_init(&b->records,NULL);
+    vec_draw_indirect_init(&b->draws[0],NULL);
+    vec_draw_indirect_init(&b->draws[1],NULL);
+}
+
+static inline void emb_draw_batch_reset(emb_draw_batch * b){
+    vec_draw_record_clear(&b->records);
+    vec_draw_indirect_clear(&b->draws[0]);
+    vec_draw_indirect_clear(&b->draws[1]);
+}
+
+void emb_draw_batch_free(emb_draw_batch * b){
+    vec_draw_record_free(&b->records);
+    vec_draw_indirect_free(&b->draws[0]);
+    vec_draw_indirect_free(&b->draws[1]);
+}
+
+static void draw_batch_push(emb_draw_batch * b, mat4 model, uint32_t material, uint32_t skin, const emb_geometry_range * geometry, const emb_draw_range * ranges, uint32_t n){
+    if(ranges && n == 0) return;
+    emb_draw_record rec;
+    memcpy(rec.model,model,sizeof(rec.model));
+    rec.material = material;
+    rec.skin = skin;
+    rec.pad[0] = rec.pad[1] = 0;
+    uint32_t record = (uint32_t)b->records.len;
+    if(!vec_draw_record_push(&b->records,rec)) return;
+
+    vec_draw_indirect * draws = &b->draws[geometry->index_size == 2 ? 0 : 1];
+    uint32_t first = geometry->eb_offset/geometry->index_size;
+    if(!ranges){
+        emb_draw_indirect d = {geometry->eb_len, 1, first, (int32_t)geometry->base_vertex, record};
+        vec_draw_indirect_push(draws,d);
+        return;
+    }
+    for(uint32_t i=0; i<n; ++i){
+        emb_draw_indirect d = {ranges[i].count, 1, first + ranges[i].first, (int32_t)geometry->base_vertex, record};
+        vec_draw_indirect_push(draws,d);
+    }
+}
+
+/*one instance. ranges - parts of the geometry to draw (meshlets which
+survived culling), relative to it, NULL draws the whole range*/
+void emb_draw_batch_add(emb_draw_batch * b, mat4 model, uint32_t material, const emb_geometry_range * geometry, const emb_draw_range * ranges, uint32_t n){
+    draw_batch_push(b,model,material,0,geometry,ranges,n);
+}
+
+/*skinned instance, palette - first matrix from emb_skin_palettes_add.
+Vertices are skinned into the space of the joints, model is applied after
+(identity when the skeleton nodes are already placed in the world).
+Always drawn whole, meshlet bounds don't follow the joints.*/
+void emb_draw_batch_add_skinned(emb_draw_batch * b, mat4 model, uint32_t material, const emb_geometry_range * geometry, uint32_t palette){
+    if(palette == EMB_SKIN_NONE) return;
+    draw_batch_push(b,model,material,palette+1,geometry,NULL,0);
+}
+
+static inline uint32_t sort_depth_bucket(float depth, float lo, float scale){
+    uint32_t b = depth > lo ? (uint32_t)(logf(depth/lo)*scale) : 0;
+    return b < EMB_DEPTH_BUCKETS ? b : EMB_DEPTH_BUCKETS-1;
+}
+
+/*coarse front to back order for opaque instances, so the early depth test rejects
+what is hidden behind nearer ones. View depths are split into EMB_DEPTH_BUCKETS
+logarithmic buckets between the nearest and the farthest key (far away depth
+differences matter less), a counting sort writes the buckets nearest first.
+Keys inside a bucket keep their order, O(n) instead of a full sort.
+near - keys closer than it (or behind the camera) go to the first bucket*/
+void emb_sort_front_to_back(const emb_sort_key * keys, uint32_t n, float near, emb_sort_key * out){
+    if(n == 0) return;
+    float lo = INFINITY, hi = near;
+    for(uint32_t i=0; i<n; ++i){
+        float d = keys[i].depth > near ? keys[i].depth : near;
+        if(d < lo) lo = d;
+        if(d > hi) hi = d;
+    }
+    float scale = hi > lo ? (float)EMB_DEPTH_BUCKETS/logf(hi/lo) : 0.0f;
+
+    uint32_t start[EMB_DEPTH_BUCKETS+1] = {0};
+    for(uint32_t i=0; i<n; ++i) ++start[sort_depth_bucket(keys[i].depth,lo,scale)+1];
+    for(uint32_t b=0; b<EMB_DEPTH_BUCKETS; ++b) start[b+1] += start[b];
+    for(uint32_t i=0; i<n; ++i) out[start[sort_depth_bucket(keys[i].depth,lo,scale)]++] = keys[i];
+}
+
+/*draws the last batch again from the buffers it was uploaded to,
+for a second pass over the same instances (colour pass after the depth pre-pass)*/
+void emb_cmd_redraw_batch(emb_cmd_list * cl){
+    cmd_push(cl,EMB_CMD_REDRAW_BATCH,sizeof(emb_cmd_header),0);
+}
+
+//everything added to the batch, one multi-draw per index size, the data is copied
+void emb_cmd_draw_batch(emb_cmd_list * cl, const emb_draw_batch * b){
+    if(b->records.len == 0) return;
+    size_t extra = b->records.len*sizeof(emb_draw_record) + (b->draws[0].len + b->draws[1].len)*sizeof(emb_draw_indirect);
+    emb_cmd_draw_batch_t * c = (emb_cmd_draw_batch_t*)cmd_push(cl,EMB_CMD_DRAW_BATCH,sizeof(*c),extra);
+    c->records = (uint32_t)b->records.len;
+    c->draws[0] = (uint32_t)b->draws[0].len;
+    c->draws[1] = (uint32_t)b->draws[1].len;
+    uint8_t * p = (uint8_t*)(c+1);
+    memcpy(p,b->records.data,b->records.len*sizeof(emb_draw_record));
+    p += b->records.len*sizeof(emb_draw_record);
+    memcpy(p,b->draws[0].data,b->draws[0].len*sizeof(emb_draw_indirect));
+    p += b->draws[0].len*sizeof(emb_draw_indirect);
+    memcpy(p,b->draws[1].data,b->draws[1].len*sizeof(emb_draw_indirect));
+}
+
+void emb_cmd_callback(emb_cmd_list * cl, emb_cmd_fn fn, void * user){
+    emb_cmd_callback_t * c = (emb_cmd_callback_t*)cmd_push(cl,EMB_CMD_CALLBACK,sizeof(*c),0);
+    c->fn = fn;
+    c->user = user;
+}
+
+//framebuffer for the following draws (0 - window) and the viewport
+void emb_cmd_target(emb_cmd_list * cl, uint32_t fbo, uint32_t width, uint32_t height){
+    emb_cmd_target_t * c = (emb_cmd_target_t*)cmd_push(cl,EMB_CMD_TARGET,sizeof(*c),0);
+    c->fbo = fbo;
+    c->width = width;
+    c->height = height;
+}
+
+//clears one color attachment of the framebuffer to its own value
+void emb_cmd_clear_buffer(emb_cmd_list * cl, uint32_t fbo, uint32_t draw_buffer, float r, float g, float b, float a){
+    emb_cmd_clear_buffer_t * c = (emb_cmd_clear_buffer_t*)cmd_push(cl,EMB_CMD_CLEAR_BUFFER,sizeof(*c),0);
+    c->fbo = fbo;
+    c->draw_buffer = draw_buffer;
+    c->v[0] = r; c->v[1] = g; c->v[2] = b; c->v[3] = a;
+}
+
+void emb_cmd_texture(emb_cmd_list * cl, uint32_t unit, uint32_t texture){
+    emb_cmd_texture_t * c = (emb_cmd_texture_t*)cmd_push(cl,EMB_CMD_TEXTURE,sizeof(*c),0);
+    c->unit = unit;
+    c->texture = texture;
+}
+
+/*one triangle covering the target with the current program,
+the geometry has to be set again before the next draw*/
+void emb_cmd_fullscreen(emb_cmd_list * cl){
+    cmd_push(cl,EMB_CMD_FULLSCREEN,sizeof(emb_cmd_header),0);
+}
+
+//copies color of src to dst (0 - window), scaled if the sizes differ
+void emb_cmd_blit(emb_cmd_list * cl, uint32_t src, uint32_t src_width, uint32_t src_height, uint32_t dst, uint32_t dst_width, uint32_t dst_height, bool linear){
+    emb_cmd_blit_t * c = (emb_cmd_blit_t*)cmd_push(cl,EMB_CMD_BLIT,sizeof(*c),0);
+    c->src = src;
+    c->dst = dst;
+    c->src_size[0] = src_width; c->src_size[1] = src_height;
+    c->dst_size[0] = dst_width; c->dst_size[1] = dst_height;
+    c->linear = linear;
+}
+
+//records the upload and binding of the last emb_clusters_bin
+void emb_cmd_clusters(emb_cmd_list * cl, const emb_clusters * c, const emb_light * lights, float width, float height){
+    size_t indices = c->indices.len < EMB_CLUSTER_MAX_INDICES ? c->indices.len : EMB_CLUSTER_MAX_INDICES;
+    if(c->lights_len) emb_cmd_buffer_data(cl,c->ssbo_lights,0,lights,c->lights_len*sizeof(emb_light));
+    emb_cmd_buffer_data(cl,c->ssbo_grid,0,c->grid,EMB_CLUSTER_COUNT*sizeof(emb_cluster));
+    if(indices) emb_cmd_buffer_data(cl,c->ssbo_indices,0,c->indices.data,indices*sizeof(uint32_t));
+    emb_cmd_bind_storage(cl,EMB_LIGHT_BINDING,c->ssbo_lights);
+    emb_cmd_bind_storage(cl,EMB_CLUSTER_BINDING,c->ssbo_grid);
+    emb_cmd_bind_storage(cl,EMB_LIGHT_INDEX_BINDING,c->ssbo_indices);
+    emb_cmd_uniform(cl,"cluster_depth",(float[4]){c->near,c->far,c->log_scale,0.0f},4);
+    emb_cmd_uniform(cl,"cluster_screen",(float[2]){width,height},2);
+}
+
+//records the upload of changed materials and binds the table
+void emb_cmd_materials(emb_cmd_list * cl, emb_materials * m){
+    if(m->dirty_first < m->dirty_end)
+        emb_cmd_buffer_data(cl,m->ssbo,m->dirty_first*sizeof(emb_material),&m->materials[m->dirty_first],(m->dirty_end-m->dirty_first)*sizeof(emb_material));
+    m->dirty_first = m->dirty_end = 0;
+    emb_cmd_bind_storage(cl,EMB_MATERIAL_BINDING,m->ssbo);
+}
+
+/*depth-only pass: colour writes off, program with the position-only vertex array
+(shaders/depth_vertex.glsl, emb_ebvb_handler.pos_data). proj and view are set
+for the program, draw the opaque batch after this*/
+void emb_cmd_prepass_begin(emb_cmd_list * cl, uint32_t program, uint32_t vertex_array, mat4 proj, mat4 view){
+    emb_cmd_state(cl,EMB_STATE_DEPTH_TEST | EMB_STATE_CULL_BACK | EMB_STATE_NO_COLOR_WRITE);
+    emb_cmd_program(cl,program);
+    emb_cmd_geometry(cl,vertex_array);
+    emb_cmd_uniform_mat4(cl,"proj",proj);
+    emb_cmd_uniform_mat4(cl,"view",view);
+}
+
+/*colour pass over the pre-pass depth: every pixel is shaded once, by the fragment
+at the stored depth, depth isn't written. Draw the same batch after this (emb_cmd_redraw_batch)*/
+void emb_cmd_prepass_end(emb_cmd_list * cl, uint32_t program, uint32_t vertex_array){
+    emb_cmd_state(cl,EMB_STATE_DEPTH_TEST | EMB_STATE_CULL_BACK | EMB_STATE_NO_DEPTH_WRITE | EMB_STATE_DEPTH_EQUAL);
+    emb_cmd_program(cl,program);
+    emb_cmd_geometry(cl,vertex_array);
+}
+
+//records the upload of the frame's palettes and binds the table
+void emb_cmd_skin_palettes(emb_cmd_list * cl, const emb_skin_palettes * p){
+    if(p->len) emb_cmd_buffer_data(cl,p->ssbo,0,p->matrices,p->len*sizeof(mat4));
+    emb_cmd_bind_storage(cl,EMB_SKIN_BINDING,p->ssbo);
+}
+
+
+
+//__________________________________________________
+// replay (GL backend)
+//__________________________________________________
+
+static GLint render_uniform_location(emb_renderer * r, const char * name){
+    for(uint32_t i=0; i<r->uniforms_len; ++i)
+        if(r->uniforms[i].program == r->program && r->uniforms[i].name == name) return r->uniforms[i].location;
+    GLint loc = glGetUniformLocation(r->program,name);
+    if(r->uniforms_len < EMB_RENDER_UNIFORM_CACHE) r->uniforms[r->uniforms_len++] = (render_uniform_slot){r->program,name,loc};
+    return loc;
+}
+
+//draws of the last uploaded batch
+static void render_multi_draw(emb_renderer * r){
+    uint32_t * draws = r->batch_draws_len;
+    if(!r->batch_records || !(draws[0] + draws[1])) return;
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER,EMB_DRAW_RECORD_BINDING,r->batch_records);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER,r->batch_draws);
+    glUniform1i(r->batch_location,1);
+    if(draws[0]) glMultiDrawElementsIndirect(GL_TRIANGLES,GL_UNSIGNED_SHORT,(void*)0,(GLsizei)draws[0],0);
+    if(draws[1]) glMultiDrawElementsIndirect(GL_TRIANGLES,GL_UNSIGNED_INT,(void*)(draws[0]*sizeof(emb_draw_indirect)),(GLsizei)draws[1],0);
+    glUniform1i(r->batch_location,0);
+}
+
+//records and draws are orphaned and refilled for every batch, the driver keeps the old storage while it's in use
+static void render_draw_batch(emb_renderer * r, const emb_cmd_draw_batch_t * c){
+    if(!r->batch_records){
+        glCreateBuffers(1,&r->batch_records);
+        glCreateBuffers(1,&r->batch_draws);
+    }
+    size_t records = c->records*sizeof(emb_draw_record);
+    size_t draws = (c->draws[0] + c->draws[1])*sizeof(emb_draw_indirect);
+    const uint8_t * data = (const uint8_t*)(c+1);
+    glNamedBufferData(r->batch_records,records,data,GL_STREAM_DRAW);
+    glNamedBufferData(r->batch_draws,draws,data+records,GL_STREAM_DRAW);
+    EMB_MEM_GPU_SET(EMB_GPU_BUFFER,r->batch_records,"batch records",records);
+    EMB_MEM_GPU_SET(EMB_GPU_BUFFER,r->batch_draws,"batch draws",draws);
+
+    r->batch_draws_len[0] = c->draws[0];
+    r->batch_draws_len[1] = c->draws[1];
+    render_multi_draw(r);
+}
+
+//runs the list on the calling thread, it has to own the GL context
+void emb_renderer_replay(emb_renderer * r, const emb_cmd_list * cl){
+    for(size_t at = 0; at < cl->len;){
+        const emb_cmd_header * h = (const emb_cmd_header*)(cl->data + at);
+        at += h->size;
+        switch(h->type){
+            case EMB_CMD_CLEAR:{
+                const emb_cmd_clear_t * c = (const emb_cmd_clear_t*)h;
+                glClearColor(c->color[0],c->color[1],c->color[2],c->color[3]);
+                //depth and color are cleared even while writes are off
+                if(c->bits & EMB_CLEAR_DEPTH) glDepthMask(GL_TRUE);
+                if(c->bits & EMB_CLEAR_COLOR) glColorMask(GL_TRUE,GL_TRUE,GL_TRUE,GL_TRUE);
+                glClear((c->bits & EMB_CLEAR_COLOR ? GL_COLOR_BUFFER_BIT : 0) | (c->bits & EMB_CLEAR_DEPTH ? GL_DEPTH_BUFFER_BIT : 0));
+                if(c->bits & EMB_CLEAR_DEPTH) glDepthMask(r->state & EMB_STATE_NO_DEPTH_WRITE ? GL_FALSE : GL_TRUE);
+                if(c->bits & EMB_CLEAR_COLOR) {GLboolean w = r->state & EMB_STATE_NO_COLOR_WRITE ? GL_FALSE : GL_TRUE; glColorMask(w,w,w,w);}
+            } break;
+            case EMB_CMD_STATE:{
+                const emb_cmd_state_t * c = (const emb_cmd_state_t*)h;
+                r->state = c->bits;
+                if(c->bits & EMB_STATE_DEPTH_TEST) glEnable(GL_DEPTH_TEST); else glDisable(GL_DEPTH_TEST);
+                if(c->bits & EMB_STATE_CULL_BACK) {glEnable(GL_CULL_FACE); glCullFace(GL_BACK);} else glDisable(GL_CULL_FACE);
+                glDepthMask(c->bits & EMB_STATE_NO_DEPTH_WRITE ? GL_FALSE : GL_TRUE);
+                glDepthFunc(c->bits & EMB_STATE_DEPTH_EQUAL ? GL_EQUAL : GL_LESS);
+                GLboolean color = c->bits & EMB_STATE_NO_COLOR_WRITE ? GL_FALSE : GL_TRUE;
+                glColorMask(color,color,color,color);
+                if(c->bits & EMB_STATE_BLEND_OIT){
+                    glEnable(GL_BLEND);
+                    glBlendFunci(0,GL_ONE,GL_ONE);
+                    glBlendFunci(1,GL_ZERO,GL_ONE_MINUS_SRC_COLOR);
+                }
+                else if(c->bits & EMB_STATE_BLEND_ALPHA) {glEnable(GL_BLEND); glBlendFunc(GL_SRC_ALPHA,GL_ONE_MINUS_SRC_ALPHA);}
+                else glDisable(GL_BLEND);
+            } break;
+            case EMB_CMD_PROGRAM:{
+                const emb_cmd_program_t * c = (const emb_cmd_program_t*)h;
+                r->program = c->program;
+                glUseProgram(r->program);
+                r->model_location = render_uniform_location(r,"model");
+                r->batch_location = render_uniform_location(r,"draw_batch");
+            } break;
+            case EMB_CMD_GEOMETRY:
+                glBindVertexArray(((const emb_cmd_geometry_t*)h)->vertex_array);
+                break;
+            case EMB_CMD_UNIFORM:{
+                const emb_cmd_uniform_t * c = (const emb_cmd_uniform_t*)h;
+                GLint loc = render_uniform_location(r,c->name);
+                if(loc < 0) break;
+                switch(c->floats){
+                    case 1: glUniform1fv(loc,1,c->v); break;
+                    case 2: glUniform2fv(loc,1,c->v); break;
+                    case 3: glUniform3fv(loc,1,c->v); break;
+                    case 4: glUniform4fv(loc,1,c->v); break;
+                    case 16: glUniformMatrix4fv(loc,1,GL_FALSE,c->v); break;
+                }
+            } break;
+            case EMB_CMD_UNIFORM_INT:{
+                const emb_cmd_uniform_int_t * c = (const emb_cmd_uniform_int_t*)h;
+                GLint loc = render_uniform_location(r,c->name);
+                if(loc >= 0) glUniform1i(loc,c->v);
+            } break;
+            case EMB_CMD_BUFFER_DATA:{
+                const emb_cmd_buffer_data_t * c = (const emb_cmd_buffer_data_t*)h;
+                glNamedBufferSubData(c->buffer,c->offset,c->size,c+1);
+            } break;
+            case EMB_CMD_BIND_STORAGE:{
+                const emb_cmd_bind_storage_t * c = (const emb_cmd_bind_storage_t*)h;
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER,c->binding,c->buffer);
+            } break;
+            case EMB_CMD_DRAW:{
+                const emb_cmd_draw_t * c = (const emb_cmd_draw_t*)h;
+                glUniformMatrix4fv(r->model_location,1,GL_FALSE,c->model);
+                glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES,c->geometry.eb_len,emb_index_type(c->geometry.index_size),
+                    (void*)(size_t)c->geometry.eb_offset,1,c->geometry.base_vertex,c->material);
+            } break;
+            case EMB_CMD_DRAW_BATCH:
+                render_draw_batch(r,(const emb_cmd_draw_batch_t*)h);
+                break;
+            case EMB_CMD_REDRAW_BATCH:
+                render_multi_draw(r);
+                break;
+            case EMB_CMD_CALLBACK:{
+                const emb_cmd_callback_t * c = (const emb_cmd_callback_t*)h;
+                c->fn(c->user);
+            } break;
+            case EMB_CMD_TARGET:{
+                const emb_cmd_target_t * c = (const emb_cmd_target_t*)h;
+                glBindFramebuffer(GL_FRAMEBUFFER,c->fbo);
+                glViewport(0,0,(GLsizei)c->width,(GLsizei)c->height);
+            } break;
+            case EMB_CMD_CLEAR_BUFFER:{
+                const emb_cmd_clear_buffer_t * c = (const emb_cmd_clear_buffer_t*)h;
+                glClearNamedFramebufferfv(c->fbo,GL_COLOR,(GLint)c->draw_buffer,c->v);
+            } break;
+            case EMB_CMD_TEXTURE:{
+                const emb_cmd_texture_t * c = (const emb_cmd_texture_t*)h;
+                glBindTextureUnit(c->unit,c->texture);
+            } break;
+            case EMB_CMD_FULLSCREEN:
+                if(!r->empty_vao) glCreateVertexArrays(1,&r->empty_vao);
+                glBindVertexArray(r->empty_vao);
+                glDrawArrays(GL_TRIANGLES,0,3);
+                break;
+            case EMB_CMD_BLIT:{
+                const emb_cmd_blit_t * c = (const emb_cmd_blit_t*)h;
+                glBlitNamedFramebuffer(c->src,c->dst,0,0,(GLint)c->src_size[0],(GLint)c->src_size[1],0,0,(GLint)c->dst_size[0],(GLint)c->dst_size[1],
+                    GL_COLOR_BUFFER_BIT,c->linear ? GL_LINEAR : GL_NEAREST);
+            } break;
+        }
+    }
+}
+
+
+
+//__________________________________________________
+// render thread
+//__________________________________________________
+
+static int render_thread(void * user){
+    emb_renderer * r = (emb_renderer*)user;
+    SDL_GL_MakeCurrent(r->window,r->context);
+    //target_fps goes to the game thread's limiter, sleeping here would come after input is sampled
+    emb_frame_pacer_init(&r->pacer,r->frames_in_flight,0);
+
+    for(;;){
+        SDL_WaitSemaphore(r->filled);
+        if(atomic_load_explicit(&r->quit,memory_order_acquire)) break;
+
+        EMB_PROFILE_BEGIN("render");
+        EMB_PROFILE_BEGIN("pacing");
+        emb_frame_pacer_begin(&r->pacer);
+        SDL_SignalSemaphore(r->paced);
+        EMB_PROFILE_END();
+
+        EMB_PROFILE_BEGIN("replay");
+        EMB_PROFILE_GPU_BEGIN("replay");
+        emb_renderer_replay(r,&r->lists[r->replaying]);
+        EMB_PROFILE_GPU_END();
+        EMB_PROFILE_END();
+
+        EMB_PROFILE_BEGIN("swap");
+        SDL_GL_SwapWindow(r->window);
+        emb_frame_pacer_end(&r->pacer);
+        EMB_PROFILE_END();
+        EMB_PROFILE_END(); //render
+
+        SDL_SignalSemaphore(r->consumed);
+
+        //gl queries are read here, so profiling frames follow the render thread
+        EMB_PROFILE_FRAME();
+        if(++r->frames % 240 == 0){
+            EMB_PROFILE_PRINT();
+            #ifdef EMB_PROFILE
+            //sleeping is on the game thread, emb_renderer_submit prints it
+            printf("pacing: %u frames in flight, cpu wait %.3fms, gpu idle %.3fms\n",
+                r->pacer.frames_in_flight,r->pacer.avg_cpu_wait_ns*1e-6,r->pacer.avg_gpu_idle_ns*1e-6);
+            #endif
+        }
+    }
+
+    emb_frame_pacer_free(&r->pacer);
+    if(r->batch_records){
+        GLuint buffers[2] = {r->batch_records, r->batch_draws};
+        EMB_MEM_GPU_RELEASE(EMB_GPU_BUFFER,buffers[0]);
+        EMB_MEM_GPU_RELEASE(EMB_GPU_BUFFER,buffers[1]);
+        glDeleteBuffers(2,buffers);
+    }
+    if(r->empty_vao) glDeleteVertexArrays(1,&r->empty_vao);
+    SDL_GL_MakeCurrent(r->window,NULL);
+    return 0;
+}
+
+/*moves the context of the calling thread to a new render thread.
+The renderer must not move after this call, the calling thread
+can't use GL until emb_renderer_stop.
+target_fps - 0 disables sleeping (vsync or uncapped)*/
+bool emb_renderer_start(emb_renderer * r, SDL_Window * window, SDL_GLContext context, uint32_t frames_in_flight, uint32_t target_fps){
+    memset(r,0,sizeof(*r));
+    r->window = window;
+    r->context = context;
+    r->frames_in_flight = frames_in_flight;
+    r->target_fps = target_fps;
+    emb_frame_limiter_init(&r->limiter,target_fps);
+    emb_cmd_list_init(&r->lists[0],0);
+    emb_cmd_list_init(&r->lists[1],0);
+    r->recording = 0;
+    r->replaying = 1;
+    atomic_init(&r->quit,false);
+    r->filled = SDL_CreateSemaphore(0);
+    r->consumed = SDL_CreateSemaphore(1);
+    r->paced = SDL_CreateSemaphore(1);
+
+    SDL_GL_MakeCurrent(window,NULL);
+    r->thread = SDL_CreateThread(render_thread,"emb_render",r);
+    if(!r->thread){
+        printf("ERROR emb_renderer_start(): cannot create thread.\n");
+        SDL_GL_MakeCurrent(window,context);
+        SDL_DestroySemaphore(r->filled);
+        SDL_DestroySemaphore(r->consumed);
+        SDL_DestroySemaphore(r->paced);
+        emb_cmd_list_free(&r->lists[0]);
+        emb_cmd_list_free(&r->lists[1]);
+        return false;
+    }
+    return true;
+}
+
+//list for the current frame, valid until emb_renderer_submit
+static inline emb_cmd_list * emb_renderer_list(emb_renderer * r){
+    return &r->lists[r->recording];
+}
+
+/*game thread, right before sampling input. Blocks until the render thread
+is past the GPU wait of the previous frame (frames_in_flight back), then
+sleeps to target_fps, so the frame's input is as fresh as possible.
+The recording of this frame still overlaps the replay of the previous one.*/
+void emb_renderer_begin(emb_renderer * r){
+    if(r->begun) return;
+    r->begun = true;
+    EMB_PROFILE_BEGIN("pacing wait");
+    SDL_WaitSemaphore(r->paced);
+    emb_frame_limiter_wait(&r->limiter);
+    EMB_PROFILE_END();
+}
+
+/*hands the recorded list to the render thread. Waits only until
+the previous list is replayed, then the next one can be recorded*/
+void emb_renderer_submit(emb_renderer * r){
+    emb_renderer_begin(r); //one pacing wait per frame, also when begin was skipped
+    r->begun = false;
+    EMB_PROFILE_BEGIN("submit wait");
+    SDL_WaitSemaphore(r->consumed);
+    EMB_PROFILE_END();
+    r->replaying = r->recording;
+    r->recording ^= 1;
+    emb_cmd_list_reset(&r->lists[r->recording]);
+    SDL_SignalSemaphore(r->filled);
+    #ifdef EMB_PROFILE
+    if(++r->submitted % 240 == 0) printf("pacing: sleep before input %.3fms\n",r->limiter.avg_sleep_ns*1e-6);
+    #endif
+}
+
+//waits for the last frame, the GL context comes back to the calling thread
+void emb_renderer_stop(emb_renderer * r){
+    if(!r->thread) return;
+    SDL_WaitSemaphore(r->consumed);
+    atomic_store_explicit(&r->quit,true,memory_order_release);
+    SDL_SignalSemaphore(r->filled);
+    SDL_WaitThread(r->thread,NULL);
+    r->thread = NULL;
+    SDL_GL_MakeCurrent(r->window,r->context);
+
+    SDL_DestroySemaphore(r->filled);
+    SDL_DestroySemaphore(r->consumed);
+    SDL_DestroySemaphore(r->paced);
+    emb_cmd_list_free(&r->lists[0]);
+    emb_cmd_list_free(&r->lists[1]);
+}
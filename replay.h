@@ -0,0 +1,198 @@
+/*______________________________________
+replay - input recording and deterministic playback
+
+Input is sampled once per frame into emb_input_frame together with
+the frame duration, everything the frame reads comes from it:
+
+    uint64_t real_ns = emb_frame_loop_elapsed(&loop);
+    if(!emb_input_next(&input,real_ns)) break; //replay finished
+    uint32_t steps = emb_frame_loop_advance(&loop,input.frame.frame_ns);
+
+- live - SDL is sampled
+- record - SDL is sampled and every frame is appended to a file
+- replay - frames are read back, SDL isn't touched
+
+With fixed_ns set every frame lasts exactly that long, so simulation
+steps don't depend on how fast the machine renders. A replay uses
+the recorded durations unless fixed_ns overrides them.
+______________________________________*/
+#pragma once
+
+#include <SDL3/SDL.h>
+#include <cglm/cglm.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "utils/vector.h"
+#include "input.c"
+
+
+#define EMB_INPUT_MAGIC 0x49424D45u //"EMBI"
+#define EMB_INPUT_VERSION 1
+#define EMB_INPUT_KEY_WORDS (SDL_SCANCODE_COUNT/64)
+
+typedef enum{
+    EMB_INPUT_LIVE,
+    EMB_INPUT_RECORD,
+    EMB_INPUT_REPLAY,
+} emb_input_mode;
+
+//everything a frame reads from the player, stored as is in recordings
+typedef struct{
+    uint64_t frame_ns; //duration of the frame, drives emb_frame_loop_advance
+    float mouse_dx; //raw mouse delta (emb_mouse_delta)
+    float mouse_dy;
+    uint32_t mouse_buttons; //0 - no button held
+    uint32_t pad;
+    uint64_t keys[EMB_INPUT_KEY_WORDS]; //bit per SDL_Scancode
+} emb_input_frame;
+
+typedef struct{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t frame_size; //sizeof(emb_input_frame) of the writer
+    uint32_t pad;
+} emb_input_header;
+
+typedef struct{
+    emb_input_mode mode;
+    FILE * file; //recording or replay, NULL when live
+    uint64_t fixed_ns; //0 - real (or recorded) frame time
+
+    emb_input_frame frame; //current frame
+    uint64_t prev_keys[EMB_INPUT_KEY_WORDS]; //previous frame, for key presses
+    uint64_t frames; //frames sampled (or read)
+} emb_input;
+
+_Static_assert(sizeof(emb_input_frame) == 88, "input frame layout changed, bump EMB_INPUT_VERSION");
+
+
+emb_input emb_input_init(){
+    emb_input in;
+    memset(&in,0,sizeof(in));
+    in.mode = EMB_INPUT_LIVE;
+    return in;
+}
+
+//every frame is appended to path
+bool emb_input_record(emb_input * in, const char * path){
+    in->file = fopen(path,"wb");
+    if(!in->file) {printf("ERROR emb_input_record(): cannot open %s.\n",path); return false;}
+    emb_input_header h = {EMB_INPUT_MAGIC, EMB_INPUT_VERSION, sizeof(emb_input_frame), 0};
+    if(fwrite(&h,sizeof(h),1,in->file) != 1) {printf("ERROR emb_input_record(): cannot write %s.\n",path); fclose(in->file); in->file = NULL; return false;}
+    in->mode = EMB_INPUT_RECORD;
+    return true;
+}
+
+//frames are read from path instead of SDL
+bool emb_input_replay(emb_input * in, const char * path){
+    in->file = fopen(path,"rb");
+    if(!in->file) {printf("ERROR emb_input_replay(): cannot open %s.\n",path); return false;}
+    emb_input_header h;
+    if(fread(&h,sizeof(h),1,in->file) != 1 || h.magic != EMB_INPUT_MAGIC
+        || h.version != EMB_INPUT_VERSION || h.frame_size != sizeof(emb_input_frame)){
+        printf("ERROR emb_input_replay(): %s is not a supported recording.\n",path);
+        fclose(in->file);
+        in->file = NULL;
+        return false;
+    }
+    in->mode = EMB_INPUT_REPLAY;
+    return true;
+}
+
+void emb_input_close(emb_input * in){
+    if(in->file) fclose(in->file);
+    in->file = NULL;
+    in->mode = EMB_INPUT_LIVE;
+}
+
+static void input_sample(emb_input_frame * f){
+    memset(f,0,sizeof(*f));
+    f->mouse_buttons = emb_mouse_delta(&f->mouse_dx,&f->mouse_dy);
+    int count = 0;
+    const bool * keyboard_state = SDL_GetKeyboardState(&count);
+    if(count > SDL_SCANCODE_COUNT) count = SDL_SCANCODE_COUNT;
+    for(int k=0; k<count; ++k)
+        if(keyboard_state[k]) f->keys[k/64] |= 1ull << (k%64);
+}
+
+/*input of the next frame into in->frame.
+real_ns - measured duration of the frame (emb_frame_loop_elapsed).
+Returns false when the replay has no more frames.*/
+bool emb_input_next(emb_input * in, uint64_t real_ns){
+    memcpy(in->prev_keys,in->frame.keys,sizeof(in->prev_keys));
+    if(in->mode == EMB_INPUT_REPLAY){
+        if(fread(&in->frame,sizeof(in->frame),1,in->file) != 1) return false;
+    }
+    else{
+        input_sample(&in->frame);
+        in->frame.frame_ns = real_ns;
+    }
+    if(in->fixed_ns) in->frame.frame_ns = in->fixed_ns;
+
+    if(in->mode == EMB_INPUT_RECORD && fwrite(&in->frame,sizeof(in->frame),1,in->file) != 1){
+        printf("ERROR emb_input_next(): recording failed, continuing live.\n");
+        emb_input_close(in);
+    }
+    ++in->frames;
+    return true;
+}
+
+static inline bool emb_input_key(const emb_input * in, SDL_Scancode k){
+    return (in->frame.keys[k/64] >> (k%64)) & 1u;
+}
+
+//true only on the frame the key went down
+static inline bool emb_input_pressed(const emb_input * in, SDL_Scancode k){
+    return emb_input_key(in,k) && !((in->prev_keys[k/64] >> (k%64)) & 1u);
+}
+
+//same as emb_get_keyboard_movement, from the frame's keys
+void emb_input_movement(const emb_input * in, vec3 dir){
+    dir[0] = (float)emb_input_key(in,SDL_SCANCODE_RIGHT) - (float)emb_input_key(in,SDL_SCANCODE_LEFT);
+    dir[1] = (float)emb_input_key(in,SDL_SCANCODE_SPACE) - (float)emb_input_key(in,SDL_SCANCODE_LSHIFT);
+    dir[2] = (float)emb_input_key(in,SDL_SCANCODE_DOWN) - (float)emb_input_key(in,SDL_SCANCODE_UP);
+}
+
+
+
+//__________________________________________________
+// run statistics
+//__________________________________________________
+
+/*real frame times of a run, printed as one line at the end
+so results of the same path can be compared across commits*/
+typedef struct{
+    vec_u32 frame_us;
+    uint64_t total_ns;
+} emb_run_stats;
+
+void emb_run_stats_init(emb_run_stats * s){
+    vec_u32_init(&s->frame_us,NULL);
+    s->total_ns = 0;
+}
+
+static inline void emb_run_stats_add(emb_run_stats * s, uint64_t frame_ns){
+    vec_u32_push(&s->frame_us,(uint32_t)(frame_ns/1000));
+    s->total_ns += frame_ns;
+}
+
+static int run_stats_cmp(const void * a, const void * b){
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+//sorts the samples, call once at the end
+void emb_run_stats_print(emb_run_stats * s){
+    size_t n = s->frame_us.len;
+    if(!n) return;
+    uint32_t * t = s->frame_us.data;
+    qsort(t,n,sizeof(uint32_t),run_stats_cmp);
+    printf("run: frames %zu, avg %.3f ms, p50 %.3f ms, p95 %.3f ms, p99 %.3f ms, worst %.3f ms\n",
+        n, (double)s->total_ns*1e-6/(double)n, t[n/2]*1e-3, t[n*95/100]*1e-3, t[n*99/100]*1e-3, t[n-1]*1e-3);
+}
+
+void emb_run_stats_free(emb_run_stats * s){
+    vec_u32_free(&s->frame_us);
+}
@@ -0,0 +1,6 @@
+#version 460 core
+
+//depth pre-pass, only depth is written (colour writes are off)
+
+void main(){
+}
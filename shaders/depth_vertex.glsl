@@ -0,0 +1,41 @@
+#version 460 core
+
+//depth pre-pass: positions only (emb_ebvb_handler.pos_data), transform written
+//exactly as in shaders/vertex.glsl so both passes produce the same depth
+
+uniform mat4 proj;
+uniform mat4 view;
+uniform mat4 model;
+uniform int draw_batch; //1 - model comes from draws[gl_BaseInstance], see render.h
+
+struct draw_record{
+    mat4 model;
+    uint material;
+    uint skin; //first palette matrix + 1, 0 - not skinned
+    uint pad0, pad1;
+};
+
+layout(std430, binding = 4) readonly buffer draw_buffer { draw_record draws[]; };
+layout(std430, binding = 5) readonly buffer skin_buffer { mat4 palettes[]; }; //model/skin.h
+
+layout (location = 0) in vec3 pos;
+layout (location = 4) in uvec4 joints;
+layout (location = 5) in vec4 weights;
+
+invariant gl_Position;
+
+void main() {
+    mat4 m = model;
+    if(draw_batch != 0){
+        m = draws[gl_BaseInstance].model;
+        uint skin = draws[gl_BaseInstance].skin;
+        if(skin != 0u){
+            uint first = skin - 1u;
+            m = m * (weights.x*palettes[first+joints.x] + weights.y*palettes[first+joints.y]
+                   + weights.z*palettes[first+joints.z] + weights.w*palettes[first+joints.w]);
+        }
+    }
+
+    vec4 worldpos = m*vec4(pos,1.0);
+    gl_Position = proj*view*worldpos;
+};
@@ -1,19 +1,125 @@
 #version 460 core
 
 uniform vec3 light_dir;
+uniform int transparency; //0 - opaque, 1 - weighted blended accumulation, 2 - alpha blended (oit.h)
+uniform int overdraw; //1 - shaded fragments are counted (overdraw.h)
 
+//depth is tested before shading also while the counter below is written
+layout(early_fragment_tests) in;
+layout(std430, binding = 6) buffer overdraw_buffer { uint overdraw_fragments; };
+
+//clustered lights, see model/light.h
+#define CLUSTER_X 16u
+#define CLUSTER_Y 9u
+#define CLUSTER_Z 24u
+#define LIGHT_SPOT 1u
+
+uniform vec4 cluster_depth; //near, far, slice scale
+uniform vec2 cluster_screen; //framebuffer size
+
+struct light{
+    vec3 pos;
+    float radius;
+    vec3 color;
+    float intensity;
+    vec3 dir;
+    float cos_outer;
+    float cos_inner;
+    uint type;
+    vec2 pad;
+};
+
+layout(std430, binding = 0) readonly buffer light_buffer { light lights[]; };
+layout(std430, binding = 1) readonly buffer cluster_buffer { uvec2 clusters[]; }; //offset, count
+layout(std430, binding = 2) readonly buffer light_index_buffer { uint light_indices[]; };
+
+//materials and texture arrays, see model/material.h
+#define TEXTURE_BUCKETS 5
+#define TEXTURE_NONE 0xFFFFFFFFu
+#define MATERIAL_VERTEX_COLOR 1u
+
+struct material{
+    vec4 base_color;
+    uint albedo; //bucket << 16 | layer
+    uint flags;
+    vec2 pad;
+};
+
+layout(std430, binding = 3) readonly buffer material_buffer { material materials[]; };
+layout(binding = 0) uniform sampler2DArray textures[TEXTURE_BUCKETS]; //one array per size
 
 
 
 in vec3 vertex_color;  //get vertex color
 in vec3 frag_normal;
 in vec3 frag_pos;
+in vec2 frag_uv;
+in flat uint frag_material;
+
+layout(location = 0) out vec4 frag_color; //accumulation in the weighted pass
+layout(location = 1) out float frag_revealage;
 
-out vec4 frag_color;
+
+uvec2 get_cluster(){
+    float near = cluster_depth.x, far = cluster_depth.y;
+    float z_ndc = gl_FragCoord.z*2.0 - 1.0;
+    float depth = 2.0*near*far / (far + near - z_ndc*(far - near));
+    uint slice = uint(clamp(floor(log(depth/near)*cluster_depth.z), 0.0, float(CLUSTER_Z-1u)));
+    uvec2 tile = uvec2(clamp(gl_FragCoord.xy/cluster_screen*vec2(CLUSTER_X,CLUSTER_Y), vec2(0.0), vec2(CLUSTER_X-1u,CLUSTER_Y-1u)));
+    return clusters[slice*CLUSTER_X*CLUSTER_Y + tile.y*CLUSTER_X + tile.x];
+}
+
+
+//arrays are indexed by constants only, the material can change inside a multi-draw
+vec4 sample_texture(uint t, vec2 uv, vec2 dx, vec2 dy){
+    vec3 coord = vec3(uv, float(t & 0xFFFFu));
+    switch(t >> 16){
+        case 0u: return textureGrad(textures[0], coord, dx, dy);
+        case 1u: return textureGrad(textures[1], coord, dx, dy);
+        case 2u: return textureGrad(textures[2], coord, dx, dy);
+        case 3u: return textureGrad(textures[3], coord, dx, dy);
+        default: return textureGrad(textures[4], coord, dx, dy);
+    }
+}
+
+vec4 get_albedo(){
+    //derivatives outside of the branch
+    vec2 dx = dFdx(frag_uv), dy = dFdy(frag_uv);
+    material m = materials[frag_material];
+    vec4 albedo = m.base_color;
+    if((m.flags & MATERIAL_VERTEX_COLOR) != 0u) albedo.rgb *= vertex_color;
+    if(m.albedo != TEXTURE_NONE) albedo *= sample_texture(m.albedo, frag_uv, dx, dy);
+    return albedo;
+}
 
 
 void main(){
+    if(overdraw != 0) atomicAdd(overdraw_fragments, 1u);
     vec3 flat_normal = normalize(cross(dFdx(frag_pos),dFdy(frag_pos)));
     float light_power = clamp(dot(flat_normal,-light_dir),0.1,1.0);
-    frag_color = light_power * vec4(vertex_color.r,vertex_color.g,vertex_color.b, 1.0);
+    vec4 albedo = get_albedo();
+    vec3 color = light_power * albedo.rgb;
+
+    uvec2 cluster = get_cluster();
+    for(uint i=0u; i<cluster.y; ++i){
+        light l = lights[light_indices[cluster.x+i]];
+        vec3 to_light = l.pos - frag_pos;
+        float dist = length(to_light);
+        vec3 dir = to_light/max(dist,0.0001);
+
+        float attenuation = clamp(1.0 - dist*dist/(l.radius*l.radius), 0.0, 1.0);
+        attenuation *= attenuation;
+        if(l.type == LIGHT_SPOT) attenuation *= smoothstep(l.cos_outer, l.cos_inner, dot(-dir,l.dir));
+
+        color += max(dot(flat_normal,dir),0.0) * attenuation * l.intensity * l.color * albedo.rgb;
+    }
+
+    float alpha = albedo.a;
+    if(transparency == 1){
+        //nearer and more opaque fragments weigh more (McGuire and Bavoil, eq. 10)
+        float weight = clamp(pow(min(1.0, alpha*10.0) + 0.01, 3.0) * 1e8 * pow(1.0 - gl_FragCoord.z*0.9, 3.0), 1e-2, 3e3);
+        frag_color = vec4(color*alpha, alpha)*weight;
+        frag_revealage = alpha;
+    }
+    else frag_color = vec4(color, transparency == 2 ? alpha : 1.0);
 }
@@ -0,0 +1,11 @@
+#version 460 core
+
+//one triangle covering the screen, no vertex buffer (render.h EMB_CMD_FULLSCREEN)
+
+out vec2 frag_uv;
+
+void main(){
+    vec2 p = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2));
+    frag_uv = p;
+    gl_Position = vec4(p*2.0 - 1.0, 0.0, 1.0);
+}
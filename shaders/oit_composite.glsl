@@ -0,0 +1,22 @@
+#version 460 core
+
+//resolves weighted blended transparency (oit.h), blended over the scene with src alpha, 1 - src alpha
+
+layout(binding = 5) uniform sampler2D accum_texture;
+layout(binding = 6) uniform sampler2D revealage_texture;
+
+in vec2 frag_uv;
+
+out vec4 frag_color;
+
+void main(){
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    float revealage = texelFetch(revealage_texture, p, 0).r;
+    if(revealage >= 1.0) discard; //nothing transparent here
+
+    vec4 accum = texelFetch(accum_texture, p, 0);
+    //weights can overflow half floats
+    if(isinf(max(max(abs(accum.r), abs(accum.g)), abs(accum.b)))) accum.rgb = vec3(accum.a);
+    vec3 color = accum.rgb / max(accum.a, 0.00001);
+    frag_color = vec4(color, 1.0 - revealage);
+}
@@ -3,22 +3,55 @@
 uniform mat4 proj;
 uniform mat4 view;
 uniform mat4 model;
+uniform int draw_batch; //1 - model and material come from draws[gl_BaseInstance], see render.h
+
+struct draw_record{
+    mat4 model;
+    uint material;
+    uint skin; //first palette matrix + 1, 0 - not skinned
+    uint pad0, pad1;
+};
+
+layout(std430, binding = 4) readonly buffer draw_buffer { draw_record draws[]; };
+layout(std430, binding = 5) readonly buffer skin_buffer { mat4 palettes[]; }; //model/skin.h
 
 layout (location = 0) in vec3 pos;
 layout (location = 1) in vec3 clr;
 layout (location = 2) in vec2 uv;
 layout (location = 3) in vec3 normal;
+layout (location = 4) in uvec4 joints; //skin stream, second vertex buffer
+layout (location = 5) in vec4 weights;
 
 out vec3 frag_pos;
 out flat vec3 frag_normal;
 out flat vec3 vertex_color;
+out vec2 frag_uv;
+out flat uint frag_material;
+
+invariant gl_Position; //same depth as shaders/depth_vertex.glsl, the colour pass tests GL_EQUAL against it
 
 void main() {
-    vec4 worldpos = model*vec4(pos,1.0);
+    //single draws pass the material as base instance
+    mat4 m = model;
+    uint material = uint(gl_BaseInstance);
+    if(draw_batch != 0){
+        m = draws[gl_BaseInstance].model;
+        material = draws[gl_BaseInstance].material;
+        uint skin = draws[gl_BaseInstance].skin;
+        if(skin != 0u){
+            uint first = skin - 1u;
+            m = m * (weights.x*palettes[first+joints.x] + weights.y*palettes[first+joints.y]
+                   + weights.z*palettes[first+joints.z] + weights.w*palettes[first+joints.w]);
+        }
+    }
+
+    vec4 worldpos = m*vec4(pos,1.0);
     gl_Position = proj*view*worldpos;
 
     vertex_color = clr;
+    frag_uv = uv;
+    frag_material = material;
 
-    frag_normal = mat3(transpose(inverse(model))) * normal;
+    frag_normal = mat3(transpose(inverse(m))) * normal;
     frag_pos = worldpos.xyz;
 };
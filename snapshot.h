@@ -0,0 +1,471 @@
+/*______________________________________
+snapshot - binary save/load of a built scene
+
+One versioned file holds the node pool, the primitive instances of
+a buffer handler and the used part of its vertex/element/skin buffers,
+so a level is restored without replaying instantiate calls.
+Pointers are stored as indices:
+- nodes link to each other by pool index (emb_node.index)
+- instances reference their origin by index in a table given by the caller,
+  the same table (same order) has to be passed to the load
+
+Every section starts at EMB_SNAPSHOT_ALIGN, the file is read with one
+call and fixed up in place, node links in a single pass.
+Loading keeps node chunks and instance handles, so emb_node* and
+emb_primitive_handle taken before a save are valid after the restore.
+Shader overrides are GL objects of the running program, they aren't saved.
+Skins of instances point at caller data, they aren't saved either:
+set them again with prim_inst_set_skin after the load.
+______________________________________*/
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "model/node.h"
+#include "bhandler.h"
+#include "render.h"
+
+
+#define EMB_SNAPSHOT_MAGIC 0x534D4245u //"EMBS"
+#define EMB_SNAPSHOT_VERSION 2
+#define EMB_SNAPSHOT_ALIGN 16
+#define EMB_SNAPSHOT_NONE UINT32_MAX
+
+typedef struct{
+    uint64_t offset; //from the start of the file, EMB_SNAPSHOT_ALIGN aligned
+    uint64_t size; //in bytes
+} emb_snapshot_section;
+
+typedef enum{
+    EMB_SNAPSHOT_NODES, //emb_snapshot_node[node pool capacity]
+    EMB_SNAPSHOT_ORIGINS, //emb_geometry_range[origins]
+    EMB_SNAPSHOT_PRIMITIVES, //emb_snapshot_primitive[len], dense order
+    EMB_SNAPSHOT_DENSE_TO_SLOT, //uint32_t[len]
+    EMB_SNAPSHOT_SLOTS, //emb_slot[slots_len]
+    EMB_SNAPSHOT_VB, //float[vb_len]
+    EMB_SNAPSHOT_EB, //uint8_t[eb_len]
+    EMB_SNAPSHOT_SKIN, //emb_skin_vertex[vb_len/vertex_size]
+    EMB_SNAPSHOT_SECTIONS
+} emb_snapshot_section_id;
+
+typedef struct{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vertex_size; //VB_ATTRIB_SIZE_MAX of the writer
+    uint32_t nodes; //pool capacity
+    uint32_t nodes_len; //nodes in use
+    uint32_t origins;
+    uint32_t primitives; //slotmap len
+    uint32_t slots; //slotmap slots_len
+    uint32_t free_slot; //slotmap free_head
+    uint32_t vb_len; //in elements
+    uint32_t eb_len; //in bytes
+    uint32_t pad;
+    emb_snapshot_section sections[EMB_SNAPSHOT_SECTIONS];
+} emb_snapshot_header;
+
+typedef struct{
+    float pos[3];
+    float rot[3];
+    float scale[3];
+    uint32_t parent; //pool indices, EMB_SNAPSHOT_NONE - no link
+    uint32_t first_child;
+    uint32_t next_sibling;
+    uint32_t prev_sibling;
+    uint32_t state; //NODE_STATE_*, free nodes are NODE_STATE_NONE
+} emb_snapshot_node;
+
+typedef struct{
+    uint32_t origin; //index in the caller's origin table
+    uint32_t material;
+    uint32_t parent; //node index, EMB_SNAPSHOT_NONE - no parent
+    float pos[3];
+    float scale[3];
+    float rot[3];
+    emb_geometry_range geometry; //owner is replaced by the loading handler id
+} emb_snapshot_primitive;
+
+_Static_assert(sizeof(emb_snapshot_header) % EMB_SNAPSHOT_ALIGN == 0, "snapshot header breaks section alignment");
+_Static_assert(sizeof(emb_snapshot_node) == 56, "snapshot node layout changed, bump EMB_SNAPSHOT_VERSION");
+_Static_assert(sizeof(emb_snapshot_primitive) == 68, "snapshot primitive layout changed, bump EMB_SNAPSHOT_VERSION");
+
+static inline uint32_t snapshot_node_index(const emb_node * n){
+    return n ? n->index : EMB_SNAPSHOT_NONE;
+}
+
+static inline emb_node * snapshot_node_at(emb_node_pool * np, uint32_t index){
+    return index == EMB_SNAPSHOT_NONE ? NULL : &np->chunks[index/EMB_NODE_CHUNK][index%EMB_NODE_CHUNK];
+}
+
+
+
+//__________________________________________________
+// save
+//__________________________________________________
+
+static uint32_t snapshot_origin_index(emb_primitive_origin ** origins, uint32_t origins_len, const emb_primitive_origin * o){
+    for(uint32_t i=0; i<origins_len; ++i) if(origins[i] == o) return i;
+    return EMB_SNAPSHOT_NONE;
+}
+
+static bool snapshot_write_section(FILE * f, const emb_snapshot_section * s, const void * data){
+    static const uint8_t zeros[EMB_SNAPSHOT_ALIGN] = {0};
+    long pos = ftell(f);
+    if(pos < 0 || (uint64_t)pos > s->offset) return false;
+    if(s->offset > (uint64_t)pos && fwrite(zeros,1,(size_t)(s->offset-(uint64_t)pos),f) != s->offset-(uint64_t)pos) return false;
+    return s->size == 0 || fwrite(data,1,(size_t)s->size,f) == s->size;
+}
+
+/*writes nodes, instances of bh and its vb/eb contents into path.
+origins - table of every origin the instances were made from.
+Returns false if the file can't be written or an instance's origin is not in the table.*/
+bool emb_snapshot_save(const char * path, emb_node_pool * np, emb_ebvb_handler * bh, emb_primitive_origin ** origins, uint32_t origins_len){
+    slotmap_primitive * sm = &bh->primitives;
+    emb_snapshot_header h;
+    memset(&h,0,sizeof(h));
+    h.magic = EMB_SNAPSHOT_MAGIC;
+    h.version = EMB_SNAPSHOT_VERSION;
+    h.vertex_size = VB_ATTRIB_SIZE_MAX;
+    h.nodes = (uint32_t)np->capacity;
+    h.nodes_len = (uint32_t)np->len;
+    h.origins = origins_len;
+    h.primitives = sm->len;
+    h.slots = sm->slots_len;
+    h.free_slot = sm->free_head;
+    h.vb_len = bh->vb_len;
+    h.eb_len = bh->eb_len;
+
+    uint64_t sizes[EMB_SNAPSHOT_SECTIONS] = {
+        (uint64_t)h.nodes*sizeof(emb_snapshot_node),
+        (uint64_t)h.origins*sizeof(emb_geometry_range),
+        (uint64_t)h.primitives*sizeof(emb_snapshot_primitive),
+        (uint64_t)h.primitives*sizeof(uint32_t),
+        (uint64_t)h.slots*sizeof(emb_slot),
+        (uint64_t)h.vb_len*sizeof(float),
+        (uint64_t)h.eb_len,
+        (uint64_t)(h.vb_len/VB_ATTRIB_SIZE_MAX)*sizeof(emb_skin_vertex),
+    };
+    uint64_t offset = sizeof(h);
+    for(uint32_t s=0; s<EMB_SNAPSHOT_SECTIONS; ++s){
+        h.sections[s].offset = offset;
+        h.sections[s].size = sizes[s];
+        offset = (offset + sizes[s] + EMB_SNAPSHOT_ALIGN-1) & ~(uint64_t)(EMB_SNAPSHOT_ALIGN-1);
+    }
+
+    //pointers to indices
+    emb_snapshot_node * nodes = (emb_snapshot_node*)malloc(sizes[EMB_SNAPSHOT_NODES] + 1);
+    emb_snapshot_primitive * prims = (emb_snapshot_primitive*)malloc(sizes[EMB_SNAPSHOT_PRIMITIVES] + 1);
+    emb_geometry_range * ranges = (emb_geometry_range*)malloc(sizes[EMB_SNAPSHOT_ORIGINS] + 1);
+    bool ok = nodes && prims && ranges;
+    for(uint32_t i=0; ok && i<h.nodes; ++i){
+        emb_node * n = snapshot_node_at(np,i);
+        emb_snapshot_node * o = &nodes[i];
+        memset(o,0,sizeof(*o));
+        o->state = n->node_state;
+        if(n->node_state == NODE_STATE_NONE){
+            o->parent = o->first_child = o->next_sibling = o->prev_sibling = EMB_SNAPSHOT_NONE;
+            continue;
+        }
+        memcpy(o->pos,n->pos,sizeof(o->pos));
+        memcpy(o->rot,n->rot,sizeof(o->rot));
+        memcpy(o->scale,n->scale,sizeof(o->scale));
+        o->parent = snapshot_node_index(n->parent);
+        o->first_child = snapshot_node_index(n->first_child);
+        o->next_sibling = snapshot_node_index(n->next_sibling);
+        o->prev_sibling = snapshot_node_index(n->prev_sibling);
+    }
+    for(uint32_t i=0; ok && i<origins_len; ++i) ranges[i] = origins[i]->geometry;
+    for(uint32_t i=0; ok && i<h.primitives; ++i){
+        emb_primitive * p = &sm->values[i];
+        emb_snapshot_primitive * o = &prims[i];
+        o->origin = snapshot_origin_index(origins,origins_len,p->primitive);
+        if(o->origin == EMB_SNAPSHOT_NONE) {printf("ERROR emb_snapshot_save(): instance origin is not in the origin table.\n"); ok = false; break;}
+        o->material = p->material;
+        o->parent = snapshot_node_index(prim_inst_parent(p));
+        memcpy(o->pos,p->pos,sizeof(o->pos));
+        memcpy(o->scale,p->scale,sizeof(o->scale));
+        memcpy(o->rot,p->rot,sizeof(o->rot));
+        o->geometry = p->geometry;
+    }
+
+    FILE * f = ok ? fopen(path,"wb") : NULL;
+    if(ok && !f) printf("ERROR emb_snapshot_save(): cannot open %s.\n",path);
+    ok = f && fwrite(&h,sizeof(h),1,f) == 1
+        && snapshot_write_section(f,&h.sections[EMB_SNAPSHOT_NODES],nodes)
+        && snapshot_write_section(f,&h.sections[EMB_SNAPSHOT_ORIGINS],ranges)
+        && snapshot_write_section(f,&h.sections[EMB_SNAPSHOT_PRIMITIVES],prims)
+        && snapshot_write_section(f,&h.sections[EMB_SNAPSHOT_DENSE_TO_SLOT],sm->dense_to_slot)
+        && snapshot_write_section(f,&h.sections[EMB_SNAPSHOT_SLOTS],sm->slots)
+        && snapshot_write_section(f,&h.sections[EMB_SNAPSHOT_VB],bh->vb_data)
+        && snapshot_write_section(f,&h.sections[EMB_SNAPSHOT_EB],bh->eb_data)
+        && snapshot_write_section(f,&h.sections[EMB_SNAPSHOT_SKIN],bh->skin_data);
+    if(f && !ok) printf("ERROR emb_snapshot_save(): cannot write %s.\n",path);
+    if(f && fclose(f) != 0) ok = false;
+    free(nodes);
+    free(prims);
+    free(ranges);
+    return ok;
+}
+
+
+
+//__________________________________________________
+// load
+//__________________________________________________
+
+static bool snapshot_link_valid(uint32_t index, uint32_t nodes){
+    return index == EMB_SNAPSHOT_NONE || index < nodes;
+}
+
+static inline bool snapshot_node_live(const emb_snapshot_node * nodes, uint32_t index){
+    return index != EMB_SNAPSHOT_NONE && nodes[index].state != NODE_STATE_NONE;
+}
+
+//links of live node i agree with the nodes they point at (indices are already in range)
+static bool snapshot_node_links_valid(const emb_snapshot_node * nodes, uint32_t i){
+    const emb_snapshot_node * n = &nodes[i];
+    if(n->parent == EMB_SNAPSHOT_NONE){
+        if(n->next_sibling != EMB_SNAPSHOT_NONE || n->prev_sibling != EMB_SNAPSHOT_NONE) return false; //roots aren't linked
+    }
+    else if(!snapshot_node_live(nodes,n->parent)) return false;
+    if(n->first_child != EMB_SNAPSHOT_NONE){
+        const emb_snapshot_node * c = &nodes[n->first_child];
+        if(!snapshot_node_live(nodes,n->first_child) || c->parent != i || c->prev_sibling != EMB_SNAPSHOT_NONE) return false;
+    }
+    if(n->next_sibling != EMB_SNAPSHOT_NONE){
+        const emb_snapshot_node * s = &nodes[n->next_sibling];
+        if(!snapshot_node_live(nodes,n->next_sibling) || s->prev_sibling != i || s->parent != n->parent) return false;
+    }
+    if(n->prev_sibling != EMB_SNAPSHOT_NONE) return snapshot_node_live(nodes,n->prev_sibling) && nodes[n->prev_sibling].next_sibling == i;
+    return n->parent == EMB_SNAPSHOT_NONE || nodes[n->parent].first_child == i;
+}
+
+/*every live node is reached exactly once walking down from the roots.
+With consistent links a loop in the parent chain or a sibling list can't hang
+off a root, so it shows up as fewer nodes reached; the walk stops past used.*/
+static bool snapshot_nodes_acyclic(const emb_snapshot_node * nodes, uint32_t nodes_len, uint32_t used){
+    uint32_t reached = 0;
+    for(uint32_t root=0; root<nodes_len; ++root){
+        if(nodes[root].state == NODE_STATE_NONE || nodes[root].parent != EMB_SNAPSHOT_NONE) continue;
+        uint32_t cur = root;
+        for(;;){
+            if(++reached > used) return false;
+            if(nodes[cur].first_child != EMB_SNAPSHOT_NONE) {cur = nodes[cur].first_child; continue;}
+            while(cur != root && nodes[cur].next_sibling == EMB_SNAPSHOT_NONE) cur = nodes[cur].parent;
+            if(cur == root) break;
+            cur = nodes[cur].next_sibling;
+        }
+    }
+    return reached == used;
+}
+
+//indices and vertices of the range lie inside the saved eb and vb
+static bool snapshot_range_valid(const emb_geometry_range * g, uint32_t vertices, const emb_snapshot_header * h){
+    if(g->index_size != 2 && g->index_size != 4) return false;
+    if(g->eb_offset % g->index_size || (uint64_t)g->eb_offset + (uint64_t)g->eb_len*g->index_size > h->eb_len) return false;
+    return (uint64_t)g->base_vertex + vertices <= h->vb_len/VB_ATTRIB_SIZE_MAX;
+}
+
+//every live dense index maps to a slot pointing back at it, the free chain covers the rest without cycles
+static bool snapshot_slots_valid(const emb_snapshot_header * h, const uint32_t * dense_to_slot, const emb_slot * slots){
+    if(h->slots < h->primitives) return false;
+    for(uint32_t i=0; i<h->primitives; ++i)
+        if(dense_to_slot[i] >= h->slots || slots[dense_to_slot[i]].dense_or_next != i || !(slots[dense_to_slot[i]].generation & 1)) return false;
+    uint32_t free_len = 0;
+    for(uint32_t at = h->free_slot; at != EMB_SLOT_NONE; at = slots[at].dense_or_next){
+        if(at >= h->slots || slots[at].generation & 1 || ++free_len > h->slots - h->primitives) return false;
+    }
+    return free_len == h->slots - h->primitives;
+}
+
+//checks the whole file before anything is touched, a bad file leaves the scene as it was
+static bool snapshot_validate(const uint8_t * data, size_t size, const emb_snapshot_header * h, emb_ebvb_handler * bh, emb_primitive_origin ** origins, uint32_t origins_len, uint32_t materials_len){
+    if(h->magic != EMB_SNAPSHOT_MAGIC) {printf("ERROR emb_snapshot_load(): not a snapshot.\n"); return false;}
+    if(h->version != EMB_SNAPSHOT_VERSION) {printf("ERROR emb_snapshot_load(): snapshot version %u is not supported.\n",h->version); return false;}
+    if(h->vertex_size != VB_ATTRIB_SIZE_MAX) {printf("ERROR emb_snapshot_load(): saved with %u floats per vertex.\n",h->vertex_size); return false;}
+    if(h->origins != origins_len) {printf("ERROR emb_snapshot_load(): saved with %u origins, got %u.\n",h->origins,origins_len); return false;}
+    if(h->vb_len > bh->vb_capacity || h->eb_len > bh->eb_capacity) {printf("ERROR emb_snapshot_load(): buffers don't fit the handler.\n"); return false;}
+
+    uint64_t sizes[EMB_SNAPSHOT_SECTIONS] = {
+        (uint64_t)h->nodes*sizeof(emb_snapshot_node),
+        (uint64_t)h->origins*sizeof(emb_geometry_range),
+        (uint64_t)h->primitives*sizeof(emb_snapshot_primitive),
+        (uint64_t)h->primitives*sizeof(uint32_t),
+        (uint64_t)h->slots*sizeof(emb_slot),
+        (uint64_t)h->vb_len*sizeof(float),
+        (uint64_t)h->eb_len,
+        (uint64_t)(h->vb_len/VB_ATTRIB_SIZE_MAX)*sizeof(emb_skin_vertex),
+    };
+    for(uint32_t s=0; s<EMB_SNAPSHOT_SECTIONS; ++s){
+        const emb_snapshot_section * sec = &h->sections[s];
+        if(sec->size != sizes[s] || sec->offset % EMB_SNAPSHOT_ALIGN || sec->offset > size || sec->size > size - sec->offset){
+            printf("ERROR emb_snapshot_load(): truncated or corrupted snapshot.\n");
+            return false;
+        }
+    }
+
+    const emb_snapshot_node * nodes = (const emb_snapshot_node*)(data + h->sections[EMB_SNAPSHOT_NODES].offset);
+    uint32_t nodes_used = 0;
+    for(uint32_t i=0; i<h->nodes; ++i){
+        const emb_snapshot_node * n = &nodes[i];
+        if(n->state > NODE_STATE_IGNORE || !snapshot_link_valid(n->parent,h->nodes) || !snapshot_link_valid(n->first_child,h->nodes)
+            || !snapshot_link_valid(n->next_sibling,h->nodes) || !snapshot_link_valid(n->prev_sibling,h->nodes)){
+            printf("ERROR emb_snapshot_load(): node %u is corrupted.\n",i);
+            return false;
+        }
+        nodes_used += n->state != NODE_STATE_NONE;
+    }
+    if(h->nodes_len != nodes_used) {printf("ERROR emb_snapshot_load(): %u nodes in use, the node section has %u.\n",h->nodes_len,nodes_used); return false;}
+    for(uint32_t i=0; i<h->nodes; ++i){
+        if(nodes[i].state != NODE_STATE_NONE && !snapshot_node_links_valid(nodes,i)) {printf("ERROR emb_snapshot_load(): links of node %u don't agree.\n",i); return false;}
+    }
+    if(!snapshot_nodes_acyclic(nodes,h->nodes,nodes_used)) {printf("ERROR emb_snapshot_load(): node hierarchy has a cycle.\n"); return false;}
+
+    //ranges are checked against the origins of the caller, their vb_len stays after the cpu copy is dropped
+    const emb_geometry_range * ranges = (const emb_geometry_range*)(data + h->sections[EMB_SNAPSHOT_ORIGINS].offset);
+    for(uint32_t i=0; i<h->origins; ++i){
+        if(ranges[i].owner && !snapshot_range_valid(&ranges[i],origins[i]->vb_len/VB_ATTRIB_SIZE_MAX,h)){
+            printf("ERROR emb_snapshot_load(): geometry of origin %u is outside the saved buffers.\n",i);
+            return false;
+        }
+    }
+    const emb_snapshot_primitive * prims = (const emb_snapshot_primitive*)(data + h->sections[EMB_SNAPSHOT_PRIMITIVES].offset);
+    for(uint32_t i=0; i<h->primitives; ++i){
+        if(prims[i].origin >= h->origins || !snapshot_link_valid(prims[i].parent,h->nodes)
+            || !snapshot_range_valid(&prims[i].geometry,origins[prims[i].origin]->vb_len/VB_ATTRIB_SIZE_MAX,h)){
+            printf("ERROR emb_snapshot_load(): instance %u is corrupted.\n",i);
+            return false;
+        }
+        if(prims[i].material >= materials_len){
+            printf("ERROR emb_snapshot_load(): instance %u uses material %u, the table has %u.\n",i,prims[i].material,materials_len);
+            return false;
+        }
+    }
+    const uint32_t * dense_to_slot = (const uint32_t*)(data + h->sections[EMB_SNAPSHOT_DENSE_TO_SLOT].offset);
+    const emb_slot * slots = (const emb_slot*)(data + h->sections[EMB_SNAPSHOT_SLOTS].offset);
+    if(!snapshot_slots_valid(h,dense_to_slot,slots)) {printf("ERROR emb_snapshot_load(): instance slot table is corrupted.\n"); return false;}
+    return true;
+}
+
+//grows the pool to capacity without moving chunks, so emb_node* taken before stay valid
+static bool snapshot_pool_reserve(emb_node_pool * np, uint32_t capacity){
+    while(np->capacity < capacity) if(!node_pool_grow(np)) return false;
+    return true;
+}
+
+static bool snapshot_slotmap_reserve(slotmap_primitive * sm, uint32_t len, uint32_t slots){
+    while(sm->cap < len) if(!slotmap_primitive_grow(sm)) return false;
+    if(sm->slots_cap < slots){
+        emb_slot * s = (emb_slot*)emb_realloc(sm->allocator,sm->slots,sm->slots_cap*sizeof(emb_slot),slots*sizeof(emb_slot));
+        if(!s) return false;
+        sm->slots = s;
+        sm->slots_cap = slots;
+    }
+    return true;
+}
+
+/*restores a snapshot from memory (data - EMB_SNAPSHOT_ALIGN aligned).
+materials_len - size of the material table the instances index (emb_materials.materials_len).
+Nodes and instances are replaced, origins get their saved geometry ranges,
+vb/eb/skin contents are copied into the handler - upload them before drawing
+(emb_cmd_ebvb_handler_upload or the initial glNamedBufferStorage).*/
+bool emb_snapshot_load_memory(const void * data, size_t size, emb_node_pool * np, emb_ebvb_handler * bh, emb_primitive_origin ** origins, uint32_t origins_len, uint32_t materials_len){
+    const uint8_t * bytes = (const uint8_t*)data;
+    if(size < sizeof(emb_snapshot_header)) {printf("ERROR emb_snapshot_load(): truncated or corrupted snapshot.\n"); return false;}
+    const emb_snapshot_header * h = (const emb_snapshot_header*)bytes;
+    if(!snapshot_validate(bytes,size,h,bh,origins,origins_len,materials_len)) return false;
+
+    slotmap_primitive * sm = &bh->primitives;
+    if(!snapshot_pool_reserve(np,h->nodes) || !snapshot_slotmap_reserve(sm,h->primitives,h->slots)){
+        printf("ERROR emb_snapshot_load(): out of memory.\n");
+        return false;
+    }
+
+    //nodes: one pass, links are resolved by index (chunks never move), free list is rebuilt backwards
+    const emb_snapshot_node * nodes = (const emb_snapshot_node*)(bytes + h->sections[EMB_SNAPSHOT_NODES].offset);
+    np->free_list = NULL;
+    np->len = h->nodes_len;
+    for(uint32_t i=(uint32_t)np->capacity; i>0; --i){
+        emb_node * n = snapshot_node_at(np,i-1);
+        if(i-1 >= h->nodes || nodes[i-1].state == NODE_STATE_NONE){
+            if(n->node_state != NODE_STATE_NONE) ++n->generation; //removed by the restore
+            n->node_state = NODE_STATE_NONE;
+            n->parent = n->first_child = n->prev_sibling = NULL;
+            n->next_sibling = np->free_list;
+            np->free_list = n;
+            continue;
+        }
+        const emb_snapshot_node * s = &nodes[i-1];
+        n->node_state = (uint8_t)s->state;
+        memcpy(n->pos,s->pos,sizeof(s->pos));
+        memcpy(n->rot,s->rot,sizeof(s->rot));
+        memcpy(n->scale,s->scale,sizeof(s->scale));
+        emb_node_save_state(n); //restored, not interpolated from the old state
+        n->parent = snapshot_node_at(np,s->parent);
+        n->first_child = snapshot_node_at(np,s->first_child);
+        n->next_sibling = snapshot_node_at(np,s->next_sibling);
+        n->prev_sibling = snapshot_node_at(np,s->prev_sibling);
+    }
+
+    const emb_geometry_range * ranges = (const emb_geometry_range*)(bytes + h->sections[EMB_SNAPSHOT_ORIGINS].offset);
+    for(uint32_t i=0; i<origins_len; ++i){
+        origins[i]->geometry = ranges[i];
+        if(ranges[i].owner) origins[i]->geometry.owner = bh->id;
+    }
+
+    //instances keep their slots, so handles survive the restore
+    const emb_snapshot_primitive * prims = (const emb_snapshot_primitive*)(bytes + h->sections[EMB_SNAPSHOT_PRIMITIVES].offset);
+    for(uint32_t i=0; i<h->primitives; ++i){
+        const emb_snapshot_primitive * s = &prims[i];
+        emb_primitive * p = &sm->values[i];
+        p->primitive = origins[s->origin];
+        p->geometry = s->geometry;
+        p->geometry.owner = bh->id;
+        p->material = s->material;
+        memcpy(p->pos,s->pos,sizeof(s->pos));
+        memcpy(p->scale,s->scale,sizeof(s->scale));
+        memcpy(p->rot,s->rot,sizeof(s->rot));
+        p->shader_program = 0;
+        p->shader_program_override = false;
+        prim_inst_set_parent(p,snapshot_node_at(np,s->parent));
+        prim_inst_set_skin(p,NULL,NULL);
+    }
+    sm->len = h->primitives;
+    sm->slots_len = h->slots;
+    sm->free_head = h->free_slot;
+    memcpy(sm->dense_to_slot,bytes + h->sections[EMB_SNAPSHOT_DENSE_TO_SLOT].offset,h->sections[EMB_SNAPSHOT_DENSE_TO_SLOT].size);
+    memcpy(sm->slots,bytes + h->sections[EMB_SNAPSHOT_SLOTS].offset,h->sections[EMB_SNAPSHOT_SLOTS].size);
+
+    bh->vb_len = h->vb_len;
+    bh->eb_len = h->eb_len;
+    memcpy(bh->vb_data,bytes + h->sections[EMB_SNAPSHOT_VB].offset,h->sections[EMB_SNAPSHOT_VB].size);
+    memcpy(bh->eb_data,bytes + h->sections[EMB_SNAPSHOT_EB].offset,h->sections[EMB_SNAPSHOT_EB].size);
+    memcpy(bh->skin_data,bytes + h->sections[EMB_SNAPSHOT_SKIN].offset,h->sections[EMB_SNAPSHOT_SKIN].size);
+    emb_ebvb_handler_fill_positions(bh,0,bh->vb_len/VB_ATTRIB_SIZE_MAX); //derived from vb, not saved
+    return true;
+}
+
+//reads the whole file with one call and restores it, see emb_snapshot_load_memory
+bool emb_snapshot_load(const char * path, emb_node_pool * np, emb_ebvb_handler * bh, emb_primitive_origin ** origins, uint32_t origins_len, uint32_t materials_len){
+    FILE * f = fopen(path,"rb");
+    if(!f) {printf("ERROR emb_snapshot_load(): cannot open %s.\n",path); return false;}
+    long size = (fseek(f,0,SEEK_END) == 0) ? ftell(f) : -1;
+    void * data = size > 0 ? malloc((size_t)size) : NULL; //malloc is aligned for any type, enough for the sections
+    bool ok = data && fseek(f,0,SEEK_SET) == 0 && fread(data,1,(size_t)size,f) == (size_t)size;
+    fclose(f);
+    if(!ok) printf("ERROR emb_snapshot_load(): cannot read %s.\n",path);
+    else ok = emb_snapshot_load_memory(data,(size_t)size,np,bh,origins,origins_len,materials_len);
+    free(data);
+    return ok;
+}
+
+/*records upload of the handler's vb/eb (and the skin/position streams when their vbos are set) after a restore,
+the data is copied into the list (render.h), so bh can change right after*/
+void emb_cmd_ebvb_handler_upload(emb_cmd_list * cl, emb_ebvb_handler * bh){
+    if(bh->vb_len) emb_cmd_buffer_data(cl,*bh->vbo,0,bh->vb_data,(uint32_t)(bh->vb_len*sizeof(float)));
+    if(bh->eb_len) emb_cmd_buffer_data(cl,*bh->ebo,0,bh->eb_data,bh->eb_len);
+    if(bh->skin_vbo && bh->vb_len) emb_cmd_buffer_data(cl,*bh->skin_vbo,0,bh->skin_data,(uint32_t)(bh->vb_len/VB_ATTRIB_SIZE_MAX*sizeof(emb_skin_vertex)));
+    if(bh->pos_vbo && bh->vb_len) emb_cmd_buffer_data(cl,*bh->pos_vbo,0,bh->pos_data,(uint32_t)(bh->vb_len/VB_ATTRIB_SIZE_MAX*VB_ATTRIB_POS_SIZE*sizeof(float)));
+}
@@ -0,0 +1,127 @@
+/*______________________________________
+test_clusters - CPU light binning (model/light.h), no GL context
+
+Lights with known positions and radii are binned into a fixed frustum
+(identity view, 90 degrees, 16:9, near 0.1, far 100), every cluster
+of the grid is compared with the expected light list.
+Ranges below were computed by hand from cluster_light_range,
+every edge is far from a cluster boundary except the one tested on it.
+______________________________________*/
+#include <glad/gl.h>
+#include <cglm/cglm.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "utils/vector.h"
+#include "model/light.h"
+
+
+static uint32_t FAILURES = 0;
+
+#define CHECK(cond, ...) do{ if(!(cond)){ printf("FAIL %s:%d: ",__FILE__,__LINE__); printf(__VA_ARGS__); printf("\n"); ++FAILURES; } }while(0)
+
+//inclusive cluster range of a light, x1 < x0 - no clusters
+typedef struct{
+    vec3 pos;
+    float radius;
+    int x0, x1, y0, y1, z0, z1;
+} test_light;
+
+static const test_light TEST_LIGHTS[] = {
+    {{ 3.0f, 1.0f,-20.0f},0.5f, 8,8, 4,4, 18,18}, //one cluster
+    {{-0.5f,-1.3f, -9.0f},0.5f, 7,8, 3,4, 15,15}, //right edge exactly on the x boundary between tiles 7 and 8
+    {{-6.0f, 3.0f,-30.0f},2.0f, 6,7, 4,5, 19,20}, //2x2x2 block
+    {{ 0.2f, 0.1f,-10.0f},0.3f, 7,8, 4,4, 15,16}, //shares (7..8,4,15) with light 1
+    {{ 0.0f, 0.0f,  5.0f},1.0f, 0,-1, 0,-1, 0,-1}, //behind the camera
+    {{50.0f, 0.0f, -5.0f},1.0f, 0,-1, 0,-1, 0,-1}, //outside on the right
+};
+#define TEST_LIGHTS_LEN (sizeof(TEST_LIGHTS)/sizeof(TEST_LIGHTS[0]))
+
+static void test_setup(emb_clusters * c, uint32_t threads, mat4 view){
+    emb_clusters_init(c,threads);
+    emb_clusters_set_projection(c,glm_rad(90.0f),16.0f/9.0f,0.1f,100.0f);
+    glm_mat4_identity(view);
+}
+
+static emb_light test_make_light(const float * pos, float radius){
+    emb_light l;
+    memset(&l,0,sizeof(l));
+    l.type = EMB_LIGHT_POINT;
+    glm_vec3_copy((float*)pos,l.pos);
+    l.radius = radius;
+    l.intensity = 1.0f;
+    return l;
+}
+
+static const emb_cluster * test_cluster(const emb_clusters * c, int x, int y, int z){
+    return &c->grid[z*EMB_CLUSTER_XY + y*EMB_CLUSTER_X + x];
+}
+
+//every cluster holds exactly the lights whose range contains it, in light order
+static void test_known_lights(uint32_t threads){
+    emb_clusters c;
+    mat4 view;
+    test_setup(&c,threads,view);
+    emb_light lights[TEST_LIGHTS_LEN];
+    for(uint32_t i=0; i<TEST_LIGHTS_LEN; ++i) lights[i] = test_make_light(TEST_LIGHTS[i].pos,TEST_LIGHTS[i].radius);
+    emb_clusters_bin(&c,lights,TEST_LIGHTS_LEN,view);
+
+    CHECK(c.lights_len == TEST_LIGHTS_LEN,"threads %u: lights_len %u",threads,c.lights_len);
+    uint32_t total = 0;
+    for(int z=0; z<EMB_CLUSTER_Z; ++z) for(int y=0; y<EMB_CLUSTER_Y; ++y) for(int x=0; x<EMB_CLUSTER_X; ++x){
+        uint32_t expected[TEST_LIGHTS_LEN], expected_len = 0;
+        for(uint32_t l=0; l<TEST_LIGHTS_LEN; ++l){
+            const test_light * t = &TEST_LIGHTS[l];
+            if(x >= t->x0 && x <= t->x1 && y >= t->y0 && y <= t->y1 && z >= t->z0 && z <= t->z1) expected[expected_len++] = l;
+        }
+        const emb_cluster * cl = test_cluster(&c,x,y,z);
+        CHECK(cl->count == expected_len,"threads %u: cluster (%d,%d,%d) has %u lights, expected %u",threads,x,y,z,cl->count,expected_len);
+        if(cl->count != expected_len) continue;
+        CHECK(cl->offset + cl->count <= c.indices.len,"threads %u: cluster (%d,%d,%d) is outside the index list",threads,x,y,z);
+        for(uint32_t k=0; k<expected_len && cl->offset + k < c.indices.len; ++k)
+            CHECK(c.indices.data[cl->offset+k] == expected[k],"threads %u: cluster (%d,%d,%d) light %u is %u, expected %u",
+                threads,x,y,z,k,c.indices.data[cl->offset+k],expected[k]);
+        total += expected_len;
+    }
+    CHECK(c.indices.len == total,"threads %u: %zu indices, expected %u",threads,(size_t)c.indices.len,total);
+
+    //spelled out: the shared clusters and both sides of the boundary
+    CHECK(test_cluster(&c,8,4,15)->count == 2,"threads %u: (8,4,15) should hold lights 1 and 3",threads);
+    CHECK(test_cluster(&c,8,3,15)->count == 1,"threads %u: light 1 touches tile 8",threads);
+    CHECK(test_cluster(&c,9,3,15)->count == 0,"threads %u: light 1 doesn't reach tile 9",threads);
+    emb_clusters_free(&c);
+}
+
+//lights past EMB_MAX_LIGHTS are dropped, the first ones are kept in order
+static void test_max_lights(uint32_t threads){
+    emb_clusters c;
+    mat4 view;
+    test_setup(&c,threads,view);
+    uint32_t count = EMB_MAX_LIGHTS + 5;
+    emb_light * lights = (emb_light*)malloc(count*sizeof(emb_light));
+    for(uint32_t i=0; i<count; ++i) lights[i] = test_make_light(TEST_LIGHTS[0].pos,TEST_LIGHTS[0].radius);
+    emb_clusters_bin(&c,lights,count,view);
+
+    CHECK(c.lights_len == EMB_MAX_LIGHTS,"threads %u: lights_len %u, expected %u",threads,c.lights_len,EMB_MAX_LIGHTS);
+    const emb_cluster * cl = test_cluster(&c,8,4,18);
+    CHECK(cl->count == EMB_MAX_LIGHTS,"threads %u: cluster holds %u lights, expected %u",threads,cl->count,EMB_MAX_LIGHTS);
+    CHECK(c.indices.len == EMB_MAX_LIGHTS,"threads %u: %zu indices",threads,(size_t)c.indices.len);
+    for(uint32_t k=0; k<cl->count && cl->offset + k < c.indices.len; ++k)
+        if(c.indices.data[cl->offset+k] != k) {CHECK(false,"threads %u: light %u is %u",threads,k,c.indices.data[cl->offset+k]); break;}
+    free(lights);
+    emb_clusters_free(&c);
+}
+
+
+int main(void){
+    //1 - the calling thread only, 3 - slices split between threads and merged
+    uint32_t threads[2] = {1, 3};
+    for(uint32_t i=0; i<2; ++i){
+        test_known_lights(threads[i]);
+        test_max_lights(threads[i]);
+    }
+    if(FAILURES) {printf("test_clusters: %u checks failed\n",FAILURES); return EXIT_FAILURE;}
+    printf("test_clusters: ok\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,377 @@
+/*______________________________________
+allocator - arenas, frame scratch and fixed-size pools
+
+Every allocator starts with `emb_allocator` header,
+so a pointer to it can be passed wherever emb_allocator* is expected.
+NULL allocator always means the heap (malloc/realloc/free).
+
+None of them are thread-safe, use one per thread.
+______________________________________*/
+#pragma once
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "memstats.h"
+
+
+#define EMB_ALLOC_ALIGN 16 //default alignment, enough for vec4/mat4
+#define EMB_ARENA_BLOCK_DEFAULT (1u<<20)
+
+
+typedef struct emb_allocator emb_allocator;
+
+typedef struct emb_allocator{
+    void * (*alloc)(emb_allocator * a, size_t size);
+    /*old_size is needed by linear allocators,
+    they can grow the last allocation in place*/
+    void * (*realloc)(emb_allocator * a, void * ptr, size_t old_size, size_t new_size);
+    void (*free)(emb_allocator * a, void * ptr, size_t size);
+} emb_allocator;
+
+
+
+//__________________________________________________
+// heap
+//__________________________________________________
+
+static void * allocator_heap_alloc(emb_allocator * a, size_t size){ return malloc(size); }
+static void * allocator_heap_realloc(emb_allocator * a, void * ptr, size_t old_size, size_t new_size){ return realloc(ptr,new_size); }
+static void allocator_heap_free(emb_allocator * a, void * ptr, size_t size){ free(ptr); }
+
+emb_allocator EMB_HEAP_ALLOCATOR = {allocator_heap_alloc, allocator_heap_realloc, allocator_heap_free};
+
+
+#ifdef EMB_MEMORY
+//heap allocators counting into a memstats tag, the tag is the position in the array
+static void * allocator_tagged_alloc(emb_allocator * a, size_t size);
+static void * allocator_tagged_realloc(emb_allocator * a, void * ptr, size_t old_size, size_t new_size);
+static void allocator_tagged_free(emb_allocator * a, void * ptr, size_t size);
+
+#define EMB_MEM_HEAP_ENTRY(tag, name) {allocator_tagged_alloc, allocator_tagged_realloc, allocator_tagged_free},
+emb_allocator EMB_MEM_HEAPS[EMB_MEM_TAG_COUNT] = {EMB_MEM_TAGS(EMB_MEM_HEAP_ENTRY)};
+#define ALLOCATOR_TAG(a) ((emb_mem_tag)((a) - EMB_MEM_HEAPS))
+
+static void * allocator_tagged_alloc(emb_allocator * a, size_t size){
+    void * p = malloc(size);
+    if(p) emb_mem_alloc(ALLOCATOR_TAG(a),size);
+    return p;
+}
+static void * allocator_tagged_realloc(emb_allocator * a, void * ptr, size_t old_size, size_t new_size){
+    void * p = realloc(ptr,new_size);
+    if(p) emb_mem_realloc(ALLOCATOR_TAG(a),ptr ? old_size : 0,new_size);
+    return p;
+}
+static void allocator_tagged_free(emb_allocator * a, void * ptr, size_t size){
+    free(ptr);
+    emb_mem_free(ALLOCATOR_TAG(a),size);
+}
+
+//heap which counts into tag (utils/memstats.h), use it where NULL would be passed
+#define EMB_MEM_HEAP(tag) (&EMB_MEM_HEAPS[tag])
+#else
+#define EMB_MEM_HEAP(tag) NULL
+#endif
+
+
+//generic calls, NULL allocator is the heap
+static inline void * emb_alloc(emb_allocator * a, size_t size){
+    if(!a) a = &EMB_HEAP_ALLOCATOR;
+    return a->alloc(a,size);
+}
+
+static inline void * emb_realloc(emb_allocator * a, void * ptr, size_t old_size, size_t new_size){
+    if(!a) a = &EMB_HEAP_ALLOCATOR;
+    return a->realloc(a,ptr,old_size,new_size);
+}
+
+static inline void emb_free(emb_allocator * a, void * ptr, size_t size){
+    if(!a) a = &EMB_HEAP_ALLOCATOR;
+    if(ptr) a->free(a,ptr,size);
+}
+
+
+
+//__________________________________________________
+// emb_arena - linear allocator
+//__________________________________________________
+
+typedef struct emb_arena_block emb_arena_block;
+
+typedef struct emb_arena_block{
+    emb_arena_block * next;
+    size_t capacity; //bytes after the header
+    size_t used;
+} emb_arena_block;
+
+/*Allocates by bumping the offset, freeing single allocations does nothing.
+Everything is released at once with emb_arena_reset (for example a level).
+When the current block is full, a new one is chained, blocks are never moved,
+so pointers stay valid until reset.*/
+typedef struct{
+    emb_allocator base;
+    emb_arena_block * head; //current block
+    emb_arena_block * first;
+    size_t block_size;
+    size_t used_total; //bytes in all blocks, for stats
+} emb_arena;
+
+//saved arena position
+typedef struct{
+    emb_arena_block * block;
+    size_t used;
+    size_t used_total;
+} emb_arena_mark;
+
+
+#define ARENA_BLOCK_DATA(b) ((uint8_t*)(b) + sizeof(emb_arena_block))
+
+static emb_arena_block * arena_block_new(size_t capacity){
+    emb_arena_block * b = (emb_arena_block*)malloc(sizeof(emb_arena_block) + capacity);
+    if(!b) return NULL;
+    EMB_MEM_ALLOC(EMB_MEM_ARENA,sizeof(emb_arena_block) + capacity);
+    b->next = NULL;
+    b->capacity = capacity;
+    b->used = 0;
+    return b;
+}
+
+void * emb_arena_alloc_aligned(emb_arena * ar, size_t size, size_t align){
+    emb_arena_block * b = ar->head;
+    if(b){
+        uintptr_t base = (uintptr_t)ARENA_BLOCK_DATA(b);
+        size_t offset = ((base + b->used + align-1) & ~(uintptr_t)(align-1)) - base;
+        if(offset + size <= b->capacity){
+            ar->used_total += offset + size - b->used;
+            b->used = offset + size;
+            return (void*)(base + offset);
+        }
+    }
+
+    //reuse the chained block left from a previous reset, or add a new one
+    if(b && b->next && b->next->capacity >= size + align){
+        b = b->next;
+        b->used = 0;
+    }
+    else{
+        size_t capacity = ar->block_size > size + align ? ar->block_size : size + align;
+        emb_arena_block * nb = arena_block_new(capacity);
+        if(!nb) {printf("ERROR emb_arena_alloc(): out of memory.\n"); return NULL;}
+        if(b) {nb->next = b->next; b->next = nb;}
+        else ar->first = nb;
+        b = nb;
+    }
+    ar->head = b;
+    return emb_arena_alloc_aligned(ar,size,align);
+}
+
+static inline void * emb_arena_alloc(emb_arena * ar, size_t size){
+    return emb_arena_alloc_aligned(ar,size,EMB_ALLOC_ALIGN);
+}
+
+
+static void * arena_alloc(emb_allocator * a, size_t size){
+    return emb_arena_alloc((emb_arena*)a,size);
+}
+
+//the last allocation grows in place, the rest is copied
+static void * arena_realloc(emb_allocator * a, void * ptr, size_t old_size, size_t new_size){
+    emb_arena * ar = (emb_arena*)a;
+    emb_arena_block * b = ar->head;
+    if(ptr && b && (uint8_t*)ptr + old_size == ARENA_BLOCK_DATA(b) + b->used
+    && (uint8_t*)ptr - ARENA_BLOCK_DATA(b) + new_size <= b->capacity){
+        ar->used_total += new_size - old_size;
+        b->used = (uint8_t*)ptr - ARENA_BLOCK_DATA(b) + new_size;
+        return ptr;
+    }
+    void * n = emb_arena_alloc(ar,new_size);
+    if(n && ptr) memcpy(n,ptr,old_size < new_size ? old_size : new_size);
+    return n;
+}
+
+static void arena_free(emb_allocator * a, void * ptr, size_t size){
+    //single allocations are released on reset
+}
+
+
+emb_arena emb_arena_init(size_t block_size){
+    emb_arena ar;
+    ar.base.alloc = arena_alloc;
+    ar.base.realloc = arena_realloc;
+    ar.base.free = arena_free;
+    ar.head = NULL;
+    ar.first = NULL;
+    ar.block_size = block_size ? block_size : EMB_ARENA_BLOCK_DEFAULT;
+    ar.used_total = 0;
+    return ar;
+}
+
+emb_arena_mark emb_arena_get_mark(emb_arena * ar){
+    emb_arena_mark m = {ar->head, ar->head ? ar->head->used : 0, ar->used_total};
+    return m;
+}
+
+//frees everything allocated after the mark
+void emb_arena_rewind(emb_arena * ar, emb_arena_mark m){
+    if(!m.block) {ar->head = ar->first; if(ar->head) ar->head->used = 0;}
+    else {ar->head = m.block; ar->head->used = m.used;}
+    ar->used_total = m.used_total;
+}
+
+//frees all allocations at once, blocks are kept for reuse
+void emb_arena_reset(emb_arena * ar){
+    ar->head = ar->first;
+    if(ar->head) ar->head->used = 0;
+    ar->used_total = 0;
+}
+
+//gives the memory back to the system
+void emb_arena_free(emb_arena * ar){
+    emb_arena_block * b = ar->first;
+    while(b){
+        emb_arena_block * next = b->next;
+        EMB_MEM_FREE(EMB_MEM_ARENA,sizeof(emb_arena_block) + b->capacity);
+        free(b);
+        b = next;
+    }
+    ar->head = NULL;
+    ar->first = NULL;
+    ar->used_total = 0;
+}
+
+
+
+//__________________________________________________
+// emb_frame_allocator - per-frame scratch
+//__________________________________________________
+
+/*Arena which is reset every frame. If a frame needed more than one block,
+the blocks are merged into a single one on reset, so after a few frames
+the scratch never calls malloc.*/
+typedef struct{
+    emb_arena arena;
+    size_t peak; //max bytes used by a single frame
+} emb_frame_allocator;
+
+emb_frame_allocator emb_frame_allocator_init(size_t capacity){
+    emb_frame_allocator f;
+    f.arena = emb_arena_init(capacity);
+    f.arena.first = f.arena.head = arena_block_new(f.arena.block_size);
+    f.peak = 0;
+    return f;
+}
+
+//call once at the start of the frame, invalidates all previous allocations
+void emb_frame_allocator_reset(emb_frame_allocator * f){
+    emb_arena * ar = &f->arena;
+    if(ar->used_total > f->peak) f->peak = ar->used_total;
+
+    if(ar->first && ar->first->next){
+        size_t capacity = f->peak + f->peak/2;
+        emb_arena_free(ar);
+        ar->block_size = capacity;
+        ar->first = arena_block_new(capacity);
+    }
+    emb_arena_reset(ar);
+}
+
+static inline void * emb_frame_alloc(emb_frame_allocator * f, size_t size){
+    return emb_arena_alloc(&f->arena,size);
+}
+
+//samples the peak frame against the first block (utils/memstats.h)
+static inline void emb_frame_allocator_track(emb_frame_allocator * f, const char * name){
+    EMB_MEM_FILL(name,f->arena.used_total,f->arena.block_size);
+}
+
+void emb_frame_allocator_free(emb_frame_allocator * f){
+    emb_arena_free(&f->arena);
+}
+
+
+
+//__________________________________________________
+// emb_pool - fixed-size blocks
+//__________________________________________________
+
+/*Fixed number of equally sized elements.
+Free elements are linked through their own memory, so alloc/free are O(1).*/
+typedef struct{
+    emb_allocator base;
+    uint8_t * data;
+    void * free_list;
+    size_t elem_size;
+    size_t capacity; //in elements
+    size_t len; //elements in use
+} emb_pool;
+
+void * emb_pool_alloc(emb_pool * p){
+    if(!p->free_list) {printf("ERROR emb_pool_alloc(): pool is full.\n"); return NULL;}
+    void * e = p->free_list;
+    p->free_list = *(void**)e;
+    ++p->len;
+    return e;
+}
+
+void emb_pool_release(emb_pool * p, void * e){
+    if(!e) return;
+    *(void**)e = p->free_list;
+    p->free_list = e;
+    --p->len;
+}
+
+//pool as emb_allocator, the size has to fit into elem_size
+static void * pool_alloc(emb_allocator * a, size_t size){
+    emb_pool * p = (emb_pool*)a;
+    if(size > p->elem_size) {printf("ERROR emb_pool_alloc(): %zu bytes don't fit in pool element.\n",size); return NULL;}
+    return emb_pool_alloc(p);
+}
+
+static void * pool_realloc(emb_allocator * a, void * ptr, size_t old_size, size_t new_size){
+    emb_pool * p = (emb_pool*)a;
+    if(new_size <= p->elem_size && ptr) return ptr;
+    return pool_alloc(a,new_size);
+}
+
+static void pool_free(emb_allocator * a, void * ptr, size_t size){
+    emb_pool_release((emb_pool*)a,ptr);
+}
+
+void emb_pool_clear(emb_pool * p){
+    p->free_list = NULL;
+    for(size_t i=p->capacity; i>0; --i){
+        void * e = p->data + (i-1)*p->elem_size;
+        *(void**)e = p->free_list;
+        p->free_list = e;
+    }
+    p->len = 0;
+}
+
+emb_pool emb_pool_init(size_t elem_size, size_t capacity){
+    emb_pool p;
+    p.base.alloc = pool_alloc;
+    p.base.realloc = pool_realloc;
+    p.base.free = pool_free;
+
+    //element has to hold the free list pointer and keep alignment
+    if(elem_size < sizeof(void*)) elem_size = sizeof(void*);
+    elem_size = (elem_size + sizeof(void*)-1) & ~(sizeof(void*)-1);
+
+    p.elem_size = elem_size;
+    p.capacity = capacity;
+    p.data = (uint8_t*)malloc(elem_size*capacity);
+    if(p.data) EMB_MEM_ALLOC(EMB_MEM_ARENA,elem_size*capacity);
+    emb_pool_clear(&p);
+    return p;
+}
+
+void emb_pool_free(emb_pool * p){
+    if(p->data) EMB_MEM_FREE(EMB_MEM_ARENA,p->elem_size*p->capacity);
+    free(p->data);
+    p->data = NULL;
+    p->free_list = NULL;
+    p->capacity = 0;
+    p->len = 0;
+}
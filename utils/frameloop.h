@@ -0,0 +1,97 @@
+/*______________________________________
+frameloop - fixed-step simulation, variable-rate rendering
+
+Real frame time is accumulated and the simulation advances
+in fixed steps, so it doesn't depend on FPS:
+
+    uint32_t steps = emb_frame_loop_begin(&loop);
+    for(uint32_t i=0; i<steps; ++i) {save previous state; simulate(loop.step_dt);}
+    render(interpolate(previous, current, loop.alpha));
+
+Rendering lags behind the simulation by up to one step,
+in exchange motion is smooth at any frame rate.
+______________________________________*/
+#pragma once
+
+#include <SDL3/SDL.h>
+#include <stdint.h>
+
+
+#define EMB_FRAME_MAX_NS 250000000ull //longer frames (breakpoints, loading) are clamped
+#define EMB_FRAME_MAX_STEPS 8 //spiral of death protection
+
+//monotonic clock in nanoseconds
+static inline uint64_t emb_clock_ns(){
+    return SDL_GetTicksNS();
+}
+
+typedef struct{
+    uint64_t step_ns; //simulation step
+    float step_dt; //the same in seconds, pass it to the simulation
+    uint32_t max_steps; //per frame, time past it is dropped
+
+    uint64_t prev_ns;
+    uint64_t accumulator_ns;
+
+    float frame_dt; //real duration of the last frame (seconds)
+    float alpha; //[0,1) interpolation between previous and current simulation state
+    uint64_t sim_ns; //simulated time
+    uint64_t steps_total;
+    uint64_t dropped_ns; //time skipped because the simulation couldn't keep up
+} emb_frame_loop;
+
+
+emb_frame_loop emb_frame_loop_init(uint32_t steps_per_second){
+    emb_frame_loop l;
+    l.step_ns = 1000000000ull / (steps_per_second ? steps_per_second : 60);
+    l.step_dt = (float)((double)l.step_ns * 1e-9);
+    l.max_steps = EMB_FRAME_MAX_STEPS;
+    l.prev_ns = emb_clock_ns();
+    l.accumulator_ns = 0;
+    l.frame_dt = 0.0f;
+    l.alpha = 0.0f;
+    l.sim_ns = 0;
+    l.steps_total = 0;
+    l.dropped_ns = 0;
+    return l;
+}
+
+//real time since the previous call (or init), the frame's duration
+uint64_t emb_frame_loop_elapsed(emb_frame_loop * l){
+    uint64_t now = emb_clock_ns();
+    uint64_t frame_ns = now - l->prev_ns;
+    l->prev_ns = now;
+    return frame_ns;
+}
+
+/*advances by frame_ns - measured, recorded or fixed (replay.h).
+Returns the number of simulation steps to run now, alpha is updated for rendering.*/
+uint32_t emb_frame_loop_advance(emb_frame_loop * l, uint64_t frame_ns){
+    l->frame_dt = (float)((double)frame_ns * 1e-9);
+
+    if(frame_ns > EMB_FRAME_MAX_NS) {l->dropped_ns += frame_ns - EMB_FRAME_MAX_NS; frame_ns = EMB_FRAME_MAX_NS;}
+    l->accumulator_ns += frame_ns;
+
+    uint32_t steps = (uint32_t)(l->accumulator_ns / l->step_ns);
+    if(steps > l->max_steps){
+        //can't catch up, drop the time instead of running more steps next frame
+        l->dropped_ns += (uint64_t)(steps - l->max_steps) * l->step_ns;
+        l->accumulator_ns -= (uint64_t)(steps - l->max_steps) * l->step_ns;
+        steps = l->max_steps;
+    }
+    l->accumulator_ns -= (uint64_t)steps * l->step_ns;
+    l->sim_ns += (uint64_t)steps * l->step_ns;
+    l->steps_total += steps;
+    l->alpha = (float)((double)l->accumulator_ns / (double)l->step_ns);
+    return steps;
+}
+
+//call once at the start of the frame, advances by the real frame time
+static inline uint32_t emb_frame_loop_begin(emb_frame_loop * l){
+    return emb_frame_loop_advance(l,emb_frame_loop_elapsed(l));
+}
+
+//interpolated time for rendering (seconds)
+static inline double emb_frame_loop_render_time(const emb_frame_loop * l){
+    return ((double)l->sim_ns + (double)l->accumulator_ns) * 1e-9;
+}
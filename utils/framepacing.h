@@ -0,0 +1,150 @@
+/*______________________________________
+framepacing - CPU/GPU synchronisation per frame
+
+A fence is inserted after every frame, and at the start of a frame the CPU
+waits for the fence of the frame N back, so the driver never queues more
+than N frames (less input latency) and per-frame buffers of slot
+emb_frame_pacer_slot() are no longer read by the GPU.
+
+Measured per frame:
+- cpu_wait - CPU blocked on the fence (GPU bound)
+- gpu_idle - GPU had nothing to do between two frames (CPU bound),
+  from GL_TIMESTAMP queries read once the frame's fence is signalled
+- sleep - time slept to hit the target frame time
+
+Sleeping happens in emb_frame_pacer_begin, call it right before sampling
+input, so input is read as late as possible before rendering.
+When GL runs on its own thread (render.h) the pacer stays there, but the
+sleep is done by an emb_frame_limiter on the thread that samples input.
+______________________________________*/
+#pragma once
+
+#include <SDL3/SDL.h>
+#include <glad/gl.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+
+
+#define EMB_PACING_MAX_FRAMES 4
+#define EMB_PACING_SMOOTH 0.05 //weight of the new frame in averages
+
+//sleeps to the target frame time, no GL so it can run on any thread
+typedef struct{
+    uint64_t target_ns; //0 - don't sleep
+    uint64_t begin_ns; //CPU time of the last wait
+    uint64_t sleep_ns; //last frame
+    double avg_sleep_ns;
+} emb_frame_limiter;
+
+typedef struct{
+    uint32_t frames_in_flight; //1..EMB_PACING_MAX_FRAMES
+    emb_frame_limiter limiter;
+
+    uint64_t frame; //frames begun
+    GLsync fences[EMB_PACING_MAX_FRAMES];
+    GLuint queries[EMB_PACING_MAX_FRAMES][2]; //GL_TIMESTAMP at begin and end of the frame
+    bool queried[EMB_PACING_MAX_FRAMES];
+    uint64_t last_gpu_end; //GPU timestamp, 0 - unknown
+
+    //last frame, nanoseconds
+    uint64_t cpu_wait_ns;
+    uint64_t gpu_idle_ns;
+    //smoothed averages, nanoseconds
+    double avg_cpu_wait_ns;
+    double avg_gpu_idle_ns;
+} emb_frame_pacer;
+
+
+static inline double pacer_smooth(double avg, uint64_t v){
+    return avg + ((double)v - avg)*EMB_PACING_SMOOTH;
+}
+
+//target_fps - 0 disables sleeping (vsync or uncapped)
+void emb_frame_limiter_init(emb_frame_limiter * f, uint32_t target_fps){
+    memset(f,0,sizeof(*f));
+    f->target_ns = target_fps ? 1000000000ull/target_fps : 0;
+    f->begin_ns = SDL_GetTicksNS();
+}
+
+//sleeps until target_ns passed since the last call
+void emb_frame_limiter_wait(emb_frame_limiter * f){
+    uint64_t now = SDL_GetTicksNS();
+    f->sleep_ns = 0;
+    if(f->target_ns && now - f->begin_ns < f->target_ns){
+        f->sleep_ns = f->target_ns - (now - f->begin_ns);
+        SDL_DelayPrecise(f->sleep_ns);
+        now = SDL_GetTicksNS();
+    }
+    f->begin_ns = now;
+    f->avg_sleep_ns = pacer_smooth(f->avg_sleep_ns,f->sleep_ns);
+}
+
+
+/*frames_in_flight - how many frames can be queued, 1 - CPU waits for every frame.
+target_fps - 0 disables sleeping (vsync or uncapped)*/
+void emb_frame_pacer_init(emb_frame_pacer * p, uint32_t frames_in_flight, uint32_t target_fps){
+    memset(p,0,sizeof(*p));
+    if(frames_in_flight < 1) frames_in_flight = 1;
+    if(frames_in_flight > EMB_PACING_MAX_FRAMES) frames_in_flight = EMB_PACING_MAX_FRAMES;
+    p->frames_in_flight = frames_in_flight;
+    emb_frame_limiter_init(&p->limiter,target_fps);
+    glCreateQueries(GL_TIMESTAMP,EMB_PACING_MAX_FRAMES*2,&p->queries[0][0]);
+}
+
+//ring slot of the current frame, its buffers are free to overwrite after begin
+static inline uint32_t emb_frame_pacer_slot(const emb_frame_pacer * p){
+    return (uint32_t)(p->frame % p->frames_in_flight);
+}
+
+//waits for the GPU and sleeps to the target frame time, call before sampling input
+void emb_frame_pacer_begin(emb_frame_pacer * p){
+    ++p->frame;
+    uint32_t slot = emb_frame_pacer_slot(p);
+
+    //the frame which used this slot must be finished by the GPU
+    uint64_t wait_start = SDL_GetTicksNS();
+    if(p->fences[slot]){
+        while(glClientWaitSync(p->fences[slot],GL_SYNC_FLUSH_COMMANDS_BIT,1000000000ull) == GL_TIMEOUT_EXPIRED);
+        glDeleteSync(p->fences[slot]);
+        p->fences[slot] = 0;
+    }
+    uint64_t now = SDL_GetTicksNS();
+    p->cpu_wait_ns = now - wait_start;
+
+    //its timestamps are ready now
+    if(p->queried[slot]){
+        GLuint64 gpu_begin = 0, gpu_end = 0;
+        glGetQueryObjectui64v(p->queries[slot][0],GL_QUERY_RESULT,&gpu_begin);
+        glGetQueryObjectui64v(p->queries[slot][1],GL_QUERY_RESULT,&gpu_end);
+        p->gpu_idle_ns = p->last_gpu_end && gpu_begin > p->last_gpu_end ? gpu_begin - p->last_gpu_end : 0;
+        p->last_gpu_end = gpu_end;
+        p->queried[slot] = false;
+    }
+
+    emb_frame_limiter_wait(&p->limiter);
+    p->avg_cpu_wait_ns = pacer_smooth(p->avg_cpu_wait_ns,p->cpu_wait_ns);
+    p->avg_gpu_idle_ns = pacer_smooth(p->avg_gpu_idle_ns,p->gpu_idle_ns);
+
+    glQueryCounter(p->queries[slot][0],GL_TIMESTAMP);
+}
+
+//after the frame is submitted (after swap)
+void emb_frame_pacer_end(emb_frame_pacer * p){
+    uint32_t slot = emb_frame_pacer_slot(p);
+    glQueryCounter(p->queries[slot][1],GL_TIMESTAMP);
+    p->queried[slot] = true;
+    p->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,0);
+}
+
+void emb_frame_pacer_print(const emb_frame_pacer * p){
+    printf("pacing: %u frames in flight, cpu wait %.3fms, gpu idle %.3fms, sleep %.3fms\n",
+        p->frames_in_flight,p->avg_cpu_wait_ns*1e-6,p->avg_gpu_idle_ns*1e-6,p->limiter.avg_sleep_ns*1e-6);
+}
+
+void emb_frame_pacer_free(emb_frame_pacer * p){
+    for(uint32_t i=0; i<EMB_PACING_MAX_FRAMES; ++i) if(p->fences[i]) glDeleteSync(p->fences[i]);
+    glDeleteQueries(EMB_PACING_MAX_FRAMES*2,&p->queries[0][0]);
+    memset(p,0,sizeof(*p));
+}
@@ -0,0 +1,260 @@
+/*______________________________________
+memstats - memory telemetry
+
+CPU memory is counted per subsystem tag (current, peak, live allocations).
+Subsystems which default to the heap take EMB_MEM_HEAP(tag) instead of NULL,
+a heap allocator that counts into the tag, direct malloc calls are wrapped
+with EMB_MEM_ALLOC / EMB_MEM_FREE. Arenas count their blocks under
+EMB_MEM_ARENA, what is allocated inside them isn't counted twice.
+
+GPU buffers and textures are registered per resource with their size,
+fill ratios (used / capacity) of fixed-size buffers are sampled by name,
+with the peak kept, so capacities can be sized from data.
+
+Everything is compiled out unless EMB_MEMORY is defined: EMB_MEM_HEAP
+is NULL (the plain heap) and the macros expand to nothing.
+______________________________________*/
+#pragma once
+
+//tag, printed name
+#define EMB_MEM_TAGS(X)         \
+    X(OTHER, "other")           \
+    X(ARENA, "arenas/pools")    \
+    X(VEC, "vectors")           \
+    X(SLOTMAP, "slotmaps")      \
+    X(NODES, "node pools")      \
+    X(BATCH, "vb/eb handlers")  \
+    X(MESHLETS, "meshlets")     \
+    X(GLTF, "gltf primitives")  \
+    X(TEXTURES, "texture data") \
+    X(RENDER, "render")         \
+    X(WORLD, "world chunks")    \
+    X(ANIM, "animation")
+
+#define EMB_MEM_TAG_ENUM(tag, name) EMB_MEM_##tag,
+typedef enum{
+    EMB_MEM_TAGS(EMB_MEM_TAG_ENUM)
+    EMB_MEM_TAG_COUNT
+} emb_mem_tag;
+
+typedef enum{
+    EMB_GPU_BUFFER,
+    EMB_GPU_TEXTURE,
+    EMB_GPU_KIND_COUNT
+} emb_gpu_kind;
+
+#ifdef EMB_MEMORY
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+
+#define EMB_MEM_GPU_MAX 256 //registered gpu resources
+#define EMB_MEM_FILL_MAX 32 //sampled fill ratios
+
+
+//snapshot of a tag, emb_mem_query
+typedef struct{
+    int64_t current; //bytes
+    int64_t peak;
+    int64_t count; //live allocations
+    int64_t total; //allocations ever made
+} emb_mem_stat;
+
+typedef struct{
+    _Atomic int64_t current;
+    _Atomic int64_t peak;
+    _Atomic int64_t count;
+    _Atomic int64_t total;
+} mem_counter;
+
+typedef struct{
+    const char * name; //string literal
+    uint32_t id; //GL name, 0 - free entry
+    emb_gpu_kind kind;
+    uint64_t bytes;
+} emb_mem_gpu_resource;
+
+typedef struct{
+    const char * name; //string literal, compared by pointer
+    uint64_t used;
+    uint64_t capacity;
+    uint64_t peak;
+} emb_mem_fill;
+
+#define EMB_MEM_TAG_NAME(tag, name) name,
+static const char * EMB_MEM_TAG_NAMES[EMB_MEM_TAG_COUNT] = {EMB_MEM_TAGS(EMB_MEM_TAG_NAME)};
+
+mem_counter EMB_MEM_COUNTERS[EMB_MEM_TAG_COUNT];
+
+//gpu resources are registered from the render thread and the main thread
+atomic_flag EMB_MEM_GPU_LOCK = ATOMIC_FLAG_INIT;
+emb_mem_gpu_resource EMB_MEM_GPU[EMB_MEM_GPU_MAX];
+
+//fills are sampled and printed on the game thread
+emb_mem_fill EMB_MEM_FILLS[EMB_MEM_FILL_MAX];
+uint32_t EMB_MEM_FILLS_LEN = 0;
+
+
+//__________________________________________________
+// cpu
+//__________________________________________________
+
+static inline void mem_counter_add(mem_counter * c, int64_t bytes){
+    int64_t cur = atomic_fetch_add_explicit(&c->current,bytes,memory_order_relaxed) + bytes;
+    int64_t peak = atomic_load_explicit(&c->peak,memory_order_relaxed);
+    while(cur > peak && !atomic_compare_exchange_weak_explicit(&c->peak,&peak,cur,memory_order_relaxed,memory_order_relaxed));
+}
+
+static inline void emb_mem_alloc(emb_mem_tag tag, size_t bytes){
+    mem_counter * c = &EMB_MEM_COUNTERS[tag];
+    mem_counter_add(c,(int64_t)bytes);
+    atomic_fetch_add_explicit(&c->count,1,memory_order_relaxed);
+    atomic_fetch_add_explicit(&c->total,1,memory_order_relaxed);
+}
+
+static inline void emb_mem_realloc(emb_mem_tag tag, size_t old_bytes, size_t new_bytes){
+    if(!old_bytes) {emb_mem_alloc(tag,new_bytes); return;}
+    mem_counter_add(&EMB_MEM_COUNTERS[tag],(int64_t)new_bytes - (int64_t)old_bytes);
+}
+
+static inline void emb_mem_free(emb_mem_tag tag, size_t bytes){
+    mem_counter * c = &EMB_MEM_COUNTERS[tag];
+    atomic_fetch_sub_explicit(&c->current,(int64_t)bytes,memory_order_relaxed);
+    atomic_fetch_sub_explicit(&c->count,1,memory_order_relaxed);
+}
+
+emb_mem_stat emb_mem_query(emb_mem_tag tag){
+    mem_counter * c = &EMB_MEM_COUNTERS[tag];
+    emb_mem_stat s;
+    s.current = atomic_load_explicit(&c->current,memory_order_relaxed);
+    s.peak = atomic_load_explicit(&c->peak,memory_order_relaxed);
+    s.count = atomic_load_explicit(&c->count,memory_order_relaxed);
+    s.total = atomic_load_explicit(&c->total,memory_order_relaxed);
+    return s;
+}
+
+
+
+//__________________________________________________
+// gpu
+//__________________________________________________
+
+/*sets the size of a resource, registers it on the first call.
+Call again when the storage is reallocated (glNamedBufferData).*/
+void emb_mem_gpu_set(emb_gpu_kind kind, uint32_t id, const char * name, uint64_t bytes){
+    if(!id) return;
+    while(atomic_flag_test_and_set_explicit(&EMB_MEM_GPU_LOCK,memory_order_acquire));
+    emb_mem_gpu_resource * slot = NULL;
+    for(uint32_t i=0; i<EMB_MEM_GPU_MAX; ++i){
+        emb_mem_gpu_resource * r = &EMB_MEM_GPU[i];
+        if(r->id == id && r->kind == kind) {slot = r; break;}
+        if(!r->id && !slot) slot = r;
+    }
+    if(slot) *slot = (emb_mem_gpu_resource){name,id,kind,bytes};
+    atomic_flag_clear_explicit(&EMB_MEM_GPU_LOCK,memory_order_release);
+}
+
+//call before glDelete*
+void emb_mem_gpu_release(emb_gpu_kind kind, uint32_t id){
+    while(atomic_flag_test_and_set_explicit(&EMB_MEM_GPU_LOCK,memory_order_acquire));
+    for(uint32_t i=0; i<EMB_MEM_GPU_MAX; ++i)
+        if(EMB_MEM_GPU[i].id == id && EMB_MEM_GPU[i].kind == kind) {EMB_MEM_GPU[i].id = 0; break;}
+    atomic_flag_clear_explicit(&EMB_MEM_GPU_LOCK,memory_order_release);
+}
+
+//bytes of all live resources of the kind
+uint64_t emb_mem_gpu_total(emb_gpu_kind kind){
+    uint64_t total = 0;
+    while(atomic_flag_test_and_set_explicit(&EMB_MEM_GPU_LOCK,memory_order_acquire));
+    for(uint32_t i=0; i<EMB_MEM_GPU_MAX; ++i)
+        if(EMB_MEM_GPU[i].id && EMB_MEM_GPU[i].kind == kind) total += EMB_MEM_GPU[i].bytes;
+    atomic_flag_clear_explicit(&EMB_MEM_GPU_LOCK,memory_order_release);
+    return total;
+}
+
+
+
+//__________________________________________________
+// fill ratios
+//__________________________________________________
+
+//samples used/capacity of a fixed-size buffer, the peak is kept
+void emb_mem_fill_sample(const char * name, uint64_t used, uint64_t capacity){
+    emb_mem_fill * f = NULL;
+    for(uint32_t i=0; i<EMB_MEM_FILLS_LEN && !f; ++i) if(EMB_MEM_FILLS[i].name == name) f = &EMB_MEM_FILLS[i];
+    if(!f){
+        if(EMB_MEM_FILLS_LEN >= EMB_MEM_FILL_MAX) return;
+        f = &EMB_MEM_FILLS[EMB_MEM_FILLS_LEN++];
+        f->name = name;
+        f->peak = 0;
+    }
+    f->used = used;
+    f->capacity = capacity;
+    if(used > f->peak) f->peak = used;
+}
+
+//NULL if the name was never sampled
+const emb_mem_fill * emb_mem_fill_query(const char * name){
+    for(uint32_t i=0; i<EMB_MEM_FILLS_LEN; ++i) if(EMB_MEM_FILLS[i].name == name) return &EMB_MEM_FILLS[i];
+    return NULL;
+}
+
+
+
+//__________________________________________________
+// dump
+//__________________________________________________
+
+static inline double mem_mb(int64_t bytes){ return (double)bytes/(1024.0*1024.0); }
+
+void emb_mem_print(){
+    printf("%-18s %12s %12s %10s\n","memory","current MB","peak MB","allocs");
+    for(uint32_t t=0; t<EMB_MEM_TAG_COUNT; ++t){
+        emb_mem_stat s = emb_mem_query((emb_mem_tag)t);
+        if(!s.total) continue;
+        printf("%-18s %12.3f %12.3f %10lld\n",EMB_MEM_TAG_NAMES[t],mem_mb(s.current),mem_mb(s.peak),(long long)s.count);
+    }
+
+    static const char * kinds[EMB_GPU_KIND_COUNT] = {"buffer","texture"};
+    while(atomic_flag_test_and_set_explicit(&EMB_MEM_GPU_LOCK,memory_order_acquire));
+    uint64_t totals[EMB_GPU_KIND_COUNT] = {0};
+    for(uint32_t i=0; i<EMB_MEM_GPU_MAX; ++i){
+        emb_mem_gpu_resource * r = &EMB_MEM_GPU[i];
+        if(!r->id) continue;
+        totals[r->kind] += r->bytes;
+        printf("gpu %-7s %-18s %12.3f\n",kinds[r->kind],r->name,mem_mb((int64_t)r->bytes));
+    }
+    atomic_flag_clear_explicit(&EMB_MEM_GPU_LOCK,memory_order_release);
+    printf("gpu total: buffers %.3f MB, textures %.3f MB\n",mem_mb((int64_t)totals[EMB_GPU_BUFFER]),mem_mb((int64_t)totals[EMB_GPU_TEXTURE]));
+
+    for(uint32_t i=0; i<EMB_MEM_FILLS_LEN; ++i){
+        emb_mem_fill * f = &EMB_MEM_FILLS[i];
+        double cap = f->capacity ? (double)f->capacity : 1.0;
+        printf("fill %-20s %llu / %llu (%.1f%%), peak %.1f%%\n",f->name,(unsigned long long)f->used,
+            (unsigned long long)f->capacity,100.0*(double)f->used/cap,100.0*(double)f->peak/cap);
+    }
+}
+
+
+#define EMB_MEM_ALLOC(tag, bytes) emb_mem_alloc(tag,bytes)
+#define EMB_MEM_REALLOC(tag, old_bytes, new_bytes) emb_mem_realloc(tag,old_bytes,new_bytes)
+#define EMB_MEM_FREE(tag, bytes) emb_mem_free(tag,bytes)
+#define EMB_MEM_GPU_SET(kind, id, name, bytes) emb_mem_gpu_set(kind,id,name,bytes)
+#define EMB_MEM_GPU_RELEASE(kind, id) emb_mem_gpu_release(kind,id)
+#define EMB_MEM_FILL(name, used, capacity) emb_mem_fill_sample(name,used,capacity)
+#define EMB_MEM_PRINT() emb_mem_print()
+
+#else //EMB_MEMORY
+
+#define EMB_MEM_ALLOC(tag, bytes) ((void)0)
+#define EMB_MEM_REALLOC(tag, old_bytes, new_bytes) ((void)0)
+#define EMB_MEM_FREE(tag, bytes) ((void)0)
+#define EMB_MEM_GPU_SET(kind, id, name, bytes) ((void)0)
+#define EMB_MEM_GPU_RELEASE(kind, id) ((void)0)
+#define EMB_MEM_FILL(name, used, capacity) ((void)0)
+#define EMB_MEM_PRINT() ((void)0)
+
+#endif //EMB_MEMORY
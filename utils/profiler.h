@@ -0,0 +1,410 @@
+/*______________________________________
+profiler - frame instrumentation
+
+CPU scopes are recorded into per-thread ring buffers (only the owner
+thread writes, the frame thread reads), GPU scopes use GL_TIME_ELAPSED
+queries kept in a ring of frames, so results are read a few frames later
+and the CPU never waits for them.
+
+Everything is compiled out unless EMB_PROFILE is defined,
+the macros below expand to nothing in that case.
+______________________________________*/
+#pragma once
+
+#ifdef EMB_PROFILE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <glad/gl.h>
+
+
+#define EMB_PROFILE_EVENT_CAP 8192 //events per thread ring (power of 2)
+#define EMB_PROFILE_DEPTH_MAX 32 //max nesting of cpu scopes
+#define EMB_PROFILE_SCOPE_MAX 128 //unique scope names tracked by stats
+#define EMB_PROFILE_WINDOW 128 //rolling window for min/avg/p99
+#define EMB_PROFILE_GPU_FRAMES 4 //frames a gpu query can stay in flight
+#define EMB_PROFILE_GPU_SCOPES 32 //gpu scopes per frame
+#define EMB_PROFILE_GPU_EVENT_CAP 4096 //resolved gpu events kept for export
+
+
+typedef struct{
+    const char * name; //string literal, compared by pointer first
+    uint64_t start_ns;
+    _Atomic uint64_t end_ns; //0 while the scope is open
+    uint32_t depth;
+} emb_profile_event;
+
+
+typedef struct emb_profile_thread emb_profile_thread;
+
+/*ring of events owned by a single thread.
+write_index is published with release order,
+so the reader never sees a half written event.*/
+typedef struct emb_profile_thread{
+    emb_profile_event events[EMB_PROFILE_EVENT_CAP];
+    _Atomic uint64_t write_index;
+    uint64_t read_index; //only touched by emb_profile_frame()
+
+    //open scopes
+    uint32_t stack[EMB_PROFILE_DEPTH_MAX];
+    uint32_t depth;
+
+    uint32_t tid;
+    emb_profile_thread * next; //intrusive list of all threads
+} emb_profile_thread;
+
+
+typedef struct{
+    const char * name;
+    float samples[EMB_PROFILE_WINDOW]; //in milliseconds
+    uint32_t count; //number of valid samples
+    uint32_t next; //ring position
+    uint32_t hits; //calls in the current frame
+    uint32_t hits_last; //calls in the last finished frame
+    float frame_ms; //accumulated time in the current frame
+    bool gpu;
+} emb_profile_stat;
+
+
+typedef struct{
+    GLuint queries[EMB_PROFILE_GPU_SCOPES];
+    const char * names[EMB_PROFILE_GPU_SCOPES];
+    uint64_t cpu_start_ns[EMB_PROFILE_GPU_SCOPES]; //cpu time of begin, used to place event in trace
+    uint32_t count;
+} profile_gpu_frame;
+
+
+_Atomic(emb_profile_thread *) EMB_PROFILE_THREADS = NULL;
+_Atomic uint32_t EMB_PROFILE_THREAD_COUNT = 0;
+_Thread_local emb_profile_thread * EMB_PROFILE_LOCAL = NULL;
+
+emb_profile_stat EMB_PROFILE_STATS[EMB_PROFILE_SCOPE_MAX];
+uint32_t EMB_PROFILE_STATS_LEN = 0;
+
+profile_gpu_frame EMB_PROFILE_GPU[EMB_PROFILE_GPU_FRAMES];
+uint64_t EMB_PROFILE_FRAME_INDEX = 0;
+bool EMB_PROFILE_GPU_READY = false;
+int32_t EMB_PROFILE_GPU_OPEN = -1; //index of the open gpu scope in current frame
+
+emb_profile_event EMB_PROFILE_GPU_EVENTS[EMB_PROFILE_GPU_EVENT_CAP];
+uint64_t EMB_PROFILE_GPU_EVENTS_LEN = 0;
+
+
+
+static inline uint64_t emb_profile_now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+
+//registers the calling thread on first use (lock-free push to the list)
+static emb_profile_thread * profile_thread_get(){
+    if(EMB_PROFILE_LOCAL) return EMB_PROFILE_LOCAL;
+
+    emb_profile_thread * t = (emb_profile_thread*)calloc(1,sizeof(emb_profile_thread));
+    if(!t) return NULL;
+    t->tid = atomic_fetch_add(&EMB_PROFILE_THREAD_COUNT,1);
+
+    emb_profile_thread * head = atomic_load(&EMB_PROFILE_THREADS);
+    do{
+        t->next = head;
+    } while(!atomic_compare_exchange_weak(&EMB_PROFILE_THREADS,&head,t));
+
+    EMB_PROFILE_LOCAL = t;
+    return t;
+}
+
+
+
+//__________________________________________________
+// cpu scopes
+//__________________________________________________
+
+void emb_profile_begin(const char * name){
+    emb_profile_thread * t = profile_thread_get();
+    if(!t) return;
+    if(t->depth >= EMB_PROFILE_DEPTH_MAX) {++t->depth; return;} //too deep, dropped
+
+    uint64_t w = atomic_load_explicit(&t->write_index,memory_order_relaxed);
+    uint32_t slot = (uint32_t)(w & (EMB_PROFILE_EVENT_CAP-1));
+
+    //the event is reserved now but published on end
+    emb_profile_event * e = &t->events[slot];
+    e->name = name;
+    e->depth = t->depth;
+    atomic_store_explicit(&e->end_ns,0,memory_order_relaxed);
+    e->start_ns = emb_profile_now_ns();
+
+    t->stack[t->depth++] = slot;
+    atomic_store_explicit(&t->write_index,w+1,memory_order_release);
+}
+
+void emb_profile_end(){
+    emb_profile_thread * t = EMB_PROFILE_LOCAL;
+    if(!t || t->depth == 0) return;
+    --t->depth;
+    if(t->depth >= EMB_PROFILE_DEPTH_MAX) return;
+
+    emb_profile_event * e = &t->events[t->stack[t->depth]];
+    //release store so the reader sees a complete event once end_ns != 0
+    atomic_store_explicit(&e->end_ns, emb_profile_now_ns(), memory_order_release);
+}
+
+
+
+//__________________________________________________
+// stats
+//__________________________________________________
+
+static emb_profile_stat * profile_stat_get(const char * name, bool gpu){
+    for(uint32_t i=0; i<EMB_PROFILE_STATS_LEN; ++i){
+        emb_profile_stat * s = &EMB_PROFILE_STATS[i];
+        if(s->gpu == gpu && (s->name == name || strcmp(s->name,name) == 0)) return s;
+    }
+    if(EMB_PROFILE_STATS_LEN >= EMB_PROFILE_SCOPE_MAX) return NULL;
+
+    emb_profile_stat * s = &EMB_PROFILE_STATS[EMB_PROFILE_STATS_LEN++];
+    memset(s,0,sizeof(*s));
+    s->name = name;
+    s->gpu = gpu;
+    return s;
+}
+
+static void profile_stat_add(const char * name, bool gpu, float ms){
+    emb_profile_stat * s = profile_stat_get(name,gpu);
+    if(!s) return;
+    s->frame_ms += ms;
+    ++s->hits;
+}
+
+/*collects finished events from all thread rings.
+Events still open at this moment are kept for the next frame.*/
+static void profile_collect_cpu(){
+    emb_profile_thread * t = atomic_load(&EMB_PROFILE_THREADS);
+    for(; t; t = t->next){
+        uint64_t w = atomic_load_explicit(&t->write_index,memory_order_acquire);
+
+        //the writer lapped us, skip lost events
+        if(w - t->read_index > EMB_PROFILE_EVENT_CAP) t->read_index = w - EMB_PROFILE_EVENT_CAP;
+
+        while(t->read_index < w){
+            emb_profile_event * e = &t->events[t->read_index & (EMB_PROFILE_EVENT_CAP-1)];
+            uint64_t end = atomic_load_explicit(&e->end_ns,memory_order_acquire);
+            if(end == 0) break; //still open
+            profile_stat_add(e->name,false,(float)(end - e->start_ns)*1e-6f);
+            ++t->read_index;
+        }
+    }
+}
+
+
+
+//__________________________________________________
+// gpu scopes
+//__________________________________________________
+
+static void profile_gpu_init(){
+    for(uint32_t i=0; i<EMB_PROFILE_GPU_FRAMES; ++i){
+        glGenQueries(EMB_PROFILE_GPU_SCOPES,EMB_PROFILE_GPU[i].queries);
+        EMB_PROFILE_GPU[i].count = 0;
+    }
+    EMB_PROFILE_GPU_READY = true;
+}
+
+/*GL_TIME_ELAPSED queries can't be nested,
+so only one gpu scope can be open at a time.*/
+void emb_profile_gpu_begin(const char * name){
+    if(!EMB_PROFILE_GPU_READY) profile_gpu_init();
+    profile_gpu_frame * fr = &EMB_PROFILE_GPU[EMB_PROFILE_FRAME_INDEX % EMB_PROFILE_GPU_FRAMES];
+    if(EMB_PROFILE_GPU_OPEN >= 0 || fr->count >= EMB_PROFILE_GPU_SCOPES) return;
+
+    EMB_PROFILE_GPU_OPEN = fr->count++;
+    fr->names[EMB_PROFILE_GPU_OPEN] = name;
+    fr->cpu_start_ns[EMB_PROFILE_GPU_OPEN] = emb_profile_now_ns();
+    glBeginQuery(GL_TIME_ELAPSED,fr->queries[EMB_PROFILE_GPU_OPEN]);
+}
+
+void emb_profile_gpu_end(){
+    if(EMB_PROFILE_GPU_OPEN < 0) return;
+    glEndQuery(GL_TIME_ELAPSED);
+    EMB_PROFILE_GPU_OPEN = -1;
+}
+
+//reads the oldest frame in the ring, results which are not ready are dropped
+static void profile_collect_gpu(){
+    if(!EMB_PROFILE_GPU_READY) return;
+    profile_gpu_frame * fr = &EMB_PROFILE_GPU[(EMB_PROFILE_FRAME_INDEX+1) % EMB_PROFILE_GPU_FRAMES];
+
+    for(uint32_t i=0; i<fr->count; ++i){
+        GLint available = 0;
+        glGetQueryObjectiv(fr->queries[i],GL_QUERY_RESULT_AVAILABLE,&available);
+        if(!available) continue;
+
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(fr->queries[i],GL_QUERY_RESULT,&elapsed);
+        profile_stat_add(fr->names[i],true,(float)elapsed*1e-6f);
+
+        emb_profile_event * e = &EMB_PROFILE_GPU_EVENTS[EMB_PROFILE_GPU_EVENTS_LEN++ % EMB_PROFILE_GPU_EVENT_CAP];
+        e->name = fr->names[i];
+        e->start_ns = fr->cpu_start_ns[i];
+        e->end_ns = fr->cpu_start_ns[i] + elapsed;
+        e->depth = 0;
+    }
+    fr->count = 0;
+}
+
+
+
+//__________________________________________________
+// frame
+//__________________________________________________
+
+/*marks the frame boundary. Should be called once per frame
+from the thread which owns gl context.*/
+void emb_profile_frame(){
+    profile_collect_cpu();
+    profile_collect_gpu();
+
+    for(uint32_t i=0; i<EMB_PROFILE_STATS_LEN; ++i){
+        emb_profile_stat * s = &EMB_PROFILE_STATS[i];
+        if(s->hits == 0) {s->hits_last = 0; continue;}
+        s->samples[s->next] = s->frame_ms;
+        s->next = (s->next+1) % EMB_PROFILE_WINDOW;
+        if(s->count < EMB_PROFILE_WINDOW) ++s->count;
+        s->hits_last = s->hits;
+        s->hits = 0;
+        s->frame_ms = 0.0f;
+    }
+    ++EMB_PROFILE_FRAME_INDEX;
+}
+
+
+static int profile_cmp_float(const void * a, const void * b){
+    float fa = *(const float*)a, fb = *(const float*)b;
+    return (fa > fb) - (fa < fb);
+}
+
+//min/avg/p99 of the rolling window, times are per frame
+void emb_profile_get_stat(emb_profile_stat * s, float * min, float * avg, float * p99){
+    float sorted[EMB_PROFILE_WINDOW];
+    *min = 0.0f; *avg = 0.0f; *p99 = 0.0f;
+    if(s->count == 0) return;
+
+    float sum = 0.0f;
+    for(uint32_t i=0; i<s->count; ++i) {sorted[i] = s->samples[i]; sum += sorted[i];}
+    qsort(sorted,s->count,sizeof(float),profile_cmp_float);
+
+    *min = sorted[0];
+    *avg = sum / (float)s->count;
+    *p99 = sorted[(s->count*99)/100 < s->count ? (s->count*99)/100 : s->count-1];
+}
+
+void emb_profile_print_stats(){
+    printf("%-28s %4s %9s %9s %9s %6s\n","scope","","min ms","avg ms","p99 ms","calls");
+    for(uint32_t i=0; i<EMB_PROFILE_STATS_LEN; ++i){
+        emb_profile_stat * s = &EMB_PROFILE_STATS[i];
+        float min, avg, p99;
+        emb_profile_get_stat(s,&min,&avg,&p99);
+        printf("%-28s %4s %9.3f %9.3f %9.3f %6u\n",
+            s->name, s->gpu ? "gpu" : "cpu", min, avg, p99, s->hits_last);
+    }
+}
+
+
+
+//__________________________________________________
+// chrome trace export (chrome://tracing, perfetto)
+//__________________________________________________
+
+static void profile_write_event(FILE * f, bool * first, emb_profile_event * e, uint32_t tid, uint64_t base_ns){
+    if(e->end_ns == 0 || e->start_ns < base_ns) return;
+    fprintf(f,"%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+        *first ? "" : ",",
+        e->name, tid,
+        (double)(e->start_ns - base_ns)*1e-3,
+        (double)(e->end_ns - e->start_ns)*1e-3
+    );
+    *first = false;
+}
+
+/*writes everything still held in the rings.
+Should be called when other threads are not recording.*/
+bool emb_profile_export_chrome(const char * path){
+    FILE * f = fopen(path,"w");
+    if(!f) {printf("ERROR emb_profile_export_chrome(): cannot open %s\n",path); return false;}
+
+    //the earliest event becomes ts=0
+    uint64_t base_ns = UINT64_MAX;
+    emb_profile_thread * t;
+    for(t = atomic_load(&EMB_PROFILE_THREADS); t; t = t->next){
+        uint64_t w = atomic_load(&t->write_index);
+        uint64_t from = w > EMB_PROFILE_EVENT_CAP ? w - EMB_PROFILE_EVENT_CAP : 0;
+        if(from < w && t->events[from & (EMB_PROFILE_EVENT_CAP-1)].start_ns < base_ns)
+            base_ns = t->events[from & (EMB_PROFILE_EVENT_CAP-1)].start_ns;
+    }
+    if(base_ns == UINT64_MAX) base_ns = 0;
+
+    fprintf(f,"{\"traceEvents\":[");
+    bool first = true;
+
+    for(t = atomic_load(&EMB_PROFILE_THREADS); t; t = t->next){
+        uint64_t w = atomic_load(&t->write_index);
+        uint64_t from = w > EMB_PROFILE_EVENT_CAP ? w - EMB_PROFILE_EVENT_CAP : 0;
+        for(uint64_t i=from; i<w; ++i)
+            profile_write_event(f,&first,&t->events[i & (EMB_PROFILE_EVENT_CAP-1)],t->tid,base_ns);
+    }
+
+    //gpu gets its own track
+    uint32_t gpu_tid = atomic_load(&EMB_PROFILE_THREAD_COUNT) + 1;
+    uint64_t from = EMB_PROFILE_GPU_EVENTS_LEN > EMB_PROFILE_GPU_EVENT_CAP ? EMB_PROFILE_GPU_EVENTS_LEN - EMB_PROFILE_GPU_EVENT_CAP : 0;
+    for(uint64_t i=from; i<EMB_PROFILE_GPU_EVENTS_LEN; ++i)
+        profile_write_event(f,&first,&EMB_PROFILE_GPU_EVENTS[i % EMB_PROFILE_GPU_EVENT_CAP],gpu_tid,base_ns);
+
+    fprintf(f,"\n],\"metadata\":{\"gpu_tid\":%u}}\n",gpu_tid);
+    fclose(f);
+    return true;
+}
+
+
+void emb_profile_shutdown(){
+    if(EMB_PROFILE_GPU_READY){
+        for(uint32_t i=0; i<EMB_PROFILE_GPU_FRAMES; ++i)
+            glDeleteQueries(EMB_PROFILE_GPU_SCOPES,EMB_PROFILE_GPU[i].queries);
+        EMB_PROFILE_GPU_READY = false;
+    }
+    emb_profile_thread * t = atomic_exchange(&EMB_PROFILE_THREADS,NULL);
+    while(t){
+        emb_profile_thread * next = t->next;
+        free(t);
+        t = next;
+    }
+    EMB_PROFILE_LOCAL = NULL;
+}
+
+
+#define EMB_PROFILE_BEGIN(name) emb_profile_begin(name)
+#define EMB_PROFILE_END() emb_profile_end()
+#define EMB_PROFILE_GPU_BEGIN(name) emb_profile_gpu_begin(name)
+#define EMB_PROFILE_GPU_END() emb_profile_gpu_end()
+#define EMB_PROFILE_FRAME() emb_profile_frame()
+#define EMB_PROFILE_PRINT() emb_profile_print_stats()
+#define EMB_PROFILE_EXPORT(path) emb_profile_export_chrome(path)
+#define EMB_PROFILE_SHUTDOWN() emb_profile_shutdown()
+
+#else //EMB_PROFILE
+
+#define EMB_PROFILE_BEGIN(name) ((void)0)
+#define EMB_PROFILE_END() ((void)0)
+#define EMB_PROFILE_GPU_BEGIN(name) ((void)0)
+#define EMB_PROFILE_GPU_END() ((void)0)
+#define EMB_PROFILE_FRAME() ((void)0)
+#define EMB_PROFILE_PRINT() ((void)0)
+#define EMB_PROFILE_EXPORT(path) ((void)0)
+#define EMB_PROFILE_SHUTDOWN() ((void)0)
+
+#endif //EMB_PROFILE
@@ -0,0 +1,92 @@
+/*______________________________________
+ring - bounded lock-free queue of pointers
+
+Any number of threads can push and pop at the same time
+(Vyukov's bounded MPMC queue): every cell has a sequence number
+which tells whether it is ready for the next push or pop,
+so threads only race on a single compare-and-swap of head or tail.
+______________________________________*/
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+
+#ifndef EMB_CACHE_LINE
+#define EMB_CACHE_LINE 64
+#endif
+
+typedef struct{
+    _Atomic size_t seq;
+    void * data;
+} emb_ring_cell;
+
+typedef struct{
+    emb_ring_cell * cells;
+    size_t mask; //capacity-1, capacity is a power of 2
+
+    //producers and consumers touch different cache lines
+    _Alignas(EMB_CACHE_LINE) _Atomic size_t head; //next push
+    _Alignas(EMB_CACHE_LINE) _Atomic size_t tail; //next pop
+} emb_ring;
+
+
+//capacity is rounded up to a power of 2
+void emb_ring_init(emb_ring * r, size_t capacity){
+    size_t cap = 2;
+    while(cap < capacity) cap *= 2;
+    r->cells = (emb_ring_cell*)malloc(cap*sizeof(emb_ring_cell));
+    r->mask = cap-1;
+    for(size_t i=0; i<cap; ++i) atomic_init(&r->cells[i].seq,i);
+    atomic_init(&r->head,0);
+    atomic_init(&r->tail,0);
+}
+
+//false if the ring is full
+bool emb_ring_push(emb_ring * r, void * data){
+    size_t pos = atomic_load_explicit(&r->head,memory_order_relaxed);
+    emb_ring_cell * cell;
+    for(;;){
+        cell = &r->cells[pos & r->mask];
+        size_t seq = atomic_load_explicit(&cell->seq,memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if(diff == 0){
+            if(atomic_compare_exchange_weak_explicit(&r->head,&pos,pos+1,memory_order_relaxed,memory_order_relaxed)) break;
+        }
+        else if(diff < 0) return false;
+        else pos = atomic_load_explicit(&r->head,memory_order_relaxed);
+    }
+    cell->data = data;
+    atomic_store_explicit(&cell->seq,pos+1,memory_order_release);
+    return true;
+}
+
+//false if the ring is empty
+bool emb_ring_pop(emb_ring * r, void ** out){
+    size_t pos = atomic_load_explicit(&r->tail,memory_order_relaxed);
+    emb_ring_cell * cell;
+    for(;;){
+        cell = &r->cells[pos & r->mask];
+        size_t seq = atomic_load_explicit(&cell->seq,memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos+1);
+        if(diff == 0){
+            if(atomic_compare_exchange_weak_explicit(&r->tail,&pos,pos+1,memory_order_relaxed,memory_order_relaxed)) break;
+        }
+        else if(diff < 0) return false;
+        else pos = atomic_load_explicit(&r->tail,memory_order_relaxed);
+    }
+    *out = cell->data;
+    atomic_store_explicit(&cell->seq,pos+r->mask+1,memory_order_release);
+    return true;
+}
+
+static inline size_t emb_ring_capacity(const emb_ring * r){ return r->mask+1; }
+
+void emb_ring_free(emb_ring * r){
+    free(r->cells);
+    r->cells = NULL;
+    r->mask = 0;
+}
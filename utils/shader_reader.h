@@ -2,8 +2,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <glad/gl.h>
+#include "allocator.h"
 
-char * read_shader_file(const char * filename){
+/*reads the whole file as a string.
+allocator - where the string is placed (NULL - heap, free it after use)*/
+char * read_shader_file(const char * filename, emb_allocator * allocator){
     FILE * f = fopen(filename,"r");
     if(!f){printf("ERROR: cannot find shader: %s\n", filename); return NULL;}
 
@@ -11,7 +14,8 @@ char * read_shader_file(const char * filename){
     long len = ftell(f);
     rewind(f);
 
-    char* str = (char*)malloc(len+1);
+    char* str = (char*)emb_alloc(allocator,len+1);
+    if(!str) {fclose(f); return NULL;}
     fread(str,len,1,f);
     fclose(f);
 
@@ -0,0 +1,185 @@
+/*______________________________________
+slotmap - stable handles to densely stored values
+
+Values are kept packed in `values[0..len)` for fast iteration,
+handles (index + generation) stay valid while values move around.
+A handle becomes invalid when its value is erased, even if the slot
+is reused later, because the generation changes.
+______________________________________*/
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include "allocator.h"
+
+
+typedef struct{
+    uint32_t index; //slot index
+    uint32_t generation; //odd - alive
+} emb_handle;
+
+#define EMB_HANDLE_NULL ((emb_handle){UINT32_MAX, 0})
+#define EMB_HANDLE_IS_NULL(h) ((h).index == UINT32_MAX)
+#define EMB_SLOT_NONE UINT32_MAX
+
+typedef struct{
+    /*dense index of the value while alive,
+    next free slot while in the free list*/
+    uint32_t dense_or_next;
+    uint32_t generation; //incremented on insert and erase
+} emb_slot;
+
+
+/*unchecked accessors validate the handle in debug builds only*/
+#ifndef NDEBUG
+#define EMB_HANDLE_CHECK(cond) assert((cond) && "stale or invalid handle")
+#else
+#define EMB_HANDLE_CHECK(cond) ((void)0)
+#endif
+
+
+/*
+EMB_SLOTMAP_DEFINE(type, name) generates `name` slot map of `type`.
+Pointers returned by insert/get are valid until the next insert or erase,
+keep handles instead.
+*/
+#define EMB_SLOTMAP_DEFINE(type, name)                                                   \
+typedef struct{                                                                          \
+    type * values; /*dense, iterate [0..len)*/                                           \
+    uint32_t * dense_to_slot; /*slot of each dense value*/                               \
+    uint32_t len;                                                                        \
+    uint32_t cap; /*dense capacity*/                                                     \
+                                                                                         \
+    emb_slot * slots;                                                                    \
+    uint32_t slots_len;                                                                  \
+    uint32_t slots_cap;                                                                  \
+    uint32_t free_head; /*first free slot, EMB_SLOT_NONE if empty*/                      \
+                                                                                         \
+    emb_allocator * allocator; /*NULL - heap*/                                           \
+} name;                                                                                  \
+                                                                                         \
+static inline void name##_init(name * m, uint32_t cap, emb_allocator * allocator){       \
+    if(cap == 0) cap = 16;                                                               \
+    if(!allocator) allocator = EMB_MEM_HEAP(EMB_MEM_SLOTMAP);                            \
+    m->allocator = allocator;                                                            \
+    m->values = (type*)emb_alloc(allocator,cap*sizeof(type));                            \
+    m->dense_to_slot = (uint32_t*)emb_alloc(allocator,cap*sizeof(uint32_t));             \
+    m->slots = (emb_slot*)emb_alloc(allocator,cap*sizeof(emb_slot));                     \
+    m->len = 0; m->cap = cap;                                                            \
+    m->slots_len = 0; m->slots_cap = cap;                                                \
+    m->free_head = EMB_SLOT_NONE;                                                        \
+}                                                                                        \
+                                                                                         \
+static bool name##_grow(name * m){                                                       \
+    /*new arrays first, the old ones are released only when both exist:*/                \
+    /*a failed grow leaves both arrays and their counted sizes at cap*/                  \
+    uint32_t cap = m->cap*2;                                                             \
+    type * values = (type*)emb_alloc(m->allocator,cap*sizeof(type));                     \
+    uint32_t * dense_to_slot = (uint32_t*)emb_alloc(m->allocator,cap*sizeof(uint32_t));  \
+    if(!values || !dense_to_slot){                                                       \
+        emb_free(m->allocator,values,cap*sizeof(type));                                  \
+        emb_free(m->allocator,dense_to_slot,cap*sizeof(uint32_t));                       \
+        printf("ERROR " #name "_insert(): out of memory.\n");                            \
+        return false;                                                                    \
+    }                                                                                    \
+    memcpy(values,m->values,m->len*sizeof(type));                                        \
+    memcpy(dense_to_slot,m->dense_to_slot,m->len*sizeof(uint32_t));                      \
+    emb_free(m->allocator,m->values,m->cap*sizeof(type));                                \
+    emb_free(m->allocator,m->dense_to_slot,m->cap*sizeof(uint32_t));                     \
+    m->values = values;                                                                  \
+    m->dense_to_slot = dense_to_slot;                                                    \
+    m->cap = cap;                                                                        \
+    return true;                                                                         \
+}                                                                                        \
+                                                                                         \
+static uint32_t name##_slot_new(name * m){                                               \
+    if(m->free_head != EMB_SLOT_NONE){                                                   \
+        uint32_t s = m->free_head;                                                       \
+        m->free_head = m->slots[s].dense_or_next;                                        \
+        return s;                                                                        \
+    }                                                                                    \
+    if(m->slots_len >= m->slots_cap){                                                    \
+        uint32_t cap = m->slots_cap*2;                                                   \
+        emb_slot * slots = (emb_slot*)emb_realloc(m->allocator,m->slots,                 \
+            m->slots_cap*sizeof(emb_slot),cap*sizeof(emb_slot));                         \
+        if(!slots) {printf("ERROR " #name "_insert(): out of memory.\n"); return EMB_SLOT_NONE;} \
+        m->slots = slots;                                                                \
+        m->slots_cap = cap;                                                              \
+    }                                                                                    \
+    m->slots[m->slots_len].generation = 0;                                               \
+    return m->slots_len++;                                                               \
+}                                                                                        \
+                                                                                         \
+/*O(1) amortised. Returns pointer to the stored value, out gets the handle*/             \
+static inline type * name##_insert(name * m, type value, emb_handle * out){              \
+    if(m->len >= m->cap && !name##_grow(m)) {*out = EMB_HANDLE_NULL; return NULL;}       \
+    uint32_t s = name##_slot_new(m);                                                     \
+    if(s == EMB_SLOT_NONE) {*out = EMB_HANDLE_NULL; return NULL;}                        \
+                                                                                         \
+    uint32_t d = m->len++;                                                               \
+    m->values[d] = value;                                                                \
+    m->dense_to_slot[d] = s;                                                             \
+    m->slots[s].dense_or_next = d;                                                       \
+    ++m->slots[s].generation; /*becomes odd - alive*/                                    \
+                                                                                         \
+    out->index = s;                                                                      \
+    out->generation = m->slots[s].generation;                                            \
+    return &m->values[d];                                                                \
+}                                                                                        \
+                                                                                         \
+static inline bool name##_valid(const name * m, emb_handle h){                           \
+    return h.index < m->slots_len && m->slots[h.index].generation == h.generation        \
+        && (h.generation & 1u);                                                          \
+}                                                                                        \
+                                                                                         \
+/*safe getter, NULL for stale handles*/                                                  \
+static inline type * name##_get(name * m, emb_handle h){                                 \
+    if(!name##_valid(m,h)) return NULL;                                                  \
+    return &m->values[m->slots[h.index].dense_or_next];                                  \
+}                                                                                        \
+                                                                                         \
+/*unchecked getter, asserts in debug builds*/                                            \
+static inline type * name##_at(name * m, emb_handle h){                                  \
+    EMB_HANDLE_CHECK(name##_valid(m,h));                                                 \
+    return &m->values[m->slots[h.index].dense_or_next];                                  \
+}                                                                                        \
+                                                                                         \
+/*handle of the value at dense position (for iteration)*/                                \
+static inline emb_handle name##_handle_of(const name * m, uint32_t dense_index){         \
+    emb_handle h;                                                                        \
+    h.index = m->dense_to_slot[dense_index];                                             \
+    h.generation = m->slots[h.index].generation;                                         \
+    return h;                                                                            \
+}                                                                                        \
+                                                                                         \
+/*O(1), the last dense value is moved into the hole*/                                    \
+static inline bool name##_erase(name * m, emb_handle h){                                 \
+    if(!name##_valid(m,h)) return false;                                                 \
+    uint32_t d = m->slots[h.index].dense_or_next;                                        \
+    uint32_t last = --m->len;                                                            \
+    if(d != last){                                                                       \
+        m->values[d] = m->values[last];                                                  \
+        m->dense_to_slot[d] = m->dense_to_slot[last];                                    \
+        m->slots[m->dense_to_slot[d]].dense_or_next = d;                                 \
+    }                                                                                    \
+    ++m->slots[h.index].generation; /*becomes even - free*/                              \
+    m->slots[h.index].dense_or_next = m->free_head;                                      \
+    m->free_head = h.index;                                                              \
+    return true;                                                                         \
+}                                                                                        \
+                                                                                         \
+/*erases everything, all handles become stale*/                                          \
+static inline void name##_clear(name * m){                                               \
+    while(m->len) name##_erase(m,name##_handle_of(m,m->len-1));                           \
+}                                                                                        \
+                                                                                         \
+static inline void name##_free(name * m){                                                \
+    emb_free(m->allocator,m->values,m->cap*sizeof(type));                                \
+    emb_free(m->allocator,m->dense_to_slot,m->cap*sizeof(uint32_t));                     \
+    emb_free(m->allocator,m->slots,m->slots_cap*sizeof(emb_slot));                       \
+    m->values = NULL; m->dense_to_slot = NULL; m->slots = NULL;                          \
+    m->len = m->cap = m->slots_len = m->slots_cap = 0;                                   \
+    m->free_head = EMB_SLOT_NONE;                                                        \
+}
@@ -1,24 +1,336 @@
-/*my own stringmap*/
-#pragma once 
+/*my own stringmap
 
-#define key_len 32
+Open addressing hash table (swiss table layout): one control byte per slot,
+probing checks 16 control bytes at once (SSE2 when available).
+Every slot keeps the full hash, so the string is compared only
+when hashes match and rehashing never touches the keys.
+*/
+#pragma once
 
-#include "vector.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <stdlib.h>
+
+
+#define EMB_STRMAP_GROUP 16
+
+//control bytes, full slots keep 7 bits of the hash (0..127)
+#define STRMAP_EMPTY ((int8_t)-128)
+#define STRMAP_DELETED ((int8_t)-2)
 
 
 typedef struct
 {
-    char key[key_len];
+    const char * key; //owned copy
+    uint32_t hash;
     void* value;
 
 }strmap_pair;
 
 
-typedef vec strmap;
+typedef struct
+{
+    int8_t * ctrl; //capacity + EMB_STRMAP_GROUP bytes, the tail mirrors the first group
+    strmap_pair * slots;
+    size_t capacity; //power of 2
+    size_t len;
+    size_t growth_left; //inserts left before rehash (deleted slots count as used)
+}strmap;
+
+
+
+//fnv-1a, folded with murmur finaliser for better low bits
+static inline uint32_t emb_strhash(const char * s){
+    uint32_t h = 2166136261u;
+    for(; *s; ++s) {h ^= (uint8_t)*s; h *= 16777619u;}
+    h ^= h >> 16; h *= 0x85ebca6bu;
+    h ^= h >> 13; h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+#define STRMAP_H1(hash) ((hash) >> 7)
+#define STRMAP_H2(hash) ((int8_t)((hash) & 0x7f))
+
+
+
+//__________________________________________________
+// group matching
+//__________________________________________________
+
+//bit i is set if ctrl[i] == b
+static inline uint32_t strmap_group_match(const int8_t * ctrl, int8_t b){
+#ifdef __SSE2__
+    __m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(b),g));
+#else
+    uint32_t m = 0;
+    for(uint32_t i=0; i<EMB_STRMAP_GROUP; ++i) m |= (uint32_t)(ctrl[i] == b) << i;
+    return m;
+#endif
+}
+
+//bit i is set if ctrl[i] is empty or deleted (both are negative)
+static inline uint32_t strmap_group_match_free(const int8_t * ctrl){
+#ifdef __SSE2__
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+#else
+    uint32_t m = 0;
+    for(uint32_t i=0; i<EMB_STRMAP_GROUP; ++i) m |= (uint32_t)(ctrl[i] < 0) << i;
+    return m;
+#endif
+}
+
+static inline void strmap_set_ctrl(strmap * m, size_t i, int8_t c){
+    m->ctrl[i] = c;
+    //mirror of the first group, so unaligned group loads never wrap
+    if(i < EMB_STRMAP_GROUP) m->ctrl[m->capacity + i] = c;
+}
+
+static inline size_t strmap_max_load(size_t capacity){ return capacity - capacity/8; }
+
+
+
+//__________________________________________________
+
+static void strmap_init_storage(strmap * m, size_t capacity){
+    m->capacity = capacity;
+    m->ctrl = (int8_t*)malloc(capacity + EMB_STRMAP_GROUP);
+    m->slots = (strmap_pair*)malloc(capacity*sizeof(strmap_pair));
+    memset(m->ctrl,STRMAP_EMPTY,capacity + EMB_STRMAP_GROUP);
+    m->len = 0;
+    m->growth_left = strmap_max_load(capacity);
+}
 
 strmap strmap_alloc(size_t cap){
-    return vec_alloc(sizeof(strmap_pair),cap);
+    strmap m;
+    size_t capacity = EMB_STRMAP_GROUP;
+    while(strmap_max_load(capacity) < cap) capacity *= 2;
+    strmap_init_storage(&m,capacity);
+    return m;
+}
+
+
+//first free slot on the probe sequence of hash
+static size_t strmap_find_free(strmap * m, uint32_t hash){
+    size_t mask = m->capacity-1;
+    size_t pos = STRMAP_H1(hash) & mask;
+    for(size_t stride = EMB_STRMAP_GROUP;; stride += EMB_STRMAP_GROUP){
+        uint32_t free_bits = strmap_group_match_free(m->ctrl + pos);
+        if(free_bits) return (pos + __builtin_ctz(free_bits)) & mask;
+        pos = (pos + stride) & mask;
+    }
+}
+
+//moves all pairs into a table of new capacity (same capacity drops deleted slots)
+static void strmap_rehash(strmap * m, size_t capacity){
+    strmap old = *m;
+    strmap_init_storage(m,capacity);
+    for(size_t i=0; i<old.capacity; ++i){
+        if(old.ctrl[i] < 0) continue;
+        size_t s = strmap_find_free(m,old.slots[i].hash);
+        strmap_set_ctrl(m,s,STRMAP_H2(old.slots[i].hash));
+        m->slots[s] = old.slots[i];
+    }
+    m->len = old.len;
+    m->growth_left = strmap_max_load(capacity) - m->len;
+    free(old.ctrl);
+    free(old.slots);
+}
+
+
+//slot index of the key, or SIZE_MAX
+static size_t strmap_find_hashed(const strmap * m, const char * key, uint32_t hash){
+    size_t mask = m->capacity-1;
+    size_t pos = STRMAP_H1(hash) & mask;
+    int8_t h2 = STRMAP_H2(hash);
+    for(size_t stride = EMB_STRMAP_GROUP;; stride += EMB_STRMAP_GROUP){
+        const int8_t * g = m->ctrl + pos;
+        uint32_t match = strmap_group_match(g,h2);
+        while(match){
+            size_t s = (pos + __builtin_ctz(match)) & mask;
+            if(m->slots[s].hash == hash && strcmp(m->slots[s].key,key) == 0) return s;
+            match &= match-1;
+        }
+        //an empty slot ends the probe sequence
+        if(strmap_group_match(g,STRMAP_EMPTY)) return SIZE_MAX;
+        pos = (pos + stride) & mask;
+    }
+}
+
+
+
+//__________________________________________________
+// lookups
+//__________________________________________________
+
+/*lookup with hash computed before (emb_strhash),
+useful when the same name is resolved every frame*/
+static inline void * strmap_get_hashed(const strmap * m, const char * key, uint32_t hash){
+    size_t s = strmap_find_hashed(m,key,hash);
+    return s == SIZE_MAX ? NULL : m->slots[s].value;
 }
 
+//value of the key or NULL
+static inline void * strmap_get(const strmap * m, const char * key){
+    return strmap_get_hashed(m,key,emb_strhash(key));
+}
+
+static inline bool strmap_contains(const strmap * m, const char * key){
+    return strmap_find_hashed(m,key,emb_strhash(key)) != SIZE_MAX;
+}
+
+//inserts or overwrites, the key is copied
+bool strmap_set_hashed(strmap * m, const char * key, uint32_t hash, void * value){
+    size_t s = strmap_find_hashed(m,key,hash);
+    if(s != SIZE_MAX) {m->slots[s].value = value; return true;}
+
+    if(m->growth_left == 0){
+        //mostly deleted slots - clean them up in place, otherwise grow
+        strmap_rehash(m, m->len*2 < strmap_max_load(m->capacity) ? m->capacity : m->capacity*2);
+    }
+    s = strmap_find_free(m,hash);
+
+    size_t key_size = strlen(key)+1;
+    char * copy = (char*)malloc(key_size);
+    if(!copy) {printf("ERROR strmap_set(): out of memory.\n"); return false;}
+    memcpy(copy,key,key_size);
+
+    if(m->ctrl[s] == STRMAP_EMPTY) --m->growth_left;
+    strmap_set_ctrl(m,s,STRMAP_H2(hash));
+    m->slots[s].key = copy;
+    m->slots[s].hash = hash;
+    m->slots[s].value = value;
+    ++m->len;
+    return true;
+}
+
+static inline bool strmap_set(strmap * m, const char * key, void * value){
+    return strmap_set_hashed(m,key,emb_strhash(key),value);
+}
+
+/*removes the key. The slot becomes empty again (not deleted) when no probe
+sequence could have passed through it, so tombstones don't pile up.*/
+bool strmap_erase(strmap * m, const char * key){
+    size_t s = strmap_find_hashed(m,key,emb_strhash(key));
+    if(s == SIZE_MAX) return false;
+
+    size_t mask = m->capacity-1;
+    size_t before = (s - EMB_STRMAP_GROUP) & mask;
+    uint32_t empty_after = strmap_group_match(m->ctrl + s, STRMAP_EMPTY);
+    uint32_t empty_before = strmap_group_match(m->ctrl + before, STRMAP_EMPTY);
+
+    /*a full group window around s never existed,
+    if the empty slots after and before are closer than a group*/
+    bool was_never_full = empty_before && empty_after &&
+        (__builtin_ctz(empty_after) + (__builtin_clz(empty_before << 16))) < EMB_STRMAP_GROUP;
+
+    strmap_set_ctrl(m,s,was_never_full ? STRMAP_EMPTY : STRMAP_DELETED);
+    if(was_never_full) ++m->growth_left;
+
+    free((char*)m->slots[s].key);
+    m->slots[s].key = NULL;
+    --m->len;
+    return true;
+}
+
+void strmap_clear(strmap * m){
+    for(size_t i=0; i<m->capacity; ++i) if(m->ctrl[i] >= 0) free((char*)m->slots[i].key);
+    memset(m->ctrl,STRMAP_EMPTY,m->capacity + EMB_STRMAP_GROUP);
+    m->len = 0;
+    m->growth_left = strmap_max_load(m->capacity);
+}
+
+void strmap_free(strmap * m){
+    strmap_clear(m);
+    free(m->ctrl);
+    free(m->slots);
+    m->ctrl = NULL;
+    m->slots = NULL;
+    m->capacity = 0;
+    m->growth_left = 0;
+}
 
 
+//index of the next full slot after `it` (start with -1), capacity at the end
+static inline size_t strmap_next(const strmap * m, size_t it){
+    for(++it; it < m->capacity; ++it) if(m->ctrl[it] >= 0) return it;
+    return m->capacity;
+}
+
+//iteration over all pairs, pair is strmap_pair*
+#define EMB_STRMAP_FOREACH(m, pair) \
+    for(size_t pair##_it = strmap_next((m),(size_t)-1); \
+        pair##_it < (m)->capacity && ((pair) = &(m)->slots[pair##_it], 1); \
+        pair##_it = strmap_next((m),pair##_it))
+
+
+
+//__________________________________________________
+// string interning
+//__________________________________________________
+
+/*Each unique string gets a 32-bit id (starting from 1, 0 - none).
+Hot paths compare ids instead of strings.
+Interned strings live until emb_interner_free.*/
+typedef uint32_t emb_strid;
+
+typedef struct{
+    strmap ids; //string -> id
+    const char ** strings; //id -> string
+    uint32_t len; //strings[0] is unused
+    uint32_t cap;
+}emb_interner;
+
+emb_interner emb_interner_init(size_t cap){
+    emb_interner in;
+    in.ids = strmap_alloc(cap);
+    in.cap = cap > 16 ? (uint32_t)cap : 16;
+    in.strings = (const char**)malloc(in.cap*sizeof(char*));
+    in.strings[0] = "";
+    in.len = 1;
+    return in;
+}
+
+emb_strid emb_intern(emb_interner * in, const char * str){
+    uint32_t hash = emb_strhash(str);
+    size_t s = strmap_find_hashed(&in->ids,str,hash);
+    if(s != SIZE_MAX) return (emb_strid)(uintptr_t)in->ids.slots[s].value;
+
+    if(in->len >= in->cap){
+        const char ** strings = (const char**)realloc(in->strings,in->cap*2*sizeof(char*));
+        if(!strings) {printf("ERROR emb_intern(): out of memory.\n"); return 0;}
+        in->strings = strings;
+        in->cap *= 2;
+    }
+    emb_strid id = in->len;
+    if(!strmap_set_hashed(&in->ids,str,hash,(void*)(uintptr_t)id)) return 0;
+
+    //the copy owned by the map is shared with the id table
+    in->strings[id] = in->ids.slots[strmap_find_hashed(&in->ids,str,hash)].key;
+    ++in->len;
+    return id;
+}
+
+//id of the string if it was interned before, 0 otherwise
+static inline emb_strid emb_intern_find(const emb_interner * in, const char * str){
+    return (emb_strid)(uintptr_t)strmap_get(&in->ids,str);
+}
+
+static inline const char * emb_intern_str(const emb_interner * in, emb_strid id){
+    return id < in->len ? in->strings[id] : NULL;
+}
+
+void emb_interner_free(emb_interner * in){
+    strmap_free(&in->ids);
+    free(in->strings);
+    in->strings = NULL;
+    in->len = 0;
+    in->cap = 0;
+}
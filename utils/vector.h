@@ -3,6 +3,7 @@
 
 #include  <stdlib.h>
 #include <string.h>
+#include "allocator.h"
 
 
 typedef struct  {
@@ -10,26 +11,39 @@ typedef struct  {
     size_t elem_size; //element size
     size_t len; //number of elements
     size_t cap;
+    emb_allocator * allocator; //NULL - heap
 }vec;
 
-/// @brief create a new vector
+/// @brief create a new vector using the given allocator
 /// @param elem_size number of elements 
 /// @param cap inital memory allocated (doesn't affect len)
+/// @param allocator where the memory comes from (NULL - heap)
 /// @return empty vector
-vec vec_alloc(size_t elem_size, size_t cap){
+vec vec_alloc_with(size_t elem_size, size_t cap, emb_allocator * allocator){
     vec v; 
-    v.data = malloc(cap*elem_size);
+    if(!allocator) allocator = EMB_MEM_HEAP(EMB_MEM_VEC);
+    v.allocator = allocator;
+    v.data = emb_alloc(allocator,cap*elem_size);
     v.elem_size = elem_size;
     v.len = 0;
     v.cap = cap;
     return v;
 }
 
+/// @brief create a new vector on the heap
+/// @param elem_size number of elements 
+/// @param cap inital memory allocated (doesn't affect len)
+/// @return empty vector
+vec vec_alloc(size_t elem_size, size_t cap){
+    return vec_alloc_with(elem_size,cap,NULL);
+}
+
 //push value in the vector 
 void* vec_push(vec *v, void *value){
     if(v->len >= v->cap){
-        v->cap *= 2;
-        v->data = realloc(v->data,v->cap*v->elem_size);
+        size_t cap = v->cap ? v->cap*2 : 4;
+        v->data = emb_realloc(v->allocator,v->data,v->cap*v->elem_size,cap*v->elem_size);
+        v->cap = cap;
     }
     void * ptr = memcpy((char*)v->data + v->len*v->elem_size,value,v->elem_size);
     ++v->len;
@@ -43,7 +57,7 @@ void vec_remove(vec * v, size_t index){
     memmove(
         (char*)v->data + index*v->elem_size, //element at index will be removed
         (char*)v->data + (index+1)*v->elem_size, //next elementwill replace current
-        (v->len-index)*v->elem_size //shift all next elements to left
+        (v->len-index-1)*v->elem_size //shift all next elements to left
     );
     --v->len;
 }
@@ -51,7 +65,7 @@ void vec_remove(vec * v, size_t index){
 void vec_clear(vec * v){v->len=0;}
 
 void vec_free(vec * v){
-    free(v->data);
+    emb_free(v->allocator,v->data,v->cap*v->elem_size);
     v->data = NULL;
     v->len = 0;
     v->cap = 0;
@@ -81,54 +95,125 @@ void * vec_get(vec *v, size_t index) {
 
 
 
-//specific vector type for float
-typedef struct{
-    float * data; //pointer to array
-    size_t len; //length in elements 
-    size_t cap; //cap in elements
-} vec_float;
-
-
-//allocationg a new float vec
-vec_float vec_float_alloc(size_t cap){
-    vec_float v;
-    v.len = 0;
-    v.cap = cap;
-    v.data = malloc(cap *sizeof(float));
-    return v;
-};
-
-float vec_float_get(vec_float * v, size_t index){
-    return (index < v->len) ? v->data[index] : 0.0f;
-}
-
-void vec_float_clear(vec_float * v) {v->len = 0;}
-
-void vec_float_free(vec_float * v){
-    free(v->data);
-    v->data = NULL;
-    v->len = 0;
-    v->cap = 0;
+//__________________________________________________
+// type-specialised vectors
+//__________________________________________________
+
+/*
+EMB_VEC_DEFINE(type, name) generates `name` vector of `type` with
+element size known at compile time, so push/at/swap_remove are inlined.
+
+First EMB_VEC_SMALL_CAP(type) elements are kept inside the struct,
+heap (or allocator) is touched only when it grows past that.
+Because `data` may point inside the struct itself, typed vectors are
+initialised in place with name_init() and must not be copied by value
+while they use the small buffer (name_reserve() moves them out of it).
+*/
+
+//elements fitting in 64 bytes, at least one
+#define EMB_VEC_SMALL_CAP(type) (sizeof(type) < 64 ? 64/sizeof(type) : 1)
+
+#define EMB_VEC_DEFINE(type, name) EMB_VEC_DEFINE_SMALL(type, name, EMB_VEC_SMALL_CAP(type))
+
+#define EMB_VEC_DEFINE_SMALL(type, name, small_cap)                                     \
+typedef struct{                                                                          \
+    type * data;                                                                         \
+    size_t len; /*number of elements*/                                                   \
+    size_t cap; /*in elements*/                                                          \
+    emb_allocator * allocator; /*NULL - heap*/                                           \
+    type small[small_cap]; /*inline storage*/                                            \
+} name;                                                                                  \
+                                                                                         \
+static inline void name##_init(name * v, emb_allocator * allocator){                     \
+    v->data = v->small;                                                                  \
+    v->len = 0;                                                                          \
+    v->cap = (small_cap);                                                                \
+    v->allocator = allocator ? allocator : EMB_MEM_HEAP(EMB_MEM_VEC);                    \
+}                                                                                        \
+                                                                                         \
+/*moves the storage to a buffer of exactly `cap` elements*/                              \
+static bool name##_realloc(name * v, size_t cap){                                        \
+    type * data;                                                                         \
+    if(cap <= (small_cap)){                                                              \
+        if(v->data == v->small) return true;                                             \
+        memcpy(v->small,v->data,v->len*sizeof(type));                                    \
+        emb_free(v->allocator,v->data,v->cap*sizeof(type));                              \
+        v->data = v->small; v->cap = (small_cap);                                        \
+        return true;                                                                     \
+    }                                                                                    \
+    if(v->data == v->small){                                                             \
+        data = (type*)emb_alloc(v->allocator,cap*sizeof(type));                          \
+        if(data) memcpy(data,v->small,v->len*sizeof(type));                              \
+    }                                                                                    \
+    else data = (type*)emb_realloc(v->allocator,v->data,v->cap*sizeof(type),cap*sizeof(type)); \
+    if(!data) {printf("ERROR " #name "_reserve(): out of memory.\n"); return false;}    \
+    v->data = data;                                                                      \
+    v->cap = cap;                                                                        \
+    return true;                                                                         \
+}                                                                                        \
+                                                                                         \
+static inline bool name##_reserve(name * v, size_t cap){                                 \
+    return cap <= v->cap || name##_realloc(v,cap);                                       \
+}                                                                                        \
+                                                                                         \
+/*gives back unused memory (may return to the inline storage)*/                          \
+static inline void name##_shrink(name * v){                                              \
+    if(v->len < v->cap && v->data != v->small) name##_realloc(v,v->len);                 \
+}                                                                                        \
+                                                                                         \
+static inline type * name##_push(name * v, type value){                                  \
+    if(v->len >= v->cap && !name##_realloc(v,v->cap*2)) return NULL;                     \
+    v->data[v->len] = value;                                                             \
+    return &v->data[v->len++];                                                           \
+}                                                                                        \
+                                                                                         \
+/*bulk append of n elements, returns pointer to the first one*/                          \
+static inline type * name##_append(name * v, const type * values, size_t n){             \
+    if(v->len+n > v->cap){                                                               \
+        size_t cap = v->cap*2;                                                           \
+        if(cap < v->len+n) cap = v->len+n;                                               \
+        if(!name##_realloc(v,cap)) return NULL;                                          \
+    }                                                                                    \
+    type * dst = v->data + v->len;                                                       \
+    memcpy(dst,values,n*sizeof(type));                                                   \
+    v->len += n;                                                                         \
+    return dst;                                                                          \
+}                                                                                        \
+                                                                                         \
+/*unchecked access*/                                                                     \
+static inline type * name##_at(name * v, size_t index){ return &v->data[index]; }        \
+                                                                                         \
+/*safe getter, NULL if out of bounds*/                                                   \
+static inline type * name##_get(name * v, size_t index){                                 \
+    return index < v->len ? &v->data[index] : NULL;                                      \
+}                                                                                        \
+                                                                                         \
+static inline void name##_pop(name * v){ v->len -= v->len>0; }                           \
+                                                                                         \
+/*O(1), the last element takes place of the removed one (order changes)*/               \
+static inline void name##_swap_remove(name * v, size_t index){                           \
+    if(index >= v->len) return;                                                          \
+    v->data[index] = v->data[--v->len];                                                  \
+}                                                                                        \
+                                                                                         \
+/*O(n), keeps the order*/                                                                \
+static inline void name##_remove(name * v, size_t index){                                \
+    if(index >= v->len) return;                                                          \
+    memmove(v->data+index, v->data+index+1, (v->len-index-1)*sizeof(type));             \
+    --v->len;                                                                            \
+}                                                                                        \
+                                                                                         \
+static inline void name##_clear(name * v){ v->len = 0; }                                 \
+                                                                                         \
+static inline void name##_free(name * v){                                                \
+    if(v->data != v->small) emb_free(v->allocator,v->data,v->cap*sizeof(type));          \
+    v->data = v->small;                                                                  \
+    v->len = 0;                                                                          \
+    v->cap = (small_cap);                                                                \
 }
 
-// get the value of float vector or zero ()if out of bounds
-// vec_float * v - vector
-#define VEC_FLOAT_GETVAL(v,index) ( (index<v->len && index>=0)? ((float)(v->data[index])) : 0.0f )
-
-#define VEC_FLOAT_GETPTR(v,index) ( (index<v->len && index>=0)& ((float*)&v->data[index]) : NULL )
 
 
-float* vec_float_push(vec_float *v, float value){
-    if(v->len >= v->cap){
-        v->cap *= 2;
-        v->data = realloc(v->data,v->cap*sizeof(float));
-    }
-    v->data[v->len] = value;
-    ++v->len;
-    return &v->data[v->len-1];
-}
-
-float vec_float_pop(vec_float * v){
-    v->len -= (v->len>0);
-    return v->data[v->len];
-}
+//specific vector types
+EMB_VEC_DEFINE(float, vec_float)
+EMB_VEC_DEFINE(uint32_t, vec_u32)